@@ -0,0 +1,263 @@
+#include <string.h>
+#include "config_snapshot.h"
+#include "settings.h"
+#include "keyboard.h"
+#include "flash_service.h"
+
+static_assert((int)SETTINGS_TOTAL <= MAX_SNAPSHOT_SETTINGS, "Settings do not fit the snapshot");
+static_assert(CONFIG_SNAPSHOT_PAGE_LENGTH == FLASH_PAGE_SIZE, "Snapshot pages must map to flash pages");
+static_assert(FLASH_NUM_STAGING_SECTORS >= MAX_SNAPSHOT_KEYS, "Every key needs a staging sector");
+
+ConfigSnapshot::ConfigSnapshot() {
+    for (auto& b : headerPage)
+        b = 0;
+    for (int i = 0; i < MAX_SNAPSHOT_KEYS; i++) {
+        keyMacros[i] = nullptr;
+        keyFirstPage[i] = 0;
+        keyNumPages[i] = 0;
+    }
+    totalPages = 1;
+    restoreStatus = SNAPSHOT_STATUS_OK;
+}
+
+eConfigSnapshotStatus ConfigSnapshot::BeginExport(uint32_t& length) {
+    Settings& settings = Settings::Instance();
+    Keyboard& keyboard = Keyboard::Instance();
+
+    for (auto& b : headerPage)
+        b = 0;
+
+    ConfigSnapshotHeader& header = Header();
+    header.Magic = CONFIG_SNAPSHOT_MAGIC;
+    header.Version = CONFIG_SNAPSHOT_VERSION;
+    header.NumSettings = SETTINGS_TOTAL;
+    header.NumKeys = keyboard.GetNumKeys();
+
+    for (int i = 0; i < (int)SETTINGS_TOTAL; i++)
+        header.Settings[i] = settings((SettingsIds)i);
+
+    for (int i = 0; i < header.NumKeys; i++) {
+        ProgrammingKeyInfo info;
+        const uint8_t* macro = nullptr;
+        keyMacros[i] = nullptr;
+        if (!keyboard.GetProgrammedKey(i, info, macro))
+            continue;
+
+        header.Keys[i].IsProgrammed = 1;
+        header.Keys[i].KeyCode = info.KeyCode;
+        header.Keys[i].MacroLength = (macro != nullptr) ? info.MacroLength : 0;
+        keyMacros[i] = macro;
+    }
+
+    // A macro longer than a key sector would stream past its sector
+    length = 0;
+    if (!ComputeLayout())
+        return SNAPSHOT_STATUS_INVALID_LAYOUT;
+
+    length = totalPages * CONFIG_SNAPSHOT_PAGE_LENGTH;
+    return SNAPSHOT_STATUS_OK;
+}
+
+const unsigned char* ConfigSnapshot::ExportSource(uint32_t offset, uint32_t& length) {
+    ConfigSnapshot& snapshot = Instance();
+    uint32_t page = offset / CONFIG_SNAPSHOT_PAGE_LENGTH;
+    uint32_t inPage = offset % CONFIG_SNAPSHOT_PAGE_LENGTH;
+
+    if (page == 0) {
+        length = CONFIG_SNAPSHOT_HEADER_LENGTH - inPage;
+        return snapshot.headerPage + inPage;
+    }
+
+    // Macro pages are sent straight from flash, up to the end of the key
+    int keyIndex = snapshot.FindKeyForPage(page);
+    uint32_t keyOffset = (page - snapshot.keyFirstPage[keyIndex]) * CONFIG_SNAPSHOT_PAGE_LENGTH + inPage;
+    length = snapshot.keyNumPages[keyIndex] * CONFIG_SNAPSHOT_PAGE_LENGTH - keyOffset;
+    return snapshot.keyMacros[keyIndex] + keyOffset;
+}
+
+eConfigSnapshotStatus ConfigSnapshot::RestoreChunk(uint32_t offset, const uint8_t* chunk,
+        uint32_t length, bool isLast) {
+    uint32_t page = offset / CONFIG_SNAPSHOT_PAGE_LENGTH;
+
+    // The frame was cut short, nothing was applied yet
+    if (chunk == nullptr) {
+        restoreStatus = SNAPSHOT_STATUS_INVALID_LAYOUT;
+        return restoreStatus;
+    }
+
+    if (page == 0)
+        restoreStatus = RestoreHeader(chunk, length);
+    else if (restoreStatus == SNAPSHOT_STATUS_OK)
+        restoreStatus = StageMacroPage(page, chunk, length);
+
+    if (!isLast)
+        return restoreStatus;
+
+    // The blob must hold every macro page announced in the header
+    if (restoreStatus == SNAPSHOT_STATUS_OK && page + 1 != totalPages)
+        restoreStatus = SNAPSHOT_STATUS_INVALID_LAYOUT;
+
+    // Only a whole, valid blob replaces the configuration
+    if (restoreStatus == SNAPSHOT_STATUS_OK)
+        restoreStatus = CheckRestore();
+    if (restoreStatus == SNAPSHOT_STATUS_OK)
+        restoreStatus = CommitRestore();
+
+    return restoreStatus;
+}
+
+bool ConfigSnapshot::ComputeLayout() {
+    const ConfigSnapshotHeader& header = Header();
+    uint16_t maxPages = Keyboard::Instance().GetMaxPacketsPerKey();
+
+    totalPages = 1; // Header page
+    for (int i = 0; i < MAX_SNAPSHOT_KEYS; i++) {
+        uint32_t macroBytes = (i < header.NumKeys) ? header.Keys[i].MacroLength * sizeof(MacroKey) : 0;
+        keyFirstPage[i] = totalPages;
+        keyNumPages[i] = (macroBytes + CONFIG_SNAPSHOT_PAGE_LENGTH - 1) / CONFIG_SNAPSHOT_PAGE_LENGTH;
+        if (keyNumPages[i] > maxPages)
+            return false;
+        totalPages += keyNumPages[i];
+    }
+
+    return true;
+}
+
+int ConfigSnapshot::FindKeyForPage(uint32_t page) const {
+    for (int i = 0; i < MAX_SNAPSHOT_KEYS; i++) {
+        if (page >= keyFirstPage[i] && page < keyFirstPage[i] + keyNumPages[i])
+            return i;
+    }
+
+    return -1;
+}
+
+eConfigSnapshotStatus ConfigSnapshot::RestoreHeader(const uint8_t* chunk, uint32_t length) {
+    totalPages = 1;
+    if (length < sizeof(ConfigSnapshotHeader))
+        return SNAPSHOT_STATUS_INVALID_LAYOUT;
+
+    for (uint32_t i = 0; i < CONFIG_SNAPSHOT_HEADER_LENGTH; i++)
+        headerPage[i] = (i < length) ? chunk[i] : 0;
+
+    // Only checked here, applied by CommitRestore() once the blob is whole
+    ConfigSnapshotHeader& header = Header();
+    if (header.Magic != CONFIG_SNAPSHOT_MAGIC)
+        return SNAPSHOT_STATUS_INVALID_MAGIC;
+    if (header.Version == CONFIG_SNAPSHOT_VERSION_V1)
+        UpgradeHeaderV1();
+    if (header.Version != CONFIG_SNAPSHOT_VERSION)
+        return SNAPSHOT_STATUS_INVALID_VERSION;
+    if (header.NumKeys != Keyboard::Instance().GetNumKeys() || header.NumSettings > MAX_SNAPSHOT_SETTINGS)
+        return SNAPSHOT_STATUS_INVALID_LAYOUT;
+    for (int i = 0; i < header.NumKeys; i++) {
+        if (!header.Keys[i].IsProgrammed && header.Keys[i].MacroLength > 0)
+            return SNAPSHOT_STATUS_INVALID_LAYOUT;
+    }
+    if (!ComputeLayout())
+        return SNAPSHOT_STATUS_INVALID_LAYOUT;
+
+    return SNAPSHOT_STATUS_OK;
+}
+
+void ConfigSnapshot::UpgradeHeaderV1() {
+    // Same fields, the keys only move past the larger settings array
+    ConfigSnapshotHeader& header = Header();
+    memmove(header.Keys, headerPage + CONFIG_SNAPSHOT_KEYS_OFFSET_V1, sizeof(header.Keys));
+    for (int i = MAX_SNAPSHOT_SETTINGS_V1; i < MAX_SNAPSHOT_SETTINGS; i++)
+        header.Settings[i] = 0;
+    if (header.NumSettings > MAX_SNAPSHOT_SETTINGS_V1)
+        header.NumSettings = MAX_SNAPSHOT_SETTINGS_V1;
+    header.Version = CONFIG_SNAPSHOT_VERSION;
+}
+
+eConfigSnapshotStatus ConfigSnapshot::StageMacroPage(uint32_t page, const uint8_t* chunk, uint32_t length) {
+    int keyIndex = FindKeyForPage(page);
+    if (keyIndex < 0)
+        return SNAPSHOT_STATUS_INVALID_LAYOUT;
+
+    // Pages come in order, the first one of a key clears its staging sector
+    uint32_t sectorNum = flashFirstStagingSectorNum + keyIndex;
+    uint32_t keyPage = page - keyFirstPage[keyIndex];
+    if (keyPage == 0)
+        FlashService::Instance().EraseSector(sectorNum);
+    FlashService::Instance().WriteToSector(sectorNum, keyPage, chunk, length);
+
+    return SNAPSHOT_STATUS_OK;
+}
+
+void ConfigSnapshot::GetKeyInfo(int keyIndex, ProgrammingKeyInfo& info) const {
+    const SnapshotKey& key = Header().Keys[keyIndex];
+    Keyboard::Instance().GetKeyPosition(keyIndex, info.KeyColumn, info.KeyRow);
+    info.KeyCode = key.KeyCode;
+    info.MacroLength = key.MacroLength;
+}
+
+eConfigSnapshotStatus ConfigSnapshot::CheckRestore() {
+    Keyboard& keyboard = Keyboard::Instance();
+    Settings& settings = Settings::Instance();
+    const ConfigSnapshotHeader& header = Header();
+
+    // Read only settings are derived from the others, their exported value is skipped
+    for (int i = 0; i < header.NumSettings && i < (int)SETTINGS_TOTAL; i++) {
+        SettingsIds id = (SettingsIds)i;
+        if (settings.IsWritable(id) && !settings.CanSet(id, header.Settings[i]))
+            return SNAPSHOT_STATUS_INVALID_SETTING;
+    }
+
+    for (int i = 0; i < header.NumKeys; i++) {
+        if (!header.Keys[i].IsProgrammed)
+            continue;
+        ProgrammingKeyInfo info;
+        GetKeyInfo(i, info);
+        if (keyboard.CheckProgrammingKey(info) != PROG_STATUS_OK)
+            return SNAPSHOT_STATUS_PROGRAMMING_FAILED;
+    }
+
+    return SNAPSHOT_STATUS_OK;
+}
+
+eConfigSnapshotStatus ConfigSnapshot::CommitRestore() {
+    Keyboard& keyboard = Keyboard::Instance();
+    Settings& settings = Settings::Instance();
+    const ConfigSnapshotHeader& header = Header();
+
+    // Checked by CheckRestore(). Settings newer than this firmware are
+    // ignored, missing ones keep their value.
+    for (int i = 0; i < header.NumSettings && i < (int)SETTINGS_TOTAL; i++) {
+        SettingsIds id = (SettingsIds)i;
+        if (settings.IsWritable(id))
+            settings(id, header.Settings[i]);
+    }
+    settings.Save();
+
+    eConfigSnapshotStatus status = SNAPSHOT_STATUS_OK;
+    keyboard.ProgrammingStarted();
+    for (int i = 0; i < header.NumKeys && status == SNAPSHOT_STATUS_OK; i++) {
+        const SnapshotKey& key = header.Keys[i];
+        if (!key.IsProgrammed) {
+            keyboard.EraseProgrammedKey(i);
+            continue;
+        }
+
+        ProgrammingKeyInfo info;
+        GetKeyInfo(i, info);
+        if (keyboard.GetReadyForProgrammingKey(info) != PROG_STATUS_OK) {
+            status = SNAPSHOT_STATUS_PROGRAMMING_FAILED;
+            break;
+        }
+
+        // The macro is copied from its staging sector, page by page
+        const uint8_t* staged = FlashService::Instance().GetSectorAddress(flashFirstStagingSectorNum + i);
+        for (uint16_t page = 0; page < keyNumPages[i]; page++) {
+            if (keyboard.ProgramKeyPacket(staged + page * CONFIG_SNAPSHOT_PAGE_LENGTH,
+                    CONFIG_SNAPSHOT_PAGE_LENGTH, 1 + page) != PROG_STATUS_OK) {
+                status = SNAPSHOT_STATUS_PROGRAMMING_FAILED;
+                break;
+            }
+        }
+    }
+    keyboard.ProgrammingEnded();
+
+    return status;
+}
@@ -0,0 +1,61 @@
+#ifndef CONFIG_SNAPSHOT_H
+#define CONFIG_SNAPSHOT_H
+
+#include "pico/stdlib.h"
+#include "message_payloads.h"
+#include "flash_layout.h"
+
+// Exports and restores settings + keymap as a single versioned blob,
+// see ConfigSnapshotHeader for the layout
+class ConfigSnapshot {
+public:
+    static ConfigSnapshot& Instance() {
+        static ConfigSnapshot instance;
+        return instance;
+    }
+
+    // Captures the current configuration and the blob length, nothing
+    // is exported unless it returns SNAPSHOT_STATUS_OK
+    eConfigSnapshotStatus BeginExport(uint32_t& length);
+    // PayloadSourceCallback for the export answer
+    static const unsigned char* ExportSource(uint32_t offset, uint32_t& length);
+
+    // Fed with the blob in CONFIG_SNAPSHOT_PAGE_LENGTH chunks. The header is
+    // checked and the macros staged in flash, nothing changes unless the
+    // whole blob arrived and every setting and key in it is accepted.
+    eConfigSnapshotStatus RestoreChunk(uint32_t offset, const uint8_t* chunk,
+            uint32_t length, bool isLast);
+
+private:
+    ConfigSnapshot();
+
+    bool ComputeLayout();
+    int FindKeyForPage(uint32_t page) const;
+    eConfigSnapshotStatus RestoreHeader(const uint8_t* chunk, uint32_t length);
+    void UpgradeHeaderV1();
+    eConfigSnapshotStatus StageMacroPage(uint32_t page, const uint8_t* chunk, uint32_t length);
+    eConfigSnapshotStatus CheckRestore();
+    eConfigSnapshotStatus CommitRestore();
+    void GetKeyInfo(int keyIndex, ProgrammingKeyInfo& info) const;
+
+    inline ConfigSnapshotHeader& Header() {
+        return *reinterpret_cast<ConfigSnapshotHeader*>(headerPage);
+    }
+    inline const ConfigSnapshotHeader& Header() const {
+        return *reinterpret_cast<const ConfigSnapshotHeader*>(headerPage);
+    }
+
+private:
+    // Macro pages of a restore are kept here until the whole blob arrived
+    const uint32_t flashFirstStagingSectorNum = FLASH_FIRST_STAGING_SECTOR;
+
+    alignas(4) uint8_t headerPage[CONFIG_SNAPSHOT_HEADER_LENGTH];
+    const uint8_t* keyMacros[MAX_SNAPSHOT_KEYS];
+    uint16_t keyFirstPage[MAX_SNAPSHOT_KEYS];
+    uint16_t keyNumPages[MAX_SNAPSHOT_KEYS];
+    uint16_t totalPages;
+
+    eConfigSnapshotStatus restoreStatus;
+};
+
+#endif // CONFIG_SNAPSHOT_H
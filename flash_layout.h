@@ -0,0 +1,25 @@
+#ifndef FLASH_LAYOUT_H
+#define FLASH_LAYOUT_H
+
+#include <stdint.h>
+#include "message_payloads.h"
+
+// Sectors of the stored configuration, relative to the FlashService base
+// sector. Every range starts where the previous one ends, so a user only
+// takes its sector numbers from here and they cannot overlap.
+const uint32_t FLASH_SETTINGS_SECTOR = 0;
+// Key N of layer 0 in sector FLASH_FIRST_KEY_SECTOR + N
+const uint32_t FLASH_FIRST_KEY_SECTOR = FLASH_SETTINGS_SECTOR + 1;
+const uint32_t FLASH_NUM_KEY_SECTORS = MAX_LAYER_KEYS;
+const uint32_t FLASH_KEYMAP_SECTOR = FLASH_FIRST_KEY_SECTOR + FLASH_NUM_KEY_SECTORS;
+const uint32_t FLASH_COMBOS_SECTOR = FLASH_KEYMAP_SECTOR + 1;
+const uint32_t FLASH_LEADER_SECTOR = FLASH_COMBOS_SECTOR + 1;
+const uint32_t FLASH_ENCODERS_SECTOR = FLASH_LEADER_SECTOR + 1;
+const uint32_t FLASH_FIRST_USAGE_SECTOR = FLASH_ENCODERS_SECTOR + 1;
+const uint32_t FLASH_NUM_USAGE_SECTORS = 2;
+// Macros of a snapshot restore, a sector per key
+const uint32_t FLASH_FIRST_STAGING_SECTOR = FLASH_FIRST_USAGE_SECTOR + FLASH_NUM_USAGE_SECTORS;
+const uint32_t FLASH_NUM_STAGING_SECTORS = MAX_SNAPSHOT_KEYS;
+const uint32_t FLASH_NUM_SECTORS = FLASH_FIRST_STAGING_SECTOR + FLASH_NUM_STAGING_SECTORS;
+
+#endif // FLASH_LAYOUT_H
@@ -14,7 +14,7 @@ void FlashService::EraseSector(uint32_t sectorNum) {
     restore_interrupts(intr);
 }
 
-void FlashService::WriteToSector(uint32_t sectorNum, uint8_t pageNum, uint8_t* data, int size) {
+void FlashService::WriteToSector(uint32_t sectorNum, uint8_t pageNum, const uint8_t* data, int size) {
     uint32_t absSectorNum = sectorNum + FLASH_BASE_SECTOR; 
 
     // Make sure size does not overflow
@@ -22,7 +22,7 @@ public:
     }
 
     void EraseSector(uint32_t sectorNum);
-    void WriteToSector(uint32_t sectorNum, uint8_t pageNum, uint8_t* data, int size);
+    void WriteToSector(uint32_t sectorNum, uint8_t pageNum, const uint8_t* data, int size);
     uint8_t* GetSectorAddress(uint32_t sectorNum);
     uint8_t* GetPageAddress(uint32_t sectorNum, uint8_t pageNum);
     inline uint8_t GetNumPagesPerSector() const { return NUM_PAGES_IN_SECTOR; }
@@ -0,0 +1,512 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "macropad_client.h"
+
+static void PrintUsage(const char* name) {
+    printf("Usage: %s <device> <command> [args]\n"
+           "The device is the CDC tty (/dev/ttyACM*) or the raw HID node (/dev/hidraw*)\n"
+           "Commands:\n"
+           "  blink-on <ms>                   Set the LED on time\n"
+           "  blink-off <ms>                  Set the LED off time\n"
+           "  upload <keymap-file>            Upload a keymap (see below)\n"
+           "  dump <sector> <count> <file>    Dump flash sectors to a file\n"
+           "  queue-stats                     Print the device send queue counters\n"
+           "  tasks                           Print the firmware task timings\n"
+           "  power                           Print the idle and wake counters\n"
+           "  scan-rate                       Print scans and time spent per scan rate tier\n"
+           "  profile [reset]                 Print the profiler stages (profiling builds only)\n"
+           "  usage [reset]                   Print the key and macro usage counters\n"
+           "  layer <n>                       Print the actions of a keymap layer\n"
+           "  set-layer <n> <action> ...      Write a keymap layer, one action per key index\n"
+           "  combos                          Print the combo table\n"
+           "  set-combos <mask>=<action> ...  Replace the combo table, mask has a bit per key index\n"
+           "  encoders                        Print the clockwise,counter-clockwise action of each encoder\n"
+           "  set-encoders <accel> <cw>,<ccw> ...\n"
+           "                                  Write the actions of every encoder, accel 1 is off\n"
+           "  get-settings                    Print every setting\n"
+           "  set <id>=<value> ...            Write settings in one batch\n"
+           "  snapshot <file>                 Save settings and keymap to a file\n"
+           "  restore <file>                  Restore settings and keymap from a file\n"
+           "  bench [requests] [depth]        Measure pipelined round trips\n"
+           "  bench-compare <device> [requests]\n"
+           "                                  Compare round trips against a second transport\n"
+           "\n"
+           "Keymap file, one key per line, '#' starts a comment:\n"
+           "  <column> <row> <keycode> [<code>:<is-modifier>:<is-pressed>:<delay-ms> ...]\n"
+           "  leader <index>,<index>,... <code>:<is-modifier>:<is-pressed>:<delay-ms> ...\n"
+           "\n"
+           "Actions and keycodes are kind << 12 | layer << 8 | code, kinds are\n"
+           "0 key, 1 modifier, 2 momentary layer, 3 toggle layer, 4 default layer,\n"
+           "5 mod-tap (layer is the modifier bit), 6 layer-tap, 7 macro of key index <code>,\n"
+           "8 leader, 9 consumer usage in the low 12 bits, 0xA record a macro to key index\n"
+           "<code> (again to stop), 0xB mouse key <code> (0-3 up, down, left, right,\n"
+           "4-7 wheel up, down, left, right, 0x10-0x14 buttons 1-5) and 0xF transparent (0xFFFF)\n",
+           name);
+}
+
+static void PrintBenchmark(const BenchmarkResult& result) {
+    printf("depth %2u: %u requests in %.3f s, %.1f KB/s, latency min %.0f / mean %.0f / max %.0f us, %u failed\n",
+            result.Depth, result.NumRequests, result.TotalSeconds, result.BytesPerSecond / 1024.0,
+            result.MinLatencyUs, result.MeanLatencyUs, result.MaxLatencyUs, result.NumFailed);
+}
+
+static bool ParseNumber(const std::string& text, uint32_t& value) {
+    char* end = nullptr;
+    value = (uint32_t)strtoul(text.c_str(), &end, 0);
+    return !text.empty() && end != nullptr && *end == '\0';
+}
+
+static bool ParseMacroKey(const std::string& text, MacroKey& key) {
+    std::vector<uint32_t> fields;
+    std::stringstream stream(text);
+    std::string field;
+    while (std::getline(stream, field, ':')) {
+        uint32_t value;
+        if (!ParseNumber(field, value))
+            return false;
+        fields.push_back(value);
+    }
+    if (fields.size() != 4)
+        return false;
+
+    key.Code = (uint16_t)fields[0];
+    key.IsModifier = (uint8_t)fields[1];
+    key.IsPressed = (uint8_t)fields[2];
+    key.DelayMs = fields[3];
+    return true;
+}
+
+static bool ParseLeaderKeys(const std::string& text, std::vector<uint8_t>& keys) {
+    std::stringstream stream(text);
+    std::string field;
+    while (std::getline(stream, field, ',')) {
+        uint32_t value;
+        if (!ParseNumber(field, value) || value > 0xFF)
+            return false;
+        keys.push_back((uint8_t)value);
+    }
+    return !keys.empty();
+}
+
+static bool LoadKeymap(const std::string& path, std::vector<KeyUpload>& keys,
+        std::vector<LeaderSequence>& sequences) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Could not open %s\n", path.c_str());
+        return false;
+    }
+
+    std::string line;
+    int lineNum = 0;
+    while (std::getline(file, line)) {
+        lineNum++;
+        line = line.substr(0, line.find('#'));
+
+        std::stringstream stream(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (stream >> token)
+            tokens.push_back(token);
+        if (tokens.empty())
+            continue;
+
+        if (tokens[0] == "leader") {
+            LeaderSequence sequence;
+            bool isOk = tokens.size() >= 3 && ParseLeaderKeys(tokens[1], sequence.Keys);
+            for (size_t i = 2; isOk && i < tokens.size(); i++) {
+                MacroKey macroKey;
+                isOk = ParseMacroKey(tokens[i], macroKey);
+                sequence.Macro.push_back(macroKey);
+            }
+            if (!isOk) {
+                fprintf(stderr, "%s:%d: invalid leader line\n", path.c_str(), lineNum);
+                return false;
+            }
+            sequences.push_back(sequence);
+            continue;
+        }
+
+        KeyUpload key;
+        uint32_t column, row, code;
+        bool isOk = tokens.size() >= 3 && ParseNumber(tokens[0], column) &&
+            ParseNumber(tokens[1], row) && ParseNumber(tokens[2], code);
+        for (size_t i = 3; isOk && i < tokens.size(); i++) {
+            MacroKey macroKey;
+            isOk = ParseMacroKey(tokens[i], macroKey);
+            key.Macro.push_back(macroKey);
+        }
+        if (!isOk) {
+            fprintf(stderr, "%s:%d: invalid key line\n", path.c_str(), lineNum);
+            return false;
+        }
+
+        key.KeyColumn = (uint16_t)column;
+        key.KeyRow = (uint16_t)row;
+        key.KeyCode = (uint16_t)code;
+        keys.push_back(key);
+    }
+
+    return true;
+}
+
+static std::string ProfileStageName(int stage) {
+    if (stage == PROFILER_STAGE_LOOP_PERIOD)
+        return "loop period";
+    if (stage < PROFILER_STAGE_TASK_LATENESS)
+        return "task " + std::to_string(stage - PROFILER_STAGE_TASK_RUN) + " run";
+    if (stage < PROFILER_STAGE_REPORT_WAIT)
+        return "task " + std::to_string(stage - PROFILER_STAGE_TASK_LATENESS) + " lateness";
+    return "report wait";
+}
+
+static int RunCommand(MacroPadClient& client, const std::vector<std::string>& args) {
+    const std::string& command = args[0];
+    uint32_t value = 0;
+
+    if ((command == "blink-on" || command == "blink-off") && args.size() == 2 &&
+            ParseNumber(args[1], value)) {
+        bool isOk = (command == "blink-on") ? client.SetBlinkOnTime(value) : client.SetBlinkOffTime(value);
+        return isOk ? 0 : 1;
+    }
+
+    if (command == "upload" && args.size() == 2) {
+        std::vector<KeyUpload> keys;
+        std::vector<LeaderSequence> sequences;
+        if (!LoadKeymap(args[1], keys, sequences))
+            return 1;
+
+        // The trie is always written, a keymap without leader lines clears it
+        KeyUpload trie;
+        if (!client.BuildLeaderTrie(sequences, trie))
+            return 1;
+        keys.push_back(trie);
+        if (!client.UploadKeymap(keys))
+            return 1;
+        printf("Uploaded %zu keys and %zu leader sequences\n", keys.size() - 1, sequences.size());
+        return 0;
+    }
+
+    uint32_t sector = 0, count = 0;
+    if (command == "dump" && args.size() == 4 && ParseNumber(args[1], sector) &&
+            ParseNumber(args[2], count)) {
+        std::vector<uint8_t> data;
+        if (!client.DumpFlash(sector, count, data))
+            return 1;
+        std::ofstream file(args[3], std::ios::binary);
+        file.write((const char*)data.data(), data.size());
+        printf("Wrote %zu bytes to %s\n", data.size(), args[3].c_str());
+        return file ? 0 : 1;
+    }
+
+    if (command == "queue-stats" && args.size() == 1) {
+        SendQueueStats stats;
+        if (!client.GetSendQueueStats(stats))
+            return 1;
+        printf("control depth %u (max %u), bulk depth %u (max %u), sent %u, dropped %u\n",
+                stats.Depth[SEND_PRIORITY_CONTROL], stats.MaxDepth[SEND_PRIORITY_CONTROL],
+                stats.Depth[SEND_PRIORITY_BULK], stats.MaxDepth[SEND_PRIORITY_BULK],
+                stats.Sent, stats.Dropped);
+        return 0;
+    }
+
+    if (command == "tasks" && args.size() == 1) {
+        SchedulerStats stats;
+        if (!client.GetSchedulerStats(stats))
+            return 1;
+        static const char* priorities[TASK_PRIORITY_TOTAL] = { "high", "normal", "low" };
+        for (int i = 0; i < stats.NumTasks && i < MAX_SCHEDULER_TASKS; i++) {
+            const TaskStats& task = stats.Tasks[i];
+            const char* priority = (task.Priority < TASK_PRIORITY_TOTAL) ? priorities[task.Priority] : "?";
+            if (task.IsEvent)
+                printf("task %d: event, %s", i, priority);
+            else
+                printf("task %d: every %u us, %s", i, task.PeriodUs, priority);
+            printf(", runs %u, run last %u / max %u us, total %u us, late max %u us, deadline misses %u\n",
+                    task.RunCount, task.LastRunUs, task.MaxRunUs, task.TotalRunUs,
+                    task.MaxLatenessUs, task.DeadlineMisses);
+        }
+        return 0;
+    }
+
+    if (command == "power" && args.size() == 1) {
+        PowerStats stats;
+        if (!client.GetPowerStats(stats))
+            return 1;
+        static const char* states[] = { "active", "idle", "suspended" };
+        printf("state %s, remote wakeup %s, idle entries %u, suspends %u, wakeups %u, "
+                "wake to report last %u / max %u us\n",
+                (stats.State <= POWER_STATE_SUSPENDED) ? states[stats.State] : "?",
+                stats.IsRemoteWakeupEnabled ? "on" : "off", stats.IdleEntries, stats.Suspends,
+                stats.Wakeups, stats.LastWakeLatencyUs, stats.MaxWakeLatencyUs);
+        return 0;
+    }
+
+    if (command == "scan-rate" && args.size() == 1) {
+        ScanRateStats stats;
+        if (!client.GetScanRateStats(stats))
+            return 1;
+        for (int i = 0; i < stats.NumTiers && i < MAX_SCAN_TIERS; i++) {
+            printf("%ctier %d: every %u us, %u scans, %u ms\n", (i == stats.CurrentTier) ? '*' : ' ',
+                    i, stats.PeriodUs[i], stats.Scans[i], stats.TimeMs[i]);
+        }
+        return 0;
+    }
+
+    if (command == "profile" && (args.size() == 1 || (args.size() == 2 && args[1] == "reset"))) {
+        bool isReset = args.size() == 2;
+        for (int stage = 0; stage < PROFILER_NUM_STAGES; stage++) {
+            ProfileStage profile;
+            if (!client.GetProfileStage(stage, isReset, profile))
+                return 1;
+            if (profile.Count == 0)
+                continue;
+
+            printf("%-16s count %u, min %u / mean %u / max %u us\n", ProfileStageName(stage).c_str(),
+                    profile.Count, profile.MinUs, profile.MeanUs, profile.MaxUs);
+            for (int i = 0; i < PROFILER_NUM_BUCKETS; i++) {
+                if (profile.Histogram[i] == 0)
+                    continue;
+                if (i == 0)
+                    printf("    < 1 us: %u\n", profile.Histogram[i]);
+                else if (i == PROFILER_NUM_BUCKETS - 1)
+                    printf("    >= %u us: %u\n", 1u << (i - 1), profile.Histogram[i]);
+                else
+                    printf("    %u-%u us: %u\n", 1u << (i - 1), (1u << i) - 1, profile.Histogram[i]);
+            }
+        }
+        return 0;
+    }
+
+    if (command == "usage" && (args.size() == 1 || (args.size() == 2 && args[1] == "reset"))) {
+        // The local clock lets the device bucket presses by hour of day
+        time_t now = time(nullptr);
+        struct tm local;
+        localtime_r(&now, &local);
+        UsageReport report;
+        if (!client.GetUsageStats(args.size() == 2, (uint16_t)(local.tm_hour * 60 + local.tm_min), report))
+            return 1;
+
+        const UsageCounters& counters = report.Counters;
+        for (int i = 0; i < report.NumKeys && i < MAX_LAYER_KEYS; i++)
+            printf("key %2d: %u presses, %u macro plays\n", i, counters.KeyPresses[i], counters.MacroPlays[i]);
+        printf("leader macros: %u\n", counters.LeaderPlays);
+        printf("flash saves: %u, unsaved: %u\n", counters.Saves, report.UnsavedPresses);
+        if (report.IsHistogramEnabled) {
+            for (int hour = 0; hour < USAGE_HOURS; hour++)
+                printf("%02d:00 %u\n", hour, counters.HourPresses[hour]);
+        }
+        return 0;
+    }
+
+    if (command == "layer" && args.size() == 2) {
+        uint32_t layer;
+        if (!ParseNumber(args[1], layer) || layer >= MAX_LAYERS) {
+            return -1;
+        }
+        KeymapLayer keymapLayer;
+        if (!client.GetKeymapLayer((uint8_t)layer, keymapLayer))
+            return 1;
+        printf("active layers 0x%04X\n", keymapLayer.ActiveMask);
+        for (int i = 0; i < keymapLayer.NumKeys && i < MAX_LAYER_KEYS; i++)
+            printf("%d: 0x%04X\n", i, keymapLayer.Actions[i]);
+        return 0;
+    }
+
+    if (command == "set-layer" && args.size() > 2) {
+        KeymapLayer keymapLayer = {};
+        uint32_t layer;
+        if (!ParseNumber(args[1], layer) || layer >= MAX_LAYERS || args.size() - 2 > MAX_LAYER_KEYS) {
+            return -1;
+        }
+        keymapLayer.Layer = (uint8_t)layer;
+        keymapLayer.NumKeys = (uint8_t)(args.size() - 2);
+        for (size_t i = 2; i < args.size(); i++) {
+            uint32_t action;
+            if (!ParseNumber(args[i], action) || action > 0xFFFF) {
+                return -1;
+            }
+            keymapLayer.Actions[i - 2] = (uint16_t)action;
+        }
+        return client.SetKeymapLayer(keymapLayer) ? 0 : 1;
+    }
+
+    if (command == "combos" && args.size() == 1) {
+        ComboTable table;
+        if (!client.GetCombos(table))
+            return 1;
+        for (int i = 0; i < table.NumCombos && i < MAX_COMBOS; i++)
+            printf("0x%04X=0x%04X\n", table.Combos[i].KeyMask, table.Combos[i].Action);
+        return 0;
+    }
+
+    if (command == "set-combos" && args.size() <= (size_t)MAX_COMBOS + 1) {
+        ComboTable table = {};
+        for (size_t i = 1; i < args.size(); i++) {
+            size_t split = args[i].find('=');
+            uint32_t mask, action;
+            if (split == std::string::npos || !ParseNumber(args[i].substr(0, split), mask) ||
+                    !ParseNumber(args[i].substr(split + 1), action) || mask > 0xFFFF || action > 0xFFFF)
+                return -1;
+            table.Combos[table.NumCombos].KeyMask = (uint16_t)mask;
+            table.Combos[table.NumCombos].Action = (uint16_t)action;
+            table.NumCombos++;
+        }
+        return client.SetCombos(table) ? 0 : 1;
+    }
+
+    if (command == "encoders" && args.size() == 1) {
+        EncoderMap map;
+        if (!client.GetEncoders(map))
+            return 1;
+        printf("acceleration: %u\n", map.MaxAcceleration);
+        for (int i = 0; i < map.NumEncoders && i < MAX_ENCODERS; i++)
+            printf("%d: 0x%04X,0x%04X\n", i, map.Encoders[i].Clockwise, map.Encoders[i].CounterClockwise);
+        return 0;
+    }
+
+    if (command == "set-encoders" && args.size() >= 3 && args.size() <= (size_t)MAX_ENCODERS + 2 &&
+            ParseNumber(args[1], value) && value <= 0xFF) {
+        EncoderMap map = {};
+        map.MaxAcceleration = (uint8_t)value;
+        for (size_t i = 2; i < args.size(); i++) {
+            size_t split = args[i].find(',');
+            uint32_t clockwise, counterClockwise;
+            if (split == std::string::npos || !ParseNumber(args[i].substr(0, split), clockwise) ||
+                    !ParseNumber(args[i].substr(split + 1), counterClockwise) ||
+                    clockwise > 0xFFFF || counterClockwise > 0xFFFF)
+                return -1;
+            map.Encoders[map.NumEncoders].Clockwise = (uint16_t)clockwise;
+            map.Encoders[map.NumEncoders].CounterClockwise = (uint16_t)counterClockwise;
+            map.NumEncoders++;
+        }
+        return client.SetEncoders(map) ? 0 : 1;
+    }
+
+    if (command == "get-settings" && args.size() == 1) {
+        SettingsBatch batch;
+        if (!client.GetSettings(0xFFFFFFFF, batch))
+            return 1;
+        for (int i = 0; i < MAX_BATCH_SETTINGS; i++) {
+            if (batch.IdMask & (1u << i))
+                printf("%d=%u\n", i, batch.Values[i]);
+        }
+        return 0;
+    }
+
+    if (command == "set" && args.size() > 1) {
+        SettingsBatch batch = {};
+        for (size_t i = 1; i < args.size(); i++) {
+            size_t split = args[i].find('=');
+            uint32_t id;
+            if (split == std::string::npos || !ParseNumber(args[i].substr(0, split), id) ||
+                    id >= (uint32_t)MAX_BATCH_SETTINGS || !ParseNumber(args[i].substr(split + 1), value))
+                return -1;
+            batch.IdMask |= (1u << id);
+            batch.Values[id] = value;
+        }
+
+        SettingsBatch applied;
+        if (!client.SetSettings(batch, applied))
+            return 1;
+        for (int i = 0; i < MAX_BATCH_SETTINGS; i++) {
+            if (batch.IdMask & (1u << i)) {
+                if (applied.IdMask & (1u << i))
+                    printf("%d=%u\n", i, applied.Values[i]);
+                else
+                    printf("%d rejected\n", i);
+            }
+        }
+        return 0;
+    }
+
+    if (command == "snapshot" && args.size() == 2) {
+        std::vector<uint8_t> blob;
+        if (!client.GetConfigSnapshot(blob))
+            return 1;
+        std::ofstream file(args[1], std::ios::binary);
+        file.write((const char*)blob.data(), blob.size());
+        printf("Wrote %zu bytes to %s\n", blob.size(), args[1].c_str());
+        return file ? 0 : 1;
+    }
+
+    if (command == "restore" && args.size() == 2) {
+        std::ifstream file(args[1], std::ios::binary);
+        std::vector<uint8_t> blob((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!client.RestoreConfigSnapshot(blob))
+            return 1;
+        printf("Restored %zu bytes\n", blob.size());
+        return 0;
+    }
+
+    if (command == "bench" && args.size() <= 3) {
+        uint32_t numRequests = 1000, depth = 0;
+        if (args.size() > 1 && !ParseNumber(args[1], numRequests))
+            return -1;
+        if (args.size() > 2 && !ParseNumber(args[2], depth))
+            return -1;
+
+        // Without an explicit depth compare lock step against pipelined
+        std::vector<uint32_t> depths;
+        if (depth > 0)
+            depths.push_back(depth);
+        else
+            depths = { 1, 2, 4, 8 };
+
+        for (uint32_t d : depths)
+            PrintBenchmark(client.Benchmark(numRequests, d));
+        return 0;
+    }
+
+    if (command == "bench-compare" && (args.size() == 2 || args.size() == 3)) {
+        uint32_t numRequests = 1000;
+        if (args.size() > 2 && !ParseNumber(args[2], numRequests))
+            return -1;
+
+        // Both transports reach the same device, one at a time
+        MacroPadClient other;
+        if (!other.Open(args[1])) {
+            fprintf(stderr, "%s\n", other.GetLastError().c_str());
+            return 1;
+        }
+
+        for (uint32_t depth : { 1u, 8u }) {
+            printf("this:  ");
+            PrintBenchmark(client.Benchmark(numRequests, depth));
+            printf("other: ");
+            PrintBenchmark(other.Benchmark(numRequests, depth));
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    MacroPadClient client;
+    if (!client.Open(argv[1])) {
+        fprintf(stderr, "%s\n", client.GetLastError().c_str());
+        return 1;
+    }
+
+    std::vector<std::string> args(argv + 2, argv + argc);
+    int result = RunCommand(client, args);
+    if (result < 0) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+    if (result > 0)
+        fprintf(stderr, "%s\n", client.GetLastError().c_str());
+
+    return result;
+}
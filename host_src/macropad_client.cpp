@@ -0,0 +1,699 @@
+#include "macropad_client.h"
+#include <string.h>
+#include <algorithm>
+#include "crc8.h"
+#include "raw_hid_port.h"
+#include "serial_port.h"
+
+static const uint32_t FLASH_PAGE_SIZE = sizeof(FlashPage);
+static const uint32_t FLASH_PAGES_PER_SECTOR = 16;
+
+MacroPadClient::MacroPadClient() {
+    isRunning = false;
+    inFlight = 0;
+    maxInFlight = DEFAULT_MAX_IN_FLIGHT;
+    windowSize = DEFAULT_WINDOW_SIZE;
+    nextSeq = 1;
+}
+
+MacroPadClient::~MacroPadClient() {
+    Close();
+}
+
+bool MacroPadClient::Open(const std::string& path) {
+    Close();
+
+    std::unique_ptr<Port> newPort;
+    if (RawHidPort::IsRawHidPath(path))
+        newPort.reset(new RawHidPort());
+    else
+        newPort.reset(new SerialPort());
+    if (!newPort->Open(path))
+        return Fail("Could not open " + path);
+
+    return Open(std::move(newPort));
+}
+
+bool MacroPadClient::Open(std::unique_ptr<Port> openedPort) {
+    Close();
+    if (!openedPort || !openedPort->IsOpen())
+        return Fail("Port is not open");
+
+    port = std::move(openedPort);
+    isRunning = true;
+    reader = std::thread(&MacroPadClient::ReaderLoop, this);
+    return true;
+}
+
+void MacroPadClient::Close() {
+    isRunning = false;
+    if (reader.joinable())
+        reader.join();
+    if (port)
+        port->Close();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.clear();
+    unsolicited.clear();
+    inFlight = 0;
+}
+
+//--------------------------------------------------------------------+
+// Async API
+//--------------------------------------------------------------------+
+PendingRequest MacroPadClient::Request(MessageIds id, const void* data, uint16_t length,
+        bool matchSeq, uint8_t type, uint8_t status) {
+    PendingRequest request;
+    request.Id = id;
+
+    MessageHeader header(id);
+    header.Type = type;
+    header.Len = length;
+    header.Status = status;
+
+    {
+        // Keep the device queues from overflowing
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!inFlightCv.wait_for(lock, std::chrono::milliseconds(DEFAULT_TIMEOUT_MS),
+                [this] { return inFlight < maxInFlight; })) {
+            // Not sent, the invalid future fails WaitAnswer()
+            Fail("Timeout waiting for a free slot for message " + std::to_string(id));
+            return request;
+        }
+
+        header.Seq = nextSeq++;
+        if (nextSeq == 0)
+            nextSeq = 1;
+
+        Pending entry;
+        entry.Seq = header.Seq;
+        entry.MatchSeq = matchSeq;
+        request.Seq = header.Seq;
+        request.Future = entry.Promise.get_future();
+        pending[id].push_back(std::move(entry));
+        inFlight++;
+    }
+
+    SendFrame(header, data);
+    return request;
+}
+
+bool MacroPadClient::WaitAnswer(PendingRequest& request, Answer& answer, int timeoutMs) {
+    if (!request.Future.valid())
+        return false;
+
+    if (request.Future.wait_for(std::chrono::milliseconds(timeoutMs)) == std::future_status::ready) {
+        answer = request.Future.get();
+        return true;
+    }
+
+    // Timed out, forget about the request so it does not hold a slot
+    std::lock_guard<std::mutex> lock(mutex);
+    std::deque<Pending>& entries = pending[request.Id];
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->Seq == request.Seq) {
+            entries.erase(it);
+            inFlight--;
+            inFlightCv.notify_all();
+            break;
+        }
+    }
+
+    return Fail("Timeout waiting for answer to message " + std::to_string(request.Id));
+}
+
+//--------------------------------------------------------------------+
+// Blocking helpers
+//--------------------------------------------------------------------+
+bool MacroPadClient::SetBlinkOnTime(uint32_t ms) {
+    SettingValueRequest request = { ms };
+    Answer answer;
+    return SimpleRequest(MESSAGE_ID_SET_BLINK_ON_TIME, &request, sizeof(request), answer);
+}
+
+bool MacroPadClient::SetBlinkOffTime(uint32_t ms) {
+    SettingValueRequest request = { ms };
+    Answer answer;
+    return SimpleRequest(MESSAGE_ID_SET_BLINK_OFF_TIME, &request, sizeof(request), answer);
+}
+
+bool MacroPadClient::GetFlashPage(uint32_t sectorNum, uint32_t pageNum, std::vector<uint8_t>& page) {
+    FlashPageRequest pageRequest = { sectorNum, pageNum };
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_FLASH_PAGE, &pageRequest, sizeof(pageRequest), answer))
+        return false;
+
+    page = answer.Data;
+    return true;
+}
+
+bool MacroPadClient::DumpFlash(uint32_t firstSector, uint32_t numSectors, std::vector<uint8_t>& data) {
+    // Pipeline every page request, the answers come back in order
+    std::vector<PendingRequest> requests;
+    for (uint32_t sector = firstSector; sector < firstSector + numSectors; sector++) {
+        for (uint32_t page = 0; page < FLASH_PAGES_PER_SECTOR; page++) {
+            FlashPageRequest pageRequest = { sector, page };
+            requests.push_back(Request(MESSAGE_ID_GET_FLASH_PAGE, &pageRequest, sizeof(pageRequest)));
+        }
+    }
+
+    data.clear();
+    bool isOk = true;
+    for (PendingRequest& request : requests) {
+        Answer answer;
+        if (!WaitAnswer(request, answer) || answer.Data.size() != FLASH_PAGE_SIZE) {
+            isOk = false;
+            continue;
+        }
+        data.insert(data.end(), answer.Data.begin(), answer.Data.end());
+    }
+
+    return isOk ? true : Fail("Flash dump is incomplete");
+}
+
+bool MacroPadClient::UploadKey(const KeyUpload& key) {
+    ProgrammingKeyInfo keyInfo;
+    keyInfo.KeyColumn = key.KeyColumn;
+    keyInfo.KeyRow = key.KeyRow;
+    keyInfo.KeyCode = key.KeyCode;
+    keyInfo.MacroLength = (uint16_t)key.Macro.size();
+
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_PROGRAMMING_KEY_INFO, &keyInfo, sizeof(keyInfo), answer))
+        return false;
+
+    return ProgramKeyData((const uint8_t*)key.Macro.data(), key.Macro.size() * sizeof(MacroKey));
+}
+
+bool MacroPadClient::UploadKeymap(const std::vector<KeyUpload>& keys) {
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_PROGRAMMING_START, nullptr, 0, answer))
+        return false;
+
+    bool isOk = true;
+    for (const KeyUpload& key : keys) {
+        if (!UploadKey(key)) {
+            isOk = false;
+            break;
+        }
+    }
+
+    // Always leave programming mode, even after a failure
+    std::string error = lastError;
+    if (!SimpleRequest(MESSAGE_ID_PROGRAMMING_END, nullptr, 0, answer))
+        return false;
+    if (!isOk)
+        return Fail(error);
+
+    return true;
+}
+
+bool MacroPadClient::BuildLeaderTrie(const std::vector<LeaderSequence>& sequences, KeyUpload& upload) {
+    struct TrieNode {
+        std::map<uint8_t, int> Children;
+        int Sequence = -1;
+    };
+
+    std::vector<TrieNode> tree(1);
+    for (size_t i = 0; i < sequences.size(); i++) {
+        if (sequences[i].Keys.empty())
+            return Fail("Empty leader sequence");
+        int node = 0;
+        for (uint8_t key : sequences[i].Keys) {
+            if (key >= MAX_LAYER_KEYS)
+                return Fail("Leader key index out of range");
+            auto child = tree[node].Children.find(key);
+            if (child == tree[node].Children.end()) {
+                tree.push_back(TrieNode());
+                child = tree[node].Children.emplace(key, (int)tree.size() - 1).first;
+            }
+            node = child->second;
+        }
+        if (tree[node].Sequence >= 0)
+            return Fail("Duplicate leader sequence");
+        tree[node].Sequence = (int)i;
+    }
+
+    // Breadth first, so the children of a node are consecutive and in key order
+    std::vector<int> order(1, 0);
+    std::vector<LeaderNode> nodes;
+    for (size_t i = 0; i < order.size(); i++) {
+        const TrieNode& node = tree[order[i]];
+        LeaderNode record = {};
+        record.FirstChild = (uint16_t)order.size();
+        for (const auto& child : node.Children) {
+            record.ChildMask |= (uint16_t)(1u << child.first);
+            order.push_back(child.second);
+        }
+        if (record.ChildMask == 0)
+            record.FirstChild = 0;
+        nodes.push_back(record);
+    }
+
+    size_t numRecords = 1 + nodes.size();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        int sequence = tree[order[i]].Sequence;
+        if (sequence < 0)
+            continue;
+        nodes[i].MacroStart = (uint16_t)numRecords;
+        nodes[i].MacroLength = (uint16_t)sequences[sequence].Macro.size();
+        numRecords += sequences[sequence].Macro.size();
+    }
+    if (numRecords > 0xFFFF)
+        return Fail("Leader trie too large");
+
+    LeaderTrieHeader header = {};
+    header.Magic = LEADER_TRIE_MAGIC;
+    header.NumNodes = (uint16_t)nodes.size();
+
+    upload.KeyColumn = 0;
+    upload.KeyRow = LEADER_TRIE_KEY_ROW;
+    upload.KeyCode = 0;
+    upload.Macro.resize(numRecords);
+    memcpy(&upload.Macro[0], &header, sizeof(header));
+    memcpy(&upload.Macro[1], nodes.data(), nodes.size() * sizeof(LeaderNode));
+    size_t next = 1 + nodes.size();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        int sequence = tree[order[i]].Sequence;
+        if (sequence < 0)
+            continue;
+        const std::vector<MacroKey>& macro = sequences[sequence].Macro;
+        std::copy(macro.begin(), macro.end(), upload.Macro.begin() + next);
+        next += macro.size();
+    }
+
+    return true;
+}
+
+bool MacroPadClient::GetSendQueueStats(SendQueueStats& stats) {
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_SEND_QUEUE_STATS, nullptr, 0, answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_GET_SEND_QUEUE_STATS>(answer, stats))
+        return Fail("Short send queue stats answer");
+
+    return true;
+}
+
+bool MacroPadClient::GetSchedulerStats(SchedulerStats& stats) {
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_SCHEDULER_STATS, nullptr, 0, answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_GET_SCHEDULER_STATS>(answer, stats))
+        return Fail("Short scheduler stats answer");
+
+    return true;
+}
+
+bool MacroPadClient::GetPowerStats(PowerStats& stats) {
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_POWER_STATS, nullptr, 0, answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_GET_POWER_STATS>(answer, stats))
+        return Fail("Short power stats answer");
+
+    return true;
+}
+
+bool MacroPadClient::GetScanRateStats(ScanRateStats& stats) {
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_SCAN_RATE_STATS, nullptr, 0, answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_GET_SCAN_RATE_STATS>(answer, stats))
+        return Fail("Short scan rate stats answer");
+
+    return true;
+}
+
+bool MacroPadClient::GetProfileStage(uint8_t stage, bool isReset, ProfileStage& profile) {
+    ProfileRequest request = { stage, (uint8_t)isReset, 0 };
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_PROFILE_STAGE, &request, sizeof(request), answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_GET_PROFILE_STAGE>(answer, profile))
+        return Fail("Short profile answer");
+
+    return true;
+}
+
+bool MacroPadClient::GetKeymapLayer(uint8_t layer, KeymapLayer& keymapLayer) {
+    KeymapLayerRequest request = { layer, { 0, 0, 0 } };
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_KEYMAP_LAYER, &request, sizeof(request), answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_GET_KEYMAP_LAYER>(answer, keymapLayer))
+        return Fail("Short keymap layer answer");
+
+    return true;
+}
+
+bool MacroPadClient::SetKeymapLayer(const KeymapLayer& keymapLayer) {
+    Answer answer;
+    return SimpleRequest(MESSAGE_ID_SET_KEYMAP_LAYER, &keymapLayer, sizeof(keymapLayer), answer);
+}
+
+bool MacroPadClient::GetCombos(ComboTable& table) {
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_COMBOS, nullptr, 0, answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_GET_COMBOS>(answer, table))
+        return Fail("Short combos answer");
+
+    return true;
+}
+
+bool MacroPadClient::SetCombos(const ComboTable& table) {
+    Answer answer;
+    return SimpleRequest(MESSAGE_ID_SET_COMBOS, &table, sizeof(table), answer);
+}
+
+bool MacroPadClient::GetEncoders(EncoderMap& map) {
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_ENCODERS, nullptr, 0, answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_GET_ENCODERS>(answer, map))
+        return Fail("Short encoders answer");
+
+    return true;
+}
+
+bool MacroPadClient::SetEncoders(const EncoderMap& map) {
+    Answer answer;
+    return SimpleRequest(MESSAGE_ID_SET_ENCODERS, &map, sizeof(map), answer);
+}
+
+bool MacroPadClient::GetUsageStats(bool isReset, uint16_t minuteOfDay, UsageReport& report) {
+    UsageRequest request = {};
+    request.IsReset = isReset ? 1 : 0;
+    request.MinuteOfDay = minuteOfDay;
+
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_USAGE_STATS, &request, sizeof(request), answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_GET_USAGE_STATS>(answer, report))
+        return Fail("Short usage answer");
+
+    return true;
+}
+
+bool MacroPadClient::GetSettings(uint32_t idMask, SettingsBatch& batch) {
+    SettingsMaskRequest request = { idMask };
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_SETTINGS, &request, sizeof(request), answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_GET_SETTINGS>(answer, batch))
+        return Fail("Short settings answer");
+
+    return true;
+}
+
+bool MacroPadClient::SetSettings(const SettingsBatch& batch, SettingsBatch& applied) {
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_SET_SETTINGS, &batch, sizeof(batch), answer))
+        return false;
+    if (!DecodeAnswer<MESSAGE_ID_SET_SETTINGS>(answer, applied))
+        return Fail("Short settings answer");
+
+    return true;
+}
+
+bool MacroPadClient::GetConfigSnapshot(std::vector<uint8_t>& blob) {
+    Answer answer;
+    if (!SimpleRequest(MESSAGE_ID_GET_CONFIG_SNAPSHOT, nullptr, 0, answer))
+        return false;
+    if (answer.Data.size() < sizeof(ConfigSnapshotHeader))
+        return Fail("Short snapshot answer");
+
+    ConfigSnapshotHeader header;
+    memcpy(&header, answer.Data.data(), sizeof(header));
+    // Older firmware exports version 1, restored as is
+    if (header.Magic != CONFIG_SNAPSHOT_MAGIC ||
+            (header.Version != CONFIG_SNAPSHOT_VERSION && header.Version != CONFIG_SNAPSHOT_VERSION_V1))
+        return Fail("Unsupported snapshot version " + std::to_string(header.Version));
+
+    blob = std::move(answer.Data);
+    return true;
+}
+
+bool MacroPadClient::RestoreConfigSnapshot(const std::vector<uint8_t>& blob) {
+    if (blob.empty() || blob.size() > MAX_LARGE_DATA_LENGTH)
+        return Fail("Invalid snapshot size");
+
+    // Sent as one large frame, the device programs it page by page
+    PendingRequest request = Request(MESSAGE_ID_RESTORE_CONFIG_SNAPSHOT, blob.data(),
+            (uint16_t)blob.size(), true, MESSAGE_TYPE_LARGE_REQUEST);
+    Answer answer;
+    if (!WaitAnswer(request, answer, RESTORE_TIMEOUT_MS))
+        return false;
+    if (answer.Header.Status != SNAPSHOT_STATUS_OK)
+        return Fail("Snapshot restore failed with status " + std::to_string(answer.Header.Status));
+
+    return true;
+}
+
+BenchmarkResult MacroPadClient::Benchmark(uint32_t numRequests, uint32_t depth) {
+    typedef std::chrono::steady_clock Clock;
+
+    BenchmarkResult result = {};
+    result.NumRequests = numRequests;
+    result.Depth = std::max<uint32_t>(depth, 1);
+    result.MinLatencyUs = 1e12;
+
+    int prevMaxInFlight = maxInFlight;
+    maxInFlight = (int)result.Depth;
+
+    // Flash page reads are the largest answers, use them as the payload
+    struct Sent {
+        PendingRequest Request;
+        Clock::time_point Time;
+    };
+    std::deque<Sent> window;
+    uint64_t totalBytes = 0;
+    double totalLatencyUs = 0;
+    uint32_t numAnswered = 0;
+    uint32_t numSent = 0;
+
+    Clock::time_point start = Clock::now();
+    while (numSent < numRequests || !window.empty()) {
+        while (numSent < numRequests && window.size() < result.Depth) {
+            FlashPageRequest pageRequest = { 0, numSent % FLASH_PAGES_PER_SECTOR };
+            Sent sent;
+            sent.Time = Clock::now();
+            sent.Request = Request(MESSAGE_ID_GET_FLASH_PAGE, &pageRequest, sizeof(pageRequest));
+            window.push_back(std::move(sent));
+            numSent++;
+        }
+
+        Answer answer;
+        Sent& oldest = window.front();
+        if (WaitAnswer(oldest.Request, answer)) {
+            double latencyUs = std::chrono::duration<double, std::micro>(Clock::now() - oldest.Time).count();
+            result.MinLatencyUs = std::min(result.MinLatencyUs, latencyUs);
+            result.MaxLatencyUs = std::max(result.MaxLatencyUs, latencyUs);
+            totalLatencyUs += latencyUs;
+            totalBytes += sizeof(MessageHeader) * 2 + sizeof(FlashPageRequest) + answer.Data.size();
+            numAnswered++;
+        }
+        else {
+            result.NumFailed++;
+        }
+        window.pop_front();
+    }
+
+    result.TotalSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (result.TotalSeconds > 0)
+        result.BytesPerSecond = totalBytes / result.TotalSeconds;
+    if (numAnswered > 0)
+        result.MeanLatencyUs = totalLatencyUs / numAnswered;
+    else
+        result.MinLatencyUs = 0;
+
+    maxInFlight = prevMaxInFlight;
+    return result;
+}
+
+//--------------------------------------------------------------------+
+// Internals
+//--------------------------------------------------------------------+
+bool MacroPadClient::SendFrame(const MessageHeader& header, const void* data) {
+    // One write per frame, so raw HID does not spend a report on the header
+    std::vector<uint8_t> frame(sizeof(header) + header.Len);
+    memcpy(frame.data(), &header, sizeof(header));
+    if (header.Len > 0)
+        memcpy(frame.data() + sizeof(header), data, header.Len);
+
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (!port->Write(frame.data(), (uint32_t)frame.size()))
+        return Fail("Write failed");
+
+    return true;
+}
+
+bool MacroPadClient::SimpleRequest(MessageIds id, const void* data, uint16_t length, Answer& answer) {
+    PendingRequest request = Request(id, data, length);
+    if (!WaitAnswer(request, answer))
+        return false;
+    if (answer.Header.Status != 0)
+        return Fail("Message " + std::to_string(id) + " failed with status " +
+                std::to_string(answer.Header.Status));
+
+    return true;
+}
+
+bool MacroPadClient::ProgramKeyData(const uint8_t* data, uint32_t length) {
+    uint16_t numPackets = (uint16_t)((length + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE);
+    if (numPackets == 0)
+        return true;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        unsolicited[MESSAGE_ID_PROGRAMMING_WINDOW_PACKET].clear();
+    }
+
+    ProgrammingWindowInfo windowInfo = { (uint16_t)windowSize, numPackets };
+    PendingRequest start = Request(MESSAGE_ID_PROGRAMMING_WINDOW_START,
+            &windowInfo, sizeof(windowInfo));
+    Answer answer;
+    if (!WaitAnswer(start, answer))
+        return false;
+    if (answer.Header.Status != PROG_STATUS_OK)
+        return Fail("Window start failed with status " + std::to_string(answer.Header.Status));
+
+    ProgrammingWindowInfo grantedInfo;
+    if (!DecodeAnswer<MESSAGE_ID_PROGRAMMING_WINDOW_START>(answer, grantedInfo) || grantedInfo.WindowSize == 0)
+        return Fail("Short window start answer");
+    uint16_t granted = grantedInfo.WindowSize;
+    uint16_t ackSeq = 1;       // Every packet below was programmed
+    uint16_t nextToSend = 1;
+    int retries = 0;
+
+    auto sendPacket = [&](uint16_t seq) {
+        uint32_t offset = (seq - 1) * FLASH_PAGE_SIZE;
+        MessageHeader header(MESSAGE_ID_PROGRAMMING_WINDOW_PACKET);
+        header.Type = MESSAGE_TYPE_REQUEST;
+        header.Seq = seq;
+        header.Len = (uint16_t)std::min(FLASH_PAGE_SIZE, length - offset);
+        header.Status = Crc8(data + offset, header.Len);
+        return SendFrame(header, data + offset);
+    };
+
+    while (ackSeq <= numPackets) {
+        // Stream everything the window allows without waiting
+        while (nextToSend <= numPackets && nextToSend < ackSeq + granted) {
+            if (!sendPacket(nextToSend))
+                return false;
+            nextToSend++;
+        }
+
+        if (!WaitUnsolicited(MESSAGE_ID_PROGRAMMING_WINDOW_PACKET, answer, DEFAULT_TIMEOUT_MS)) {
+            // Lost packet or ack, go back to the last acked packet
+            if (++retries > 3)
+                return Fail("Window programming timed out");
+            nextToSend = ackSeq;
+            continue;
+        }
+
+        switch (answer.Header.Status) {
+        case PROG_STATUS_OK:
+            ackSeq = std::max(ackSeq, answer.Header.Seq);
+            nextToSend = std::max(nextToSend, ackSeq);
+            retries = 0;
+            break;
+        case PROG_STATUS_INVALID_CRC:
+        case PROG_STATUS_PACKET_GAP:
+            if (!sendPacket(answer.Header.Seq))
+                return false;
+            break;
+        default:
+            return Fail("Window programming failed with status " +
+                    std::to_string(answer.Header.Status));
+        }
+    }
+
+    return true;
+}
+
+bool MacroPadClient::WaitUnsolicited(uint8_t id, Answer& answer, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mutex);
+    std::deque<Answer>& answers = unsolicited[id];
+    if (!unsolicitedCv.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+            [&answers] { return !answers.empty(); }))
+        return false;
+
+    answer = std::move(answers.front());
+    answers.pop_front();
+    return true;
+}
+
+void MacroPadClient::ReaderLoop() {
+    std::vector<uint8_t> buffer;
+    uint8_t chunk[4096];
+
+    while (isRunning) {
+        int count = port->Read(chunk, sizeof(chunk), 50);
+        if (count < 0)
+            break;
+        if (count == 0)
+            continue;
+
+        buffer.insert(buffer.end(), chunk, chunk + count);
+        ParseFrames(buffer);
+    }
+}
+
+void MacroPadClient::ParseFrames(std::vector<uint8_t>& buffer) {
+    size_t pos = 0;
+    while (buffer.size() - pos >= sizeof(MessageHeader)) {
+        MessageHeader header;
+        memcpy(&header, &buffer[pos], sizeof(header));
+
+        // Resync on the start mark
+        if (header.Mark != MESSAGE_START_MARK || header.Type != MESSAGE_TYPE_ANSWER ||
+                header.Len > MAX_LARGE_DATA_LENGTH) {
+            pos++;
+            continue;
+        }
+        if (buffer.size() - pos < sizeof(MessageHeader) + header.Len)
+            break;
+
+        Answer answer;
+        answer.Header = header;
+        const uint8_t* payload = &buffer[pos + sizeof(MessageHeader)];
+        answer.Data.assign(payload, payload + header.Len);
+        pos += sizeof(MessageHeader) + header.Len;
+
+        DispatchAnswer(answer);
+    }
+
+    buffer.erase(buffer.begin(), buffer.begin() + pos);
+}
+
+void MacroPadClient::DispatchAnswer(Answer& answer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::deque<Pending>& entries = pending[answer.Header.Id];
+
+    auto match = std::find_if(entries.begin(), entries.end(), [&answer](const Pending& entry) {
+        return entry.MatchSeq && entry.Seq == answer.Header.Seq;
+    });
+    if (match == entries.end()) {
+        match = std::find_if(entries.begin(), entries.end(), [](const Pending& entry) {
+            return !entry.MatchSeq;
+        });
+    }
+
+    if (match == entries.end()) {
+        unsolicited[answer.Header.Id].push_back(std::move(answer));
+        unsolicitedCv.notify_all();
+        return;
+    }
+
+    match->Promise.set_value(std::move(answer));
+    entries.erase(match);
+    inFlight--;
+    inFlightCv.notify_all();
+}
+
+bool MacroPadClient::Fail(const std::string& error) {
+    lastError = error;
+    return false;
+}
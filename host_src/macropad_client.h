@@ -0,0 +1,165 @@
+#ifndef MACROPAD_CLIENT_H
+#define MACROPAD_CLIENT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "message.h"
+#include "message_payloads.h"
+#include "message_codec.h"
+#include "port.h"
+
+struct Answer {
+    MessageHeader Header;
+    std::vector<uint8_t> Data;
+};
+
+// Copies the answer payload out if it holds a whole response of message Id
+template <MessageIds Id>
+bool DecodeAnswer(const Answer& answer, typename MessageTraits<Id>::Response& response) {
+    const uint16_t length = PayloadLength<typename MessageTraits<Id>::Response>::Value;
+    if (answer.Header.Id != Id || answer.Data.size() < length)
+        return false;
+
+    memcpy(&response, answer.Data.data(), length);
+    return true;
+}
+
+// Handle of an in flight request, see MacroPadClient::Request().
+// Future is not valid if the request could not be sent.
+struct PendingRequest {
+    uint8_t Id;
+    uint16_t Seq;
+    std::future<Answer> Future;
+};
+
+struct KeyUpload {
+    uint16_t KeyColumn;
+    uint16_t KeyRow;
+    uint16_t KeyCode;
+    std::vector<MacroKey> Macro;
+};
+
+// Keys pressed after the leader key, by key index, and the macro they play
+struct LeaderSequence {
+    std::vector<uint8_t> Keys;
+    std::vector<MacroKey> Macro;
+};
+
+struct BenchmarkResult {
+    uint32_t NumRequests;
+    uint32_t NumFailed;
+    uint32_t Depth;
+    double TotalSeconds;
+    double BytesPerSecond;
+    double MinLatencyUs;
+    double MeanLatencyUs;
+    double MaxLatencyUs;
+};
+
+// Host side of the protocol in message.h.
+// Requests are pipelined: Request() returns immediately and answers are
+// matched back to their request by a reader thread using (Id, Seq).
+class MacroPadClient {
+public:
+    static constexpr int DEFAULT_TIMEOUT_MS = 1000;
+    static constexpr int DEFAULT_MAX_IN_FLIGHT = 8;
+    static constexpr int DEFAULT_WINDOW_SIZE = 8;
+    // Restoring a snapshot erases and programs every key sector
+    static constexpr int RESTORE_TIMEOUT_MS = 10000;
+
+public:
+    MacroPadClient();
+    ~MacroPadClient();
+
+    // /dev/hidraw* paths use the raw HID interface, others the CDC tty
+    bool Open(const std::string& path);
+    // Takes a port the caller opened, e.g. the raw HID side of a fake device
+    bool Open(std::unique_ptr<Port> openedPort);
+    void Close();
+
+    // Async API.
+    // Answers which do not echo the request Seq (key sector) are matched
+    // by Id only, pass matchSeq = false for those.
+    PendingRequest Request(MessageIds id, const void* data, uint16_t length,
+            bool matchSeq = true, uint8_t type = MESSAGE_TYPE_REQUEST, uint8_t status = 0);
+    bool WaitAnswer(PendingRequest& request, Answer& answer, int timeoutMs = DEFAULT_TIMEOUT_MS);
+
+    // Blocking helpers built on top of the async API
+    bool SetBlinkOnTime(uint32_t ms);
+    bool SetBlinkOffTime(uint32_t ms);
+    bool GetFlashPage(uint32_t sectorNum, uint32_t pageNum, std::vector<uint8_t>& page);
+    bool DumpFlash(uint32_t firstSector, uint32_t numSectors, std::vector<uint8_t>& data);
+    bool UploadKey(const KeyUpload& key);
+    bool UploadKeymap(const std::vector<KeyUpload>& keys);
+    // Builds the leader trie, uploaded like a key with UploadKey()
+    bool BuildLeaderTrie(const std::vector<LeaderSequence>& sequences, KeyUpload& upload);
+    bool GetSendQueueStats(SendQueueStats& stats);
+    bool GetSchedulerStats(SchedulerStats& stats);
+    bool GetPowerStats(PowerStats& stats);
+    bool GetScanRateStats(ScanRateStats& stats);
+    bool GetProfileStage(uint8_t stage, bool isReset, ProfileStage& profile);
+    bool GetKeymapLayer(uint8_t layer, KeymapLayer& keymapLayer);
+    bool SetKeymapLayer(const KeymapLayer& keymapLayer);
+    bool GetCombos(ComboTable& table);
+    bool SetCombos(const ComboTable& table);
+    bool GetEncoders(EncoderMap& map);
+    bool SetEncoders(const EncoderMap& map);
+    bool GetUsageStats(bool isReset, uint16_t minuteOfDay, UsageReport& report);
+    bool GetSettings(uint32_t idMask, SettingsBatch& batch);
+    bool SetSettings(const SettingsBatch& batch, SettingsBatch& applied);
+    bool GetConfigSnapshot(std::vector<uint8_t>& blob);
+    bool RestoreConfigSnapshot(const std::vector<uint8_t>& blob);
+    BenchmarkResult Benchmark(uint32_t numRequests, uint32_t depth);
+
+    inline void SetMaxInFlight(int maxRequests) { maxInFlight = maxRequests; }
+    inline void SetWindowSize(int size) { windowSize = size; }
+    inline const std::string& GetLastError() const { return lastError; }
+
+private:
+    struct Pending {
+        uint16_t Seq;
+        bool MatchSeq;
+        std::promise<Answer> Promise;
+    };
+
+    bool SendFrame(const MessageHeader& header, const void* data);
+    bool SimpleRequest(MessageIds id, const void* data, uint16_t length, Answer& answer);
+    bool ProgramKeyData(const uint8_t* data, uint32_t length);
+    bool WaitUnsolicited(uint8_t id, Answer& answer, int timeoutMs);
+
+    void ReaderLoop();
+    void ParseFrames(std::vector<uint8_t>& buffer);
+    void DispatchAnswer(Answer& answer);
+    bool Fail(const std::string& error);
+
+private:
+    std::unique_ptr<Port> port;
+    std::thread reader;
+    std::atomic<bool> isRunning;
+
+    std::mutex writeMutex;
+    std::mutex mutex;
+    std::condition_variable inFlightCv;
+    std::condition_variable unsolicitedCv;
+    std::map<uint8_t, std::deque<Pending>> pending;
+    std::map<uint8_t, std::deque<Answer>> unsolicited;
+    int inFlight;
+    int maxInFlight;
+    int windowSize;
+    uint16_t nextSeq;
+
+    std::string lastError;
+};
+
+#endif // MACROPAD_CLIENT_H
@@ -0,0 +1,22 @@
+#ifndef PORT_H
+#define PORT_H
+
+#include <stdint.h>
+#include <string>
+
+// Byte stream to the device, the same frames go over every port
+class Port {
+public:
+    virtual ~Port() {}
+
+    virtual bool Open(const std::string& path) = 0;
+    virtual void Close() = 0;
+    virtual bool IsOpen() const = 0;
+
+    // Writes the whole buffer, returns false on error
+    virtual bool Write(const void* data, uint32_t length) = 0;
+    // Waits up to timeoutMs for data, returns bytes read or -1 on error
+    virtual int Read(void* data, uint32_t length, int timeoutMs) = 0;
+};
+
+#endif // PORT_H
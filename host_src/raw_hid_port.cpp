@@ -0,0 +1,89 @@
+#include "raw_hid_port.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include "message.h"
+
+RawHidPort::RawHidPort() : fd(-1) {
+}
+
+RawHidPort::~RawHidPort() {
+    Close();
+}
+
+bool RawHidPort::IsRawHidPath(const std::string& path) {
+    return path.find("hidraw") != std::string::npos;
+}
+
+bool RawHidPort::Open(const std::string& path) {
+    Close();
+
+    fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    return fd >= 0;
+}
+
+bool RawHidPort::Attach(int reportFd) {
+    Close();
+
+    fd = reportFd;
+    return fd >= 0;
+}
+
+void RawHidPort::Close() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    pending.clear();
+}
+
+bool RawHidPort::Write(const void* data, uint32_t length) {
+    const uint8_t* buffer = (const uint8_t*)data;
+    while (length > 0) {
+        // hidraw wants the report id first, 0 as the interface has none
+        uint8_t report[1 + RAW_HID_REPORT_LENGTH] = {};
+        uint32_t count = (length < (uint32_t)RAW_HID_PAYLOAD_LENGTH) ? length : RAW_HID_PAYLOAD_LENGTH;
+        report[1] = (uint8_t)count;
+        memcpy(&report[2], buffer, count);
+
+        ssize_t written = write(fd, report, sizeof(report));
+        if (written < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return false;
+        }
+        buffer += count;
+        length -= count;
+    }
+
+    return true;
+}
+
+int RawHidPort::Read(void* data, uint32_t length, int timeoutMs) {
+    if (pending.empty()) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, timeoutMs);
+        if (ready < 0)
+            return (errno == EINTR) ? 0 : -1;
+        if (ready == 0)
+            return 0;
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+            return -1;
+
+        uint8_t report[RAW_HID_REPORT_LENGTH];
+        ssize_t count = read(fd, report, sizeof(report));
+        if (count < 0)
+            return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+        if (count < 1 || report[0] > count - 1)
+            return 0;
+
+        pending.assign(report + 1, report + 1 + report[0]);
+    }
+
+    uint32_t count = (length < pending.size()) ? length : (uint32_t)pending.size();
+    memcpy(data, pending.data(), count);
+    pending.erase(pending.begin(), pending.begin() + count);
+    return (int)count;
+}
@@ -0,0 +1,38 @@
+#ifndef RAW_HID_PORT_H
+#define RAW_HID_PORT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "port.h"
+
+// Linux hidraw access to the raw HID interface, e.g. /dev/hidraw3.
+// The byte stream is cut into reports of a count byte and up to
+// RAW_HID_PAYLOAD_LENGTH bytes, see RawHidTransport on the device.
+class RawHidPort : public Port {
+public:
+    RawHidPort();
+    ~RawHidPort();
+
+    RawHidPort(const RawHidPort&) = delete;
+    RawHidPort& operator=(const RawHidPort&) = delete;
+
+    bool Open(const std::string& path) override;
+    // Takes an open descriptor that keeps report boundaries like hidraw,
+    // e.g. the SOCK_SEQPACKET socket of the fake device
+    bool Attach(int reportFd);
+    void Close() override;
+    inline bool IsOpen() const override { return fd >= 0; }
+
+    bool Write(const void* data, uint32_t length) override;
+    int Read(void* data, uint32_t length, int timeoutMs) override;
+
+    static bool IsRawHidPath(const std::string& path);
+
+private:
+    int fd;
+    // Payload of the last report the caller had no room for
+    std::vector<uint8_t> pending;
+};
+
+#endif // RAW_HID_PORT_H
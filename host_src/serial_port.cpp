@@ -0,0 +1,74 @@
+#include "serial_port.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+SerialPort::SerialPort() : fd(-1) {
+}
+
+SerialPort::~SerialPort() {
+    Close();
+}
+
+bool SerialPort::Open(const std::string& path) {
+    Close();
+
+    fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    // Raw mode, the protocol is binary
+    termios tty;
+    if (tcgetattr(fd, &tty) == 0) {
+        cfmakeraw(&tty);
+        tty.c_cflag |= (CLOCAL | CREAD);
+        tty.c_cc[VMIN] = 0;
+        tty.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tty);
+    }
+    tcflush(fd, TCIOFLUSH);
+
+    return true;
+}
+
+void SerialPort::Close() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+bool SerialPort::Write(const void* data, uint32_t length) {
+    const uint8_t* buffer = (const uint8_t*)data;
+    while (length > 0) {
+        ssize_t count = write(fd, buffer, length);
+        if (count < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return false;
+        }
+        buffer += count;
+        length -= count;
+    }
+
+    return true;
+}
+
+int SerialPort::Read(void* data, uint32_t length, int timeoutMs) {
+    pollfd pfd = { fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeoutMs);
+    if (ready < 0)
+        return (errno == EINTR) ? 0 : -1;
+    if (ready == 0)
+        return 0;
+    if (pfd.revents & (POLLERR | POLLNVAL))
+        return -1;
+
+    ssize_t count = read(fd, data, length);
+    if (count < 0)
+        return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+
+    return (int)count;
+}
@@ -0,0 +1,28 @@
+#ifndef SERIAL_PORT_H
+#define SERIAL_PORT_H
+
+#include <stdint.h>
+#include <string>
+#include "port.h"
+
+// Raw (no line discipline) access to a tty, e.g. /dev/ttyACM0 or a pty
+class SerialPort : public Port {
+public:
+    SerialPort();
+    ~SerialPort();
+
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+
+    bool Open(const std::string& path) override;
+    void Close() override;
+    inline bool IsOpen() const override { return fd >= 0; }
+
+    bool Write(const void* data, uint32_t length) override;
+    int Read(void* data, uint32_t length, int timeoutMs) override;
+
+private:
+    int fd;
+};
+
+#endif // SERIAL_PORT_H
@@ -0,0 +1,116 @@
+// MacroPadClient against the fake device, through a pty like the CDC tty
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "fake_device.h"
+#include "macropad_client.h"
+#include "test_check.h"
+
+static MacroPadClient client;
+
+static void TestSimpleRequest() {
+    FakeDevice& device = FakeDevice::Instance();
+    device.FillFlash(3);
+
+    std::vector<uint8_t> page;
+    CHECK(client.GetFlashPage(2, 5, page));
+    CHECK(page == device.ReadFlash(2, 5 * FakeDevice::PAGE_SIZE, FakeDevice::PAGE_SIZE));
+}
+
+static void TestFailedStatus() {
+    std::vector<uint8_t> page;
+    CHECK(!client.GetFlashPage(FakeDevice::NUM_SECTORS, 0, page));
+    CHECK(client.GetLastError().find("status") != std::string::npos);
+}
+
+static void TestPipelinedDump() {
+    FakeDevice& device = FakeDevice::Instance();
+    device.FillFlash(7);
+
+    // More pages than the in-flight limit, answers are matched back in order
+    client.SetMaxInFlight(4);
+    std::vector<uint8_t> data;
+    CHECK(client.DumpFlash(1, 2, data));
+    CHECK(data == device.ReadFlash(1, 0, 2 * FakeDevice::SECTOR_SIZE));
+    client.SetMaxInFlight(MacroPadClient::DEFAULT_MAX_IN_FLIGHT);
+}
+
+static void TestWindowUpload() {
+    FakeDevice& device = FakeDevice::Instance();
+
+    // 3 packets, the second one fails its CRC and is sent again
+    KeyUpload key;
+    key.KeyColumn = 2;
+    key.KeyRow = 0;
+    key.KeyCode = 0x04;
+    for (int i = 0; i < 80; i++)
+        key.Macro.push_back({ (uint16_t)(0x04 + i % 26), 0, (uint8_t)(i % 2), (uint32_t)i });
+    uint32_t length = key.Macro.size() * sizeof(MacroKey);
+
+    uint32_t numCorrupted = device.GetNumCorrupted();
+    device.CorruptPacketOnce(2);
+    CHECK(client.UploadKeymap({ key }));
+    CHECK(device.GetNumCorrupted() == numCorrupted + 1);
+
+    std::vector<uint8_t> stored = device.ReadFlash(key.KeyColumn, FakeDevice::PAGE_SIZE, length);
+    CHECK(memcmp(stored.data(), key.Macro.data(), length) == 0);
+}
+
+static void TestWindowWithoutKey() {
+    // A window before any key info has nowhere to write its packets
+    Answer answer;
+    ProgrammingWindowInfo windowInfo = { 4, 2 };
+    PendingRequest start = client.Request(MESSAGE_ID_PROGRAMMING_START, nullptr, 0);
+    CHECK(client.WaitAnswer(start, answer));
+    PendingRequest window = client.Request(MESSAGE_ID_PROGRAMMING_WINDOW_START, &windowInfo,
+            sizeof(windowInfo));
+    CHECK(client.WaitAnswer(window, answer));
+    CHECK(answer.Header.Seq == window.Seq);
+    CHECK(answer.Header.Status == PROG_STATUS_NO_KEY);
+}
+
+static void TestInFlightLimit() {
+    FakeDevice& device = FakeDevice::Instance();
+    device.SetSilent(true);
+    client.SetMaxInFlight(1);
+    uint32_t bytesReceived = device.GetBytesReceived();
+
+    // The second request finds no free slot, it fails without being sent
+    FlashPageRequest pageRequest = { 0, 0 };
+    PendingRequest first = client.Request(MESSAGE_ID_GET_FLASH_PAGE, &pageRequest, sizeof(pageRequest));
+    PendingRequest second = client.Request(MESSAGE_ID_GET_FLASH_PAGE, &pageRequest, sizeof(pageRequest));
+    CHECK(first.Future.valid());
+    CHECK(!second.Future.valid());
+    CHECK(client.GetLastError().find("free slot") != std::string::npos);
+
+    Answer answer;
+    CHECK(!client.WaitAnswer(second, answer));
+    CHECK(!client.WaitAnswer(first, answer, 100));
+    CHECK(device.GetBytesReceived() - bytesReceived == sizeof(MessageHeader) + sizeof(pageRequest));
+
+    device.SetSilent(false);
+    client.SetMaxInFlight(MacroPadClient::DEFAULT_MAX_IN_FLIGHT);
+
+    // A timed out request gives its slot back
+    std::vector<uint8_t> page;
+    CHECK(client.GetFlashPage(0, 0, page));
+}
+
+int main() {
+    FakeDevice& device = FakeDevice::Instance();
+    if (!device.Start() || !client.Open(device.GetPath())) {
+        fprintf(stderr, "Could not open the fake device\n");
+        return 1;
+    }
+
+    RUN_TEST(TestSimpleRequest);
+    RUN_TEST(TestFailedStatus);
+    RUN_TEST(TestPipelinedDump);
+    RUN_TEST(TestWindowUpload);
+    RUN_TEST(TestWindowWithoutKey);
+    RUN_TEST(TestInFlightLimit);
+
+    client.Close();
+    device.Stop();
+    return TestResult();
+}
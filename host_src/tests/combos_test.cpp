@@ -0,0 +1,160 @@
+// Combo matching on scripted key events and times
+#include <vector>
+#include "combos.h"
+#include "test_check.h"
+
+static const uint32_t WINDOW_US = 50000;
+static const int NUM_KEYS = 9;
+
+static const uint16_t ACTION_01 = MakeKeyAction(KEY_ACTION_KEY, 0, 0x29);
+static const uint16_t ACTION_012 = MakeKeyAction(KEY_ACTION_KEY, 0, 0x2A);
+static const uint16_t ACTION_34 = MakeKeyAction(KEY_ACTION_KEY, 0, 0x2B);
+static const Combo comboTable[] = {
+    { 0x003, ACTION_01 },
+    { 0x018, ACTION_34 },
+    { 0x007, ACTION_012 },
+};
+
+// Key events passed on are recorded with Action 0, combo actions with KeyIndex -1
+struct Passed {
+    int KeyIndex;
+    uint16_t Action;
+    bool IsPressed;
+    uint64_t Time;
+
+    bool operator==(const Passed& other) const {
+        return KeyIndex == other.KeyIndex && Action == other.Action &&
+            IsPressed == other.IsPressed && Time == other.Time;
+    }
+};
+
+static std::vector<Passed> passed;
+
+static void OnKey(int keyIndex, bool isPressed, uint64_t time) {
+    passed.push_back({ keyIndex, KEY_ACTION_NONE, isPressed, time });
+}
+
+static void OnAction(uint16_t action, bool isPressed) {
+    passed.push_back({ -1, action, isPressed, 0 });
+}
+
+static void Setup(Combos& combos) {
+    passed.clear();
+    combos.Configure(WINDOW_US);
+    combos.SetCallbacks(OnKey, OnAction);
+    CHECK(combos.SetCombos(comboTable, sizeof(comboTable) / sizeof(comboTable[0]), NUM_KEYS));
+}
+
+static void TestRejectedCombos() {
+    Combos combos;
+    Setup(combos);
+    Combo single = { 0x004, ACTION_01 };
+    CHECK(!combos.SetCombos(&single, 1, NUM_KEYS));
+    Combo outside = { 0x201, ACTION_01 };
+    CHECK(!combos.SetCombos(&outside, 1, NUM_KEYS));
+}
+
+static void TestFiresAtOnce() {
+    Combos combos;
+    Setup(combos);
+
+    // No larger combo contains 3 and 4, the window is not waited for
+    combos.OnKeyEvent(3, true, 0);
+    CHECK(combos.IsPending());
+    combos.OnKeyEvent(4, true, 10000);
+    CHECK(!combos.IsPending());
+    CHECK((passed == std::vector<Passed>{ { -1, ACTION_34, true, 0 } }));
+
+    // The first key up releases the action, the other one is swallowed
+    combos.OnKeyEvent(4, false, 100000);
+    combos.OnKeyEvent(3, false, 110000);
+    CHECK((passed == std::vector<Passed>{ { -1, ACTION_34, true, 0 }, { -1, ACTION_34, false, 0 } }));
+}
+
+static void TestPrefixWaitsForWindow() {
+    Combos combos;
+    Setup(combos);
+
+    // 0 and 1 may still become 0, 1 and 2
+    combos.OnKeyEvent(0, true, 0);
+    combos.OnKeyEvent(1, true, 10000);
+    combos.Update(WINDOW_US - 1);
+    CHECK(passed.empty());
+    combos.Update(WINDOW_US);
+    CHECK((passed == std::vector<Passed>{ { -1, ACTION_01, true, 0 } }));
+    combos.OnKeyEvent(0, false, 60000);
+    combos.OnKeyEvent(1, false, 70000);
+
+    // The third key inside the window fires the larger combo
+    passed.clear();
+    combos.OnKeyEvent(1, true, 100000);
+    combos.OnKeyEvent(0, true, 110000);
+    combos.OnKeyEvent(2, true, 120000);
+    CHECK((passed == std::vector<Passed>{ { -1, ACTION_012, true, 0 } }));
+}
+
+static void TestUnmatchedKeysPassOn() {
+    Combos combos;
+    Setup(combos);
+
+    // The window expires on a lone candidate, it goes on with its own time
+    combos.OnKeyEvent(0, true, 1000);
+    combos.Update(1000 + WINDOW_US);
+    CHECK((passed == std::vector<Passed>{ { 0, KEY_ACTION_NONE, true, 1000 } }));
+    combos.OnKeyEvent(0, false, 80000);
+
+    // A key outside every combo flushes the candidates first, in order
+    passed.clear();
+    combos.OnKeyEvent(3, true, 100000);
+    combos.OnKeyEvent(5, true, 110000);
+    CHECK((passed == std::vector<Passed>{ { 3, KEY_ACTION_NONE, true, 100000 },
+            { 5, KEY_ACTION_NONE, true, 110000 } }));
+
+    // A released candidate ends the window
+    passed.clear();
+    combos.OnKeyEvent(1, true, 200000);
+    combos.OnKeyEvent(1, false, 210000);
+    CHECK((passed == std::vector<Passed>{ { 1, KEY_ACTION_NONE, true, 200000 },
+            { 1, KEY_ACTION_NONE, false, 210000 } }));
+
+    // A press that can not extend the candidates starts a new window
+    passed.clear();
+    combos.OnKeyEvent(0, true, 300000);
+    combos.OnKeyEvent(3, true, 310000);
+    CHECK((passed == std::vector<Passed>{ { 0, KEY_ACTION_NONE, true, 300000 } }));
+    CHECK(combos.IsPending());
+}
+
+static void TestTableSwapPassesCandidates() {
+    Combos combos;
+    Setup(combos);
+
+    // 0 is held back for the old table, it goes on before the swap
+    combos.OnKeyEvent(0, true, 1000);
+    CHECK(combos.IsPending());
+    Combo other = { 0x030, ACTION_34 };
+    CHECK(combos.SetCombos(&other, 1, NUM_KEYS));
+    CHECK(!combos.IsPending());
+    CHECK((passed == std::vector<Passed>{ { 0, KEY_ACTION_NONE, true, 1000 } }));
+
+    // Its release follows the press, and nothing fires on the old keys
+    combos.OnKeyEvent(1, true, 2000);
+    combos.OnKeyEvent(0, false, 3000);
+    combos.OnKeyEvent(1, false, 4000);
+    combos.Update(100000);
+    CHECK((passed == std::vector<Passed>{
+        { 0, KEY_ACTION_NONE, true, 1000 },
+        { 1, KEY_ACTION_NONE, true, 2000 },
+        { 0, KEY_ACTION_NONE, false, 3000 },
+        { 1, KEY_ACTION_NONE, false, 4000 },
+    }));
+}
+
+int main() {
+    RUN_TEST(TestRejectedCombos);
+    RUN_TEST(TestFiresAtOnce);
+    RUN_TEST(TestPrefixWaitsForWindow);
+    RUN_TEST(TestUnmatchedKeysPassOn);
+    RUN_TEST(TestTableSwapPassesCandidates);
+    return TestResult();
+}
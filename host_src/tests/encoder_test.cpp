@@ -0,0 +1,130 @@
+// Quadrature decoding, detents and acceleration of Encoder
+#include "encoder.h"
+#include "test_check.h"
+
+// Pin states A << 1 | B in clockwise order
+static const uint8_t CW_SEQUENCE[4] = { 0x0, 0x2, 0x3, 0x1 };
+
+static int CwPosition(uint8_t pins) {
+    for (int i = 0; i < 4; i++) {
+        if (CW_SEQUENCE[i] == pins)
+            return i;
+    }
+    return -1;
+}
+
+// Feeds quarter steps from the current position, negative counter-clockwise
+static void Turn(Encoder& encoder, uint8_t& pins, int quarterSteps) {
+    int direction = (quarterSteps > 0) ? 1 : 3;
+    for (int i = 0; i < quarterSteps * (quarterSteps > 0 ? 1 : -1); i++) {
+        pins = CW_SEQUENCE[(CwPosition(pins) + direction) % 4];
+        encoder.OnPins(pins);
+    }
+}
+
+static void TestDecodeTable() {
+    // One position on is a step, two is a missed state, none is no move
+    for (uint8_t previous = 0; previous < 4; previous++) {
+        for (uint8_t current = 0; current < 4; current++) {
+            int distance = (CwPosition(current) - CwPosition(previous) + 4) % 4;
+            int8_t expected = (distance == 1) ? 1 : (distance == 3) ? -1 : 0;
+            CHECK(Encoder::Decode(previous, current) == expected);
+        }
+    }
+}
+
+static void TestMissedState() {
+    Encoder encoder;
+    encoder.Configure(4, 1);
+    uint8_t pins = 0x0;
+    encoder.Reset(pins);
+
+    // Both pins changed at once, the direction is unknown so nothing counts
+    encoder.OnPins(0x3);
+    CHECK(!encoder.HasPendingSteps());
+
+    // Decoding goes on from the state it landed in
+    pins = 0x3;
+    Turn(encoder, pins, 4);
+    CHECK(encoder.TakeDetents(0) == 1);
+}
+
+static void TestPartialDetents() {
+    Encoder encoder;
+    encoder.Configure(4, 1);
+    uint8_t pins = 0x0;
+    encoder.Reset(pins);
+
+    // Steps short of a detent stay pending
+    Turn(encoder, pins, 3);
+    CHECK(encoder.TakeDetents(0) == 0);
+    CHECK(encoder.HasPendingSteps());
+    Turn(encoder, pins, 6);
+    CHECK(encoder.TakeDetents(1000000) == 2);
+    CHECK(encoder.HasPendingSteps());
+
+    // The pending step counts against a turn back, in either direction
+    Turn(encoder, pins, -4);
+    CHECK(encoder.TakeDetents(2000000) == 0);
+    Turn(encoder, pins, -2);
+    CHECK(encoder.TakeDetents(3000000) == -1);
+    CHECK(encoder.HasPendingSteps());
+    Turn(encoder, pins, 1);
+    CHECK(!encoder.HasPendingSteps());
+
+    // Reset drops what is pending
+    Turn(encoder, pins, 3);
+    encoder.Reset(pins);
+    CHECK(!encoder.HasPendingSteps());
+}
+
+static void TestAcceleration() {
+    const uint32_t WINDOW = Encoder::ACCELERATION_WINDOW_US;
+    Encoder encoder;
+    encoder.Configure(4, 4);
+    uint8_t pins = 0x0;
+    encoder.Reset(pins);
+
+    // The first detent has no previous one to be close to
+    uint64_t now = 1000000;
+    Turn(encoder, pins, 4);
+    CHECK(encoder.TakeDetents(now) == 1);
+
+    // Multiplied by the window over the interval, up to the maximum
+    now += WINDOW / 2;
+    Turn(encoder, pins, 4);
+    CHECK(encoder.TakeDetents(now) == 2);
+    now += WINDOW / 10;
+    Turn(encoder, pins, 4);
+    CHECK(encoder.TakeDetents(now) == 4);
+
+    // Several detents in one call share the time since the last one
+    now += 2 * (WINDOW / 3);
+    Turn(encoder, pins, 8);
+    CHECK(encoder.TakeDetents(now) == 2 * 3);
+
+    // Outside the window, or after a change of direction, it is 1 again
+    now += WINDOW;
+    Turn(encoder, pins, 4);
+    CHECK(encoder.TakeDetents(now) == 1);
+    now += WINDOW / 10;
+    Turn(encoder, pins, -4);
+    CHECK(encoder.TakeDetents(now) == -1);
+    now += WINDOW / 10;
+    Turn(encoder, pins, -4);
+    CHECK(encoder.TakeDetents(now) == -4);
+
+    // No acceleration configured
+    encoder.Configure(4, 1);
+    now += WINDOW / 10;
+    Turn(encoder, pins, -4);
+    CHECK(encoder.TakeDetents(now) == -1);
+}
+
+int main() {
+    RUN_TEST(TestDecodeTable);
+    RUN_TEST(TestMissedState);
+    RUN_TEST(TestPartialDetents);
+    RUN_TEST(TestAcceleration);
+    return TestResult();
+}
@@ -0,0 +1,266 @@
+#include "fake_device.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include "programming_service.h"
+#include "serial_dispatcher.h"
+
+static uint64_t NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FakeDevice::FakeDevice() : flash(NUM_SECTORS * SECTOR_SIZE, 0xFF) {
+    masterFd = -1;
+    slaveFd = -1;
+    isRunning = false;
+    isSilent = false;
+    corruptSeq = 0;
+    bytesReceived = 0;
+    numCorrupted = 0;
+    numHeaderBytes = 0;
+    payloadRemaining = 0;
+    isCorruptingPayload = false;
+    keySector = 0;
+    lastFrameTime = 0;
+    cdcOutBudget = 0;
+}
+
+FakeDevice::~FakeDevice() {
+    Stop();
+}
+
+bool FakeDevice::Start() {
+    if (isRunning)
+        return true;
+
+    masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (masterFd < 0 || grantpt(masterFd) != 0 || unlockpt(masterFd) != 0)
+        return false;
+    path = ptsname(masterFd);
+
+    // Keeping the slave open spares the master a hang up between clients
+    slaveFd = open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (slaveFd < 0)
+        return false;
+    termios tty;
+    if (tcgetattr(slaveFd, &tty) == 0) {
+        cfmakeraw(&tty);
+        tcsetattr(slaveFd, TCSANOW, &tty);
+    }
+
+    if (!rawHid.Open())
+        return false;
+
+    SerialDispatcher::Instance().AddTransport(this);
+    SerialDispatcher::Instance().AddTransport(&rawHid);
+    ProgrammingService::Instance().Initialize(this);
+
+    isRunning = true;
+    thread = std::thread(&FakeDevice::Loop, this);
+    return true;
+}
+
+void FakeDevice::Stop() {
+    isRunning = false;
+    if (thread.joinable())
+        thread.join();
+    if (slaveFd >= 0)
+        close(slaveFd);
+    if (masterFd >= 0)
+        close(masterFd);
+    slaveFd = -1;
+    masterFd = -1;
+    rawHid.Close();
+}
+
+void FakeDevice::Loop() {
+    SerialDispatcher& dispatcher = SerialDispatcher::Instance();
+    while (isRunning) {
+        pollfd pfd = { masterFd, POLLIN, 0 };
+        poll(&pfd, 1, 1);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t now = NowUs();
+        OnFrame(now);
+        if (isSilent) {
+            uint8_t buffer[256];
+            while (Available() > 0)
+                Read(buffer, sizeof(buffer));
+            continue;
+        }
+
+        rawHid.OnFrame(now);
+        while (dispatcher.ListenForMessage(now)) {
+        }
+        dispatcher.CheckReceiveTimeout(now);
+        dispatcher.ProcessSendQueue();
+    }
+}
+
+void FakeDevice::OnFrame(uint64_t now) {
+    if (now - lastFrameTime < FakeRawHid::FRAME_US)
+        return;
+    lastFrameTime = now;
+    cdcOutBudget = CDC_BYTES_PER_FRAME;
+
+    uint32_t length = std::min<uint32_t>(cdcTx.size(), CDC_BYTES_PER_FRAME);
+    uint32_t written = 0;
+    while (written < length) {
+        ssize_t count = write(masterFd, cdcTx.data() + written, length - written);
+        if (count < 0)
+            break;
+        written += count;
+    }
+    cdcTx.erase(cdcTx.begin(), cdcTx.begin() + written);
+}
+
+void FakeDevice::SetSilent(bool isSilent) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->isSilent = isSilent;
+}
+
+void FakeDevice::CorruptPacketOnce(uint16_t seq) {
+    std::lock_guard<std::mutex> lock(mutex);
+    corruptSeq = seq;
+}
+
+uint32_t FakeDevice::GetBytesReceived() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytesReceived;
+}
+
+uint32_t FakeDevice::GetNumCorrupted() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return numCorrupted;
+}
+
+std::vector<uint8_t> FakeDevice::ReadFlash(uint32_t sector, uint32_t offset, uint32_t length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto begin = flash.begin() + sector * SECTOR_SIZE + offset;
+    return std::vector<uint8_t>(begin, begin + length);
+}
+
+void FakeDevice::FillFlash(uint8_t seed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t i = 0; i < flash.size(); i++)
+        flash[i] = (uint8_t)(seed + i * 7 + i / PAGE_SIZE);
+}
+
+//--------------------------------------------------------------------+
+// Transport
+//--------------------------------------------------------------------+
+bool FakeDevice::IsConnected() {
+    return masterFd >= 0;
+}
+
+uint32_t FakeDevice::Available() {
+    int count = 0;
+    if (ioctl(masterFd, FIONREAD, &count) != 0)
+        return 0;
+    return std::min<uint32_t>(count, cdcOutBudget);
+}
+
+uint32_t FakeDevice::Read(void* data, uint32_t length) {
+    ssize_t count = read(masterFd, data, std::min(length, cdcOutBudget));
+    if (count <= 0)
+        return 0;
+    cdcOutBudget -= count;
+
+    uint8_t* bytes = (uint8_t*)data;
+    for (ssize_t i = 0; i < count; i++)
+        Track(bytes[i]);
+    bytesReceived += count;
+    return (uint32_t)count;
+}
+
+void FakeDevice::Track(uint8_t& byte) {
+    // Follows the frames on the wire, the header of the packet to corrupt
+    // has gone by when its payload comes, so a payload byte is flipped
+    if (payloadRemaining > 0) {
+        if (isCorruptingPayload) {
+            byte ^= 0xFF;
+            isCorruptingPayload = false;
+            numCorrupted++;
+        }
+        payloadRemaining--;
+        return;
+    }
+
+    if (numHeaderBytes == 0 && byte != MESSAGE_START_MARK)
+        return;
+    headerBytes[numHeaderBytes++] = byte;
+    if (numHeaderBytes < sizeof(MessageHeader))
+        return;
+
+    MessageHeader header;
+    memcpy(&header, headerBytes, sizeof(header));
+    numHeaderBytes = 0;
+    payloadRemaining = header.Len;
+    if (header.Id == MESSAGE_ID_PROGRAMMING_WINDOW_PACKET && header.Seq == corruptSeq && header.Len > 0) {
+        isCorruptingPayload = true;
+        corruptSeq = 0;
+    }
+}
+
+uint32_t FakeDevice::WriteAvailable() {
+    return CDC_FIFO_LENGTH - (uint32_t)cdcTx.size();
+}
+
+uint32_t FakeDevice::Write(const void* data, uint32_t length) {
+    uint32_t count = std::min(length, WriteAvailable());
+    const uint8_t* bytes = (const uint8_t*)data;
+    cdcTx.insert(cdcTx.end(), bytes, bytes + count);
+    return count;
+}
+
+void FakeDevice::Flush() {
+}
+
+//--------------------------------------------------------------------+
+// Programming target, called from Loop() with the mutex held
+//--------------------------------------------------------------------+
+void FakeDevice::ProgrammingStarted() {
+}
+
+void FakeDevice::ProgrammingEnded() {
+}
+
+eProgrammingStatus FakeDevice::GetReadyForProgrammingKey(const ProgrammingKeyInfo& info) {
+    if (info.KeyColumn >= NUM_SECTORS)
+        return PROG_STATUS_INVALID_KEY_COLUMN;
+
+    // Every column has a sector of its own, page 0 holds the key info
+    keySector = info.KeyColumn;
+    std::fill_n(flash.begin() + keySector * SECTOR_SIZE, SECTOR_SIZE, 0xFF);
+    memcpy(&flash[keySector * SECTOR_SIZE], &info, sizeof(info));
+    return PROG_STATUS_OK;
+}
+
+eProgrammingStatus FakeDevice::ProgramKeyPacket(const uint8_t* data, uint16_t length, uint16_t seq) {
+    if (seq == 0 || seq > GetMaxPacketsPerKey())
+        return PROG_STATUS_INVALID_PACKET_SEQ;
+    if (length > PAGE_SIZE)
+        return PROG_STATUS_INVALID_MACRO_LENGTH;
+
+    memcpy(&flash[keySector * SECTOR_SIZE + seq * PAGE_SIZE], data, length);
+    return PROG_STATUS_OK;
+}
+
+uint16_t FakeDevice::GetMaxPacketsPerKey() const {
+    return SECTOR_SIZE / PAGE_SIZE - 1;
+}
+
+const FlashPage* FakeDevice::GetFlashPage(uint32_t sectorNum, uint32_t pageNum) {
+    if (sectorNum >= NUM_SECTORS || pageNum >= SECTOR_SIZE / PAGE_SIZE)
+        return nullptr;
+
+    // Like flash, the answer points at the page itself
+    return (const FlashPage*)&flash[sectorNum * SECTOR_SIZE + pageNum * PAGE_SIZE];
+}
@@ -0,0 +1,110 @@
+#ifndef FAKE_DEVICE_H
+#define FAKE_DEVICE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "message_transport.h"
+#include "message_codec.h"
+#include "fake_raw_hid.h"
+#include "programming_target.h"
+
+// The firmware side of the protocol, run on the host. The firmware
+// SerialDispatcher reads frames from the master side of a pty pair, and
+// the client opens the slave path as it would open the CDC tty. The raw
+// HID interface is a FakeRawHid next to it, and answers go back the way
+// the request came like on the device. The firmware ProgrammingService
+// handles the messages, with the keys and flash kept in RAM. The
+// dispatcher is a singleton, so the device is one too.
+// Both interfaces move data on millisecond frames like full speed USB: the
+// CDC side up to CDC_BYTES_PER_FRAME each way, the raw HID side a report.
+class FakeDevice : public MessageTransport, public ProgrammingTarget {
+public:
+    static constexpr uint32_t NUM_SECTORS = 4;
+    static constexpr uint32_t SECTOR_SIZE = 4096;
+    static constexpr uint32_t PAGE_SIZE = 256;
+    // 19 bulk packets of 64 bytes, what a full speed frame carries
+    static constexpr uint32_t CDC_BYTES_PER_FRAME = 19 * 64;
+    static constexpr uint32_t CDC_FIFO_LENGTH = 4096;
+
+public:
+    static FakeDevice& Instance() {
+        static FakeDevice instance;
+        return instance;
+    }
+
+    bool Start();
+    void Stop();
+    // Slave side of the pty, for MacroPadClient::Open()
+    inline const std::string& GetPath() const { return path; }
+    // Client side of the raw HID socket, for RawHidPort::Attach()
+    inline int TakeRawHidClientFd() { return rawHid.TakeClientFd(); }
+
+    // Requests are read but not handled, so none is answered
+    void SetSilent(bool isSilent);
+    // The payload of the next window packet of this Seq is corrupted on
+    // the way in, so it fails its CRC once
+    void CorruptPacketOnce(uint16_t seq);
+
+    uint32_t GetBytesReceived();
+    uint32_t GetNumCorrupted();
+    // Key column C is programmed into sector C, packet N into its page N
+    std::vector<uint8_t> ReadFlash(uint32_t sector, uint32_t offset, uint32_t length);
+    void FillFlash(uint8_t seed);
+
+    // MessageTransport over the pty master
+    bool IsConnected() override;
+    uint32_t Available() override;
+    uint32_t Read(void* data, uint32_t length) override;
+    uint32_t WriteAvailable() override;
+    uint32_t Write(const void* data, uint32_t length) override;
+    void Flush() override;
+
+    // ProgrammingTarget over the RAM flash
+    void ProgrammingStarted() override;
+    void ProgrammingEnded() override;
+    eProgrammingStatus GetReadyForProgrammingKey(const ProgrammingKeyInfo& info) override;
+    eProgrammingStatus ProgramKeyPacket(const uint8_t* data, uint16_t length, uint16_t seq) override;
+    uint16_t GetMaxPacketsPerKey() const override;
+    const FlashPage* GetFlashPage(uint32_t sectorNum, uint32_t pageNum) override;
+
+private:
+    FakeDevice();
+    ~FakeDevice();
+
+    void Loop();
+    void OnFrame(uint64_t now);
+    void Track(uint8_t& byte);
+
+private:
+    int masterFd;
+    int slaveFd;
+    std::string path;
+    std::thread thread;
+    std::atomic<bool> isRunning;
+    // Held by the device thread while it handles messages
+    std::mutex mutex;
+    FakeRawHid rawHid;
+
+    bool isSilent;
+    uint16_t corruptSeq;
+    uint32_t bytesReceived;
+    uint32_t numCorrupted;
+    uint8_t headerBytes[sizeof(MessageHeader)];
+    uint32_t numHeaderBytes;
+    uint32_t payloadRemaining;
+    bool isCorruptingPayload;
+
+    // CDC data waiting for the next frames
+    uint64_t lastFrameTime;
+    uint32_t cdcOutBudget;
+    std::vector<uint8_t> cdcTx;
+
+    std::vector<uint8_t> flash;
+    uint32_t keySector;
+};
+
+#endif // FAKE_DEVICE_H
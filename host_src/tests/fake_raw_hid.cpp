@@ -0,0 +1,100 @@
+#include "fake_raw_hid.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include "message.h"
+
+FakeRawHid::FakeRawHid() {
+    deviceFd = -1;
+    clientFd = -1;
+    lastFrameTime = 0;
+    droppedReports = 0;
+}
+
+FakeRawHid::~FakeRawHid() {
+    Close();
+}
+
+bool FakeRawHid::Open() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+        return false;
+
+    deviceFd = fds[0];
+    clientFd = fds[1];
+    return true;
+}
+
+void FakeRawHid::Close() {
+    if (deviceFd >= 0)
+        close(deviceFd);
+    if (clientFd >= 0)
+        close(clientFd);
+    deviceFd = -1;
+    clientFd = -1;
+    rxFifo.clear();
+    txFifo.clear();
+}
+
+int FakeRawHid::TakeClientFd() {
+    int fd = clientFd;
+    clientFd = -1;
+    return fd;
+}
+
+void FakeRawHid::OnFrame(uint64_t now) {
+    if (deviceFd < 0 || now - lastFrameTime < FRAME_US)
+        return;
+    lastFrameTime = now;
+
+    // hidraw puts the report id first, 0 as the interface has none
+    uint8_t out[1 + RAW_HID_REPORT_LENGTH];
+    ssize_t length = recv(deviceFd, out, sizeof(out), MSG_DONTWAIT);
+    if (length == (ssize_t)sizeof(out) && out[1] <= RAW_HID_PAYLOAD_LENGTH) {
+        // A partly stored report would splice two frames, drop all of it
+        if (out[1] > FIFO_LENGTH - rxFifo.size())
+            droppedReports++;
+        else
+            rxFifo.insert(rxFifo.end(), out + 2, out + 2 + out[1]);
+    }
+
+    if (txFifo.empty())
+        return;
+
+    // Reports always have the full length, the count byte tells what is used
+    uint8_t in[RAW_HID_REPORT_LENGTH] = {};
+    uint32_t count = std::min<uint32_t>(txFifo.size(), RAW_HID_PAYLOAD_LENGTH);
+    in[0] = (uint8_t)count;
+    std::copy(txFifo.begin(), txFifo.begin() + count, in + 1);
+    if (send(deviceFd, in, sizeof(in), MSG_DONTWAIT) == (ssize_t)sizeof(in))
+        txFifo.erase(txFifo.begin(), txFifo.begin() + count);
+}
+
+bool FakeRawHid::IsConnected() {
+    return deviceFd >= 0;
+}
+
+uint32_t FakeRawHid::Available() {
+    return (uint32_t)rxFifo.size();
+}
+
+uint32_t FakeRawHid::Read(void* data, uint32_t length) {
+    uint32_t count = std::min<uint32_t>(length, rxFifo.size());
+    std::copy(rxFifo.begin(), rxFifo.begin() + count, (uint8_t*)data);
+    rxFifo.erase(rxFifo.begin(), rxFifo.begin() + count);
+    return count;
+}
+
+uint32_t FakeRawHid::WriteAvailable() {
+    return FIFO_LENGTH - (uint32_t)txFifo.size();
+}
+
+uint32_t FakeRawHid::Write(const void* data, uint32_t length) {
+    uint32_t count = std::min(length, WriteAvailable());
+    const uint8_t* bytes = (const uint8_t*)data;
+    txFifo.insert(txFifo.end(), bytes, bytes + count);
+    return count;
+}
+
+void FakeRawHid::Flush() {
+}
@@ -0,0 +1,49 @@
+#ifndef FAKE_RAW_HID_H
+#define FAKE_RAW_HID_H
+
+#include <stdint.h>
+#include <deque>
+#include "message_transport.h"
+
+// Raw HID interface of the fake device, cut into reports like
+// RawHidTransport: a count byte then up to RAW_HID_PAYLOAD_LENGTH bytes.
+// A SOCK_SEQPACKET socket pair keeps the report boundaries hidraw has,
+// the client side goes to RawHidPort::Attach(). Like interrupt endpoints
+// polled every FRAME_US, at most one OUT and one IN report move per frame.
+class FakeRawHid : public MessageTransport {
+public:
+    static constexpr uint64_t FRAME_US = 1000;
+    static constexpr uint32_t FIFO_LENGTH = 2048;
+
+public:
+    FakeRawHid();
+    ~FakeRawHid();
+
+    bool Open();
+    void Close();
+    // Handed over once, the taker closes it
+    int TakeClientFd();
+    inline int GetDeviceFd() const { return deviceFd; }
+
+    // Moves the reports of the frames since the last call
+    void OnFrame(uint64_t now);
+    inline uint32_t GetDroppedReports() const { return droppedReports; }
+
+    bool IsConnected() override;
+    uint32_t Available() override;
+    uint32_t Read(void* data, uint32_t length) override;
+    uint32_t WriteAvailable() override;
+    uint32_t Write(const void* data, uint32_t length) override;
+    // Reports only go out on frames
+    void Flush() override;
+
+private:
+    int deviceFd;
+    int clientFd;
+    uint64_t lastFrameTime;
+    std::deque<uint8_t> rxFifo;
+    std::deque<uint8_t> txFifo;
+    uint32_t droppedReports;
+};
+
+#endif // FAKE_RAW_HID_H
@@ -0,0 +1,269 @@
+// Matrix reads through the ghost filter, debounce and auto repeat, and
+// idle wake, on a scripted matrix
+#include "fake_matrix_scanner.h"
+#include "ghost_filter.h"
+#include "key_matrix.h"
+#include "test_check.h"
+
+static const int NUM_ROWS = 3;
+static const int NUM_COLS = 3;
+
+static const uint32_t DEBOUNCE_US = 5000;
+static const uint32_t REPEAT_FIRST_DELAY_US = 300000;
+static const uint32_t REPEAT_PERIOD_US = 50000;
+
+static int numWakes = 0;
+
+// Key events seen by the callbacks
+static int numPresses = 0;
+static int numReleases = 0;
+static int numRepeats = 0;
+static int lastRow = -1;
+static int lastCol = -1;
+static uint64_t lastTime = 0;
+static bool isPressAccepted = true;
+
+static void OnWake() {
+    numWakes++;
+}
+
+static MatrixState Bit(int row, int col) {
+    return MatrixScanner::KeyBit(row, col, NUM_COLS);
+}
+
+static bool OnPress(int row, int col, uint64_t time) {
+    numPresses++;
+    lastRow = row;
+    lastCol = col;
+    lastTime = time;
+    return isPressAccepted;
+}
+
+static void OnRelease(int row, int col, uint64_t time) {
+    numReleases++;
+    lastRow = row;
+    lastCol = col;
+    lastTime = time;
+}
+
+static void OnRepeat(int row, int col) {
+    numRepeats++;
+    lastRow = row;
+    lastCol = col;
+}
+
+static void ResetEvents(KeyMatrix& matrix) {
+    numPresses = 0;
+    numReleases = 0;
+    numRepeats = 0;
+    lastRow = -1;
+    lastCol = -1;
+    lastTime = 0;
+    isPressAccepted = true;
+    matrix.Configure(DEBOUNCE_US, REPEAT_FIRST_DELAY_US, REPEAT_PERIOD_US);
+    matrix.SetCallbacks(OnPress, OnRelease, OnRepeat);
+}
+
+static MatrixState ReadFiltered(FakeMatrixScanner& scanner, GhostFilter& filter) {
+    MatrixState state = 0;
+    CHECK(scanner.Read(state));
+    return filter.Filter(state);
+}
+
+static void TestPlainKeys() {
+    FakeMatrixScanner scanner(NUM_COLS);
+    GhostFilter filter(NUM_ROWS, NUM_COLS);
+
+    // A full row and a full column have no rectangle, every key is real
+    scanner.SetState(Bit(0, 0) | Bit(0, 1) | Bit(0, 2));
+    CHECK(ReadFiltered(scanner, filter) == (Bit(0, 0) | Bit(0, 1) | Bit(0, 2)));
+    scanner.SetState(Bit(0, 1) | Bit(1, 1) | Bit(2, 1));
+    CHECK(ReadFiltered(scanner, filter) == (Bit(0, 1) | Bit(1, 1) | Bit(2, 1)));
+    CHECK(scanner.GetNumReads() == 2);
+}
+
+static void TestGhostPressHeldBack() {
+    FakeMatrixScanner scanner(NUM_COLS);
+    GhostFilter filter(NUM_ROWS, NUM_COLS);
+
+    // Three corners held, the fourth reads as pressed and must not get through
+    MatrixState held = Bit(0, 0) | Bit(0, 2) | Bit(2, 0);
+    scanner.SetState(held);
+    CHECK(ReadFiltered(scanner, filter) == held);
+    scanner.SetState(held | Bit(2, 2));
+    CHECK(ReadFiltered(scanner, filter) == held);
+
+    // Once the rectangle goes away the corners are trusted again
+    scanner.SetState(Bit(0, 2) | Bit(2, 0) | Bit(2, 2));
+    CHECK(ReadFiltered(scanner, filter) == (Bit(0, 2) | Bit(2, 0) | Bit(2, 2)));
+}
+
+static void TestIdleWake() {
+    FakeMatrixScanner scanner(NUM_COLS);
+    numWakes = 0;
+
+    // Not armed, a press only shows in the next read
+    scanner.EnterIdle(false, OnWake);
+    scanner.SetKey(1, 1, true);
+    CHECK(numWakes == 0);
+    scanner.ExitIdle();
+    scanner.SetKey(1, 1, false);
+
+    // Armed, the first press wakes
+    scanner.EnterIdle(true, OnWake);
+    CHECK(scanner.IsIdle());
+    CHECK(numWakes == 0);
+    scanner.SetKey(2, 0, true);
+    CHECK(numWakes == 1);
+    scanner.ExitIdle();
+    CHECK(!scanner.IsIdle());
+
+    // A key still down when idling starts wakes at once
+    scanner.EnterIdle(true, OnWake);
+    CHECK(numWakes == 2);
+    scanner.ExitIdle();
+}
+
+static void TestDebounce() {
+    FakeMatrixScanner scanner(NUM_COLS);
+    Key keys[NUM_ROWS * NUM_COLS];
+    KeyMatrix matrix(keys, NUM_ROWS, NUM_COLS);
+    ResetEvents(matrix);
+
+    // Down but not for the debounce time yet
+    scanner.SetKey(1, 2, true);
+    CHECK(matrix.Scan(scanner, 1000));
+    CHECK(matrix.IsAnyKeyDown());
+    CHECK(!matrix.IsIdle());
+    CHECK(matrix.Scan(scanner, 1000 + DEBOUNCE_US - 1));
+    CHECK(numPresses == 0);
+
+    // A bounce starts the time over
+    scanner.SetKey(1, 2, false);
+    CHECK(matrix.Scan(scanner, 1000 + DEBOUNCE_US));
+    CHECK(matrix.IsIdle());
+    scanner.SetKey(1, 2, true);
+    CHECK(matrix.Scan(scanner, 10000));
+    CHECK(matrix.Scan(scanner, 10000 + DEBOUNCE_US - 1));
+    CHECK(numPresses == 0);
+
+    // Debounced by time, however few scans it took
+    CHECK(matrix.Scan(scanner, 10000 + DEBOUNCE_US));
+    CHECK(numPresses == 1);
+    CHECK(lastRow == 1 && lastCol == 2 && lastTime == 10000 + DEBOUNCE_US);
+    CHECK(matrix.GetKey(1, 2).IsPressed);
+
+    // Released on the first scan that reads it up
+    scanner.SetKey(1, 2, false);
+    CHECK(matrix.Scan(scanner, 20000));
+    CHECK(numReleases == 1);
+    CHECK(lastTime == 20000);
+    CHECK(!matrix.IsAnyKeyDown());
+    CHECK(matrix.IsIdle());
+}
+
+static void TestAutoRepeat() {
+    FakeMatrixScanner scanner(NUM_COLS);
+    Key keys[NUM_ROWS * NUM_COLS];
+    KeyMatrix matrix(keys, NUM_ROWS, NUM_COLS);
+    ResetEvents(matrix);
+
+    scanner.SetKey(0, 0, true);
+    matrix.Scan(scanner, 0);
+    matrix.Scan(scanner, DEBOUNCE_US);
+    CHECK(numPresses == 1);
+
+    // Nothing until the first delay, then one repeat per period
+    uint64_t pressTime = DEBOUNCE_US;
+    matrix.Scan(scanner, pressTime + REPEAT_FIRST_DELAY_US);
+    CHECK(numRepeats == 0);
+    matrix.Scan(scanner, pressTime + REPEAT_FIRST_DELAY_US + 1);
+    CHECK(numRepeats == 1);
+    CHECK(matrix.GetKey(0, 0).IsLongPressed);
+
+    uint64_t repeatTime = pressTime + REPEAT_FIRST_DELAY_US + 1;
+    matrix.Scan(scanner, repeatTime + REPEAT_PERIOD_US);
+    CHECK(numRepeats == 1);
+    matrix.Scan(scanner, repeatTime + REPEAT_PERIOD_US + 1);
+    CHECK(numRepeats == 2);
+    CHECK(numPresses == 1);
+
+    scanner.SetKey(0, 0, false);
+    matrix.Scan(scanner, repeatTime + 2 * REPEAT_PERIOD_US);
+    CHECK(numReleases == 1);
+    CHECK(!matrix.GetKey(0, 0).IsLongPressed);
+}
+
+static void TestRejectedPress() {
+    FakeMatrixScanner scanner(NUM_COLS);
+    Key keys[NUM_ROWS * NUM_COLS];
+    KeyMatrix matrix(keys, NUM_ROWS, NUM_COLS);
+    ResetEvents(matrix);
+
+    // A rejected press, e.g. a macro starting, stays unpressed and ends the
+    // scan, so the key in the next column is not seen in this scan
+    scanner.SetState(Bit(0, 0) | Bit(0, 1));
+    matrix.Scan(scanner, 0);
+    isPressAccepted = false;
+    CHECK(matrix.Scan(scanner, DEBOUNCE_US));
+    CHECK(numPresses == 1);
+    CHECK(lastRow == 0 && lastCol == 0);
+    CHECK(!matrix.GetKey(0, 0).IsPressed);
+    CHECK(!matrix.GetKey(0, 1).IsPressed);
+
+    // Still debounced, both keys press on the next scan
+    isPressAccepted = true;
+    CHECK(matrix.Scan(scanner, DEBOUNCE_US + 1000));
+    CHECK(numPresses == 3);
+    CHECK(matrix.GetKey(0, 0).IsPressed);
+    CHECK(matrix.GetKey(0, 1).IsPressed);
+    CHECK(numReleases == 0);
+}
+
+static void TestGhostNeverPressed() {
+    FakeMatrixScanner scanner(NUM_COLS);
+    Key keys[NUM_ROWS * NUM_COLS];
+    KeyMatrix matrix(keys, NUM_ROWS, NUM_COLS);
+    ResetEvents(matrix);
+
+    MatrixState held = Bit(0, 0) | Bit(0, 2) | Bit(2, 0);
+    scanner.SetState(held);
+    matrix.Scan(scanner, 0);
+    matrix.Scan(scanner, DEBOUNCE_US);
+    CHECK(numPresses == 3);
+
+    // The fourth corner reads down for a while, it is never pressed
+    scanner.SetState(held | Bit(2, 2));
+    matrix.Scan(scanner, 2 * DEBOUNCE_US);
+    matrix.Scan(scanner, 4 * DEBOUNCE_US);
+    CHECK(numPresses == 3);
+    CHECK(!matrix.GetKey(2, 2).IsPressed);
+}
+
+static void TestNoSnapshot() {
+    // A scanner without a snapshot leaves the keys alone
+    class EmptyScanner : public FakeMatrixScanner {
+    public:
+        EmptyScanner() : FakeMatrixScanner(NUM_COLS) {}
+        bool Read(MatrixState&) override { return false; }
+    };
+
+    EmptyScanner scanner;
+    Key keys[NUM_ROWS * NUM_COLS];
+    KeyMatrix matrix(keys, NUM_ROWS, NUM_COLS);
+    ResetEvents(matrix);
+    CHECK(!matrix.Scan(scanner, 0));
+    CHECK(matrix.IsIdle());
+}
+
+int main() {
+    RUN_TEST(TestPlainKeys);
+    RUN_TEST(TestGhostPressHeldBack);
+    RUN_TEST(TestDebounce);
+    RUN_TEST(TestAutoRepeat);
+    RUN_TEST(TestRejectedPress);
+    RUN_TEST(TestGhostNeverPressed);
+    RUN_TEST(TestNoSnapshot);
+    RUN_TEST(TestIdleWake);
+    return TestResult();
+}
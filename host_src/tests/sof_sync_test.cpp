@@ -0,0 +1,67 @@
+// Poll frame tracking of SofSync, across the 11-bit frame number wrap
+#include "sof_sync.h"
+#include "test_check.h"
+
+// Runs frames [first, first + count), the host polls when the running frame
+// is a multiple of interval. Returns how many pre-poll scans were timed
+// for the frame before a poll, and how many for another frame.
+static void RunFrames(SofSync& sync, uint64_t first, uint64_t count, uint32_t interval,
+        int& numHits, int& numMisses) {
+    numHits = 0;
+    numMisses = 0;
+    for (uint64_t frame = first; frame < first + count; frame++) {
+        uint32_t frameNumber = frame & SofSync::FRAME_NUMBER_MASK;
+        uint64_t scanTime = sync.OnSof(frameNumber, frameNumber, frame * SofSync::FRAME_US);
+        if (scanTime != 0) {
+            if ((frame + 1) % interval == 0)
+                numHits++;
+            else
+                numMisses++;
+        }
+        if (frame % interval == 0)
+            sync.OnReportComplete();
+    }
+}
+
+static void TestPhaseLearned() {
+    SofSync sync;
+    sync.Configure(true, 4);
+
+    int numHits = 0;
+    int numMisses = 0;
+    RunFrames(sync, 0, 400, 4, numHits, numMisses);
+    CHECK(numHits == 100);
+    CHECK(numMisses == 0);
+}
+
+static void TestPhaseAcrossWrap() {
+    SofSync sync;
+    sync.Configure(true, 10);
+
+    // 2048 is not a multiple of 10, the 11-bit number alone would drift by
+    // 8 frames at every wrap
+    int numHits = 0;
+    int numMisses = 0;
+    RunFrames(sync, 0, 3 * 2048, 10, numHits, numMisses);
+    CHECK(numMisses == 0);
+    CHECK(numHits == (int)(3 * 2048 / 10));
+}
+
+static void TestLateCallback() {
+    SofSync sync;
+    sync.Configure(true, 1);
+
+    // The hardware counter moved on, the callback times nothing
+    CHECK(sync.OnSof(5, 5, 5000) == 5000 + SofSync::FRAME_US - SofSync::LEAD_US);
+    CHECK(sync.OnSof(6, 7, 7000) == 0);
+
+    sync.Configure(false, 1);
+    CHECK(sync.OnSof(8, 8, 8000) == 0);
+}
+
+int main() {
+    RUN_TEST(TestPhaseLearned);
+    RUN_TEST(TestPhaseAcrossWrap);
+    RUN_TEST(TestLateCallback);
+    return TestResult();
+}
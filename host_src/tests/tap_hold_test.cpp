@@ -0,0 +1,193 @@
+// TapHold decisions on scripted key events and times
+#include <vector>
+#include "tap_hold.h"
+#include "test_check.h"
+
+static const uint32_t TAPPING_TERM_US = 200000;
+
+// Key 0 is a mod-tap (tap A, hold left shift), key 1 a layer-tap (tap B,
+// hold layer 1), key 2 a plain key that is C on layer 0 and 1 on layer 1
+static const int NUM_KEYS = 3;
+static const uint16_t layers[2][NUM_KEYS] = {
+    {
+        MakeKeyAction(KEY_ACTION_MOD_TAP, 1, 0x04),
+        MakeKeyAction(KEY_ACTION_LAYER_TAP, 1, 0x05),
+        MakeKeyAction(KEY_ACTION_KEY, 0, 0x06),
+    },
+    {
+        KEY_ACTION_NONE,
+        KEY_ACTION_NONE,
+        MakeKeyAction(KEY_ACTION_KEY, 0, 0x1E),
+    },
+};
+
+static const uint16_t TAP_A = MakeKeyAction(KEY_ACTION_KEY, 0, 0x04);
+static const uint16_t TAP_B = MakeKeyAction(KEY_ACTION_KEY, 0, 0x05);
+static const uint16_t HOLD_SHIFT = MakeKeyAction(KEY_ACTION_MODIFIER, 0, 1u << 1);
+static const uint16_t HOLD_LAYER_1 = MakeKeyAction(KEY_ACTION_LAYER_MOMENTARY, 1, 0);
+static const uint16_t KEY_C = layers[0][2];
+static const uint16_t KEY_1 = layers[1][2];
+
+struct Emitted {
+    int KeyIndex;
+    uint16_t Action;
+    bool IsPressed;
+
+    bool operator==(const Emitted& other) const {
+        return KeyIndex == other.KeyIndex && Action == other.Action && IsPressed == other.IsPressed;
+    }
+};
+
+static std::vector<Emitted> emitted;
+static int activeLayer = 0;
+
+static uint16_t OnResolve(int keyIndex) {
+    return layers[activeLayer][keyIndex];
+}
+
+static void OnAction(int keyIndex, uint16_t action, bool isPressed) {
+    emitted.push_back({ keyIndex, action, isPressed });
+    if (GetKeyActionKind(action) == KEY_ACTION_LAYER_MOMENTARY)
+        activeLayer = isPressed ? GetKeyActionLayer(action) : 0;
+}
+
+static TapHold MakeTapHold(bool isPermissiveHold, bool isHoldOnOtherKeyPress) {
+    emitted.clear();
+    activeLayer = 0;
+    TapHold tapHold;
+    tapHold.Configure(TAPPING_TERM_US, isPermissiveHold, isHoldOnOtherKeyPress);
+    tapHold.SetCallbacks(OnResolve, OnAction);
+    return tapHold;
+}
+
+static void TestTap() {
+    TapHold tapHold = MakeTapHold(false, false);
+
+    tapHold.OnKeyEvent(0, true, 0);
+    CHECK(tapHold.IsPending());
+    CHECK(emitted.empty());
+    tapHold.OnKeyEvent(0, false, 50000);
+    CHECK(!tapHold.IsPending());
+    CHECK((emitted == std::vector<Emitted>{ { 0, TAP_A, true }, { 0, TAP_A, false } }));
+
+    // Another key tapped inside it stays behind the tap without permissive hold
+    tapHold.OnKeyEvent(0, true, 100000);
+    tapHold.OnKeyEvent(2, true, 110000);
+    tapHold.OnKeyEvent(2, false, 120000);
+    CHECK(emitted.size() == 2);
+    tapHold.OnKeyEvent(0, false, 130000);
+    CHECK((emitted == std::vector<Emitted>{ { 0, TAP_A, true }, { 0, TAP_A, false },
+            { 0, TAP_A, true }, { 2, KEY_C, true }, { 2, KEY_C, false }, { 0, TAP_A, false } }));
+}
+
+static void TestTappingTermExpiry() {
+    TapHold tapHold = MakeTapHold(false, false);
+
+    tapHold.OnKeyEvent(0, true, 1000);
+    tapHold.Update(1000 + TAPPING_TERM_US - 1);
+    CHECK(emitted.empty());
+    tapHold.Update(1000 + TAPPING_TERM_US);
+    CHECK((emitted == std::vector<Emitted>{ { 0, HOLD_SHIFT, true } }));
+
+    tapHold.OnKeyEvent(0, false, 500000);
+    CHECK((emitted == std::vector<Emitted>{ { 0, HOLD_SHIFT, true }, { 0, HOLD_SHIFT, false } }));
+
+    // An event past the term decides the hold even before Update runs
+    emitted.clear();
+    tapHold.OnKeyEvent(0, true, 1000000);
+    tapHold.OnKeyEvent(2, true, 1000000 + TAPPING_TERM_US);
+    CHECK((emitted == std::vector<Emitted>{ { 0, HOLD_SHIFT, true }, { 2, KEY_C, true } }));
+}
+
+static void TestPermissiveHold() {
+    TapHold tapHold = MakeTapHold(true, false);
+
+    // A press alone decides nothing, its release inside the term does
+    tapHold.OnKeyEvent(0, true, 0);
+    tapHold.OnKeyEvent(2, true, 10000);
+    CHECK(emitted.empty());
+    tapHold.OnKeyEvent(2, false, 20000);
+    CHECK((emitted == std::vector<Emitted>{ { 0, HOLD_SHIFT, true }, { 2, KEY_C, true },
+            { 2, KEY_C, false } }));
+
+    // A release of a key pressed before the tap-hold key does not count
+    emitted.clear();
+    tapHold.OnKeyEvent(0, false, 30000);
+    tapHold.OnKeyEvent(2, true, 40000);
+    tapHold.OnKeyEvent(0, true, 50000);
+    tapHold.OnKeyEvent(2, false, 60000);
+    tapHold.OnKeyEvent(0, false, 70000);
+    CHECK((emitted == std::vector<Emitted>{ { 0, HOLD_SHIFT, false }, { 2, KEY_C, true },
+            { 0, TAP_A, true }, { 2, KEY_C, false }, { 0, TAP_A, false } }));
+}
+
+static void TestHoldOnOtherKeyPress() {
+    TapHold tapHold = MakeTapHold(false, true);
+
+    tapHold.OnKeyEvent(0, true, 0);
+    tapHold.OnKeyEvent(2, true, 10000);
+    CHECK((emitted == std::vector<Emitted>{ { 0, HOLD_SHIFT, true }, { 2, KEY_C, true } }));
+    tapHold.OnKeyEvent(0, false, 20000);
+    tapHold.OnKeyEvent(2, false, 30000);
+    CHECK(emitted.size() == 4);
+    CHECK((emitted[2] == Emitted{ 0, HOLD_SHIFT, false }));
+    CHECK((emitted[3] == Emitted{ 2, KEY_C, false }));
+}
+
+static void TestFullBufferForcesHold() {
+    TapHold tapHold = MakeTapHold(false, false);
+
+    // Every event after the pending key is buffered until the buffer is full
+    tapHold.OnKeyEvent(0, true, 0);
+    uint64_t time = 1000;
+    for (int i = 0; i < TapHold::MAX_BUFFERED_EVENTS; i++, time += 1000)
+        tapHold.OnKeyEvent(2, (i % 2) == 0, time);
+    CHECK(tapHold.IsPending());
+    CHECK(emitted.empty());
+
+    // One more, still inside the tapping term, forces the hold
+    tapHold.OnKeyEvent(2, true, time);
+    CHECK(!tapHold.IsPending());
+    CHECK((int)emitted.size() == TapHold::MAX_BUFFERED_EVENTS + 2);
+    CHECK((emitted.front() == Emitted{ 0, HOLD_SHIFT, true }));
+    for (int i = 1; i < (int)emitted.size(); i++)
+        CHECK((emitted[i] == Emitted{ 2, KEY_C, (i % 2) == 1 }));
+}
+
+static void TestLayerTapReplaysOnLayer() {
+    TapHold tapHold = MakeTapHold(false, false);
+
+    // Key 2 is pressed while the layer-tap key is undecided
+    tapHold.OnKeyEvent(1, true, 0);
+    tapHold.OnKeyEvent(2, true, 50000);
+    CHECK(emitted.empty());
+
+    // The hold turns layer 1 on before key 2 is resolved
+    tapHold.Update(TAPPING_TERM_US);
+    CHECK((emitted == std::vector<Emitted>{ { 1, HOLD_LAYER_1, true }, { 2, KEY_1, true } }));
+
+    // Key 2 releases what it pressed, even once the layer is off
+    tapHold.OnKeyEvent(1, false, 300000);
+    tapHold.OnKeyEvent(2, false, 310000);
+    CHECK(activeLayer == 0);
+    CHECK((emitted[2] == Emitted{ 1, HOLD_LAYER_1, false }));
+    CHECK((emitted[3] == Emitted{ 2, KEY_1, false }));
+
+    // Tapped, it is B and key 2 stays on layer 0
+    emitted.clear();
+    tapHold.OnKeyEvent(1, true, 400000);
+    tapHold.OnKeyEvent(2, true, 410000);
+    tapHold.OnKeyEvent(1, false, 420000);
+    CHECK((emitted == std::vector<Emitted>{ { 1, TAP_B, true }, { 2, KEY_C, true },
+            { 1, TAP_B, false } }));
+}
+
+int main() {
+    RUN_TEST(TestTap);
+    RUN_TEST(TestTappingTermExpiry);
+    RUN_TEST(TestPermissiveHold);
+    RUN_TEST(TestHoldOnOtherKeyPress);
+    RUN_TEST(TestFullBufferForcesHold);
+    RUN_TEST(TestLayerTapReplaysOnLayer);
+    return TestResult();
+}
@@ -0,0 +1,29 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <stdio.h>
+
+// Checks of the host tests. A failed check is reported and the test goes
+// on, so one run lists every failure; main() returns TestResult().
+inline int testFailures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            testFailures++; \
+        } \
+    } while (0)
+
+#define RUN_TEST(test) \
+    do { \
+        int failuresBefore = testFailures; \
+        test(); \
+        printf("%s %s\n", (testFailures == failuresBefore) ? "PASS" : "FAIL", #test); \
+    } while (0)
+
+inline int TestResult() {
+    return (testFailures == 0) ? 0 : 1;
+}
+
+#endif // TEST_CHECK_H
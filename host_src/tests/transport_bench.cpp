@@ -0,0 +1,59 @@
+// Round trips over the CDC tty and the raw HID interface of the fake
+// device, like bench-compare does against a board. The pty stands in for
+// the tty layer and the raw HID side moves one report per direction and
+// millisecond frame, so this compares the framing and polling models,
+// not the USB hardware.
+#include <stdio.h>
+#include <memory>
+#include "fake_device.h"
+#include "macropad_client.h"
+#include "raw_hid_port.h"
+#include "test_check.h"
+
+static const uint32_t NUM_REQUESTS = 100;
+
+static void PrintResult(const char* name, const BenchmarkResult& result) {
+    printf("%-8s depth %u: %.0f us mean (%.0f..%.0f), %.1f KB/s, %u failed\n",
+            name, result.Depth, result.MeanLatencyUs, result.MinLatencyUs, result.MaxLatencyUs,
+            result.BytesPerSecond / 1024, result.NumFailed);
+}
+
+static void TestCompare() {
+    FakeDevice& device = FakeDevice::Instance();
+    device.FillFlash(1);
+
+    MacroPadClient cdc;
+    CHECK(cdc.Open(device.GetPath()));
+
+    std::unique_ptr<RawHidPort> port(new RawHidPort());
+    CHECK(port->Attach(device.TakeRawHidClientFd()));
+    MacroPadClient rawHid;
+    CHECK(rawHid.Open(std::move(port)));
+
+    for (uint32_t depth : { 1u, 8u }) {
+        BenchmarkResult cdcResult = cdc.Benchmark(NUM_REQUESTS, depth);
+        BenchmarkResult rawHidResult = rawHid.Benchmark(NUM_REQUESTS, depth);
+        PrintResult("cdc", cdcResult);
+        PrintResult("raw hid", rawHidResult);
+
+        CHECK(cdcResult.NumFailed == 0);
+        CHECK(rawHidResult.NumFailed == 0);
+        // A flash page answer spans 5 reports, a frame each
+        CHECK(rawHidResult.MinLatencyUs >= 5 * FakeRawHid::FRAME_US);
+    }
+
+    std::vector<uint8_t> page;
+    CHECK(rawHid.GetFlashPage(1, 3, page));
+    CHECK(page == device.ReadFlash(1, 3 * FakeDevice::PAGE_SIZE, FakeDevice::PAGE_SIZE));
+}
+
+int main() {
+    if (!FakeDevice::Instance().Start()) {
+        fprintf(stderr, "Could not start the fake device\n");
+        return 1;
+    }
+
+    RUN_TEST(TestCompare);
+    FakeDevice::Instance().Stop();
+    return TestResult();
+}
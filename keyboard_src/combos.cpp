@@ -0,0 +1,168 @@
+#include "combos.h"
+
+static_assert(MAX_COMBOS <= 32, "activeCombos holds one bit per combo");
+
+static int CountKeys(uint16_t mask) {
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1)
+        count++;
+    return count;
+}
+
+Combos::Combos() {
+    windowUs = 50000;
+    keyCallback = nullptr;
+    actionCallback = nullptr;
+    numCombos = 0;
+    numCandidates = 0;
+    candidateMask = 0;
+    windowStart = 0;
+    activeCombos = 0;
+    for (auto& combo : keyCombo)
+        combo = -1;
+    BuildLookup();
+}
+
+void Combos::Configure(uint32_t windowUs) {
+    this->windowUs = windowUs;
+}
+
+void Combos::SetCallbacks(ComboKeyCallback key, ComboActionCallback action) {
+    keyCallback = key;
+    actionCallback = action;
+}
+
+bool Combos::SetCombos(const Combo* newCombos, int newNumCombos, int numKeys) {
+    if (newNumCombos > MAX_COMBOS || numKeys > MAX_KEYS)
+        return false;
+    for (int i = 0; i < newNumCombos; i++) {
+        if (CountKeys(newCombos[i].KeyMask) < 2 || (newCombos[i].KeyMask >> numKeys) != 0)
+            return false;
+    }
+
+    // Presses held back for the old table go on as they happened, and
+    // actions of the old table are released, their keys pass on from now
+    PassCandidates();
+    for (int i = 0; i < numCombos; i++) {
+        if (activeCombos & (1u << i))
+            actionCallback(combos[i].Action, false);
+    }
+    activeCombos = 0;
+    for (auto& combo : keyCombo)
+        combo = -1;
+
+    // Insertion sort, largest combos first
+    numCombos = 0;
+    for (int i = 0; i < newNumCombos; i++) {
+        int j = numCombos++;
+        int numKeysInCombo = CountKeys(newCombos[i].KeyMask);
+        for (; j > 0 && CountKeys(combos[j - 1].KeyMask) < numKeysInCombo; j--)
+            combos[j] = combos[j - 1];
+        combos[j] = newCombos[i];
+    }
+
+    BuildLookup();
+    return true;
+}
+
+void Combos::BuildLookup() {
+    for (auto& entry : lookup)
+        entry = 0;
+
+    comboKeysMask = 0;
+    for (int i = 0; i < numCombos; i++) {
+        uint16_t mask = combos[i].KeyMask;
+        comboKeysMask |= mask;
+
+        // The first of two combos on the same keys wins
+        if ((lookup[mask] & LOOKUP_COMBO_MASK) == 0)
+            lookup[mask] |= (uint8_t)(i + 1);
+        for (uint16_t sub = (mask - 1) & mask; sub != 0; sub = (sub - 1) & mask)
+            lookup[sub] |= LOOKUP_IS_PREFIX;
+    }
+}
+
+void Combos::OnKeyEvent(int keyIndex, bool isPressed, uint64_t time) {
+    if (keyIndex >= MAX_KEYS) {
+        keyCallback(keyIndex, isPressed, time);
+        return;
+    }
+
+    uint16_t bit = 1u << keyIndex;
+    if (!isPressed) {
+        // A released candidate ends the window, it may still fire the combo
+        if (candidateMask & bit)
+            Resolve();
+
+        int combo = keyCombo[keyIndex];
+        if (combo < 0) {
+            keyCallback(keyIndex, false, time);
+            return;
+        }
+        keyCombo[keyIndex] = -1;
+        if (activeCombos & (1u << combo)) {
+            activeCombos &= ~(1u << combo);
+            actionCallback(combos[combo].Action, false);
+        }
+        return;
+    }
+
+    if (!(comboKeysMask & bit)) {
+        Resolve();
+        keyCallback(keyIndex, true, time);
+        return;
+    }
+
+    // A press that cannot extend the candidates starts a new window
+    if (lookup[candidateMask | bit] == 0)
+        Resolve();
+
+    if (numCandidates == 0)
+        windowStart = time;
+    candidateKeys[numCandidates] = (uint8_t)keyIndex;
+    candidateTimes[numCandidates] = time;
+    numCandidates++;
+    candidateMask |= bit;
+
+    // Nothing larger can follow, no need to wait for the window
+    uint8_t entry = lookup[candidateMask];
+    if ((entry & LOOKUP_COMBO_MASK) != 0 && !(entry & LOOKUP_IS_PREFIX))
+        Resolve();
+}
+
+void Combos::Update(uint64_t now) {
+    if (numCandidates > 0 && now - windowStart >= windowUs)
+        Resolve();
+}
+
+void Combos::Resolve() {
+    if (numCandidates == 0)
+        return;
+
+    int combo = lookup[candidateMask] & LOOKUP_COMBO_MASK;
+    if (combo != 0) {
+        Fire(combo - 1);
+        return;
+    }
+
+    // No match, the presses go on as they happened
+    PassCandidates();
+}
+
+void Combos::PassCandidates() {
+    int count = numCandidates;
+    numCandidates = 0;
+    candidateMask = 0;
+    for (int i = 0; i < count; i++)
+        keyCallback(candidateKeys[i], true, candidateTimes[i]);
+}
+
+void Combos::Fire(int comboIndex) {
+    for (int i = 0; i < numCandidates; i++)
+        keyCombo[candidateKeys[i]] = (int8_t)comboIndex;
+    numCandidates = 0;
+    candidateMask = 0;
+
+    activeCombos |= (1u << comboIndex);
+    actionCallback(combos[comboIndex].Action, true);
+}
@@ -0,0 +1,73 @@
+#ifndef COMBOS_H
+#define COMBOS_H
+
+#include <stdint.h>
+#include "message_payloads.h"
+
+// Passes on a key event that is not part of a combo
+typedef void (*ComboKeyCallback)(int keyIndex, bool isPressed, uint64_t time);
+// Press or release of the action of a matched combo
+typedef void (*ComboActionCallback)(uint16_t action, bool isPressed);
+
+// Matches presses against the combo table. Presses of keys used by a combo
+// are held back as candidates while they can still form one. The combo
+// fires as soon as the candidates match a combo no other combo extends,
+// otherwise when the window expires or a candidate is released. Candidates
+// that match nothing are passed on in order with their original times.
+//
+// Every set of pressed keys is precomputed into a lookup table, so matching
+// is one table read per event no matter how many combos are defined.
+class Combos {
+public:
+    static const int MAX_KEYS = 10;
+
+public:
+    Combos();
+
+    void Configure(uint32_t windowUs);
+    void SetCallbacks(ComboKeyCallback key, ComboActionCallback action);
+    // Combos of fewer than two keys or with keys above numKeys are rejected.
+    // Pending candidates are passed on first, as the table they were
+    // held back for goes away.
+    bool SetCombos(const Combo* newCombos, int newNumCombos, int numKeys);
+
+    void OnKeyEvent(int keyIndex, bool isPressed, uint64_t time);
+    // Resolves the candidates once the window expired
+    void Update(uint64_t now);
+
+    inline bool IsPending() const { return numCandidates > 0; }
+
+private:
+    // Lookup entries: index + 1 of the combo with exactly these keys, and
+    // whether a larger combo contains them
+    static const uint8_t LOOKUP_COMBO_MASK = 0x7F;
+    static const uint8_t LOOKUP_IS_PREFIX = 0x80;
+
+    void BuildLookup();
+    void Resolve();
+    void PassCandidates();
+    void Fire(int comboIndex);
+
+private:
+    uint32_t windowUs;
+    ComboKeyCallback keyCallback;
+    ComboActionCallback actionCallback;
+
+    // Sorted by number of keys, largest first
+    Combo combos[MAX_COMBOS];
+    int numCombos;
+    uint8_t lookup[1 << MAX_KEYS];
+    uint16_t comboKeysMask;
+
+    uint8_t candidateKeys[MAX_KEYS];
+    uint64_t candidateTimes[MAX_KEYS];
+    int numCandidates;
+    uint16_t candidateMask;
+    uint64_t windowStart;
+
+    // Combo each key fired, its action is released with the first of its keys
+    int8_t keyCombo[MAX_KEYS];
+    uint32_t activeCombos;
+};
+
+#endif // COMBOS_H
@@ -0,0 +1,55 @@
+#include "encoder.h"
+
+// Indexed by previous state << 2 | current state, clockwise is
+// 00 -> 10 -> 11 -> 01 -> 00
+const int8_t Encoder::DECODE_TABLE[16] = {
+     0, -1, +1,  0,
+    +1,  0,  0, -1,
+    -1,  0,  0, +1,
+     0, +1, -1,  0
+};
+
+Encoder::Encoder() {
+    state = 0;
+    steps = 0;
+    consumedSteps = 0;
+    stepsPerDetent = 4;
+    maxAcceleration = 1;
+    lastDirection = 0;
+    lastDetentTime = 0;
+}
+
+void Encoder::Configure(uint8_t stepsPerDetent, uint8_t maxAcceleration) {
+    this->stepsPerDetent = (stepsPerDetent > 0) ? stepsPerDetent : 1;
+    this->maxAcceleration = (maxAcceleration > 0) ? maxAcceleration : 1;
+}
+
+void Encoder::Reset(uint8_t pins) {
+    state = pins & 0x03;
+    consumedSteps = steps;
+    lastDirection = 0;
+}
+
+int32_t Encoder::TakeDetents(uint64_t now) {
+    // Partial detents stay pending, in either direction
+    int32_t detents = (int32_t)(steps - consumedSteps) / stepsPerDetent;
+    if (detents == 0)
+        return 0;
+    consumedSteps += detents * stepsPerDetent;
+
+    int8_t direction = (detents > 0) ? 1 : -1;
+    uint32_t count = (uint32_t)(detents * direction);
+    uint32_t multiplier = 1;
+    if (direction == lastDirection && maxAcceleration > 1) {
+        uint64_t interval = (now - lastDetentTime) / count;
+        if (interval < ACCELERATION_WINDOW_US) {
+            multiplier = ACCELERATION_WINDOW_US / (interval > 0 ? (uint32_t)interval : 1);
+            if (multiplier > maxAcceleration)
+                multiplier = maxAcceleration;
+        }
+    }
+
+    lastDirection = direction;
+    lastDetentTime = now;
+    return detents * (int32_t)multiplier;
+}
@@ -0,0 +1,51 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdint.h>
+
+// Quadrature decoding of one rotary encoder. OnPins runs in the edge
+// interrupt and only does a table lookup, so no step is lost however
+// slowly the matrix is scanned. Detents and the acceleration are worked
+// out from the main loop by TakeDetents. Keeps no SDK dependency.
+class Encoder {
+public:
+    // Detents closer than this to the previous one are multiplied
+    static const uint32_t ACCELERATION_WINDOW_US = 100000;
+
+public:
+    Encoder();
+
+    void Configure(uint8_t stepsPerDetent, uint8_t maxAcceleration);
+    // Starts decoding from the current pin levels, A << 1 | B
+    void Reset(uint8_t pins);
+
+    // From the edge interrupt, pin levels A << 1 | B
+    inline void OnPins(uint8_t pins) {
+        steps += Decode(state, pins);
+        state = pins;
+    }
+
+    // Detents turned since the last call, positive clockwise, multiplied
+    // while the encoder turns fast in one direction
+    int32_t TakeDetents(uint64_t now);
+    inline bool HasPendingSteps() const { return steps != consumedSteps; }
+
+    // Quarter step between two pin states: +1, -1 or 0 for no move or a
+    // missed state (both pins changed)
+    static inline int8_t Decode(uint8_t previous, uint8_t current) {
+        return DECODE_TABLE[((previous & 0x03) << 2) | (current & 0x03)];
+    }
+
+private:
+    static const int8_t DECODE_TABLE[16];
+
+    volatile uint8_t state;
+    volatile int32_t steps;     // Written by the interrupt only
+    int32_t consumedSteps;
+    uint8_t stepsPerDetent;
+    uint8_t maxAcceleration;
+    int8_t lastDirection;
+    uint64_t lastDetentTime;
+};
+
+#endif // ENCODER_H
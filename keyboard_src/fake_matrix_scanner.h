@@ -0,0 +1,57 @@
+#ifndef FAKE_MATRIX_SCANNER_H
+#define FAKE_MATRIX_SCANNER_H
+
+#include "matrix_scanner.h"
+
+// Scripted matrix for host builds, keys are set by the caller.
+// Pressing a key while idle calls the wake callback like a row edge would,
+// and idling with a key already down calls it at once.
+class FakeMatrixScanner : public MatrixScanner {
+public:
+    explicit FakeMatrixScanner(int numCols) :
+        numCols(numCols), state(0), numReads(0), isIdle(false), isWakeArmed(false),
+        wakeCallback(nullptr)
+    {}
+
+    bool Initialize() override { return true; }
+
+    bool Read(MatrixState& out) override {
+        out = state;
+        numReads++;
+        return true;
+    }
+
+    void EnterIdle(bool isWakeArmed, MatrixWakeCallback wakeCallback) override {
+        isIdle = true;
+        this->isWakeArmed = isWakeArmed;
+        this->wakeCallback = wakeCallback;
+        if (isWakeArmed && state != 0 && wakeCallback != nullptr)
+            wakeCallback();
+    }
+
+    void ExitIdle() override {
+        isIdle = false;
+        isWakeArmed = false;
+    }
+
+    void SetKey(int row, int col, bool isDown) {
+        MatrixState bit = KeyBit(row, col, numCols);
+        state = isDown ? (state | bit) : (state & ~bit);
+        if (isDown && isIdle && isWakeArmed && wakeCallback != nullptr)
+            wakeCallback();
+    }
+
+    inline void SetState(MatrixState newState) { state = newState; }
+    inline uint32_t GetNumReads() const { return numReads; }
+    inline bool IsIdle() const { return isIdle; }
+
+private:
+    int numCols;
+    MatrixState state;
+    uint32_t numReads;
+    bool isIdle;
+    bool isWakeArmed;
+    MatrixWakeCallback wakeCallback;
+};
+
+#endif // FAKE_MATRIX_SCANNER_H
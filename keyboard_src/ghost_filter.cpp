@@ -0,0 +1,36 @@
+#include "ghost_filter.h"
+
+GhostFilter::GhostFilter(int numRows, int numCols) :
+    numRows(numRows), numCols(numCols)
+{
+    rowMask = ((MatrixState)1 << numCols) - 1;
+    previous = 0;
+}
+
+MatrixState GhostFilter::Filter(MatrixState raw) {
+    // Rows with at least two keys down, the only ones a rectangle can use
+    MatrixState rows[sizeof(MatrixState) * 8];
+    int rowNums[sizeof(MatrixState) * 8];
+    int numMultiRows = 0;
+    for (int row = 0; row < numRows; row++) {
+        MatrixState cols = (raw >> (row * numCols)) & rowMask;
+        if ((cols & (cols - 1)) == 0)
+            continue;
+        rows[numMultiRows] = cols;
+        rowNums[numMultiRows] = row;
+        numMultiRows++;
+    }
+
+    MatrixState ambiguous = 0;
+    for (int i = 1; i < numMultiRows; i++) {
+        for (int j = 0; j < i; j++) {
+            MatrixState shared = rows[i] & rows[j];
+            if ((shared & (shared - 1)) == 0)
+                continue;
+            ambiguous |= (shared << (rowNums[i] * numCols)) | (shared << (rowNums[j] * numCols));
+        }
+    }
+
+    previous = (raw & ~ambiguous) | (raw & ambiguous & previous);
+    return previous;
+}
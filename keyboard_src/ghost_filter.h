@@ -0,0 +1,27 @@
+#ifndef GHOST_FILTER_H
+#define GHOST_FILTER_H
+
+#include "matrix_scanner.h"
+
+// Without diodes, three keys held on the corners of a rectangle make the
+// fourth corner read as pressed. Any two rows sharing two or more pressed
+// columns form such a rectangle, and none of its corners can be trusted:
+// they keep their previous state until the rectangle goes away, so held
+// keys stay held and no ghost press gets through. Rows are contiguous in
+// MatrixState, so each row costs a shift and a mask, and only rows with
+// two keys down are compared.
+class GhostFilter {
+public:
+    GhostFilter(int numRows, int numCols);
+
+    MatrixState Filter(MatrixState raw);
+    inline void Reset() { previous = 0; }
+
+private:
+    int numRows;
+    int numCols;
+    MatrixState rowMask;
+    MatrixState previous;
+};
+
+#endif // GHOST_FILTER_H
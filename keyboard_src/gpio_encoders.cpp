@@ -0,0 +1,59 @@
+#include "gpio_encoders.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+
+GpioEncoders* GpioEncoders::instance = nullptr;
+
+GpioEncoders::GpioEncoders(const uint8_t* aPins, const uint8_t* bPins, Encoder* encoders, int numEncoders) :
+    aPins(aPins), bPins(bPins), encoders(encoders), numEncoders(numEncoders)
+{
+    pinMask = 0;
+    wakeCallback = nullptr;
+}
+
+void GpioEncoders::Initialize() {
+    instance = this;
+    pinMask = 0;
+    for (int i = 0; i < numEncoders; i++) {
+        const uint8_t pins[2] = { aPins[i], bPins[i] };
+        for (uint8_t pin : pins) {
+            gpio_init(pin);
+            gpio_set_dir(pin, GPIO_IN);
+            gpio_set_pulls(pin, true, false);
+            pinMask |= (1u << pin);
+        }
+    }
+
+    // Pull-ups need a moment before the first read
+    sleep_us(10);
+    for (int i = 0; i < numEncoders; i++)
+        encoders[i].Reset(ReadPins(i));
+
+    gpio_add_raw_irq_handler_masked(pinMask, OnEdge);
+    for (int i = 0; i < numEncoders; i++) {
+        gpio_set_irq_enabled(aPins[i], GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+        gpio_set_irq_enabled(bPins[i], GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+    }
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+void GpioEncoders::OnEdge() {
+    GpioEncoders* self = instance;
+    bool isAnyEdge = false;
+    for (int i = 0; i < self->numEncoders; i++) {
+        uint32_t aEvents = gpio_get_irq_event_mask(self->aPins[i]);
+        uint32_t bEvents = gpio_get_irq_event_mask(self->bPins[i]);
+        if (aEvents == 0 && bEvents == 0)
+            continue;
+
+        // Raw handlers acknowledge their own pins
+        gpio_acknowledge_irq(self->aPins[i], aEvents);
+        gpio_acknowledge_irq(self->bPins[i], bEvents);
+        self->encoders[i].OnPins(self->ReadPins(i));
+        isAnyEdge = true;
+    }
+
+    MatrixWakeCallback callback = self->wakeCallback;
+    if (isAnyEdge && callback != nullptr)
+        callback();
+}
@@ -0,0 +1,36 @@
+#ifndef GPIO_ENCODERS_H
+#define GPIO_ENCODERS_H
+
+#include "pico/stdlib.h"
+#include "matrix_scanner.h"
+#include "encoder.h"
+
+// Feeds the encoders from a raw GPIO interrupt on both edges of their A
+// and B pins. Uses a raw handler so the row wake callback of the matrix
+// scanners keeps working next to it.
+class GpioEncoders {
+public:
+    GpioEncoders(const uint8_t* aPins, const uint8_t* bPins, Encoder* encoders, int numEncoders);
+
+    void Initialize();
+    // Called on the next edge, nullptr to disarm. Safe from interrupts.
+    inline void SetWakeCallback(MatrixWakeCallback callback) { wakeCallback = callback; }
+
+private:
+    static void OnEdge();
+    inline uint8_t ReadPins(int encoder) const {
+        return (uint8_t)((gpio_get(aPins[encoder]) << 1) | gpio_get(bPins[encoder]));
+    }
+
+private:
+    static GpioEncoders* instance;
+
+    const uint8_t* aPins;
+    const uint8_t* bPins;
+    Encoder* encoders;
+    int numEncoders;
+    uint32_t pinMask;
+    volatile MatrixWakeCallback wakeCallback;
+};
+
+#endif // GPIO_ENCODERS_H
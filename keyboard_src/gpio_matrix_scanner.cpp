@@ -0,0 +1,87 @@
+#include "gpio_matrix_scanner.h"
+
+MatrixWakeCallback GpioMatrixScanner::rowWakeCallback = nullptr;
+
+GpioMatrixScanner::GpioMatrixScanner(const uint8_t* colPins, int numCols,
+        const uint8_t* rowPins, int numRows) :
+    colPins(colPins), rowPins(rowPins), numCols(numCols), numRows(numRows)
+{}
+
+bool GpioMatrixScanner::Initialize() {
+    // Init Columns (ouputs), idle high
+    for (int i = 0; i < numCols; i++) {
+        gpio_init(colPins[i]);
+        gpio_set_dir(colPins[i], GPIO_OUT);
+        gpio_set_pulls(colPins[i], true, false);
+        gpio_put(colPins[i], true);
+    }
+
+    // Init Rows (inputs)
+    for (int i = 0; i < numRows; i++) {
+        gpio_init(rowPins[i]);
+        gpio_set_dir(rowPins[i], GPIO_IN);
+        gpio_set_pulls(rowPins[i], true, false);
+    }
+
+    return true;
+}
+
+bool GpioMatrixScanner::Read(MatrixState& state) {
+    state = 0;
+    for (int col = 0; col < numCols; col++) {
+        gpio_put(colPins[col], false);
+        for (int row = 0; row < numRows; row++) {
+            // Rows are pulled up, a pressed key pulls its row low
+            if (!gpio_get(rowPins[row]))
+                state |= KeyBit(row, col, numCols);
+        }
+        gpio_put(colPins[col], true);
+    }
+
+    return true;
+}
+
+void GpioMatrixScanner::EnterIdle(bool isWakeArmed, MatrixWakeCallback wakeCallback) {
+    for (int col = 0; col < numCols; col++)
+        gpio_put(colPins[col], false);
+
+    if (isWakeArmed)
+        ArmRowWake(rowPins, numRows, wakeCallback);
+    else
+        DisarmRowWake(rowPins, numRows);
+}
+
+void GpioMatrixScanner::ExitIdle() {
+    DisarmRowWake(rowPins, numRows);
+
+    // Read expects every column high
+    for (int col = 0; col < numCols; col++)
+        gpio_put(colPins[col], true);
+}
+
+void GpioMatrixScanner::ArmRowWake(const uint8_t* rowPins, int numRows, MatrixWakeCallback wakeCallback) {
+    rowWakeCallback = wakeCallback;
+    for (int row = 0; row < numRows; row++)
+        gpio_set_irq_enabled_with_callback(rowPins[row], GPIO_IRQ_EDGE_FALL, true, OnRowEdge);
+
+    // A key pressed before the edge was armed raises no interrupt, wake now
+    for (int row = 0; row < numRows; row++) {
+        if (!gpio_get(rowPins[row])) {
+            wakeCallback();
+            return;
+        }
+    }
+}
+
+void GpioMatrixScanner::DisarmRowWake(const uint8_t* rowPins, int numRows) {
+    for (int row = 0; row < numRows; row++)
+        gpio_set_irq_enabled(rowPins[row], GPIO_IRQ_EDGE_FALL, false);
+}
+
+void GpioMatrixScanner::OnRowEdge(uint gpio, uint32_t events) {
+    (void) gpio;
+    (void) events;
+
+    if (rowWakeCallback != nullptr)
+        rowWakeCallback();
+}
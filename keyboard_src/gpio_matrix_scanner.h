@@ -0,0 +1,35 @@
+#ifndef GPIO_MATRIX_SCANNER_H
+#define GPIO_MATRIX_SCANNER_H
+
+#include "pico/stdlib.h"
+#include "matrix_scanner.h"
+
+// Software scan: each Read() drives one column low at a time and
+// samples the rows with gpio_get
+class GpioMatrixScanner : public MatrixScanner {
+public:
+    GpioMatrixScanner(const uint8_t* colPins, int numCols, const uint8_t* rowPins, int numRows);
+
+    bool Initialize() override;
+    bool Read(MatrixState& state) override;
+    void EnterIdle(bool isWakeArmed, MatrixWakeCallback wakeCallback) override;
+    void ExitIdle() override;
+
+    // Row edge wake, shared with the other hardware backends. Expects every
+    // column low, a row already low calls wakeCallback right away.
+    static void ArmRowWake(const uint8_t* rowPins, int numRows, MatrixWakeCallback wakeCallback);
+    static void DisarmRowWake(const uint8_t* rowPins, int numRows);
+
+private:
+    static void OnRowEdge(uint gpio, uint32_t events);
+
+private:
+    static MatrixWakeCallback rowWakeCallback;
+
+    const uint8_t* colPins;
+    const uint8_t* rowPins;
+    int numCols;
+    int numRows;
+};
+
+#endif // GPIO_MATRIX_SCANNER_H
@@ -0,0 +1,91 @@
+#include "key_matrix.h"
+
+KeyMatrix::KeyMatrix(Key* keys, int numRows, int numCols) :
+    keys(keys), numRows(numRows), numCols(numCols)
+#ifndef MACROPAD_MATRIX_HAS_DIODES
+    , ghostFilter(numRows, numCols)
+#endif
+{
+    debounceUs = 10000;
+    repeatFirstDelayUs = 500000;
+    repeatPeriodUs = 100000;
+    pressCallback = nullptr;
+    releaseCallback = nullptr;
+    repeatCallback = nullptr;
+    isAnyKeyDown = false;
+}
+
+void KeyMatrix::Configure(uint32_t debounceUs, uint32_t repeatFirstDelayUs, uint32_t repeatPeriodUs) {
+    this->debounceUs = debounceUs;
+    this->repeatFirstDelayUs = repeatFirstDelayUs;
+    this->repeatPeriodUs = repeatPeriodUs;
+}
+
+void KeyMatrix::SetCallbacks(KeyPressCallback press, KeyReleaseCallback release, KeyRepeatCallback repeat) {
+    pressCallback = press;
+    releaseCallback = release;
+    repeatCallback = repeat;
+}
+
+bool KeyMatrix::Scan(MatrixScanner& scanner, uint64_t now) {
+    MatrixState matrix;
+    if (!scanner.Read(matrix))
+        return false;
+
+    isAnyKeyDown = (matrix != 0);
+#ifndef MACROPAD_MATRIX_HAS_DIODES
+    matrix = ghostFilter.Filter(matrix);
+#endif
+    for (int col = 0; col < numCols; col++) {
+        for (int row = 0; row < numRows; row++) {
+            Key& key = GetKey(row, col);
+            if (matrix & MatrixScanner::KeyBit(row, col, numCols)) {
+                if (key.DebounceCounter++ == 0)
+                    key.DebounceStart = now;
+                if (key.IsLongPressed) {
+                    if (now - key.PressStart > repeatPeriodUs) {
+                        key.PressStart = now;
+                        if (repeatCallback != nullptr)
+                            repeatCallback(row, col);
+                    }
+                }
+                else if (key.IsPressed) {
+                    if (now - key.PressStart > repeatFirstDelayUs) {
+                        key.IsLongPressed = true;
+                        key.PressStart = now;
+                        if (repeatCallback != nullptr)
+                            repeatCallback(row, col);
+                    }
+                }
+                else if (now - key.DebounceStart >= debounceUs) {
+                    if (pressCallback != nullptr && !pressCallback(row, col, now))
+                        return true;
+
+                    key.DebounceCounter = 0;
+                    key.IsPressed = true;
+                    key.PressStart = now;
+                }
+            }
+            else if (key.IsPressed) {
+                key.Reset();
+                if (releaseCallback != nullptr)
+                    releaseCallback(row, col, now);
+            }
+            else {
+                // A bounce shorter than the debounce starts over
+                key.DebounceCounter = 0;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool KeyMatrix::IsIdle() const {
+    for (int i = 0; i < numRows * numCols; i++) {
+        // A key still debouncing has made its edge already
+        if (keys[i].IsPressed || keys[i].DebounceCounter != 0)
+            return false;
+    }
+    return true;
+}
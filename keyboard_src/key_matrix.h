@@ -0,0 +1,80 @@
+#ifndef KEY_MATRIX_H
+#define KEY_MATRIX_H
+
+// Free of SDK includes so fakes can be built on the host
+
+#include <stdint.h>
+#include "message_payloads.h"
+#include "matrix_scanner.h"
+#include "ghost_filter.h"
+
+struct Key {
+    bool IsPressed;
+    bool IsLongPressed;
+    uint64_t PressStart;
+    uint32_t DebounceCounter;  // Scans seen down since the bounce started
+    uint64_t DebounceStart;
+    uint16_t Action;    // Latched on press, so the release undoes what the press did
+    MacroKey* Macro;
+    uint16_t MacroLength;
+
+    Key() {
+        Reset();
+        Macro = nullptr;
+        MacroLength = 0;
+    }
+
+    void Reset() {
+        IsPressed = false;
+        IsLongPressed = false;
+        PressStart = 0;
+        DebounceCounter = 0;
+        DebounceStart = 0;
+        Action = KEY_ACTION_NONE;
+    }
+};
+
+// A key down for the debounce time. Returning false leaves the key
+// unpressed and ends the scan, e.g. when the press started a macro.
+typedef bool (*KeyPressCallback)(int row, int col, uint64_t time);
+typedef void (*KeyReleaseCallback)(int row, int col, uint64_t time);
+// A held key past the first repeat delay, then every repeat period
+typedef void (*KeyRepeatCallback)(int row, int col);
+
+// Debounce, press, release and auto repeat of the matrix keys, from the
+// snapshots of a MatrixScanner. Debouncing is by time, so a slower scan
+// tier does not lengthen it. Time comes from the caller.
+class KeyMatrix {
+public:
+    // keys holds numRows * numCols entries, row after row
+    KeyMatrix(Key* keys, int numRows, int numCols);
+
+    void Configure(uint32_t debounceUs, uint32_t repeatFirstDelayUs, uint32_t repeatPeriodUs);
+    void SetCallbacks(KeyPressCallback press, KeyReleaseCallback release, KeyRepeatCallback repeat);
+
+    // Returns false if the scanner had no snapshot yet
+    bool Scan(MatrixScanner& scanner, uint64_t now);
+
+    // Raw state of the last snapshot, before debouncing
+    inline bool IsAnyKeyDown() const { return isAnyKeyDown; }
+    // No key is held or debouncing
+    bool IsIdle() const;
+    inline Key& GetKey(int row, int col) { return keys[row * numCols + col]; }
+
+private:
+    Key* keys;
+    int numRows;
+    int numCols;
+#ifndef MACROPAD_MATRIX_HAS_DIODES
+    GhostFilter ghostFilter;
+#endif
+    uint32_t debounceUs;
+    uint32_t repeatFirstDelayUs;
+    uint32_t repeatPeriodUs;
+    KeyPressCallback pressCallback;
+    KeyReleaseCallback releaseCallback;
+    KeyRepeatCallback repeatCallback;
+    bool isAnyKeyDown;
+};
+
+#endif // KEY_MATRIX_H
@@ -3,16 +3,56 @@
 #include "keycodes.h"
 #include "../flash_service.h"
 #include "serial_dispatcher.h"
-
-Keyboard::Keyboard() : settings(Settings::Instance()) {
+#include "raw_hid_transport.h"
+#include "../power_manager.h"
+#include "../profiler.h"
+#include "../usage_analytics.h"
+
+Keyboard::Keyboard() :
+    gpioScanner(colPins, NUM_COLS, rowPins, NUM_ROWS),
+    pioScanner(colPins, NUM_COLS, rowPins, NUM_ROWS),
+    matrix(&keys[0][0], NUM_ROWS, NUM_COLS),
+    gpioEncoders(encoderAPins, encoderBPins, encoders, NUM_ENCODERS)
+{
+    scanner = nullptr;
     startTime = 0;
     sendReport = false;
     currentState = KEYBOARD_STATE_SCAN;
-    currentRow = 0;
-    currentCol = 0;
+    currentMacro = nullptr;
+    currentMacroLength = 0;
     currentMacroKeyIndex = 0;
     isInPostDelay = false;
     macroPostDelay = 0;
+    scanSettings = Settings::Instance().GetCache();
+    scanRatePolicy.Configure(scanSettings.ScanPeriodMinUs, scanSettings.ScanPeriodMaxUs,
+            scanSettings.IdleTimeoutUs);
+    scanPeriodUs = scanRatePolicy.GetPeriod();
+    matrix.Configure(scanSettings.DebounceUs, scanSettings.RepeatFirstDelayUs, scanSettings.RepeatPeriodUs);
+    matrix.SetCallbacks(OnKeyPress, OnKeyRelease, OnKeyRepeat);
+    sofSync.Configure(scanSettings.IsSofSyncEnabled, scanSettings.HidPollIntervalMs);
+    reportSentTime = 0;
+    tapHold.Configure(scanSettings.TappingTermUs, scanSettings.IsPermissiveHold,
+            scanSettings.IsHoldOnOtherKeyPress);
+    tapHold.SetCallbacks(ResolveTapHoldAction, ApplyTapHoldAction);
+    combos.Configure(scanSettings.ComboWindowUs);
+    combos.SetCallbacks(OnComboKey, OnComboAction);
+    leader.Configure(scanSettings.LeaderTimeoutUs);
+    leaderKeysMask = 0;
+    recorder.Configure(scanSettings.RecordQuantumMs, scanSettings.RecordIdleTrimMs);
+    mouseKeys.Configure((eMouseCurve)scanSettings.MouseCurve, scanSettings.MouseTickUs,
+            scanSettings.MouseAccelTimeUs, scanSettings.MouseSpeedMin, scanSettings.MouseSpeedMax,
+            scanSettings.WheelSpeedMin, scanSettings.WheelSpeedMax);
+    comboTable = {};
+    numEncoders = 0;
+    for (int i = 0; i < NUM_ENCODERS; i++)
+        pendingDetents[i] = 0;
+    encoderMap = {};
+    consumerUsage = 0;
+    sendConsumerReport = false;
+    isConsumerPressPending = false;
+    isConsumerReleaseDeferred = false;
+    numBatchPresses = 0;
+    numDeferredReleases = 0;
 }
 
 void Keyboard::Initialize() {
@@ -23,20 +63,32 @@ void Keyboard::Initialize() {
     rowPins[0] = ROW0_PIN;
     rowPins[1] = ROW1_PIN;
     rowPins[2] = ROW2_PIN;
-
-    // Init Columns (ouputs)
-    for (int i = 0; i < NUM_COLS; i++) {
-        gpio_init(colPins[i]);
-        gpio_set_dir(colPins[i], GPIO_OUT);
-        gpio_set_pulls(colPins[i], true, false);
+    encoderAPins[0] = ENC0_A_PIN;
+    encoderBPins[0] = ENC0_B_PIN;
+    encoderAPins[1] = ENC1_A_PIN;
+    encoderBPins[1] = ENC1_B_PIN;
+
+    // A scanner set with SetScanner (e.g. a fake) is kept
+    if (scanner == nullptr) {
+#ifdef MACROPAD_PIO_SCANNER
+        // The PIO scans at the ceiling rate, falls back to software scanning
+        pioScanner.SetScanPeriod(scanSettings.ScanPeriodMinUs);
+        if (pioScanner.Initialize())
+            scanner = &pioScanner;
+#endif
+        if (scanner == nullptr) {
+            gpioScanner.Initialize();
+            scanner = &gpioScanner;
+        }
     }
 
-    // Init Rows (inputs)
-    for (int i = 0; i < NUM_ROWS; i++) {
-        gpio_init(rowPins[i]);
-        gpio_set_dir(rowPins[i], GPIO_IN);
-        gpio_set_pulls(rowPins[i], true, false);
-    }
+#ifdef MACROPAD_ENCODERS
+    gpioEncoders.Initialize();
+    numEncoders = NUM_ENCODERS;
+#endif
+
+    // Keep a copy of the scan settings, Scan reads them inline
+    Settings::Instance().Subscribe(OnSettingsChanged);
 
     // Load default keys to make sure defaults are loaded 
     // in case flash was not programmed
@@ -44,20 +96,37 @@ void Keyboard::Initialize() {
     
     // Load keys from flash (macros or defaults)
     LoadKeysFromFlash();
+    keymap.Load();
+    LoadCombosFromFlash();
+    LoadLeaderFromFlash();
+    LoadEncodersFromFlash();
 }
 
 void Keyboard::LoadDefaultKeys() {
-    keys[0][0] = Key(KEY_A);
-    keys[0][1] = Key(KEY_D);
-    keys[0][2] = Key(KEY_G);
-
-    keys[1][0] = Key(KEY_B);
-    keys[1][1] = Key(KEY_E);
-    keys[1][2] = Key(KEY_H);
-    
-    keys[2][0] = Key(KEY_C);
-    keys[2][1] = Key(KEY_F);
-    keys[2][2] = Key(KEY_MOD_LSHIFT, true);
+    static const uint16_t defaultActions[NUM_ROWS * NUM_COLS] = {
+        MakeKeyAction(KEY_ACTION_KEY, 0, KEY_A),
+        MakeKeyAction(KEY_ACTION_KEY, 0, KEY_B),
+        MakeKeyAction(KEY_ACTION_KEY, 0, KEY_C),
+        MakeKeyAction(KEY_ACTION_KEY, 0, KEY_D),
+        MakeKeyAction(KEY_ACTION_KEY, 0, KEY_E),
+        MakeKeyAction(KEY_ACTION_KEY, 0, KEY_F),
+        MakeKeyAction(KEY_ACTION_KEY, 0, KEY_G),
+        MakeKeyAction(KEY_ACTION_KEY, 0, KEY_H),
+        MakeKeyAction(KEY_ACTION_MODIFIER, 0, KEY_MOD_LSHIFT)
+    };
+
+    for (int i = 0; i < (NUM_ROWS * NUM_COLS); i++)
+        keymap.SetBaseAction(i, defaultActions[i]);
+
+    // Volume on the first encoder, arrows on the second
+    static_assert(NUM_ENCODERS == 2, "Default encoder actions");
+    encoderMap.NumEncoders = NUM_ENCODERS;
+    encoderMap.MaxAcceleration = 4;
+    encoderMap.Encoders[0].Clockwise = MakeConsumerAction(HID_USAGE_CONSUMER_VOLUME_INCREMENT);
+    encoderMap.Encoders[0].CounterClockwise = MakeConsumerAction(HID_USAGE_CONSUMER_VOLUME_DECREMENT);
+    encoderMap.Encoders[1].Clockwise = MakeKeyAction(KEY_ACTION_KEY, 0, KEY_RIGHT);
+    encoderMap.Encoders[1].CounterClockwise = MakeKeyAction(KEY_ACTION_KEY, 0, KEY_LEFT);
+    ConfigureEncoders();
 }
 
 void Keyboard::LoadKeysFromFlash() {
@@ -69,11 +138,48 @@ void Keyboard::LoadKeysFromFlash() {
         int row = i / NUM_ROWS;
         int col = i % NUM_ROWS;
 
+        // The programmed KeyCode is the base layer action
         keys[col][row].Reset();
-        keys[col][row].Code = keyConfig->KeyCode;
         keys[col][row].Macro = reinterpret_cast<MacroKey*>(keyConfig->MacroBaseAddress);
         keys[col][row].MacroLength = keyConfig->MacroLength;
+        keymap.SetBaseAction(i, keyConfig->KeyCode);
+    }
+}
+
+void Keyboard::LoadLeaderFromFlash() {
+    const KeysFlashConfig* config = (const KeysFlashConfig*)FlashService::Instance().
+        GetSectorAddress(flashLeaderSectorNum);
+    if (config->MagicNumber != flashMagicNumber) {
+        leader.SetTrie(nullptr, 0);
+        return;
     }
+
+    leader.SetTrie(reinterpret_cast<const MacroKey*>(config->MacroBaseAddress), config->MacroLength);
+}
+
+void Keyboard::LoadCombosFromFlash() {
+    const CombosFlashConfig* config = (const CombosFlashConfig*)FlashService::Instance().
+        GetSectorAddress(flashCombosSectorNum);
+    if (config->MagicNumber != flashCombosMagicNumber)
+        return;
+
+    if (combos.SetCombos(config->Table.Combos, config->Table.NumCombos, GetNumKeys()))
+        comboTable = config->Table;
+}
+
+void Keyboard::LoadEncodersFromFlash() {
+    const EncodersFlashConfig* config = (const EncodersFlashConfig*)FlashService::Instance().
+        GetSectorAddress(flashEncodersSectorNum);
+    if (config->MagicNumber != flashEncodersMagicNumber || config->Map.NumEncoders != NUM_ENCODERS)
+        return;
+
+    encoderMap = config->Map;
+    ConfigureEncoders();
+}
+
+void Keyboard::ConfigureEncoders() {
+    for (Encoder& encoder : encoders)
+        encoder.Configure(ENCODER_STEPS_PER_DETENT, encoderMap.MaxAcceleration);
 }
 
 Keyboard::KeysFlashConfig* Keyboard::GetKeyFlashConfig(int keyIndex) {
@@ -92,17 +198,26 @@ void Keyboard::ProgrammingStarted() {
     currentState = KEYBOARD_STATE_PROGRAMMING;
 }
 
-eProgrammingStatus Keyboard::GetReadyForProgrammingKey(const ProgrammingKeyInfo& keyInfo) {
-    if (keyInfo.KeyColumn >= NUM_COLS)
+eProgrammingStatus Keyboard::CheckProgrammingKey(const ProgrammingKeyInfo& keyInfo) const {
+    // The leader trie is programmed like a key whose macro is the trie
+    bool isLeaderTrie = (keyInfo.KeyRow == LEADER_TRIE_KEY_ROW);
+    if (keyInfo.KeyColumn >= (isLeaderTrie ? 1 : NUM_COLS))
         return PROG_STATUS_INVALID_KEY_COLUMN;
-    if (keyInfo.KeyRow >= NUM_ROWS)
+    if (keyInfo.KeyRow >= NUM_ROWS && !isLeaderTrie)
         return PROG_STATUS_INVALID_KEY_ROW;
     if (keyInfo.MacroLength > (FLASH_SECTOR_SIZE - FLASH_PAGE_SIZE))
         return PROG_STATUS_INVALID_MACRO_LENGTH;
 
+    return PROG_STATUS_OK;
+}
+
+eProgrammingStatus Keyboard::GetReadyForProgrammingKey(const ProgrammingKeyInfo& keyInfo) {
+    eProgrammingStatus status = CheckProgrammingKey(keyInfo);
+    if (status != PROG_STATUS_OK)
+        return status;
+
     curProgKeyInfo = keyInfo;
-    int keyIndex = keyInfo.KeyRow * NUM_COLS + keyInfo.KeyColumn;
-    int sectorNum = GetFlashSectorNum(keyIndex);
+    int sectorNum = GetProgrammingSectorNum(keyInfo);
 
     // Program config page
     KeysFlashConfig flashConfig;
@@ -124,14 +239,13 @@ eProgrammingStatus Keyboard::GetReadyForProgrammingKey(const ProgrammingKeyInfo&
     return PROG_STATUS_OK;
 }
 
-eProgrammingStatus Keyboard::ProgramKeyPacket(uint8_t* data, uint16_t length, uint16_t seq) {
+eProgrammingStatus Keyboard::ProgramKeyPacket(const uint8_t* data, uint16_t length, uint16_t seq) {
     if (seq >= FlashService::Instance().GetNumPagesPerSector())
         return PROG_STATUS_PACKET_OVERFLOW; 
     if (seq == 0)
         return PROG_STATUS_INVALID_PACKET_SEQ;
 
-    int keyIndex = curProgKeyInfo.KeyRow * NUM_COLS + curProgKeyInfo.KeyColumn;
-    int sectorNum = GetFlashSectorNum(keyIndex);
+    int sectorNum = GetProgrammingSectorNum(curProgKeyInfo);
     int pageNum = seq;
 
     FlashService::Instance().WriteToSector(sectorNum, pageNum, data, length);
@@ -141,20 +255,122 @@ eProgrammingStatus Keyboard::ProgramKeyPacket(uint8_t* data, uint16_t length, ui
 
 void Keyboard::ProgrammingEnded() {
     LoadKeysFromFlash();
+    LoadLeaderFromFlash();
     currentState = KEYBOARD_STATE_SCAN;
 }
 
+void Keyboard::GetKeyPosition(int keyIndex, uint16_t& keyColumn, uint16_t& keyRow) const {
+    keyColumn = keyIndex % NUM_COLS;
+    keyRow = keyIndex / NUM_COLS;
+}
+
+bool Keyboard::GetProgrammedKey(int keyIndex, ProgrammingKeyInfo& info, const uint8_t*& macro) {
+    KeysFlashConfig* keyConfig = GetKeyFlashConfig(keyIndex);
+    if (keyConfig == nullptr || keyConfig->MagicNumber != flashMagicNumber)
+        return false;
+
+    GetKeyPosition(keyIndex, info.KeyColumn, info.KeyRow);
+    info.KeyCode = keyConfig->KeyCode;
+    info.MacroLength = keyConfig->MacroLength;
+    macro = (const uint8_t*)keyConfig->MacroBaseAddress;
+
+    return true;
+}
+
+void Keyboard::EraseProgrammedKey(int keyIndex) {
+    if (keyIndex >= (NUM_COLS * NUM_ROWS))
+        return;
+
+    FlashService::Instance().EraseSector(GetFlashSectorNum(keyIndex));
+}
+
+bool Keyboard::SetLayer(int layer, const uint16_t* actions, int numKeys) {
+    if (numKeys != GetNumKeys())
+        return false;
+
+    return keymap.SaveLayer(layer, actions, numKeys);
+}
+
+bool Keyboard::SetCombos(const ComboTable& table) {
+    if (!combos.SetCombos(table.Combos, table.NumCombos, GetNumKeys()))
+        return false;
+
+    comboTable = table;
+    CombosFlashConfig config;
+    config.MagicNumber = flashCombosMagicNumber;
+    config.Table = table;
+    FlashService::Instance().EraseSector(flashCombosSectorNum);
+    FlashService::Instance().WriteToSector(flashCombosSectorNum, 0,
+            (const uint8_t*)&config, sizeof(CombosFlashConfig));
+
+    return true;
+}
+
+bool Keyboard::SetEncoders(const EncoderMap& map) {
+    if (map.NumEncoders != NUM_ENCODERS || map.MaxAcceleration == 0 ||
+            map.MaxAcceleration > MAX_ENCODER_ACCELERATION)
+        return false;
+
+    encoderMap = map;
+    ConfigureEncoders();
+    EncodersFlashConfig config;
+    config.MagicNumber = flashEncodersMagicNumber;
+    config.Map = map;
+    FlashService::Instance().EraseSector(flashEncodersSectorNum);
+    FlashService::Instance().WriteToSector(flashEncodersSectorNum, 0,
+            (const uint8_t*)&config, sizeof(EncodersFlashConfig));
+
+    return true;
+}
+
+void Keyboard::GetLayer(int layer, uint16_t* actions, int numKeys) const {
+    keymap.GetLayer(layer, actions, numKeys);
+}
+
 void Keyboard::Main() {
+    uint64_t now = time_us_64();
     if (currentState == KEYBOARD_STATE_SCAN)
-        Scan();
+        Scan(now);
     else if  (currentState == KEYBOARD_STATE_MACRO)
         PlayMacro();
 
+    mouseKeys.Update(now);
     HidTask();
+
+    // Held keys, debouncing and macros all run at the ceiling rate
+    bool isActive = matrix.IsAnyKeyDown() || currentState != KEYBOARD_STATE_SCAN;
+    scanPeriodUs = scanRatePolicy.Update(isActive, now);
+}
+
+bool Keyboard::IsIdle() const {
+    if (currentState != KEYBOARD_STATE_SCAN || sendReport || sendConsumerReport)
+        return false;
+    if (mouseKeys.IsMoving() || mouseKeys.HasReport())
+        return false;
+    if (combos.IsPending() || tapHold.IsPending() || leader.IsActive() || numDeferredReleases > 0)
+        return false;
+
+    if (!matrix.IsIdle())
+        return false;
+    for (int i = 0; i < numEncoders; i++) {
+        if (pendingDetents[i] != 0 || encoders[i].HasPendingSteps())
+            return false;
+    }
+    return true;
+}
+
+void Keyboard::EnterIdle(bool isWakeArmed, MatrixWakeCallback wakeCallback) {
+    scanner->EnterIdle(isWakeArmed, wakeCallback);
+    gpioEncoders.SetWakeCallback(isWakeArmed ? wakeCallback : nullptr);
+}
+
+void Keyboard::ExitIdle() {
+    gpioEncoders.SetWakeCallback(nullptr);
+    scanner->ExitIdle();
 }
 
 void Keyboard::HidTask() {
-    if (!sendReport)
+    if (!sendReport && !sendConsumerReport && !mouseKeys.HasReport())
         return;
 
     if (tud_suspended()) {
@@ -171,80 +387,326 @@ bool Keyboard::SendReport() {
     // skip if hid is not ready yet
     if (!tud_hid_ready())
         return false;
+    // Keys go first, the consumer report takes the next free slot and
+    // mouse motion the one after, piling up in mouseKeys meanwhile
+    if (!sendReport)
+        return sendConsumerReport ? SendConsumerReport() : SendMouseReport();
 
     tud_hid_keyboard_report(REPORT_ID_KEYBOARD, report.GetModifiers(), report.GetKeycodes());
     sendReport = false;
+
+    // Releases held back for this report go in the next one
+    numBatchPresses = 0;
+    for (int i = 0; i < numDeferredReleases; i++) {
+        eKeyActionKind kind = GetKeyActionKind(deferredReleases[i]);
+        report.Remove(kind == KEY_ACTION_MODIFIER, GetKeyActionCode(deferredReleases[i]));
+        sendReport = true;
+    }
+    numDeferredReleases = 0;
+    reportSentTime = time_us_64();
+    PowerManager::Instance().OnReportSent();
     
     return true;
 }
 
-void Keyboard::Scan() {
-    for (int col = 0; col < NUM_COLS; col++) {
-        gpio_put(colPins[col], false);
-        for (int row = 0; row < NUM_ROWS; row++) {
-            Key& key = keys[row][col];
-            if (!gpio_get(rowPins[row])) {
-                // Key was pressed
-                
-                
-                key.DebounceCounter += 1;
-                if (key.IsLongPressed) {
-                    if (time_us_64() - key.PressStart > settings(AUTO_REPEAT_DELAY)) {
-                        key.PressStart = time_us_64();
-                        std::cout << "(" << row << ", " << col << ") other auto delay" << std::endl;
-                        report.Add(key.IsModifier, key.Code);
-                        sendReport = true;
-                    }
-                }
-                else if (key.IsPressed && !key.IsLongPressed) {
-                    if (time_us_64() - key.PressStart > settings(AUTO_REPEAT_FIRST_DELAY)) {
-                        key.IsLongPressed = true;
-                        key.PressStart = time_us_64();
-                        std::cout << "(" << row << ", " << col << ") first auto delay" << std::endl;
-                        report.Add(key.IsModifier, key.Code);
-                        sendReport = true;
-                    }
-                }
-                else {
-                    if (key.DebounceCounter > settings(DEBOUNCE_MAX)) {
-                        // Check if it is a macro, if it is, change to macro state and break out
-                        if (key.Macro != nullptr && key.MacroLength > 0) {
-                            currentRow = row;
-                            currentCol = col;
-                            currentState = KEYBOARD_STATE_MACRO;
-                            break;
-                        }
-
-                        key.DebounceCounter = 0;
-                        key.IsPressed = true;
-                        key.PressStart = time_us_64();
-                        std::cout << "(" << row << ", " << col << ") is pressed" << std::endl;
-                        report.Add(key.IsModifier, key.Code);
-                        sendReport = true;
-                    }
-                }
-            }
-            else {
-                if (key.IsPressed) {
-                    // Key was released
-                    key.Reset();
-                    std::cout << "(" << row << ", " << col << ") was released" << std::endl;
-                    report.Remove(key.IsModifier, key.Code);
-                    sendReport = true;
-                }
-            }
+bool Keyboard::SendConsumerReport() {
+    tud_hid_report(REPORT_ID_CONSUMER_CONTROL, &consumerUsage, sizeof(consumerUsage));
+    sendConsumerReport = false;
+    isConsumerPressPending = false;
+    if (isConsumerReleaseDeferred) {
+        isConsumerReleaseDeferred = false;
+        consumerUsage = 0;
+        sendConsumerReport = true;
+    }
+    reportSentTime = time_us_64();
+    PowerManager::Instance().OnReportSent();
+
+    return true;
+}
+
+bool Keyboard::SendMouseReport() {
+    MouseMotion motion;
+    mouseKeys.TakeReport(motion);
+    tud_hid_report(REPORT_ID_MOUSE, &motion, sizeof(motion));
+    reportSentTime = time_us_64();
+    PowerManager::Instance().OnReportSent();
+
+    return true;
+}
+
+uint8_t Keyboard::GetMouseFeature() const {
+    return (mouseKeys.IsVerticalHighResolution() ? 0x01 : 0) |
+        (mouseKeys.IsHorizontalHighResolution() ? 0x04 : 0);
+}
+
+void Keyboard::SetMouseFeature(uint8_t feature) {
+    mouseKeys.SetHighResolution((feature & 0x03) != 0, (feature & 0x0C) != 0);
+}
+
+void Keyboard::OnSettingsChanged(const SettingsCache& cache) {
+    Keyboard& keyboard = Instance();
+    keyboard.scanSettings = cache;
+    keyboard.matrix.Configure(cache.DebounceUs, cache.RepeatFirstDelayUs, cache.RepeatPeriodUs);
+    keyboard.scanRatePolicy.Configure(cache.ScanPeriodMinUs, cache.ScanPeriodMaxUs,
+            cache.IdleTimeoutUs);
+    keyboard.sofSync.Configure(cache.IsSofSyncEnabled, cache.HidPollIntervalMs);
+    keyboard.tapHold.Configure(cache.TappingTermUs, cache.IsPermissiveHold, cache.IsHoldOnOtherKeyPress);
+    keyboard.combos.Configure(cache.ComboWindowUs);
+    keyboard.leader.Configure(cache.LeaderTimeoutUs);
+    keyboard.recorder.Configure(cache.RecordQuantumMs, cache.RecordIdleTrimMs);
+    keyboard.mouseKeys.Configure((eMouseCurve)cache.MouseCurve, cache.MouseTickUs,
+            cache.MouseAccelTimeUs, cache.MouseSpeedMin, cache.MouseSpeedMax,
+            cache.WheelSpeedMin, cache.WheelSpeedMax);
+}
+
+void Keyboard::OnComboKey(int keyIndex, bool isPressed, uint64_t time) {
+    Instance().tapHold.OnKeyEvent(keyIndex, isPressed, time);
+}
+
+void Keyboard::OnComboAction(uint16_t action, bool isPressed) {
+    if (isPressed)
+        Instance().PressAction(action);
+    else
+        Instance().ReleaseAction(action);
+}
+
+uint16_t Keyboard::ResolveTapHoldAction(int keyIndex) {
+    return Instance().keymap.Resolve(keyIndex).Action;
+}
+
+void Keyboard::ApplyTapHoldAction(int keyIndex, uint16_t action, bool isPressed) {
+    Keyboard& keyboard = Instance();
+    if (isPressed) {
+        keyboard.GetKeyAt(keyIndex).Action = action;
+        keyboard.PressAction(action);
+    }
+    else {
+        keyboard.ReleaseAction(action);
+    }
+}
+
+bool Keyboard::OnKeyPress(int row, int col, uint64_t time) {
+    Keyboard& keyboard = Instance();
+    int keyIndex = keyboard.GetKeyIndex(row, col);
+    UsageAnalytics& analytics = UsageAnalytics::Instance();
+
+    if (keyboard.leader.IsActive()) {
+        // Keys of a leader sequence only walk the trie
+        analytics.OnKeyPress(keyIndex);
+        keyboard.leaderKeysMask |= (1u << keyIndex);
+        keyboard.OnLeaderResult(keyboard.leader.OnKey(keyIndex, time));
+        return true;
+    }
+
+    // Macros belong to the programmed key, so only play on the base layer,
+    // and not while combo or tap-hold keys hold back the events after them
+    const ResolvedKey& resolved = keyboard.keymap.Resolve(keyIndex);
+    const Key& key = keyboard.keys[row][col];
+    if (resolved.Layer == 0 && key.Macro != nullptr && key.MacroLength > 0 &&
+            !keyboard.combos.IsPending() && !keyboard.tapHold.IsPending()) {
+        analytics.OnKeyPress(keyIndex);
+        analytics.OnMacroPlay(keyIndex);
+        keyboard.StartMacro(key.Macro, key.MacroLength);
+        return false;
+    }
+
+    std::cout << "(" << row << ", " << col << ") is pressed" << std::endl;
+    analytics.OnKeyPress(keyIndex);
+    keyboard.combos.OnKeyEvent(keyIndex, true, time);
+    return true;
+}
+
+void Keyboard::OnKeyRelease(int row, int col, uint64_t time) {
+    Keyboard& keyboard = Instance();
+    std::cout << "(" << row << ", " << col << ") was released" << std::endl;
+    uint16_t bit = 1u << keyboard.GetKeyIndex(row, col);
+    if (keyboard.leaderKeysMask & bit)
+        keyboard.leaderKeysMask &= ~bit;
+    else
+        keyboard.combos.OnKeyEvent(keyboard.GetKeyIndex(row, col), false, time);
+}
+
+void Keyboard::OnKeyRepeat(int row, int col) {
+    Keyboard& keyboard = Instance();
+    std::cout << "(" << row << ", " << col << ") auto repeat" << std::endl;
+    keyboard.RepeatAction(keyboard.keys[row][col].Action);
+}
+
+void Keyboard::Scan(uint64_t now) {
+    if (!matrix.Scan(*scanner, now))
+        return;
+
+    combos.Update(now);
+    tapHold.Update(now);
+    OnLeaderResult(leader.Update(now));
+    ScanEncoders(now);
+}
+
+void Keyboard::ScanEncoders(uint64_t now) {
+    for (int i = 0; i < numEncoders; i++) {
+        int32_t detents = pendingDetents[i] + encoders[i].TakeDetents(now);
+        if (detents > MAX_PENDING_DETENTS)
+            detents = MAX_PENDING_DETENTS;
+        else if (detents < -MAX_PENDING_DETENTS)
+            detents = -MAX_PENDING_DETENTS;
+        pendingDetents[i] = detents;
+    }
+
+    // Every detent is a tap of its action, with a report of its own for
+    // the press and the release, so wait for the last one to go out
+    if (sendReport || sendConsumerReport || numDeferredReleases > 0 || currentState != KEYBOARD_STATE_SCAN)
+        return;
+
+    for (int i = 0; i < numEncoders; i++) {
+        if (pendingDetents[i] == 0)
+            continue;
+
+        bool isClockwise = pendingDetents[i] > 0;
+        pendingDetents[i] += isClockwise ? -1 : 1;
+        uint16_t action = isClockwise ? encoderMap.Encoders[i].Clockwise :
+            encoderMap.Encoders[i].CounterClockwise;
+        if (action == KEY_ACTION_NONE)
+            continue;
+
+        PressAction(action);
+        ReleaseAction(action);
+        return;
+    }
+}
+
+void Keyboard::OnLeaderResult(eLeaderResult result) {
+    if (result == LEADER_RESULT_MATCH) {
+        UsageAnalytics::Instance().OnLeaderPlay();
+        StartMacro(leader.GetMacro(), leader.GetMacroLength());
+    }
+}
+
+void Keyboard::PressAction(uint16_t action) {
+    eKeyActionKind kind = GetKeyActionKind(action);
+    if (kind == KEY_ACTION_KEY || kind == KEY_ACTION_MODIFIER) {
+        report.Add(kind == KEY_ACTION_MODIFIER, GetKeyActionCode(action));
+        sendReport = true;
+        if (numBatchPresses < MAX_BATCH_ACTIONS)
+            batchPresses[numBatchPresses++] = action;
+        recorder.Record(GetKeyActionCode(action), kind == KEY_ACTION_MODIFIER, true, time_us_64());
+    }
+    else if (kind == KEY_ACTION_MACRO) {
+        int keyIndex = GetKeyActionCode(action);
+        if (keyIndex < GetNumKeys()) {
+            UsageAnalytics::Instance().OnMacroPlay(keyIndex);
+            StartMacro(GetKeyAt(keyIndex).Macro, GetKeyAt(keyIndex).MacroLength);
         }
-        gpio_put(colPins[col], true);
+    }
+    else if (kind == KEY_ACTION_LEADER) {
+        leader.Start(time_us_64());
+    }
+    else if (kind == KEY_ACTION_RECORD) {
+        if (recorder.IsRecording())
+            CommitRecording();
+        else if (GetKeyActionCode(action) < GetNumKeys())
+            recorder.Start(GetKeyActionCode(action));
+    }
+    else if (kind == KEY_ACTION_CONSUMER) {
+        consumerUsage = GetKeyActionUsage(action);
+        sendConsumerReport = true;
+        isConsumerPressPending = true;
+    }
+    else if (kind == KEY_ACTION_MOUSE) {
+        mouseKeys.OnAction(GetKeyActionCode(action), true, time_us_64());
+    }
+    else {
+        keymap.OnLayerAction(action, true);
+    }
+}
+
+void Keyboard::RepeatAction(uint16_t action) {
+    // Layer keys do not auto repeat, nor keys still held back by a tap-hold key
+    if (action == KEY_ACTION_NONE)
+        return;
+
+    eKeyActionKind kind = GetKeyActionKind(action);
+    if (kind == KEY_ACTION_KEY || kind == KEY_ACTION_MODIFIER) {
+        report.Add(kind == KEY_ACTION_MODIFIER, GetKeyActionCode(action));
+        sendReport = true;
+    }
+}
+
+void Keyboard::ReleaseAction(uint16_t action) {
+    eKeyActionKind kind = GetKeyActionKind(action);
+    if (kind == KEY_ACTION_KEY || kind == KEY_ACTION_MODIFIER) {
+        recorder.Record(GetKeyActionCode(action), kind == KEY_ACTION_MODIFIER, false, time_us_64());
+        if (IsInBatch(action) && numDeferredReleases < MAX_BATCH_ACTIONS) {
+            deferredReleases[numDeferredReleases++] = action;
+            return;
+        }
+        report.Remove(kind == KEY_ACTION_MODIFIER, GetKeyActionCode(action));
+        sendReport = true;
+    }
+    else if (kind == KEY_ACTION_CONSUMER) {
+        // Another usage pressed since replaced this one
+        if (consumerUsage != GetKeyActionUsage(action))
+            return;
+        if (isConsumerPressPending) {
+            isConsumerReleaseDeferred = true;
+            return;
+        }
+        consumerUsage = 0;
+        sendConsumerReport = true;
+    }
+    else if (kind == KEY_ACTION_MOUSE) {
+        mouseKeys.OnAction(GetKeyActionCode(action), false, time_us_64());
+    }
+    else {
+        keymap.OnLayerAction(action, false);
+    }
+}
+
+void Keyboard::StartMacro(const MacroKey* macro, uint16_t macroLength) {
+    if (macro == nullptr || macroLength == 0)
+        return;
+
+    currentMacro = macro;
+    currentMacroLength = macroLength;
+    currentState = KEYBOARD_STATE_MACRO;
+}
+
+void Keyboard::CommitRecording() {
+    int numKeys = recorder.Stop();
+    int keyIndex = recorder.GetTargetKeyIndex();
+    // An empty recording keeps the macro the key had
+    if (numKeys == 0)
+        return;
+
+    // The key keeps its base layer action, only its macro is replaced
+    uint16_t baseActions[MAX_LAYER_KEYS];
+    keymap.GetLayer(0, baseActions, GetNumKeys());
+    ProgrammingKeyInfo info;
+    GetKeyPosition(keyIndex, info.KeyColumn, info.KeyRow);
+    info.KeyCode = baseActions[keyIndex];
+    info.MacroLength = (uint16_t)numKeys;
+    if (GetReadyForProgrammingKey(info) != PROG_STATUS_OK)
+        return;
+
+    // The whole arena in one write, the config page was written above
+    FlashService::Instance().WriteToSector(GetFlashSectorNum(keyIndex), flashKeyConfigPageNum + 1,
+            (const uint8_t*)recorder.GetKeys(), numKeys * sizeof(MacroKey));
+
+    // Not LoadKeysFromFlash, that would reset the keys held for the stop chord
+    const KeysFlashConfig* keyConfig = GetKeyFlashConfig(keyIndex);
+    GetKeyAt(keyIndex).Macro = reinterpret_cast<MacroKey*>(keyConfig->MacroBaseAddress);
+    GetKeyAt(keyIndex).MacroLength = keyConfig->MacroLength;
+}
 
-        // changed to macro state, no need to continue the scan
-        if (currentState == KEYBOARD_STATE_MACRO)
-            break;
+bool Keyboard::IsInBatch(uint16_t action) const {
+    for (int i = 0; i < numBatchPresses; i++) {
+        if (batchPresses[i] == action)
+            return true;
     }
+    return false;
 }
 
 void Keyboard::PlayMacro() {
-    Key& key = keys[currentCol][currentRow];
-    MacroKey& mKey = key.Macro[currentMacroKeyIndex];
+    const MacroKey& mKey = currentMacro[currentMacroKeyIndex];
 
     if (isInPostDelay) {
         if ((time_us_64() - macroPostDelay) > (mKey.DelayMs * 1000)) {
@@ -268,7 +730,7 @@ void Keyboard::PlayMacro() {
 
     }
 
-    if (currentMacroKeyIndex == key.MacroLength) {
+    if (currentMacroKeyIndex == currentMacroLength) {
         currentMacroKeyIndex = 0;
         isInPostDelay = false;
         report.Reset();
@@ -277,30 +739,45 @@ void Keyboard::PlayMacro() {
     }
 }   
 
+void Keyboard::OnReportComplete() {
+    PROFILE_RECORD(PROFILER_STAGE_REPORT_WAIT, (uint32_t)(time_us_64() - reportSentTime));
+    sofSync.OnReportComplete();
+}
+
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint8_t len) {
-    // TODO: implement
-    (void)instance;
     (void)report;
     (void)len;
+
+    if (instance == HID_INSTANCE_RAW) {
+        RawHidTransport::Instance().OnReportComplete();
+        return;
+    }
+    Keyboard::Instance().OnReportComplete();
 }
 
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen) {
-    // TODO: implement
-    (void)instance;
-    (void)report_id;
-    (void)report_type;
-    (void)buffer;
-    (void)reqlen;
+    if (instance == HID_INSTANCE_KEYBOARD && report_id == REPORT_ID_MOUSE &&
+            report_type == HID_REPORT_TYPE_FEATURE && reqlen >= 1) {
+        buffer[0] = Keyboard::Instance().GetMouseFeature();
+        return 1;
+    }
 
+    // TODO: implement the other reports
     return 0;
 }
 
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize) {
-    // TODO: implemet
-    (void)instance;
-    (void)report_id;
-    (void)report_type;
-    (void)buffer;
-    (void)bufsize;
-}
+    // Reports of the OUT endpoint carry the messages stream
+    if (instance == HID_INSTANCE_RAW) {
+        RawHidTransport::Instance().OnReport(buffer, bufsize);
+        return;
+    }
 
+    // The wheel resolution multipliers. Older TinyUSB passes the report
+    // id as the first byte, newer ones strip it.
+    if (report_id == REPORT_ID_MOUSE && report_type == HID_REPORT_TYPE_FEATURE && bufsize >= 1) {
+        if (bufsize >= 2 && buffer[0] == REPORT_ID_MOUSE)
+            buffer++;
+        Keyboard::Instance().SetMouseFeature(buffer[0]);
+    }
+}
@@ -7,66 +7,31 @@
 #include "tusb.h"
 #include "usb_descriptors.h"
 #include "message.h"
-
-enum eProgrammingStatus {
-    PROG_STATUS_OK = 0,
-    PROG_STATUS_INVALID_KEY_COLUMN = 0x1,
-    PROG_STATUS_INVALID_KEY_ROW = 0x2,
-    PROG_STATUS_INVALID_MACRO_LENGTH = 0x4,
-    PROG_STATUS_INVALID_PACKET_SEQ = 0x8,
-    PROG_STATUS_PACKET_OVERFLOW = 0x10
-};
-
-struct ProgrammingKeyInfo {
-    uint16_t KeyColumn;
-    uint16_t KeyRow;
-    uint16_t KeyCode;
-    uint16_t MacroLength;
-};
-
-struct MacroKey {
-    uint16_t Code;
-    uint8_t IsModifier;
-    uint8_t IsPressed;
-    uint32_t DelayMs;
-};
-
-struct Key {
-    bool IsPressed;
-    bool IsLongPressed;
-    uint64_t PressStart;
-    uint32_t DebounceCounter;
-    uint8_t Code;
-    bool IsModifier;
-    MacroKey* Macro;
-    uint16_t MacroLength;
-
-    Key() {
-        Reset();
-    }
-
-    Key(uint8_t code, bool isModifier = false) {
-        Reset();
-        Code = code;
-        IsModifier = isModifier;
-    }
-
-    void Reset() {
-        IsPressed = false;
-        IsLongPressed = false;
-        PressStart = 0;
-        DebounceCounter = 0;
-
-        IsModifier = false;
-        Macro = nullptr;
-        MacroLength = 0;
-    }
-};
+#include "message_payloads.h"
+#include "flash_service.h"
+#include "flash_layout.h"
+#include "scan_rate_policy.h"
+#include "gpio_matrix_scanner.h"
+#include "pio_matrix_scanner.h"
+#include "sof_sync.h"
+#include "key_matrix.h"
+#include "keymap.h"
+#include "tap_hold.h"
+#include "combos.h"
+#include "leader.h"
+#include "macro_recorder.h"
+#include "mouse_keys.h"
+#include "encoder.h"
+#include "gpio_encoders.h"
 
 class Keyboard {
 private:
     static const uint8_t NUM_COLS = 3;
     static const uint8_t NUM_ROWS = 3;
+    static_assert(NUM_ROWS * NUM_COLS <= MAX_LAYER_KEYS, "Keys do not fit the keymap layers");
+    static_assert(NUM_ROWS * NUM_COLS <= Combos::MAX_KEYS, "Keys do not fit the combo lookup");
+
+    static const int MAX_BATCH_ACTIONS = 8;
 
     static const uint8_t COL0_PIN = 28;
     static const uint8_t COL1_PIN = 27;
@@ -76,9 +41,27 @@ private:
     static const uint8_t ROW1_PIN = 6;
     static const uint8_t ROW2_PIN = 5;
 
-    const uint32_t flashFirstKeySectorNum = 1;
+    // Rotary encoders of the second board revision, see MACROPAD_ENCODERS
+    static const int NUM_ENCODERS = 2;
+    static_assert(NUM_ENCODERS <= MAX_ENCODERS, "Encoders do not fit the encoder map");
+    static const uint8_t ENCODER_STEPS_PER_DETENT = 4;
+    static const uint8_t MAX_ENCODER_ACCELERATION = 16;
+    // Detents waiting for their reports, turning faster than that drops some
+    static const int32_t MAX_PENDING_DETENTS = 32;
+
+    static const uint8_t ENC0_A_PIN = 2;
+    static const uint8_t ENC0_B_PIN = 3;
+    static const uint8_t ENC1_A_PIN = 8;
+    static const uint8_t ENC1_B_PIN = 9;
+
+    const uint32_t flashFirstKeySectorNum = FLASH_FIRST_KEY_SECTOR;
     const uint8_t flashKeyConfigPageNum = 0;
     const uint32_t flashMagicNumber = 0xDDCCBBAA;
+    const uint32_t flashCombosSectorNum = FLASH_COMBOS_SECTOR;
+    const uint32_t flashCombosMagicNumber = 0xFFEEDDCC;
+    const uint32_t flashLeaderSectorNum = FLASH_LEADER_SECTOR;
+    const uint32_t flashEncodersSectorNum = FLASH_ENCODERS_SECTOR;
+    const uint32_t flashEncodersMagicNumber = 0x00FFEEDD;
 
     struct KeysFlashConfig {
         uint32_t MagicNumber;
@@ -87,6 +70,16 @@ private:
         uint32_t MacroBaseAddress;
     };
 
+    struct CombosFlashConfig {
+        uint32_t MagicNumber;
+        ComboTable Table;
+    };
+
+    struct EncodersFlashConfig {
+        uint32_t MagicNumber;
+        EncoderMap Map;
+    };
+
     enum KeyboardStates {
         KEYBOARD_STATE_SCAN,
         KEYBOARD_STATE_MACRO,
@@ -103,9 +96,58 @@ public:
     void Main();
 
     void ProgrammingStarted();
+    // The checks of GetReadyForProgrammingKey(), nothing is written
+    eProgrammingStatus CheckProgrammingKey(const ProgrammingKeyInfo& info) const;
     eProgrammingStatus GetReadyForProgrammingKey(const ProgrammingKeyInfo& info);
-    eProgrammingStatus ProgramKeyPacket(uint8_t* data, uint16_t length, uint16_t seq);
+    eProgrammingStatus ProgramKeyPacket(const uint8_t* data, uint16_t length, uint16_t seq);
+    inline uint16_t GetMaxPacketsPerKey() const {
+        return FlashService::Instance().GetNumPagesPerSector() - (flashKeyConfigPageNum + 1);
+    }
     void ProgrammingEnded();
+
+    // Period until the next Main() call, from the adaptive scan rate
+    inline uint32_t GetScanPeriod() const { return scanPeriodUs; }
+    inline const ScanRateStats& GetScanRateStats() const { return scanRatePolicy.GetStats(); }
+
+    // From tud_sof_cb, returns the time the next scan should run or 0
+    inline uint64_t OnSof(uint32_t frameCount, uint32_t currentFrame) {
+        return sofSync.OnSof(frameCount, currentFrame, time_us_64());
+    }
+    void OnReportComplete();
+
+    // Replaces the hardware scanner, call before Initialize()
+    inline void SetScanner(MatrixScanner* matrixScanner) { scanner = matrixScanner; }
+
+    // True if no key is held and nothing is left to play or report
+    bool IsIdle() const;
+    // Drives every column low so a keypress pulls its row low, and
+    // optionally arms a falling edge interrupt on the rows
+    void EnterIdle(bool isWakeArmed, MatrixWakeCallback wakeCallback);
+    // Safe to call from the wake interrupt
+    void ExitIdle();
+
+    inline int GetNumKeys() const { return NUM_ROWS * NUM_COLS; }
+    void GetKeyPosition(int keyIndex, uint16_t& keyColumn, uint16_t& keyRow) const;
+    bool GetProgrammedKey(int keyIndex, ProgrammingKeyInfo& info, const uint8_t*& macro);
+    void EraseProgrammedKey(int keyIndex);
+
+    // Layer 0 is made of the programmed keys
+    bool SetLayer(int layer, const uint16_t* actions, int numKeys);
+    void GetLayer(int layer, uint16_t* actions, int numKeys) const;
+    inline uint16_t GetActiveLayers() const { return keymap.GetActiveMask(); }
+
+    bool SetCombos(const ComboTable& table);
+    inline const ComboTable& GetCombos() const { return comboTable; }
+
+    bool SetEncoders(const EncoderMap& map);
+    inline const EncoderMap& GetEncoders() const { return encoderMap; }
+
+    // Mouse feature report, the wheel resolution multipliers in bits 1..0
+    // (vertical) and 3..2 (horizontal)
+    uint8_t GetMouseFeature() const;
+    void SetMouseFeature(uint8_t feature);
+    // The host sets the multipliers again after enumeration if it uses them
+    inline void OnMount() { mouseKeys.SetHighResolution(false, false); }
  
 private:
     Keyboard();
@@ -113,11 +155,33 @@ private:
     void LoadDefaultKeys();
     void LoadKeysFromFlash();
     KeysFlashConfig* GetKeyFlashConfig(int keyIndex);
+    void LoadCombosFromFlash();
+    void LoadLeaderFromFlash();
+    void LoadEncodersFromFlash();
+    void ConfigureEncoders();
   
-    void Scan();
+    static void OnSettingsChanged(const SettingsCache& cache);
+    static bool OnKeyPress(int row, int col, uint64_t time);
+    static void OnKeyRelease(int row, int col, uint64_t time);
+    static void OnKeyRepeat(int row, int col);
+    static void OnComboKey(int keyIndex, bool isPressed, uint64_t time);
+    static void OnComboAction(uint16_t action, bool isPressed);
+    static uint16_t ResolveTapHoldAction(int keyIndex);
+    static void ApplyTapHoldAction(int keyIndex, uint16_t action, bool isPressed);
+    void Scan(uint64_t now);
+    void ScanEncoders(uint64_t now);
+    void PressAction(uint16_t action);
+    void RepeatAction(uint16_t action);
+    void ReleaseAction(uint16_t action);
+    bool IsInBatch(uint16_t action) const;
+    void StartMacro(const MacroKey* macro, uint16_t macroLength);
+    void CommitRecording();
+    void OnLeaderResult(eLeaderResult result);
     void PlayMacro();
     void HidTask();
     bool SendReport();
+    bool SendConsumerReport();
+    bool SendMouseReport();
 
     // Invoked when sent REPORT successfully to host
     // Application can use this to send the next report
@@ -137,19 +201,67 @@ private:
         return flashFirstKeySectorNum + keyIndex;
     }
 
+    // Where LoadKeysFromFlash places the programmed key indexes
+    inline int GetKeyIndex(int row, int col) const {
+        return col * NUM_ROWS + row;
+    }
+    inline int GetProgrammingSectorNum(const ProgrammingKeyInfo& info) {
+        if (info.KeyRow == LEADER_TRIE_KEY_ROW)
+            return flashLeaderSectorNum;
+        return GetFlashSectorNum(info.KeyRow * NUM_COLS + info.KeyColumn);
+    }
+    inline Key& GetKeyAt(int keyIndex) {
+        return keys[keyIndex % NUM_ROWS][keyIndex / NUM_ROWS];
+    }
+
 private:
     uint8_t colPins[NUM_COLS];
     uint8_t rowPins[NUM_ROWS];
+    GpioMatrixScanner gpioScanner;
+    PioMatrixScanner pioScanner;
+    MatrixScanner* scanner;
     Key keys[NUM_ROWS][NUM_COLS];
+    KeyMatrix matrix;
+    Keymap keymap;
+    TapHold tapHold;
+    Combos combos;
+    ComboTable comboTable;
+    Leader leader;
+    uint16_t leaderKeysMask;    // Keys pressed as part of a leader sequence
+    MacroRecorder recorder;
+    uint8_t encoderAPins[NUM_ENCODERS];
+    uint8_t encoderBPins[NUM_ENCODERS];
+    Encoder encoders[NUM_ENCODERS];
+    GpioEncoders gpioEncoders;
+    int numEncoders;            // 0 on boards without encoders
+    int32_t pendingDetents[NUM_ENCODERS];
+    EncoderMap encoderMap;
+    // Codes pressed since the last report went out. Releasing one of them
+    // waits for that report, or the host would never see a tap.
+    uint16_t batchPresses[MAX_BATCH_ACTIONS];
+    int numBatchPresses;
+    uint16_t deferredReleases[MAX_BATCH_ACTIONS];
+    int numDeferredReleases;
     uint64_t startTime;
     bool sendReport;
     Report report;
-    Settings& settings;
+    // Consumer control report, a usage is released once its press went out
+    uint16_t consumerUsage;
+    bool sendConsumerReport;
+    bool isConsumerPressPending;
+    bool isConsumerReleaseDeferred;
+    // Mouse reports take the slots keyboard and consumer reports leave
+    MouseKeys mouseKeys;
+    SettingsCache scanSettings;
+    ScanRatePolicy scanRatePolicy;
+    uint32_t scanPeriodUs;
+    SofSync sofSync;
+    uint64_t reportSentTime;
     ProgrammingKeyInfo curProgKeyInfo;
 
     KeyboardStates currentState;
-    int currentRow;
-    int currentCol;
+    const MacroKey* currentMacro;
+    uint16_t currentMacroLength;
     int currentMacroKeyIndex;
     bool isInPostDelay;
     uint64_t macroPostDelay;
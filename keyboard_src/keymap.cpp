@@ -0,0 +1,119 @@
+#include "keymap.h"
+#include "../flash_service.h"
+
+Keymap::Keymap() {
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+        for (int i = 0; i < MAX_LAYER_KEYS; i++)
+            layers[layer][i] = KEY_ACTION_TRANSPARENT_ALL;
+    }
+    for (int i = 0; i < MAX_LAYER_KEYS; i++)
+        layers[0][i] = KEY_ACTION_NONE;
+
+    momentaryMask = 0;
+    toggleMask = 0;
+    defaultLayer = 0;
+    UpdateEffective();
+}
+
+void Keymap::Load() {
+    const KeymapFlash* flash = (const KeymapFlash*)FlashService::Instance().
+        GetSectorAddress(flashSectorNum);
+
+    if (flash->MagicNumber == flashMagicNumber && flash->NumLayers == MAX_LAYERS &&
+            flash->NumKeys == MAX_LAYER_KEYS) {
+        for (int layer = 1; layer < MAX_LAYERS; layer++) {
+            for (int i = 0; i < MAX_LAYER_KEYS; i++)
+                layers[layer][i] = flash->Actions[layer][i];
+        }
+    }
+
+    UpdateEffective();
+}
+
+void Keymap::SetBaseAction(int keyIndex, uint16_t action) {
+    if (keyIndex >= MAX_LAYER_KEYS)
+        return;
+
+    // Nothing below the base layer to fall through to
+    if (GetKeyActionKind(action) == KEY_ACTION_TRANSPARENT)
+        action = KEY_ACTION_NONE;
+
+    layers[0][keyIndex] = action;
+    UpdateEffective();
+}
+
+bool Keymap::SaveLayer(int layer, const uint16_t* actions, int numKeys) {
+    if (layer <= 0 || layer >= MAX_LAYERS || numKeys > MAX_LAYER_KEYS)
+        return false;
+
+    for (int i = 0; i < MAX_LAYER_KEYS; i++)
+        layers[layer][i] = (i < numKeys) ? actions[i] : KEY_ACTION_TRANSPARENT_ALL;
+
+    KeymapFlash flash;
+    flash.MagicNumber = flashMagicNumber;
+    flash.NumLayers = MAX_LAYERS;
+    flash.NumKeys = MAX_LAYER_KEYS;
+    for (int l = 0; l < MAX_LAYERS; l++) {
+        for (int i = 0; i < MAX_LAYER_KEYS; i++)
+            flash.Actions[l][i] = layers[l][i];
+    }
+
+    FlashService::Instance().EraseSector(flashSectorNum);
+    FlashService::Instance().WriteToSector(flashSectorNum, 0, (uint8_t*)&flash, sizeof(KeymapFlash));
+
+    UpdateEffective();
+    return true;
+}
+
+void Keymap::GetLayer(int layer, uint16_t* actions, int numKeys) const {
+    for (int i = 0; i < numKeys && i < MAX_LAYER_KEYS; i++)
+        actions[i] = (layer >= 0 && layer < MAX_LAYERS) ? layers[layer][i] : KEY_ACTION_TRANSPARENT_ALL;
+}
+
+void Keymap::OnLayerAction(uint16_t action, bool isPressed) {
+    uint16_t oldMask = GetActiveMask();
+    uint8_t layer = GetKeyActionLayer(action);
+
+    switch (GetKeyActionKind(action)) {
+    case KEY_ACTION_LAYER_MOMENTARY:
+        if (isPressed)
+            momentaryMask |= (1u << layer);
+        else
+            momentaryMask &= ~(1u << layer);
+        break;
+    case KEY_ACTION_LAYER_TOGGLE:
+        if (isPressed)
+            toggleMask ^= (1u << layer);
+        break;
+    case KEY_ACTION_LAYER_DEFAULT:
+        if (isPressed)
+            defaultLayer = layer;
+        break;
+    default:
+        return;
+    }
+
+    if (GetActiveMask() != oldMask)
+        UpdateEffective();
+}
+
+void Keymap::UpdateEffective() {
+    uint16_t activeMask = GetActiveMask();
+
+    for (int i = 0; i < MAX_LAYER_KEYS; i++) {
+        // The highest active layer that is not transparent wins
+        effective[i].Layer = 0;
+        effective[i].Action = layers[0][i];
+        for (int layer = MAX_LAYERS - 1; layer > 0; layer--) {
+            if (!(activeMask & (1u << layer)))
+                continue;
+            if (GetKeyActionKind(layers[layer][i]) == KEY_ACTION_TRANSPARENT)
+                continue;
+
+            effective[i].Layer = layer;
+            effective[i].Action = layers[layer][i];
+            break;
+        }
+        effective[i].Reserved = 0;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include "pico/stdlib.h"
+#include "message_payloads.h"
+#include "flash_layout.h"
+
+// Action a key resolves to on the active layers, and the layer it came from
+struct ResolvedKey {
+    uint16_t Action;
+    uint8_t Layer;
+    uint8_t Reserved;
+};
+
+// Layer stack of the keyboard. Layer 0 comes from the programmed keys, the
+// other layers live in their own flash sector. The effective keymap of the
+// active layers is rebuilt whenever they change, so resolving a key on a
+// press is a single table read.
+class Keymap {
+private:
+    const uint32_t flashSectorNum = FLASH_KEYMAP_SECTOR;
+    const uint32_t flashMagicNumber = 0xEEDDCCBB;
+
+    struct KeymapFlash {
+        uint32_t MagicNumber;
+        uint16_t NumLayers;
+        uint16_t NumKeys;
+        uint16_t Actions[MAX_LAYERS][MAX_LAYER_KEYS];
+    };
+
+public:
+    Keymap();
+
+    // Loads layers 1 and up from flash
+    void Load();
+    void SetBaseAction(int keyIndex, uint16_t action);
+    // Layer 0 can only be changed through key programming
+    bool SaveLayer(int layer, const uint16_t* actions, int numKeys);
+    void GetLayer(int layer, uint16_t* actions, int numKeys) const;
+
+    inline const ResolvedKey& Resolve(int keyIndex) const { return effective[keyIndex]; }
+
+    // Press or release of a layer action
+    void OnLayerAction(uint16_t action, bool isPressed);
+    // Layer 0 is always at the bottom of the stack
+    inline uint16_t GetActiveMask() const {
+        return momentaryMask | toggleMask | (1u << defaultLayer) | 1u;
+    }
+
+private:
+    void UpdateEffective();
+
+private:
+    uint16_t layers[MAX_LAYERS][MAX_LAYER_KEYS];
+    ResolvedKey effective[MAX_LAYER_KEYS];
+    uint16_t momentaryMask;
+    uint16_t toggleMask;
+    uint8_t defaultLayer;
+};
+
+#endif // KEYMAP_H
@@ -0,0 +1,97 @@
+#include "leader.h"
+
+static int CountBits(uint16_t mask) {
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1)
+        count++;
+    return count;
+}
+
+Leader::Leader() {
+    timeoutUs = 1000000;
+    trie = nullptr;
+    isActive = false;
+    currentNode = 0;
+    lastKeyTime = 0;
+    macro = nullptr;
+    macroLength = 0;
+}
+
+void Leader::Configure(uint32_t timeoutUs) {
+    this->timeoutUs = timeoutUs;
+}
+
+bool Leader::SetTrie(const MacroKey* records, uint32_t numRecords) {
+    trie = nullptr;
+    isActive = false;
+    if (records == nullptr || numRecords < 2)
+        return false;
+
+    const LeaderTrieHeader* header = reinterpret_cast<const LeaderTrieHeader*>(records);
+    if (header->Magic != LEADER_TRIE_MAGIC || header->NumNodes == 0 ||
+            1u + header->NumNodes > numRecords)
+        return false;
+
+    // Children always come after their parent, so a walk cannot loop, and
+    // every reference stays inside the records
+    const LeaderNode* nodes = reinterpret_cast<const LeaderNode*>(records + 1);
+    for (uint32_t i = 0; i < header->NumNodes; i++) {
+        const LeaderNode& node = nodes[i];
+        if (node.ChildMask != 0 && (node.FirstChild <= i ||
+                node.FirstChild + CountBits(node.ChildMask) > header->NumNodes))
+            return false;
+        if (node.MacroLength > 0 && (node.MacroStart < 1u + header->NumNodes ||
+                (uint32_t)node.MacroStart + node.MacroLength > numRecords))
+            return false;
+    }
+
+    trie = records;
+    return true;
+}
+
+void Leader::Start(uint64_t now) {
+    if (trie == nullptr)
+        return;
+
+    isActive = true;
+    currentNode = 0;
+    lastKeyTime = now;
+}
+
+eLeaderResult Leader::OnKey(int keyIndex, uint64_t now) {
+    if (!isActive)
+        return LEADER_RESULT_CANCEL;
+
+    const LeaderNode& node = Node(currentNode);
+    uint16_t bit = (keyIndex < 16) ? (1u << keyIndex) : 0;
+    if (!(node.ChildMask & bit)) {
+        isActive = false;
+        return LEADER_RESULT_CANCEL;
+    }
+
+    currentNode = node.FirstChild + CountBits(node.ChildMask & (bit - 1));
+    lastKeyTime = now;
+
+    // Wait for a longer sequence unless this is a leaf
+    const LeaderNode& next = Node(currentNode);
+    if (next.ChildMask != 0)
+        return LEADER_RESULT_CONTINUE;
+    return Match(next);
+}
+
+eLeaderResult Leader::Update(uint64_t now) {
+    if (!isActive || now - lastKeyTime < timeoutUs)
+        return LEADER_RESULT_CONTINUE;
+
+    return Match(Node(currentNode));
+}
+
+eLeaderResult Leader::Match(const LeaderNode& node) {
+    isActive = false;
+    if (node.MacroLength == 0)
+        return LEADER_RESULT_CANCEL;
+
+    macro = trie + node.MacroStart;
+    macroLength = node.MacroLength;
+    return LEADER_RESULT_MATCH;
+}
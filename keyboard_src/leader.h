@@ -0,0 +1,52 @@
+#ifndef LEADER_H
+#define LEADER_H
+
+#include <stdint.h>
+#include "message_payloads.h"
+
+enum eLeaderResult {
+    LEADER_RESULT_CONTINUE = 0,     // Waiting for the next key
+    LEADER_RESULT_MATCH,            // A macro was found
+    LEADER_RESULT_CANCEL            // The sequence matches nothing
+};
+
+// Leader key sequences, matched against the trie programmed in flash.
+// Every key press moves one node down, so matching costs one node read
+// per key whatever the number of sequences. A sequence that is also the
+// start of a longer one plays when the timeout runs out.
+class Leader {
+public:
+    Leader();
+
+    void Configure(uint32_t timeoutUs);
+    // Records points to the programmed trie, it is validated once here
+    bool SetTrie(const MacroKey* records, uint32_t numRecords);
+
+    void Start(uint64_t now);
+    eLeaderResult OnKey(int keyIndex, uint64_t now);
+    // Ends the sequence once no key came within the timeout
+    eLeaderResult Update(uint64_t now);
+
+    inline bool IsActive() const { return isActive; }
+    // The macro of the last LEADER_RESULT_MATCH
+    inline const MacroKey* GetMacro() const { return macro; }
+    inline uint16_t GetMacroLength() const { return macroLength; }
+
+private:
+    inline const LeaderNode& Node(int index) const {
+        return reinterpret_cast<const LeaderNode*>(trie + 1)[index];
+    }
+    eLeaderResult Match(const LeaderNode& node);
+
+private:
+    uint32_t timeoutUs;
+    const MacroKey* trie;       // Header record first, nodes from record 1
+
+    bool isActive;
+    uint16_t currentNode;
+    uint64_t lastKeyTime;
+    const MacroKey* macro;
+    uint16_t macroLength;
+};
+
+#endif // LEADER_H
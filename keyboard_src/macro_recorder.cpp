@@ -0,0 +1,57 @@
+#include "macro_recorder.h"
+
+MacroRecorder::MacroRecorder() {
+    quantumMs = 10;
+    idleTrimMs = 500;
+    isRecording = false;
+    isTruncated = false;
+    targetKeyIndex = 0;
+    numKeys = 0;
+    lastEventTime = 0;
+}
+
+void MacroRecorder::Configure(uint32_t quantumMs, uint32_t idleTrimMs) {
+    this->quantumMs = (quantumMs > 0) ? quantumMs : 1;
+    this->idleTrimMs = idleTrimMs;
+}
+
+void MacroRecorder::Start(int targetKeyIndex) {
+    this->targetKeyIndex = targetKeyIndex;
+    isRecording = true;
+    isTruncated = false;
+    numKeys = 0;
+}
+
+void MacroRecorder::Record(uint16_t code, bool isModifier, bool isPressed, uint64_t now) {
+    if (!isRecording)
+        return;
+    if (numKeys == MAX_RECORDED_KEYS) {
+        isTruncated = true;
+        return;
+    }
+
+    // The delay is played after a key, the wait before the first one is dropped
+    if (numKeys > 0)
+        keys[numKeys - 1].DelayMs = Quantize(now - lastEventTime);
+
+    MacroKey& key = keys[numKeys++];
+    key.Code = code;
+    key.IsModifier = isModifier ? 1 : 0;
+    key.IsPressed = isPressed ? 1 : 0;
+    key.DelayMs = 0;
+    lastEventTime = now;
+}
+
+int MacroRecorder::Stop() {
+    isRecording = false;
+    return numKeys;
+}
+
+uint32_t MacroRecorder::Quantize(uint64_t us) const {
+    uint64_t ms = (us + 500) / 1000;
+    if (ms > idleTrimMs)
+        ms = idleTrimMs;
+
+    uint32_t delay = (uint32_t)((ms + quantumMs / 2) / quantumMs) * quantumMs;
+    return (delay > 0) ? delay : quantumMs;
+}
@@ -0,0 +1,47 @@
+#ifndef MACRO_RECORDER_H
+#define MACRO_RECORDER_H
+
+#include <stdint.h>
+#include "message_payloads.h"
+
+// Records key presses and releases with the time between them into a
+// static arena, so nothing touches flash until the recording is stopped
+// and committed in one write. Delays are rounded to a multiple of the
+// quantum, never below one quantum so every event gets a report of its
+// own, and pauses are trimmed to the idle trim. Keeps no SDK dependency.
+class MacroRecorder {
+public:
+    // A key sector minus its config page
+    static const int MAX_RECORDED_KEYS = (4096 - 256) / sizeof(MacroKey);
+
+public:
+    MacroRecorder();
+
+    void Configure(uint32_t quantumMs, uint32_t idleTrimMs);
+
+    void Start(int targetKeyIndex);
+    void Record(uint16_t code, bool isModifier, bool isPressed, uint64_t now);
+    // Ends the recording, returns the number of recorded keys
+    int Stop();
+
+    inline bool IsRecording() const { return isRecording; }
+    inline int GetTargetKeyIndex() const { return targetKeyIndex; }
+    inline const MacroKey* GetKeys() const { return keys; }
+    inline bool IsTruncated() const { return isTruncated; }
+
+private:
+    uint32_t Quantize(uint64_t us) const;
+
+private:
+    uint32_t quantumMs;
+    uint32_t idleTrimMs;
+
+    bool isRecording;
+    bool isTruncated;
+    int targetKeyIndex;
+    int numKeys;
+    uint64_t lastEventTime;
+    MacroKey keys[MAX_RECORDED_KEYS];
+};
+
+#endif // MACRO_RECORDER_H
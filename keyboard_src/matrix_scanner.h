@@ -0,0 +1,35 @@
+#ifndef MATRIX_SCANNER_H
+#define MATRIX_SCANNER_H
+
+// Free of SDK includes so fakes can be built on the host
+
+#include <stdint.h>
+
+// Raw key matrix, bit (row * numCols + col) is set while the key is down
+typedef uint32_t MatrixState;
+
+// Called from the interrupt that ends an idle period
+typedef void (*MatrixWakeCallback)();
+
+class MatrixScanner {
+public:
+    virtual ~MatrixScanner() {}
+
+    // Returns false if the backend can not run on this board
+    virtual bool Initialize() = 0;
+    // Most recent full matrix snapshot, false if none was taken yet
+    virtual bool Read(MatrixState& state) = 0;
+
+    // Stops scanning with every column driven low so any keypress pulls
+    // its row low, optionally calling wakeCallback on the first row edge,
+    // or at once if a key is already down
+    virtual void EnterIdle(bool isWakeArmed, MatrixWakeCallback wakeCallback) = 0;
+    // Safe to call from the wake interrupt
+    virtual void ExitIdle() = 0;
+
+    static inline MatrixState KeyBit(int row, int col, int numCols) {
+        return (MatrixState)1 << (row * numCols + col);
+    }
+};
+
+#endif // MATRIX_SCANNER_H
@@ -0,0 +1,199 @@
+#include "mouse_keys.h"
+
+static const int32_t ONE = 1 << 16;
+// A report carries at most that much, more waiting is dropped
+static const int32_t MAX_POINTER_PENDING = 127 * ONE;
+static const int32_t MAX_WHEEL_PENDING = 127 * MouseKeys::WHEEL_UNITS_PER_DETENT * ONE;
+// Ticks run late past that many are skipped, not caught up in a burst
+static const uint32_t MAX_LATE_TICKS = 4;
+
+static uint32_t PerTick(uint32_t perSecond, uint32_t tickUs) {
+    return (uint32_t)((((uint64_t)perSecond << 16) * tickUs) / 1000000);
+}
+
+static bool Reaches(uint32_t start, uint32_t top, uint32_t growth, uint32_t numTicks) {
+    uint64_t speed = start;
+    for (uint32_t i = 0; i < numTicks && speed < top; i++)
+        speed += (speed * growth) >> 16;
+    return speed >= top;
+}
+
+static void AddClamped(int32_t& pending, int32_t delta, int32_t limit) {
+    pending += delta;
+    if (pending > limit)
+        pending = limit;
+    else if (pending < -limit)
+        pending = -limit;
+}
+
+// Whole units of pending, rounded toward zero so both directions move alike
+static int32_t Take(int32_t& pending, int32_t unit, int32_t limit) {
+    int32_t count = pending / unit;
+    if (count > limit)
+        count = limit;
+    else if (count < -limit)
+        count = -limit;
+    pending -= count * unit;
+    return count;
+}
+
+MouseKeys::MouseKeys() {
+    directions = 0;
+    buttons = 0;
+    isButtonChanged = false;
+    nextTick = 0;
+    x = 0;
+    y = 0;
+    wheelV = 0;
+    wheelH = 0;
+    isVerticalHighRes = false;
+    isHorizontalHighRes = false;
+    Configure(MOUSE_CURVE_EXPONENTIAL, 8000, 1000000, 100, 1200, 4, 20);
+}
+
+void MouseKeys::Configure(eMouseCurve curve, uint32_t tickUs, uint32_t accelTimeUs,
+        uint32_t speedMin, uint32_t speedMax, uint32_t wheelMin, uint32_t wheelMax) {
+    this->curve = (curve < MOUSE_CURVE_TOTAL) ? curve : MOUSE_CURVE_LINEAR;
+    this->tickUs = (tickUs > 0) ? tickUs : 1;
+
+    uint32_t numTicks = accelTimeUs / this->tickUs;
+    if (numTicks == 0)
+        numTicks = 1;
+    ConfigureRamp(pointer, PerTick(speedMin, this->tickUs), PerTick(speedMax, this->tickUs), numTicks);
+    ConfigureRamp(wheel, PerTick(wheelMin * WHEEL_UNITS_PER_DETENT, this->tickUs),
+            PerTick(wheelMax * WHEEL_UNITS_PER_DETENT, this->tickUs), numTicks);
+}
+
+void MouseKeys::ConfigureRamp(Ramp& ramp, uint32_t start, uint32_t top, uint32_t numTicks) {
+    ramp.Start = (start > 0) ? start : 1;
+    ramp.Top = (top > ramp.Start) ? top : ramp.Start;
+    ramp.Step = 0;
+
+    if (curve == MOUSE_CURVE_LINEAR) {
+        ramp.Step = (ramp.Top - ramp.Start) / numTicks;
+        if (ramp.Step == 0 && ramp.Top > ramp.Start)
+            ramp.Step = 1;
+    }
+    else if (curve == MOUSE_CURVE_EXPONENTIAL) {
+        // Smallest growth reaching the top in numTicks, searched once
+        // here so a tick is a single multiply
+        uint32_t low = 0;
+        uint32_t high = 1u << 20;
+        while (low < high) {
+            uint32_t mid = low + (high - low) / 2;
+            if (Reaches(ramp.Start, ramp.Top, mid, numTicks))
+                high = mid;
+            else
+                low = mid + 1;
+        }
+        ramp.Step = low;
+    }
+    Reset(ramp);
+}
+
+void MouseKeys::Reset(Ramp& ramp) {
+    ramp.Speed = (curve == MOUSE_CURVE_CONSTANT) ? ramp.Top : ramp.Start;
+}
+
+void MouseKeys::Accelerate(Ramp& ramp) {
+    if (curve == MOUSE_CURVE_LINEAR)
+        ramp.Speed += ramp.Step;
+    else if (curve == MOUSE_CURVE_EXPONENTIAL)
+        ramp.Speed += (uint32_t)(((uint64_t)ramp.Speed * ramp.Step) >> 16);
+
+    if (ramp.Speed > ramp.Top)
+        ramp.Speed = ramp.Top;
+}
+
+void MouseKeys::SetHighResolution(bool isVertical, bool isHorizontal) {
+    isVerticalHighRes = isVertical;
+    isHorizontalHighRes = isHorizontal;
+}
+
+void MouseKeys::OnAction(uint8_t code, bool isPressed, uint64_t now) {
+    if (code >= MOUSE_CODE_BUTTON_1) {
+        if (code - MOUSE_CODE_BUTTON_1 >= NUM_BUTTONS)
+            return;
+        uint8_t bit = (uint8_t)(1u << (code - MOUSE_CODE_BUTTON_1));
+        buttons = isPressed ? (buttons | bit) : (buttons & ~bit);
+        isButtonChanged = true;
+        return;
+    }
+    if (code > MOUSE_CODE_WHEEL_RIGHT)
+        return;
+
+    uint8_t bit = (uint8_t)(1u << code);
+    if (!isPressed) {
+        directions &= ~bit;
+        return;
+    }
+
+    // The ramp starts over with the first key of its group
+    uint8_t group = (bit & POINTER_MASK) ? POINTER_MASK : WHEEL_MASK;
+    if ((directions & group) == 0)
+        Reset((group == POINTER_MASK) ? pointer : wheel);
+    if (directions == 0)
+        nextTick = now + tickUs;
+    directions |= bit;
+
+    // The nudge moves a whole pixel or detent even below the start speed
+    bool isPointer = (bit & POINTER_MASK) != 0;
+    int32_t unit = isPointer ? ONE : WHEEL_UNITS_PER_DETENT * ONE;
+    int32_t speed = (int32_t)(isPointer ? pointer.Speed : wheel.Speed);
+    Move(code, (speed > unit) ? speed : unit);
+}
+
+void MouseKeys::Update(uint64_t now) {
+    if (directions == 0 || now < nextTick)
+        return;
+
+    if (now - nextTick >= (uint64_t)MAX_LATE_TICKS * tickUs)
+        nextTick = now;
+    while (now >= nextTick) {
+        Tick();
+        nextTick += tickUs;
+    }
+}
+
+void MouseKeys::Tick() {
+    if (directions & POINTER_MASK)
+        Accelerate(pointer);
+    if (directions & WHEEL_MASK)
+        Accelerate(wheel);
+
+    for (uint8_t code = MOUSE_CODE_UP; code <= MOUSE_CODE_WHEEL_RIGHT; code++) {
+        if (directions & (1u << code))
+            Move(code, (int32_t)((code <= MOUSE_CODE_RIGHT) ? pointer.Speed : wheel.Speed));
+    }
+}
+
+void MouseKeys::Move(uint8_t code, int32_t step) {
+    switch (code) {
+    case MOUSE_CODE_UP:          AddClamped(y, -step, MAX_POINTER_PENDING); break;
+    case MOUSE_CODE_DOWN:        AddClamped(y, step, MAX_POINTER_PENDING); break;
+    case MOUSE_CODE_LEFT:        AddClamped(x, -step, MAX_POINTER_PENDING); break;
+    case MOUSE_CODE_RIGHT:       AddClamped(x, step, MAX_POINTER_PENDING); break;
+    case MOUSE_CODE_WHEEL_UP:    AddClamped(wheelV, step, MAX_WHEEL_PENDING); break;
+    case MOUSE_CODE_WHEEL_DOWN:  AddClamped(wheelV, -step, MAX_WHEEL_PENDING); break;
+    case MOUSE_CODE_WHEEL_LEFT:  AddClamped(wheelH, -step, MAX_WHEEL_PENDING); break;
+    case MOUSE_CODE_WHEEL_RIGHT: AddClamped(wheelH, step, MAX_WHEEL_PENDING); break;
+    }
+}
+
+bool MouseKeys::HasReport() const {
+    int32_t verticalUnit = isVerticalHighRes ? ONE : WHEEL_UNITS_PER_DETENT * ONE;
+    int32_t horizontalUnit = isHorizontalHighRes ? ONE : WHEEL_UNITS_PER_DETENT * ONE;
+    return isButtonChanged || x >= ONE || x <= -ONE || y >= ONE || y <= -ONE ||
+        wheelV >= verticalUnit || wheelV <= -verticalUnit ||
+        wheelH >= horizontalUnit || wheelH <= -horizontalUnit;
+}
+
+void MouseKeys::TakeReport(MouseMotion& motion) {
+    motion.Buttons = buttons;
+    motion.X = (int8_t)Take(x, ONE, 127);
+    motion.Y = (int8_t)Take(y, ONE, 127);
+    motion.Reserved = 0;
+    motion.Wheel = (int16_t)Take(wheelV, isVerticalHighRes ? ONE : WHEEL_UNITS_PER_DETENT * ONE, 32767);
+    motion.Pan = (int16_t)Take(wheelH, isHorizontalHighRes ? ONE : WHEEL_UNITS_PER_DETENT * ONE, 32767);
+    isButtonChanged = false;
+}
@@ -0,0 +1,103 @@
+#ifndef MOUSE_KEYS_H
+#define MOUSE_KEYS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "message_payloads.h"
+
+enum eMouseCurve {
+    MOUSE_CURVE_CONSTANT = 0,   // Top speed from the first tick
+    MOUSE_CURVE_LINEAR,         // The same speed is added every tick
+    MOUSE_CURVE_EXPONENTIAL,    // The speed grows by the same ratio every tick
+    MOUSE_CURVE_TOTAL
+};
+
+// Body of the mouse report, laid out as in the report descriptor
+struct MouseMotion {
+    uint8_t Buttons;
+    int8_t X;
+    int8_t Y;
+    uint8_t Reserved;
+    int16_t Wheel;      // In 1/120 detents once the host set the multiplier
+    int16_t Pan;
+};
+static_assert(sizeof(MouseMotion) == 8, "MouseMotion must match the report descriptor");
+static_assert(offsetof(MouseMotion, Wheel) == 4, "MouseMotion must match the report descriptor");
+
+// Mouse keys: held direction keys move the pointer or the wheel, at a
+// speed following the acceleration curve. The curve is evaluated at a
+// fixed tick in 16.16 fixed point, so slow speeds keep their fraction
+// and a tick costs one add or multiply. Pressing a direction moves it
+// one tick at once, a tap nudges the pointer.
+//
+// Motion piles up between reports: a report that waits behind keyboard
+// reports is merged, never lost, up to what one report carries. The
+// wheel counts in 1/120 of a detent and is reported in whole detents
+// until the host sets the resolution multiplier. Keeps no SDK
+// dependency, times are passed in.
+class MouseKeys {
+public:
+    static const int32_t WHEEL_UNITS_PER_DETENT = 120;
+    static const int NUM_BUTTONS = 5;
+
+public:
+    MouseKeys();
+
+    // Speeds in pixels per second, detents per second for the wheel
+    void Configure(eMouseCurve curve, uint32_t tickUs, uint32_t accelTimeUs,
+            uint32_t speedMin, uint32_t speedMax, uint32_t wheelMin, uint32_t wheelMax);
+    // Resolution multipliers as set by the host, off after a bus reset
+    void SetHighResolution(bool isVertical, bool isHorizontal);
+
+    void OnAction(uint8_t code, bool isPressed, uint64_t now);
+    // Runs the ticks due by now
+    void Update(uint64_t now);
+
+    // A button changed or some motion fills a report
+    bool HasReport() const;
+    // Takes what fits a report, the rest stays for the next one
+    void TakeReport(MouseMotion& motion);
+
+    inline bool IsMoving() const { return directions != 0; }
+    inline bool IsVerticalHighResolution() const { return isVerticalHighRes; }
+    inline bool IsHorizontalHighResolution() const { return isHorizontalHighRes; }
+
+private:
+    static const uint8_t POINTER_MASK = 0x0F;  // Direction bits of MOUSE_CODE_UP..RIGHT
+    static const uint8_t WHEEL_MASK = 0xF0;    // And of MOUSE_CODE_WHEEL_UP..RIGHT
+
+    // Speeds in 16.16 units per tick
+    struct Ramp {
+        uint32_t Start;
+        uint32_t Top;
+        uint32_t Step;      // Added per tick, or the 16.16 growth per tick
+        uint32_t Speed;
+    };
+
+    void ConfigureRamp(Ramp& ramp, uint32_t start, uint32_t top, uint32_t numTicks);
+    void Reset(Ramp& ramp);
+    void Accelerate(Ramp& ramp);
+    void Move(uint8_t code, int32_t step);
+    void Tick();
+
+private:
+    eMouseCurve curve;
+    uint32_t tickUs;
+    Ramp pointer;
+    Ramp wheel;
+
+    uint8_t directions;     // Bit per held direction code
+    uint8_t buttons;
+    bool isButtonChanged;
+    uint64_t nextTick;
+
+    // Motion not reported yet, 16.16 pixels and wheel units
+    int32_t x;
+    int32_t y;
+    int32_t wheelV;
+    int32_t wheelH;
+    bool isVerticalHighRes;
+    bool isHorizontalHighRes;
+};
+
+#endif // MOUSE_KEYS_H
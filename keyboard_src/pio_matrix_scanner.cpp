@@ -0,0 +1,130 @@
+#include "pio_matrix_scanner.h"
+#include "gpio_matrix_scanner.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+#include "matrix_scan.pio.h"
+
+PioMatrixScanner::PioMatrixScanner(const uint8_t* colPins, int numCols,
+        const uint8_t* rowPins, int numRows) :
+    colPins(colPins), rowPins(rowPins), numCols(numCols), numRows(numRows)
+{
+    scanPeriodUs = 1000;
+    pio = pio0;
+    sm = -1;
+    offset = 0;
+    dmaChannel = -1;
+    startTransferCount = 0;
+    for (auto& b : sourceBits)
+        b = 0;
+    for (auto& w : ring)
+        w = 0xFFFFFFFF;
+}
+
+bool PioMatrixScanner::FindPinBase(const uint8_t* pins, int numPins, uint& base) const {
+    // The program needs consecutive pins, in any order
+    base = pins[0];
+    for (int i = 1; i < numPins; i++) {
+        if (pins[i] < base)
+            base = pins[i];
+    }
+    uint32_t mask = 0;
+    for (int i = 0; i < numPins; i++) {
+        if (pins[i] >= base + PROGRAM_PINS)
+            return false;
+        mask |= 1u << (pins[i] - base);
+    }
+    return mask == (1u << PROGRAM_PINS) - 1;
+}
+
+bool PioMatrixScanner::Initialize() {
+    uint colBase, rowBase;
+    if (numCols != PROGRAM_PINS || numRows != PROGRAM_PINS ||
+            !FindPinBase(colPins, numCols, colBase) || !FindPinBase(rowPins, numRows, rowBase))
+        return false;
+
+    if (!pio_can_add_program(pio, &matrix_scan_program))
+        return false;
+    sm = pio_claim_unused_sm(pio, false);
+    dmaChannel = dma_claim_unused_channel(false);
+    if (sm < 0 || dmaChannel < 0) {
+        if (sm >= 0)
+            pio_sm_unclaim(pio, sm);
+        if (dmaChannel >= 0)
+            dma_channel_unclaim(dmaChannel);
+        return false;
+    }
+
+    for (int row = 0; row < numRows; row++) {
+        for (int col = 0; col < numCols; col++)
+            sourceBits[row * numCols + col] = (colPins[col] - colBase) * PROGRAM_PINS + (rowPins[row] - rowBase);
+    }
+
+    offset = pio_add_program(pio, &matrix_scan_program);
+    float clkdiv = (float)clock_get_hz(clk_sys) / (PIO_CYCLES_PER_US * 1000000);
+    matrix_scan_program_init(pio, sm, offset, colBase, rowBase, clkdiv);
+
+    // Idle loops that make up the rest of the scan period
+    uint32_t periodCycles = scanPeriodUs * PIO_CYCLES_PER_US;
+    uint32_t idleLoops = (periodCycles > MATRIX_SCAN_CYCLES) ?
+        (periodCycles - MATRIX_SCAN_CYCLES) / MATRIX_SCAN_IDLE_LOOP_CYCLES : 0;
+    pio_sm_put(pio, sm, idleLoops);
+
+    StartDma();
+    pio_sm_set_enabled(pio, sm, true);
+    return true;
+}
+
+void PioMatrixScanner::StartDma() {
+    dma_channel_config c = dma_channel_get_default_config(dmaChannel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, RING_SIZE_BITS);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+
+    startTransferCount = 0xFFFFFFFF;
+    dma_channel_configure(dmaChannel, &c, (void*)ring, &pio->rxf[sm], startTransferCount, true);
+}
+
+bool PioMatrixScanner::Read(MatrixState& state) {
+    uint32_t transferCount = dma_hw->ch[dmaChannel].transfer_count;
+    if (transferCount == startTransferCount)
+        return false;
+    // Runs out after 2^32 snapshots
+    if (transferCount == 0)
+        StartDma();
+
+    // Write address points at the next slot, the one before is complete
+    uint32_t next = (dma_hw->ch[dmaChannel].write_addr - (uintptr_t)ring) / sizeof(uint32_t);
+    uint32_t snapshot = ring[(next + RING_LENGTH - 1) % RING_LENGTH];
+
+    state = 0;
+    for (int key = 0; key < numRows * numCols; key++) {
+        if (!(snapshot & (1u << sourceBits[key])))
+            state |= (MatrixState)1 << key;
+    }
+    return true;
+}
+
+void PioMatrixScanner::EnterIdle(bool isWakeArmed, MatrixWakeCallback wakeCallback) {
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_exec(pio, sm, pio_encode_set(pio_pins, 0));
+
+    if (isWakeArmed)
+        GpioMatrixScanner::ArmRowWake(rowPins, numRows, wakeCallback);
+    else
+        GpioMatrixScanner::DisarmRowWake(rowPins, numRows);
+}
+
+void PioMatrixScanner::ExitIdle() {
+    GpioMatrixScanner::DisarmRowWake(rowPins, numRows);
+
+    // Snapshots taken before idle are stale
+    startTransferCount = dma_hw->ch[dmaChannel].transfer_count;
+
+    // Start over from a full scan, Y still holds the idle loop count
+    pio_sm_exec(pio, sm, pio_encode_set(pio_pins, 0x7));
+    pio_sm_restart(pio, sm);
+    pio_sm_exec(pio, sm, pio_encode_jmp(offset + matrix_scan_wrap_target));
+    pio_sm_set_enabled(pio, sm, true);
+}
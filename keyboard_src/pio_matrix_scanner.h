@@ -0,0 +1,55 @@
+#ifndef PIO_MATRIX_SCANNER_H
+#define PIO_MATRIX_SCANNER_H
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "matrix_scanner.h"
+
+// Hardware scan: the matrix_scan PIO program drives the columns and
+// samples the rows at a fixed rate, a DMA channel streams every snapshot
+// into a ring buffer. Read() only decodes the latest one.
+// Needs a 3x3 matrix on consecutive column and row pins.
+class PioMatrixScanner : public MatrixScanner {
+private:
+    static const int RING_LENGTH = 8;
+    static const int RING_SIZE_BITS = 5;    // log2(RING_LENGTH * 4 bytes)
+    static const uint32_t PIO_CYCLES_PER_US = 8;
+    static const int PROGRAM_PINS = 3;
+    static_assert((1 << RING_SIZE_BITS) == RING_LENGTH * sizeof(uint32_t),
+            "The DMA ring wraps at a power of two size");
+
+public:
+    PioMatrixScanner(const uint8_t* colPins, int numCols, const uint8_t* rowPins, int numRows);
+
+    // Scan period is fixed once the state machine runs
+    void SetScanPeriod(uint32_t periodUs) { scanPeriodUs = periodUs; }
+
+    bool Initialize() override;
+    bool Read(MatrixState& state) override;
+    void EnterIdle(bool isWakeArmed, MatrixWakeCallback wakeCallback) override;
+    void ExitIdle() override;
+
+private:
+    bool FindPinBase(const uint8_t* pins, int numPins, uint& base) const;
+    void StartDma();
+
+private:
+    const uint8_t* colPins;
+    const uint8_t* rowPins;
+    int numCols;
+    int numRows;
+    uint32_t scanPeriodUs;
+
+    PIO pio;
+    int sm;
+    uint offset;
+    int dmaChannel;
+    // Transfer count when the current run started, Read waits for a new snapshot
+    volatile uint32_t startTransferCount;
+    // Snapshot bit of every key, from the key's column and row pins
+    uint8_t sourceBits[32];
+
+    alignas(RING_LENGTH * 4) volatile uint32_t ring[RING_LENGTH];
+};
+
+#endif // PIO_MATRIX_SCANNER_H
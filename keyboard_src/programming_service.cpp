@@ -0,0 +1,188 @@
+#include "programming_service.h"
+#include "crc8.h"
+#include "serial_dispatcher.h"
+
+ProgrammingService::ProgrammingService() {
+    target = nullptr;
+    isInProgrammingMode = false;
+    isKeyArmed = false;
+    keySectorStatus = PROG_STATUS_OK;
+}
+
+void ProgrammingService::Initialize(ProgrammingTarget* target) {
+    this->target = target;
+
+    SerialDispatcher& dispatcher = SerialDispatcher::Instance();
+    dispatcher.RegisterForMessage<MESSAGE_ID_GET_FLASH_PAGE, OnGetFlashPage>();
+    dispatcher.RegisterForMessage<MESSAGE_ID_PROGRAMMING_START, OnProgrammingStart>();
+    dispatcher.RegisterForMessage<MESSAGE_ID_PROGRAMMING_KEY_INFO, OnKeyInfo>();
+    dispatcher.RegisterForMessage<MESSAGE_ID_PROGRAMMING_KEY_PACKET, OnKeyPacket>();
+    dispatcher.RegisterForMessage<MESSAGE_ID_PROGRAMMING_END, OnProgrammingEnd>();
+    dispatcher.RegisterForMessage<MESSAGE_ID_PROGRAMMING_WINDOW_START, OnWindowStart>();
+    dispatcher.RegisterForMessage<MESSAGE_ID_PROGRAMMING_WINDOW_PACKET, OnWindowPacket>();
+    dispatcher.RegisterStreamSink(MESSAGE_ID_PROGRAMMING_KEY_SECTOR, KeySectorSink);
+}
+
+void ProgrammingService::Abort() {
+    window.Stop();
+    isInProgrammingMode = false;
+}
+
+void ProgrammingService::OnGetFlashPage(const MessageHeader& header, const FlashPageRequest& request) {
+    const FlashPage* page = Instance().target->GetFlashPage(request.SectorNum, request.PageNum);
+    if (page == nullptr) {
+        SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_GET_FLASH_PAGE>(header.Seq, nullptr,
+                MESSAGE_STATUS_INVALID_VALUE);
+        return;
+    }
+
+    // Send answer back, straight from flash
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_GET_FLASH_PAGE>(header.Seq, page,
+            0, SEND_PRIORITY_BULK);
+}
+
+void ProgrammingService::OnProgrammingStart(const MessageHeader& header, const EmptyPayload&) {
+    ProgrammingService& service = Instance();
+    service.isInProgrammingMode = true;
+    service.isKeyArmed = false;
+    service.target->ProgrammingStarted();
+
+    // Send answer back
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_PROGRAMMING_START>(header.Seq, nullptr);
+}
+
+void ProgrammingService::OnProgrammingEnd(const MessageHeader& header, const EmptyPayload&) {
+    ProgrammingService& service = Instance();
+    service.isInProgrammingMode = false;
+    service.isKeyArmed = false;
+    service.window.Stop();
+    service.target->ProgrammingEnded();
+
+    // Send answer back
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_PROGRAMMING_END>(header.Seq, nullptr);
+}
+
+void ProgrammingService::OnKeyInfo(const MessageHeader& header, const ProgrammingKeyInfo& keyInfo) {
+    ProgrammingService& service = Instance();
+    service.window.Stop(); // A new key needs a new window
+    eProgrammingStatus status = service.target->GetReadyForProgrammingKey(keyInfo);
+    service.isKeyArmed = (status == PROG_STATUS_OK);
+
+    // Send answer back
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_PROGRAMMING_KEY_INFO>(header.Seq, nullptr, status);
+
+    if (status != PROG_STATUS_OK)
+        service.isInProgrammingMode = false;
+}
+
+void ProgrammingService::OnKeyPacket(const MessageHeader& header, const ByteSpan& packet) {
+    ProgrammingService& service = Instance();
+    eProgrammingStatus status = service.target->ProgramKeyPacket(packet.Data, packet.Length, header.Seq);
+
+    // Send answer back
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_PROGRAMMING_KEY_PACKET>(header.Seq, nullptr, status);
+
+    if (status != PROG_STATUS_OK)
+        service.isInProgrammingMode = false;
+}
+
+void ProgrammingService::OnWindowStart(const MessageHeader& header, const ProgrammingWindowInfo& windowInfo) {
+    ProgrammingService& service = Instance();
+    eProgrammingStatus status = PROG_STATUS_OK;
+    ProgrammingWindowInfo granted = { 0, windowInfo.NumPackets };
+
+    // Packets go to the key of the last accepted key info, there must be one
+    if (!service.isInProgrammingMode || !service.isKeyArmed)
+        status = PROG_STATUS_NO_KEY;
+    else if (windowInfo.NumPackets == 0 || windowInfo.NumPackets > service.target->GetMaxPacketsPerKey())
+        status = PROG_STATUS_PACKET_OVERFLOW;
+    else
+        granted.WindowSize = service.window.Start(windowInfo.WindowSize, windowInfo.NumPackets);
+
+    // Send answer back with the granted window size
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_PROGRAMMING_WINDOW_START>(header.Seq,
+            granted, status);
+
+    if (status != PROG_STATUS_OK)
+        service.isInProgrammingMode = false;
+}
+
+void ProgrammingService::OnWindowPacket(const MessageHeader& header, const ByteSpan& packet) {
+    ProgrammingService& service = Instance();
+    ProgrammingWindow& window = service.window;
+
+    // A packet after the window stopped fails at once instead of timing out
+    if (!window.IsActive()) {
+        SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_PROGRAMMING_WINDOW_PACKET>(header.Seq,
+                nullptr, PROG_STATUS_WINDOW_INACTIVE);
+        return;
+    }
+
+    uint16_t seq = header.Seq;
+    bool isCrcValid = (Crc8(packet.Data, packet.Length) == header.Status);
+    eProgrammingStatus status = PROG_STATUS_OK;
+    uint16_t answerSeq = window.GetAckSeq();
+
+    switch (window.Receive(seq, isCrcValid)) {
+    case WINDOW_VERDICT_WRITE:
+        status = service.target->ProgramKeyPacket(packet.Data, packet.Length, seq);
+        if (status != PROG_STATUS_OK) {
+            answerSeq = seq;
+            break;
+        }
+
+        switch (window.Commit(seq)) {
+        case WINDOW_REPLY_NONE:
+            return;
+        case WINDOW_REPLY_ACK:
+            answerSeq = window.GetAckSeq();
+            break;
+        case WINDOW_REPLY_NACK_GAP:
+            answerSeq = window.GetAckSeq();
+            status = PROG_STATUS_PACKET_GAP;
+            break;
+        }
+        break;
+    case WINDOW_VERDICT_BAD_CRC:
+        answerSeq = seq;
+        status = PROG_STATUS_INVALID_CRC;
+        break;
+    case WINDOW_VERDICT_DUPLICATE:
+    case WINDOW_VERDICT_OUT_OF_WINDOW:
+        break;
+    }
+
+    // Send answer back (cumulative ACK or selective NACK)
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_PROGRAMMING_WINDOW_PACKET>(answerSeq,
+            nullptr, status);
+
+    // Flash write errors abort programming, transport errors are recoverable
+    if (status != PROG_STATUS_OK && status != PROG_STATUS_INVALID_CRC &&
+            status != PROG_STATUS_PACKET_GAP)
+        service.Abort();
+}
+
+void ProgrammingService::KeySectorSink(const MessageHeader& header, uint32_t offset,
+        const unsigned char* chunk, uint32_t length, bool isLast) {
+    ProgrammingService& service = Instance();
+
+    // Every chunk is a flash page, program it as soon as it arrives
+    if (offset == 0)
+        service.keySectorStatus = PROG_STATUS_OK;
+    if (chunk == nullptr)
+        service.keySectorStatus = PROG_STATUS_PACKET_GAP;
+    if (service.keySectorStatus == PROG_STATUS_OK) {
+        uint16_t seq = 1 + offset / sizeof(FlashPage);
+        service.keySectorStatus = service.target->ProgramKeyPacket(chunk, length, seq);
+    }
+
+    if (!isLast)
+        return;
+
+    // Send answer back, Seq holds the number of bytes received
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_PROGRAMMING_KEY_SECTOR>(header.Len,
+            nullptr, service.keySectorStatus);
+
+    if (service.keySectorStatus != PROG_STATUS_OK)
+        service.isInProgrammingMode = false;
+}
@@ -0,0 +1,50 @@
+#ifndef PROGRAMMING_SERVICE_H
+#define PROGRAMMING_SERVICE_H
+
+#include <stdint.h>
+#include "message.h"
+#include "message_codec.h"
+#include "programming_target.h"
+#include "programming_window.h"
+
+// Handlers of the key programming messages and of flash page reads.
+// They only reach the keys through a ProgrammingTarget and keep no SDK
+// dependency, so the host tests run these same handlers over a pty.
+class ProgrammingService {
+public:
+    static ProgrammingService& Instance() {
+        static ProgrammingService instance;
+        return instance;
+    }
+
+    // Registers the handlers with the dispatcher
+    void Initialize(ProgrammingTarget* target);
+
+    // From PROGRAMMING_START until PROGRAMMING_END or a failed step
+    inline bool IsInProgrammingMode() const { return isInProgrammingMode; }
+
+private:
+    ProgrammingService();
+
+    void Abort();
+
+    static void OnGetFlashPage(const MessageHeader& header, const FlashPageRequest& request);
+    static void OnProgrammingStart(const MessageHeader& header, const EmptyPayload&);
+    static void OnProgrammingEnd(const MessageHeader& header, const EmptyPayload&);
+    static void OnKeyInfo(const MessageHeader& header, const ProgrammingKeyInfo& keyInfo);
+    static void OnKeyPacket(const MessageHeader& header, const ByteSpan& packet);
+    static void OnWindowStart(const MessageHeader& header, const ProgrammingWindowInfo& windowInfo);
+    static void OnWindowPacket(const MessageHeader& header, const ByteSpan& packet);
+    static void KeySectorSink(const MessageHeader& header, uint32_t offset,
+            const unsigned char* chunk, uint32_t length, bool isLast);
+
+private:
+    ProgrammingTarget* target;
+    bool isInProgrammingMode;
+    // A key info was accepted, window packets have a key to go to
+    bool isKeyArmed;
+    ProgrammingWindow window;
+    eProgrammingStatus keySectorStatus;
+};
+
+#endif // PROGRAMMING_SERVICE_H
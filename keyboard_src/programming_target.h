@@ -0,0 +1,27 @@
+#ifndef PROGRAMMING_TARGET_H
+#define PROGRAMMING_TARGET_H
+
+// Free of SDK includes so fakes can be built on the host
+
+#include <stdint.h>
+#include "message_payloads.h"
+
+// What the programming messages write keys to and read flash back from:
+// the keyboard and its flash on the device, RAM in the host tests.
+class ProgrammingTarget {
+public:
+    virtual ~ProgrammingTarget() {}
+
+    virtual void ProgrammingStarted() = 0;
+    virtual void ProgrammingEnded() = 0;
+    // Erases the key and stores its info, packets follow
+    virtual eProgrammingStatus GetReadyForProgrammingKey(const ProgrammingKeyInfo& info) = 0;
+    // Packet seq N is flash page N of the key sector, page 0 holds the info
+    virtual eProgrammingStatus ProgramKeyPacket(const uint8_t* data, uint16_t length, uint16_t seq) = 0;
+    virtual uint16_t GetMaxPacketsPerKey() const = 0;
+
+    // Null if the page is outside the flash the device owns
+    virtual const FlashPage* GetFlashPage(uint32_t sectorNum, uint32_t pageNum) = 0;
+};
+
+#endif // PROGRAMMING_TARGET_H
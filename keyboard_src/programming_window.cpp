@@ -0,0 +1,69 @@
+#include "programming_window.h"
+
+ProgrammingWindow::ProgrammingWindow() {
+    Stop();
+}
+
+uint16_t ProgrammingWindow::Start(uint16_t size, uint16_t numPackets) {
+    if (size == 0)
+        size = 1;
+    if (size > MAX_WINDOW_SIZE)
+        size = MAX_WINDOW_SIZE;
+
+    isActive = true;
+    windowSize = size;
+    lastSeq = FIRST_SEQ + numPackets - 1;
+    nextExpectedSeq = FIRST_SEQ;
+    lastNackedSeq = 0;
+    packetsSinceAck = 0;
+    receivedMask = 0;
+
+    return windowSize;
+}
+
+void ProgrammingWindow::Stop() {
+    isActive = false;
+    windowSize = 0;
+    lastSeq = 0;
+    nextExpectedSeq = FIRST_SEQ;
+    lastNackedSeq = 0;
+    packetsSinceAck = 0;
+    receivedMask = 0;
+}
+
+eWindowVerdict ProgrammingWindow::Receive(uint16_t seq, bool isCrcValid) const {
+    if (seq < nextExpectedSeq)
+        return WINDOW_VERDICT_DUPLICATE;
+    if (seq > lastSeq || seq >= nextExpectedSeq + windowSize)
+        return WINDOW_VERDICT_OUT_OF_WINDOW;
+    if (IsReceived(seq))
+        return WINDOW_VERDICT_DUPLICATE;
+    if (!isCrcValid)
+        return WINDOW_VERDICT_BAD_CRC;
+
+    return WINDOW_VERDICT_WRITE;
+}
+
+eWindowReply ProgrammingWindow::Commit(uint16_t seq) {
+    receivedMask |= (1u << seq);
+    packetsSinceAck++;
+
+    // Slide the window over every contiguous packet we have
+    while (nextExpectedSeq <= lastSeq && IsReceived(nextExpectedSeq))
+        nextExpectedSeq++;
+
+    // A packet arrived past a hole, ask for the hole once
+    if (seq > nextExpectedSeq && lastNackedSeq != nextExpectedSeq) {
+        lastNackedSeq = nextExpectedSeq;
+        return WINDOW_REPLY_NACK_GAP;
+    }
+
+    // Ack every half window so the host never stalls on a full window
+    uint16_t ackEvery = (windowSize > 1) ? (windowSize / 2) : 1;
+    if (IsComplete() || packetsSinceAck >= ackEvery) {
+        packetsSinceAck = 0;
+        return WINDOW_REPLY_ACK;
+    }
+
+    return WINDOW_REPLY_NONE;
+}
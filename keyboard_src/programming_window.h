@@ -0,0 +1,61 @@
+#ifndef PROGRAMMING_WINDOW_H
+#define PROGRAMMING_WINDOW_H
+
+#include <stdint.h>
+
+// Windowed (pipelined) key programming.
+// The host streams up to WindowSize packets without waiting for an answer.
+// Each packet carries its page number in Header.Seq and the CRC-8 of its
+// payload in Header.Status. The device answers with:
+//  - Cumulative ACK: Status = OK, Seq = next expected packet
+//    (every packet below Seq is programmed)
+//  - Selective NACK: Status = INVALID_CRC or PACKET_GAP, Seq = packet to resend
+enum eWindowVerdict {
+    WINDOW_VERDICT_WRITE,        // New packet inside the window, program it and Commit()
+    WINDOW_VERDICT_DUPLICATE,    // Already programmed, answer with an ACK
+    WINDOW_VERDICT_BAD_CRC,      // Corrupted packet, answer with a NACK
+    WINDOW_VERDICT_OUT_OF_WINDOW // Sequence outside of the window, answer with an ACK
+};
+
+enum eWindowReply {
+    WINDOW_REPLY_NONE,
+    WINDOW_REPLY_ACK,
+    WINDOW_REPLY_NACK_GAP
+};
+
+class ProgrammingWindow {
+public:
+    static const uint16_t MAX_WINDOW_SIZE = 8;
+    static const uint16_t FIRST_SEQ = 1;
+
+public:
+    ProgrammingWindow();
+
+    // Returns the granted window size
+    uint16_t Start(uint16_t windowSize, uint16_t numPackets);
+    void Stop();
+
+    eWindowVerdict Receive(uint16_t seq, bool isCrcValid) const;
+    eWindowReply Commit(uint16_t seq);
+
+    inline bool IsActive() const { return isActive; }
+    inline bool IsComplete() const { return nextExpectedSeq > lastSeq; }
+    inline uint16_t GetAckSeq() const { return nextExpectedSeq; }
+    inline uint16_t GetWindowSize() const { return windowSize; }
+
+private:
+    inline bool IsReceived(uint16_t seq) const {
+        return (receivedMask & (1u << seq)) != 0;
+    }
+
+private:
+    bool isActive;
+    uint16_t windowSize;
+    uint16_t lastSeq;
+    uint16_t nextExpectedSeq;
+    uint16_t lastNackedSeq;
+    uint16_t packetsSinceAck;
+    uint32_t receivedMask;
+};
+
+#endif // PROGRAMMING_WINDOW_H
@@ -0,0 +1,63 @@
+#include "scan_rate_policy.h"
+
+ScanRatePolicy::ScanRatePolicy() {
+    lastActivityTime = 0;
+    lastScanTime = 0;
+    for (auto& t : tierTimeUs)
+        t = 0;
+    stats = {};
+    Configure(1000, 1000, ACTIVE_HOLD_US);
+}
+
+void ScanRatePolicy::Configure(uint32_t minPeriodUs, uint32_t maxPeriodUs, uint64_t idleTimeoutUs) {
+    // Each tier doubles the period, the last one is clamped to the floor
+    int numTiers = 1;
+    uint32_t period = minPeriodUs;
+    stats.PeriodUs[0] = minPeriodUs;
+    while (numTiers < MAX_SCAN_TIERS && period < maxPeriodUs) {
+        period *= 2;
+        if (period > maxPeriodUs || numTiers == MAX_SCAN_TIERS - 1)
+            period = maxPeriodUs;
+        stats.PeriodUs[numTiers++] = period;
+    }
+    for (int i = numTiers; i < MAX_SCAN_TIERS; i++)
+        stats.PeriodUs[i] = 0;
+
+    stats.NumTiers = numTiers;
+    if (stats.CurrentTier >= numTiers)
+        stats.CurrentTier = numTiers - 1;
+
+    // The hold, the steps and a stay at the floor rate share the idle
+    // timeout, so every tier runs before the pad goes idle
+    uint64_t slotUs = idleTimeoutUs / numTiers;
+    activeHoldUs = (slotUs < ACTIVE_HOLD_US) ? (uint32_t)slotUs : ACTIVE_HOLD_US;
+    tierStepUs = (slotUs < TIER_STEP_US) ? (uint32_t)slotUs : TIER_STEP_US;
+}
+
+uint32_t ScanRatePolicy::Update(bool isActive, uint64_t now) {
+    // Account the scan and the time since the previous one to the tier it ran in
+    uint8_t tier = stats.CurrentTier;
+    stats.Scans[tier]++;
+    if (lastScanTime != 0) {
+        tierTimeUs[tier] += (uint32_t)(now - lastScanTime);
+        stats.TimeMs[tier] += tierTimeUs[tier] / 1000;
+        tierTimeUs[tier] %= 1000;
+    }
+    lastScanTime = now;
+
+    if (isActive) {
+        lastActivityTime = now;
+        stats.CurrentTier = 0;
+    }
+    else {
+        uint64_t quietTime = now - lastActivityTime;
+        int newTier = 0;
+        if (quietTime > activeHoldUs)
+            newTier = 1 + (int)((quietTime - activeHoldUs) / tierStepUs);
+        if (newTier >= stats.NumTiers)
+            newTier = stats.NumTiers - 1;
+        stats.CurrentTier = newTier;
+    }
+
+    return stats.PeriodUs[stats.CurrentTier];
+}
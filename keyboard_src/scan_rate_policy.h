@@ -0,0 +1,36 @@
+#ifndef SCAN_RATE_POLICY_H
+#define SCAN_RATE_POLICY_H
+
+#include "pico/stdlib.h"
+#include "message_payloads.h"
+
+// Picks the scan period from recent key activity.
+// Any activity jumps straight to the ceiling rate (tier 0). After
+// ACTIVE_HOLD_US without activity the period doubles every TIER_STEP_US
+// until it reaches the floor rate. Both are shortened so the whole
+// schedule fits the idle timeout, or the pad would go idle from tier 0.
+class ScanRatePolicy {
+public:
+    static const uint32_t ACTIVE_HOLD_US = 250000;
+    static const uint32_t TIER_STEP_US = 500000;
+
+public:
+    ScanRatePolicy();
+
+    void Configure(uint32_t minPeriodUs, uint32_t maxPeriodUs, uint64_t idleTimeoutUs);
+    // Called after every scan, returns the period until the next one
+    uint32_t Update(bool isActive, uint64_t now);
+
+    inline uint32_t GetPeriod() const { return stats.PeriodUs[stats.CurrentTier]; }
+    inline const ScanRateStats& GetStats() const { return stats; }
+
+private:
+    uint64_t lastActivityTime;
+    uint64_t lastScanTime;
+    uint32_t activeHoldUs;
+    uint32_t tierStepUs;
+    uint32_t tierTimeUs[MAX_SCAN_TIERS];
+    ScanRateStats stats;
+};
+
+#endif // SCAN_RATE_POLICY_H
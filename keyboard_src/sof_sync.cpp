@@ -0,0 +1,29 @@
+#include "sof_sync.h"
+
+SofSync::SofSync() {
+    isEnabled = false;
+    pollInterval = 1;
+    pollPhase = 0;
+    lastFrame = 0;
+    runningFrame = 0;
+}
+
+void SofSync::Configure(bool isEnabled, uint8_t pollIntervalMs) {
+    this->isEnabled = isEnabled;
+    pollInterval = (pollIntervalMs > 0) ? pollIntervalMs : 1;
+    pollPhase %= pollInterval;
+}
+
+uint64_t SofSync::OnSof(uint32_t frameCount, uint32_t currentFrame, uint64_t now) {
+    runningFrame += (frameCount - lastFrame) & FRAME_NUMBER_MASK;
+    lastFrame = frameCount;
+    if (!isEnabled || currentFrame != frameCount || (runningFrame + 1) % pollInterval != pollPhase)
+        return 0;
+
+    return now + FRAME_US - LEAD_US;
+}
+
+void SofSync::OnReportComplete() {
+    // The host fetched the report in the current frame
+    pollPhase = runningFrame % pollInterval;
+}
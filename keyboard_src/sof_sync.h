@@ -0,0 +1,44 @@
+#ifndef SOF_SYNC_H
+#define SOF_SYNC_H
+
+// Free of SDK includes so it can be tested on the host
+
+#include <stdint.h>
+
+// Times an extra matrix scan LEAD_US before the start of every frame in
+// which the host polls the HID endpoint, so a report built from it is
+// armed right before the poll instead of waiting up to a whole interval.
+// The poll frames are learned from the frames reports complete in.
+// TinyUSB calls tud_sof_cb from tud_task, not from the SOF interrupt, so
+// the scan is timed from when tud_task got to it: it runs late by that
+// delay, and the lead only covers it while it stays under LEAD_US minus
+// the scan time. A callback that arrives after the hardware frame counter
+// moved on is more than a frame late and times nothing. The USB frame
+// number is 11 bits, so frames are counted in 64 bits from its deltas and
+// a poll interval that does not divide 2048 keeps its phase across the wrap.
+class SofSync {
+public:
+    static const uint32_t FRAME_US = 1000;
+    static const uint32_t LEAD_US = 150;
+    static const uint32_t FRAME_NUMBER_MASK = 0x7FF;
+
+public:
+    SofSync();
+
+    void Configure(bool isEnabled, uint8_t pollIntervalMs);
+    inline bool IsEnabled() const { return isEnabled; }
+
+    // From tud_sof_cb, returns the time of the pre-poll scan or 0 if the
+    // next frame is not a poll frame or currentFrame is past frameCount
+    uint64_t OnSof(uint32_t frameCount, uint32_t currentFrame, uint64_t now);
+    void OnReportComplete();
+
+private:
+    bool isEnabled;
+    uint8_t pollInterval;
+    uint8_t pollPhase;
+    uint32_t lastFrame;
+    uint64_t runningFrame;
+};
+
+#endif // SOF_SYNC_H
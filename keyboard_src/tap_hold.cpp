@@ -0,0 +1,140 @@
+#include "tap_hold.h"
+
+TapHold::TapHold() {
+    tappingTermUs = 200000;
+    isPermissiveHold = false;
+    isHoldOnOtherKeyPress = false;
+    resolveCallback = nullptr;
+    actionCallback = nullptr;
+    pendingKey = -1;
+    pendingAction = KEY_ACTION_NONE;
+    pendingStart = 0;
+    numEvents = 0;
+    numExamined = 0;
+    for (auto& action : keyActions)
+        action = KEY_ACTION_NONE;
+}
+
+void TapHold::Configure(uint32_t tappingTermUs, bool isPermissiveHold, bool isHoldOnOtherKeyPress) {
+    this->tappingTermUs = tappingTermUs;
+    this->isPermissiveHold = isPermissiveHold;
+    this->isHoldOnOtherKeyPress = isHoldOnOtherKeyPress;
+}
+
+void TapHold::SetCallbacks(TapHoldResolveCallback resolve, TapHoldActionCallback action) {
+    resolveCallback = resolve;
+    actionCallback = action;
+}
+
+void TapHold::OnKeyEvent(int keyIndex, bool isPressed, uint64_t time) {
+    if (keyIndex >= MAX_LAYER_KEYS)
+        return;
+
+    // A full buffer forces the pending key to hold, which frees its events
+    if (numEvents == MAX_BUFFERED_EVENTS) {
+        Decide(true);
+        Run();
+    }
+
+    events[numEvents].KeyIndex = (uint8_t)keyIndex;
+    events[numEvents].IsPressed = isPressed;
+    events[numEvents].Time = time;
+    numEvents++;
+    Run();
+}
+
+void TapHold::Update(uint64_t now) {
+    // Replaying the buffer can leave another key pending, also expired
+    while (pendingKey >= 0 && now - pendingStart >= tappingTermUs) {
+        Decide(true);
+        Run();
+    }
+}
+
+uint16_t TapHold::GetTapAction(uint16_t action) {
+    return MakeKeyAction(KEY_ACTION_KEY, 0, GetKeyActionCode(action));
+}
+
+uint16_t TapHold::GetHoldAction(uint16_t action) {
+    if (GetKeyActionKind(action) == KEY_ACTION_MOD_TAP)
+        return MakeKeyAction(KEY_ACTION_MODIFIER, 0, 1u << (GetKeyActionLayer(action) & 0x07));
+    return MakeKeyAction(KEY_ACTION_LAYER_MOMENTARY, GetKeyActionLayer(action), 0);
+}
+
+void TapHold::Run() {
+    while (true) {
+        if (pendingKey < 0) {
+            if (numEvents == 0)
+                return;
+
+            KeyEvent event = PopEvent();
+            if (!event.IsPressed) {
+                Emit(event.KeyIndex, keyActions[event.KeyIndex], false);
+                continue;
+            }
+
+            uint16_t action = resolveCallback(event.KeyIndex);
+            if (IsTapHoldAction(action)) {
+                pendingKey = event.KeyIndex;
+                pendingAction = action;
+                pendingStart = event.Time;
+                numExamined = 0;
+                continue;
+            }
+            Emit(event.KeyIndex, action, true);
+            continue;
+        }
+
+        // Wait for the next event or the end of the tapping term
+        if (numExamined == numEvents)
+            return;
+
+        const KeyEvent& event = events[numExamined];
+        if (event.Time - pendingStart >= tappingTermUs) {
+            Decide(true);
+        }
+        else if (event.KeyIndex == pendingKey) {
+            // Only its release can follow, it stays queued behind the tap
+            Decide(false);
+        }
+        else {
+            numExamined++;
+            if (event.IsPressed && isHoldOnOtherKeyPress)
+                Decide(true);
+            else if (!event.IsPressed && isPermissiveHold &&
+                    IsPressExamined(event.KeyIndex, numExamined - 1))
+                Decide(true);
+        }
+    }
+}
+
+TapHold::KeyEvent TapHold::PopEvent() {
+    KeyEvent event = events[0];
+    for (int i = 1; i < numEvents; i++)
+        events[i - 1] = events[i];
+    numEvents--;
+    return event;
+}
+
+bool TapHold::IsPressExamined(int keyIndex, int numExaminedEvents) const {
+    for (int i = 0; i < numExaminedEvents; i++) {
+        if (events[i].KeyIndex == keyIndex && events[i].IsPressed)
+            return true;
+    }
+    return false;
+}
+
+void TapHold::Decide(bool isHold) {
+    if (pendingKey < 0)
+        return;
+
+    int keyIndex = pendingKey;
+    pendingKey = -1;
+    numExamined = 0;
+    Emit(keyIndex, isHold ? GetHoldAction(pendingAction) : GetTapAction(pendingAction), true);
+}
+
+void TapHold::Emit(int keyIndex, uint16_t action, bool isPressed) {
+    keyActions[keyIndex] = isPressed ? action : KEY_ACTION_NONE;
+    actionCallback(keyIndex, action, isPressed);
+}
@@ -0,0 +1,79 @@
+#ifndef TAP_HOLD_H
+#define TAP_HOLD_H
+
+#include <stdint.h>
+#include "message_payloads.h"
+
+// Resolves the action of a key index on the current layers
+typedef uint16_t (*TapHoldResolveCallback)(int keyIndex);
+// Applies a resolved action, in event order
+typedef void (*TapHoldActionCallback)(int keyIndex, uint16_t action, bool isPressed);
+
+// Decides between the tap and the hold action of KEY_ACTION_MOD_TAP and
+// KEY_ACTION_LAYER_TAP keys. Key events are handled strictly in order:
+// while a tap-hold key is undecided the events after it are buffered,
+// and replayed once the decision is made, so a layer-tap hold applies to
+// the keys pressed after it. The key becomes a hold when:
+//  - it is still down after the tapping term,
+//  - another key is pressed (hold on other key press),
+//  - another key pressed after it is released (permissive hold),
+//  - the event buffer is full.
+// Released before that, it is a tap. Keeps no SDK dependency, times are
+// taken from the events so the host can script them.
+class TapHold {
+public:
+    static const int MAX_BUFFERED_EVENTS = 16;
+
+public:
+    TapHold();
+
+    void Configure(uint32_t tappingTermUs, bool isPermissiveHold, bool isHoldOnOtherKeyPress);
+    void SetCallbacks(TapHoldResolveCallback resolve, TapHoldActionCallback action);
+
+    // Debounced press or release of a key
+    void OnKeyEvent(int keyIndex, bool isPressed, uint64_t time);
+    // Decides a pending key whose tapping term expired
+    void Update(uint64_t now);
+
+    inline bool IsPending() const { return pendingKey >= 0; }
+
+    static inline bool IsTapHoldAction(uint16_t action) {
+        eKeyActionKind kind = GetKeyActionKind(action);
+        return kind == KEY_ACTION_MOD_TAP || kind == KEY_ACTION_LAYER_TAP;
+    }
+    static uint16_t GetTapAction(uint16_t action);
+    static uint16_t GetHoldAction(uint16_t action);
+
+private:
+    struct KeyEvent {
+        uint8_t KeyIndex;
+        bool IsPressed;
+        uint64_t Time;
+    };
+
+    void Run();
+    KeyEvent PopEvent();
+    bool IsPressExamined(int keyIndex, int numExaminedEvents) const;
+    void Decide(bool isHold);
+    void Emit(int keyIndex, uint16_t action, bool isPressed);
+
+private:
+    uint32_t tappingTermUs;
+    bool isPermissiveHold;
+    bool isHoldOnOtherKeyPress;
+    TapHoldResolveCallback resolveCallback;
+    TapHoldActionCallback actionCallback;
+
+    int pendingKey;
+    uint16_t pendingAction;
+    uint64_t pendingStart;
+    // Events not applied yet, in order. While a key is pending the first
+    // numExamined of them have been checked against it.
+    KeyEvent events[MAX_BUFFERED_EVENTS];
+    int numEvents;
+    int numExamined;
+    // Action each held key was pressed with, released with the key
+    uint16_t keyActions[MAX_LAYER_KEYS];
+};
+
+#endif // TAP_HOLD_H
@@ -2,20 +2,67 @@
 #include "serial_src/message.h"
 #include "serial_src/serial_dispatcher.h"
 #include "tusb.h"
+#include "hardware/structs/usb.h"
 #include "usb_descriptors.h"
 #include "settings.h"
 #include "message.h"
 #include "serial_dispatcher.h"
+#include "cdc_transport.h"
+#include "raw_hid_transport.h"
 #include "keyboard.h"
 #include "flash_service.h"
+#include "flash_layout.h"
+#include "programming_service.h"
+#include "config_snapshot.h"
+#include "scheduler.h"
+#include "power_manager.h"
+#include "profiler.h"
+#include "usage_analytics.h"
 
 Settings& settings = Settings::Instance();
 
 const uint LED_PIN = PICO_DEFAULT_LED_PIN;
 static uint64_t startTime = 0;
 
-static bool isInProgrammingMode = false;
-static Message answerMessage;
+// Keys are programmed into the keyboard, pages are read from the flash it owns
+class DeviceProgrammingTarget : public ProgrammingTarget {
+public:
+    void ProgrammingStarted() override {
+        Keyboard::Instance().ProgrammingStarted();
+    }
+
+    void ProgrammingEnded() override {
+        Keyboard::Instance().ProgrammingEnded();
+    }
+
+    eProgrammingStatus GetReadyForProgrammingKey(const ProgrammingKeyInfo& info) override {
+        return Keyboard::Instance().GetReadyForProgrammingKey(info);
+    }
+
+    eProgrammingStatus ProgramKeyPacket(const uint8_t* data, uint16_t length, uint16_t seq) override {
+        return Keyboard::Instance().ProgramKeyPacket(data, length, seq);
+    }
+
+    uint16_t GetMaxPacketsPerKey() const override {
+        return Keyboard::Instance().GetMaxPacketsPerKey();
+    }
+
+    const FlashPage* GetFlashPage(uint32_t sectorNum, uint32_t pageNum) override {
+        if (sectorNum >= FLASH_NUM_SECTORS || pageNum >= FlashService::Instance().GetNumPagesPerSector())
+            return nullptr;
+        return (const FlashPage*)FlashService::Instance().GetPageAddress(sectorNum, (uint8_t)pageNum);
+    }
+};
+static DeviceProgrammingTarget programmingTarget;
+
+// Task periods, the keyboard task follows the adaptive scan rate
+const uint32_t BLINK_TASK_PERIOD_US = 10000;
+const uint32_t POWER_TASK_PERIOD_US = 10000;
+static int listenTaskId = -1;
+static int keyboardTaskId = -1;
+
+static_assert(LARGE_FRAME_CHUNK_LENGTH == FLASH_PAGE_SIZE, 
+        "Large frame chunks must map to flash pages");
 
 void InitGPIOs() {
     gpio_init(LED_PIN);
@@ -28,6 +75,7 @@ void InitGPIOs() {
                                                                                                                                                                                       
 // Invoked when device is mounted                                                                                                                                                     
 void tud_mount_cb(void) {
+    Keyboard::Instance().OnMount();
 }
 
 // Invoked when device is unmounted                                                                                                                                                   
@@ -38,116 +86,252 @@ void tud_umount_cb(void) {
 // remote_wakeup_en : if host allow us to perform remote wakeup                                                                                                                      
 // Within 7ms, device must draw an average of current less than 2.5 mA from bus                                                                                                       
 void tud_suspend_cb(bool remote_wakeup_en) {
-    (void) remote_wakeup_en;
+    PowerManager::Instance().OnSuspend(remote_wakeup_en);
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void) {
+    PowerManager::Instance().OnResume();
+}
+
+// Invoked from tud_task at every USB start of frame (when enabled).
+// Deferred from the interrupt, so it runs as late as tud_task does;
+// SOF_RD tells whether the frame is already over.
+void tud_sof_cb(uint32_t frame_count) {
+    uint32_t currentFrame = usb_hw->sof_rd & USB_SOF_RD_BITS;
+    uint64_t scanTime = Keyboard::Instance().OnSof(frame_count, currentFrame);
+    if (scanTime != 0 && keyboardTaskId >= 0)
+        Scheduler::Instance().SetNextRelease(keyboardTaskId, scanTime);
+}
+
+// Invoked from tud_task when CDC data was received
+void tud_cdc_rx_cb(uint8_t itf) {
+    (void) itf;
+    if (listenTaskId >= 0)
+        Scheduler::Instance().Signal(listenTaskId);
+}
+
+// Invoked from tud_task when a raw HID report was received
+void OnRawHidReceived() {
+    if (listenTaskId >= 0)
+        Scheduler::Instance().Signal(listenTaskId);
 }
 
 
 //--------------------------------------------------------------------+
 // Messages Callbacks                                                  
 //--------------------------------------------------------------------+
-void SetBlinkOnTimeMessageCallback(const Message& msg) {
-    settings(SettingsIds::BLINK_ON_TIME, *(uint32_t*)msg.Data);
-    settings.Save();
+void SetBlinkOnTimeMessageCallback(const MessageHeader& header, const SettingValueRequest& request) {
+    uint8_t status = MESSAGE_STATUS_INVALID_VALUE;
+    if (settings(SettingsIds::BLINK_ON_TIME, request.Value)) {
+        settings.Save();
+        status = 0;
+    }
+
+    // Send answer back
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_SET_BLINK_ON_TIME>(header.Seq, nullptr, status);
+}
+
+void SetBlinkOffTimeMessageCallback(const MessageHeader& header, const SettingValueRequest& request) {
+    uint8_t status = MESSAGE_STATUS_INVALID_VALUE;
+    if (settings(SettingsIds::BLINK_OFF_TIME, request.Value)) {
+        settings.Save();
+        status = 0;
+    }
 
     // Send answer back
-    answerMessage.Header.Seq = 1;
-    answerMessage.Header.Len = 0;
-    answerMessage.Header.Id = MESSAGE_ID_SET_BLINK_ON_TIME;
-    answerMessage.Header.Status = 0;
-    SerialDispatcher::Instance().SendMessage(answerMessage);
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_SET_BLINK_OFF_TIME>(header.Seq, nullptr, status);
 }
 
-void SetBlinkOffTimeMessageCallback(const Message& msg) {
-    settings(SettingsIds::BLINK_OFF_TIME, *(uint32_t*)msg.Data);
-    settings.Save();
+void GetSendQueueStatsMessageCallback(const MessageHeader& header, const EmptyPayload& request) {
+    // Copied, the live counters change while the answer waits in the queue
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_GET_SEND_QUEUE_STATS>(header.Seq,
+            SerialDispatcher::Instance().GetSendQueueStats());
+}
+
+void GetSchedulerStatsMessageCallback(const MessageHeader& header, const EmptyPayload& request) {
+    SchedulerStats stats;
+    Scheduler::Instance().GetStats(stats);
 
     // Send answer back
-    answerMessage.Header.Seq = 1;
-    answerMessage.Header.Len = 0;
-    answerMessage.Header.Id = MESSAGE_ID_SET_BLINK_OFF_TIME;
-    answerMessage.Header.Status = 0;
-    SerialDispatcher::Instance().SendMessage(answerMessage);
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_GET_SCHEDULER_STATS>(header.Seq, stats);
 }
 
-void GetFlashPageMessageCallback(const Message& msg) {
-    uint8_t* addr = FlashService::Instance().GetPageAddress(
-            ((uint32_t*)msg.Data)[0], ((uint32_t*)msg.Data)[1]);
+void GetPowerStatsMessageCallback(const MessageHeader& header, const EmptyPayload& request) {
+    const PowerStats& stats = PowerManager::Instance().GetStats();
+
+    // Send answer back, copied as the counters keep changing
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_GET_POWER_STATS>(header.Seq, stats);
+}
+
+void GetUsageStatsMessageCallback(const MessageHeader& header, const UsageRequest& request) {
+    // A snapshot, a reset below only clears the live counters
+    UsageReport report;
+    UsageAnalytics& analytics = UsageAnalytics::Instance();
+
+    if (request.MinuteOfDay != USAGE_MINUTE_UNKNOWN)
+        analytics.SetClock(request.MinuteOfDay, time_us_64());
+    analytics.GetReport(Keyboard::Instance().GetNumKeys(), report);
+    if (request.IsReset)
+        analytics.Reset();
 
     // Send answer back
-    answerMessage.Header.Seq = 1;
-    answerMessage.Header.Len = FLASH_PAGE_SIZE;
-    answerMessage.Header.Id = MESSAGE_ID_GET_FLASH_PAGE;
-    answerMessage.Header.Status = 0;
-    for (uint32_t i = 0; i < answerMessage.Header.Len; i++) {
-        answerMessage.Data[i] = addr[i];
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_GET_USAGE_STATS>(header.Seq, report);
+}
+
+void GetScanRateStatsMessageCallback(const MessageHeader& header, const EmptyPayload& request) {
+    const ScanRateStats& stats = Keyboard::Instance().GetScanRateStats();
+
+    // Send answer back, copied as the counters keep changing
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_GET_SCAN_RATE_STATS>(header.Seq, stats);
+}
+
+void GetProfileStageMessageCallback(const MessageHeader& header, const ProfileRequest& request) {
+    ProfileStage stage = {};
+    uint8_t status = MESSAGE_STATUS_NOT_SUPPORTED;
+#ifdef MACROPAD_PROFILING
+    status = MESSAGE_STATUS_INVALID_VALUE;
+    if (request.Stage < PROFILER_NUM_STAGES) {
+        Profiler::Instance().GetStage(request.Stage, stage);
+        if (request.IsReset)
+            Profiler::Instance().Reset(request.Stage);
+        status = 0;
     }
-    SerialDispatcher::Instance().SendMessage(answerMessage);
+#else
+    (void) request;
+#endif
+
+    // Send answer back
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_GET_PROFILE_STAGE>(header.Seq, stage, status);
 }
 
-void ProgrammingStartCallback(const Message& msg) {
-    isInProgrammingMode = true;
-    Keyboard::Instance().ProgrammingStarted();
-    
+void GetKeymapLayerMessageCallback(const MessageHeader& header, const KeymapLayerRequest& request) {
+    Keyboard& keyboard = Keyboard::Instance();
+    KeymapLayer layer = {};
+    uint8_t status = MESSAGE_STATUS_INVALID_VALUE;
+    if (request.Layer < MAX_LAYERS) {
+        layer.Layer = request.Layer;
+        layer.NumKeys = keyboard.GetNumKeys();
+        layer.ActiveMask = keyboard.GetActiveLayers();
+        keyboard.GetLayer(layer.Layer, layer.Actions, layer.NumKeys);
+        status = 0;
+    }
+
     // Send answer back
-    answerMessage.Header.Seq = 1;
-    answerMessage.Header.Len = 0;
-    answerMessage.Header.Id = MESSAGE_ID_PROGRAMMING_START;
-    answerMessage.Header.Status = 0;
-    SerialDispatcher::Instance().SendMessage(answerMessage);
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_GET_KEYMAP_LAYER>(header.Seq, layer, status);
 }
 
-void ProgrammingEndCallback(const Message& msg) {
-    isInProgrammingMode = false;
-    Keyboard::Instance().ProgrammingEnded();
+void SetKeymapLayerMessageCallback(const MessageHeader& header, const KeymapLayer& request) {
+    uint8_t status = 0;
+    if (!Keyboard::Instance().SetLayer(request.Layer, request.Actions, request.NumKeys))
+        status = MESSAGE_STATUS_INVALID_VALUE;
 
     // Send answer back
-    answerMessage.Header.Seq = 1;
-    answerMessage.Header.Len = 0;
-    answerMessage.Header.Id = MESSAGE_ID_PROGRAMMING_END;
-    answerMessage.Header.Status = 0;
-    SerialDispatcher::Instance().SendMessage(answerMessage);
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_SET_KEYMAP_LAYER>(header.Seq, nullptr, status);
+}
+
+void GetCombosMessageCallback(const MessageHeader& header, const EmptyPayload& request) {
+    // Send answer back, copied as a SET_COMBOS may replace the table first
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_GET_COMBOS>(header.Seq,
+            Keyboard::Instance().GetCombos());
 }
 
-void ProgrammingKeyInfoCallback(const Message& msg) {
-    ProgrammingKeyInfo* keyInfoInput = (ProgrammingKeyInfo*)msg.Data;
-    eProgrammingStatus status = Keyboard::Instance().GetReadyForProgrammingKey(*keyInfoInput);
+void SetCombosMessageCallback(const MessageHeader& header, const ComboTable& request) {
+    uint8_t status = 0;
+    if (!Keyboard::Instance().SetCombos(request))
+        status = MESSAGE_STATUS_INVALID_VALUE;
 
     // Send answer back
-    answerMessage.Header.Seq = 1;
-    answerMessage.Header.Len = 0;
-    answerMessage.Header.Id = MESSAGE_ID_PROGRAMMING_KEY_INFO;
-    answerMessage.Header.Status = status;
-    SerialDispatcher::Instance().SendMessage(answerMessage);
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_SET_COMBOS>(header.Seq, nullptr, status);
+}
 
-    if (status != PROG_STATUS_OK)
-        isInProgrammingMode = false;
+void GetEncodersMessageCallback(const MessageHeader& header, const EmptyPayload& request) {
+    // Send answer back
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_GET_ENCODERS>(header.Seq,
+            Keyboard::Instance().GetEncoders());
 }
 
-void ProgrammingKeyPacketCallback(const Message& msg) {
-    eProgrammingStatus status = Keyboard::Instance().
-        ProgramKeyPacket((uint8_t*)msg.Data, msg.Header.Len, msg.Header.Seq);
+void SetEncodersMessageCallback(const MessageHeader& header, const EncoderMap& request) {
+    uint8_t status = 0;
+    if (!Keyboard::Instance().SetEncoders(request))
+        status = MESSAGE_STATUS_INVALID_VALUE;
 
     // Send answer back
-    answerMessage.Header.Seq = msg.Header.Seq;
-    answerMessage.Header.Len = 0;
-    answerMessage.Header.Id = MESSAGE_ID_PROGRAMMING_KEY_PACKET;
-    answerMessage.Header.Status = status;
-    SerialDispatcher::Instance().SendMessage(answerMessage);
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_SET_ENCODERS>(header.Seq, nullptr, status);
+}
+
+void GetSettingsMessageCallback(const MessageHeader& header, const SettingsMaskRequest& request) {
+    SettingsBatch batch;
+    batch.IdMask = 0;
+    for (int i = 0; i < MAX_BATCH_SETTINGS; i++) {
+        batch.Values[i] = 0;
+        if (i < (int)SETTINGS_TOTAL && (request.IdMask & (1u << i))) {
+            batch.IdMask |= (1u << i);
+            batch.Values[i] = settings((SettingsIds)i);
+        }
+    }
+
+    // Send answer back
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_GET_SETTINGS>(header.Seq, batch);
+}
+
+void SetSettingsMessageCallback(const MessageHeader& header, const SettingsBatch& request) {
+    SettingsBatch applied;
+    applied.IdMask = 0;
+    for (int i = 0; i < MAX_BATCH_SETTINGS; i++) {
+        applied.Values[i] = 0;
+        // Rejected values are left out of the answer mask
+        if (i < (int)SETTINGS_TOTAL && (request.IdMask & (1u << i)) &&
+                settings((SettingsIds)i, request.Values[i])) {
+            applied.IdMask |= (1u << i);
+            applied.Values[i] = settings((SettingsIds)i);
+        }
+    }
+
+    // One flash write for the whole batch
+    if (applied.IdMask != 0)
+        settings.Save();
 
-    if (status != PROG_STATUS_OK)
-        isInProgrammingMode = false;
+    // Send answer back with the values now in use
+    SerialDispatcher::Instance().QueueAnswerCopy<MESSAGE_ID_SET_SETTINGS>(header.Seq, applied);
+}
+
+void GetConfigSnapshotMessageCallback(const MessageHeader& header, const EmptyPayload& request) {
+    uint32_t length = 0;
+    eConfigSnapshotStatus status = ConfigSnapshot::Instance().BeginExport(length);
+    if (status != SNAPSHOT_STATUS_OK) {
+        SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_GET_CONFIG_SNAPSHOT>(header.Seq,
+                nullptr, status);
+        return;
+    }
+
+    MessageHeader answerHeader = MakeAnswerHeader<MESSAGE_ID_GET_CONFIG_SNAPSHOT>(header.Seq);
+    answerHeader.Len = length;
+
+    // Send answer back, streamed from RAM (header) and flash (macros)
+    SerialDispatcher::Instance().QueueStream(answerHeader, ConfigSnapshot::ExportSource);
+}
+
+void RestoreConfigSnapshotSink(const MessageHeader& header, uint32_t offset, 
+        const unsigned char* chunk, uint32_t length, bool isLast) {
+    eConfigSnapshotStatus status = ConfigSnapshot::Instance().
+        RestoreChunk(offset, chunk, length, isLast);
+
+    if (!isLast)
+        return;
+
+    // Send answer back
+    SerialDispatcher::Instance().QueueAnswer<MESSAGE_ID_RESTORE_CONFIG_SNAPSHOT>(header.Seq, 
+            nullptr, status);
 }
 
 //--------------------------------------------------------------------+
 // Blink Task                                                  
 //--------------------------------------------------------------------+
 void BlinkTask(bool isFast = false) {
-    uint32_t onTime = settings(SettingsIds::BLINK_ON_TIME);
-    uint32_t offTime = settings(SettingsIds::BLINK_OFF_TIME);
+    const SettingsCache& cache = settings.GetCache();
+    uint32_t onTime = cache.BlinkOnTimeUs;
+    uint32_t offTime = cache.BlinkOffTimeUs;
 
     if (isFast) {
         onTime /= 10;
@@ -157,19 +341,65 @@ void BlinkTask(bool isFast = false) {
     bool isOn = gpio_get(LED_PIN);
 
     if(isOn) {
-        if ((time_us_64() - startTime) / 1000 > onTime) {
+        if (time_us_64() - startTime > onTime) {
             gpio_put(LED_PIN, 0);
             startTime = time_us_64();
         }
     }
     else {
-        if ((time_us_64() - startTime) / 1000 > offTime) {
+        if (time_us_64() - startTime > offTime) {
             gpio_put(LED_PIN, 1);
             startTime = time_us_64();
         }
     }
 }
 
+void OnSettingsChanged(const SettingsCache& cache) {
+    // SOF callbacks cost a tud_task event every frame, only ask for them when used
+    tud_sof_cb_enable(cache.IsSofSyncEnabled);
+}
+
+//--------------------------------------------------------------------+
+// Tasks
+//--------------------------------------------------------------------+
+void UsbTask() {
+    tud_task();
+}
+
+void ListenTask() {
+    // One message per run, come back for the rest
+    SerialDispatcher::Instance().ListenForMessage(time_us_64());
+    if (SerialDispatcher::Instance().IsDataAvailable())
+        Scheduler::Instance().Signal(listenTaskId);
+}
+
+void SendQueueTask() {
+    // Frames cut short are dropped even when no more bytes come
+    SerialDispatcher::Instance().CheckReceiveTimeout(time_us_64());
+    SerialDispatcher::Instance().ProcessSendQueue();
+}
+
+void KeyboardTask() {
+    if (ProgrammingService::Instance().IsInProgrammingMode())
+        return;
+
+    Keyboard::Instance().Main();
+    Scheduler::Instance().SetPeriod(keyboardTaskId, Keyboard::Instance().GetScanPeriod());
+}
+
+void LedTask() {
+    BlinkTask(ProgrammingService::Instance().IsInProgrammingMode());
+}
+
+void PowerTask() {
+    // Programming mode keeps the keyboard task busy anyway, and owns the flash
+    if (ProgrammingService::Instance().IsInProgrammingMode())
+        return;
+
+    PowerManager::Instance().Update();
+    UsageAnalytics::Instance().Update(time_us_64(), PowerManager::Instance().IsKeyboardIdle());
+}
+
 //--------------------------------------------------------------------+
 // Main Loop                                                  
 //--------------------------------------------------------------------+
@@ -177,39 +407,68 @@ int main() {
     settings.Load(); // Load settings from flash
 
     InitGPIOs();
+    SetHidPollInterval(settings.GetCache().HidPollIntervalMs);
     tusb_init();
+    settings.Subscribe(OnSettingsChanged);
 
     SerialDispatcher::Instance().Initialize();
+    SerialDispatcher::Instance().AddTransport(&CdcTransport::Instance());
+    SerialDispatcher::Instance().AddTransport(&RawHidTransport::Instance());
+    RawHidTransport::Instance().SetReceiveCallback(OnRawHidReceived);
     Keyboard::Instance().Initialize();
+    UsageAnalytics::Instance().Load(time_us_64());
 
     // Register callbacks
-    SerialDispatcher::Instance().RegisterForMessage(MESSAGE_ID_SET_BLINK_ON_TIME, 
-            SetBlinkOnTimeMessageCallback);
-    SerialDispatcher::Instance().RegisterForMessage(MESSAGE_ID_SET_BLINK_OFF_TIME, 
-            SetBlinkOffTimeMessageCallback);
-    SerialDispatcher::Instance().RegisterForMessage(MESSAGE_ID_GET_FLASH_PAGE, 
-            GetFlashPageMessageCallback);
-    SerialDispatcher::Instance().RegisterForMessage(MESSAGE_ID_PROGRAMMING_START,
-            ProgrammingStartCallback);
-    SerialDispatcher::Instance().RegisterForMessage(MESSAGE_ID_PROGRAMMING_KEY_INFO,
-            ProgrammingKeyInfoCallback);
-    SerialDispatcher::Instance().RegisterForMessage(MESSAGE_ID_PROGRAMMING_KEY_PACKET,
-            ProgrammingKeyPacketCallback);
-    SerialDispatcher::Instance().RegisterForMessage(MESSAGE_ID_PROGRAMMING_END,
-            ProgrammingEndCallback);
-
-    while (true) {
-        tud_task();
-        //CdcTask();
-        SerialDispatcher::Instance().ListenForMessage();
-
-        if (isInProgrammingMode) {
-            BlinkTask(true); 
-        }
-        else {
-            Keyboard::Instance().Main();
-            BlinkTask();
-        }
-    }
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_SET_BLINK_ON_TIME,
+            SetBlinkOnTimeMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_SET_BLINK_OFF_TIME,
+            SetBlinkOffTimeMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_SEND_QUEUE_STATS,
+            GetSendQueueStatsMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_SCHEDULER_STATS,
+            GetSchedulerStatsMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_POWER_STATS,
+            GetPowerStatsMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_SCAN_RATE_STATS,
+            GetScanRateStatsMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_PROFILE_STAGE,
+            GetProfileStageMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_KEYMAP_LAYER,
+            GetKeymapLayerMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_SET_KEYMAP_LAYER,
+            SetKeymapLayerMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_COMBOS,
+            GetCombosMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_SET_COMBOS,
+            SetCombosMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_ENCODERS,
+            GetEncodersMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_SET_ENCODERS,
+            SetEncodersMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_USAGE_STATS,
+            GetUsageStatsMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_SETTINGS,
+            GetSettingsMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_SET_SETTINGS,
+            SetSettingsMessageCallback>();
+    SerialDispatcher::Instance().RegisterForMessage<MESSAGE_ID_GET_CONFIG_SNAPSHOT,
+            GetConfigSnapshotMessageCallback>();
+    SerialDispatcher::Instance().RegisterStreamSink(MESSAGE_ID_RESTORE_CONFIG_SNAPSHOT,
+            RestoreConfigSnapshotSink);
+    ProgrammingService::Instance().Initialize(&programmingTarget);
+
+    // Tasks
+    Scheduler& scheduler = Scheduler::Instance();
+    scheduler.AddPeriodicTask(UsbTask, 0, TASK_PRIORITY_HIGH);
+    listenTaskId = scheduler.AddEventTask(ListenTask, TASK_PRIORITY_HIGH);
+    keyboardTaskId = scheduler.AddPeriodicTask(KeyboardTask, Keyboard::Instance().GetScanPeriod(),
+            TASK_PRIORITY_HIGH);
+    scheduler.AddPeriodicTask(SendQueueTask, 0, TASK_PRIORITY_NORMAL);
+    int ledTaskId = scheduler.AddPeriodicTask(LedTask, BLINK_TASK_PERIOD_US, TASK_PRIORITY_LOW);
+    scheduler.AddPeriodicTask(PowerTask, POWER_TASK_PERIOD_US, TASK_PRIORITY_LOW);
+
+    PowerManager::Instance().Initialize(keyboardTaskId, ledTaskId);
+    scheduler.SetIdleCallback(PowerManager::Sleep);
+
+    scheduler.Run();
 }
-
@@ -0,0 +1,115 @@
+#include "power_manager.h"
+#include "keyboard.h"
+#include "scheduler.h"
+#include "settings.h"
+#include "usage_analytics.h"
+#include "tusb.h"
+
+PowerManager::PowerManager() {
+    state = POWER_STATE_ACTIVE;
+    isKeyboardIdle = false;
+    isMeasuringWake = false;
+    wakeTime = 0;
+    lastActivityTime = 0;
+    keyboardTaskId = -1;
+    ledTaskId = -1;
+    stats = {};
+}
+
+void PowerManager::Initialize(int keyboardTaskId, int ledTaskId) {
+    this->keyboardTaskId = keyboardTaskId;
+    this->ledTaskId = ledTaskId;
+    lastActivityTime = time_us_64();
+}
+
+void PowerManager::Update() {
+    if (isKeyboardIdle)
+        return;
+
+    uint64_t now = time_us_64();
+    if (!Keyboard::Instance().IsIdle()) {
+        lastActivityTime = now;
+        return;
+    }
+
+    if (now - lastActivityTime > Settings::Instance().GetCache().IdleTimeoutUs)
+        EnterIdle();
+}
+
+void PowerManager::EnterIdle() {
+    // Also reached while suspended after a key woke us up
+    stats.IdleEntries++;
+    if (state == POWER_STATE_ACTIVE)
+        state = POWER_STATE_IDLE;
+    isKeyboardIdle = true;
+    Scheduler::Instance().SetEnabled(keyboardTaskId, false);
+    Keyboard::Instance().EnterIdle(state != POWER_STATE_SUSPENDED || stats.IsRemoteWakeupEnabled,
+            OnRowEdge);
+    UsageAnalytics::Instance().OnIdle(state == POWER_STATE_SUSPENDED, time_us_64());
+}
+
+void PowerManager::OnSuspend(bool isRemoteWakeupEnabled) {
+    stats.Suspends++;
+    stats.IsRemoteWakeupEnabled = isRemoteWakeupEnabled;
+
+    // Keys only need to be watched if they can wake the host
+    Scheduler::Instance().SetEnabled(keyboardTaskId, false);
+    Scheduler::Instance().SetEnabled(ledTaskId, false);
+    gpio_put(PICO_DEFAULT_LED_PIN, 0);
+    isKeyboardIdle = true;
+    state = POWER_STATE_SUSPENDED;
+    Keyboard::Instance().EnterIdle(isRemoteWakeupEnabled, OnRowEdge);
+    UsageAnalytics::Instance().OnIdle(true, time_us_64());
+}
+
+void PowerManager::OnResume() {
+    if (isKeyboardIdle)
+        Wake();
+
+    state = POWER_STATE_ACTIVE;
+    lastActivityTime = time_us_64();
+    Scheduler::Instance().SetEnabled(ledTaskId, true);
+}
+
+void PowerManager::Wake() {
+    isKeyboardIdle = false;
+    Keyboard::Instance().ExitIdle();
+
+    // Scan right away instead of waiting for the next period
+    Scheduler::Instance().SetEnabled(keyboardTaskId, true);
+    Scheduler::Instance().Signal(keyboardTaskId);
+}
+
+void PowerManager::OnRowEdge() {
+    PowerManager& manager = Instance();
+    if (!manager.isKeyboardIdle)
+        return;
+
+    manager.stats.Wakeups++;
+    manager.wakeTime = time_us_64();
+    manager.isMeasuringWake = true;
+    manager.Wake();
+
+    // Still suspended, the report triggers the remote wakeup
+    if (manager.state == POWER_STATE_IDLE)
+        manager.state = POWER_STATE_ACTIVE;
+}
+
+void PowerManager::OnReportSent() {
+    if (!isMeasuringWake)
+        return;
+
+    isMeasuringWake = false;
+    stats.LastWakeLatencyUs = (uint32_t)(time_us_64() - wakeTime);
+    if (stats.LastWakeLatencyUs > stats.MaxWakeLatencyUs)
+        stats.MaxWakeLatencyUs = stats.LastWakeLatencyUs;
+}
+
+void PowerManager::Sleep(uint64_t nextReleaseUs) {
+    // Busy polling while active keeps USB and scan latency low
+    if (Instance().state == POWER_STATE_ACTIVE || tud_task_event_ready())
+        return;
+
+    // Any interrupt (row edge, USB) ends the wait early
+    best_effort_wfe_or_timeout(from_us_since_boot(nextReleaseUs));
+}
@@ -0,0 +1,50 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include "pico/stdlib.h"
+#include "message_payloads.h"
+
+// Stops scanning once the keyboard has been idle for the IDLE_TIMEOUT
+// setting and sleeps with WFE until a row edge, USB or timer interrupt.
+// On USB suspend the LED is switched off as well, a keypress then wakes
+// the host if it enabled remote wakeup.
+class PowerManager {
+public:
+    static PowerManager& Instance() {
+        static PowerManager instance;
+        return instance;
+    }
+
+    // Scheduler tasks that are paused while idle
+    void Initialize(int keyboardTaskId, int ledTaskId);
+    // Periodic task, enters idle after the timeout
+    void Update();
+
+    void OnSuspend(bool isRemoteWakeupEnabled);
+    void OnResume();
+    void OnReportSent();
+
+    // Scheduler IdleCallback
+    static void Sleep(uint64_t nextReleaseUs);
+
+    inline const PowerStats& GetStats() { stats.State = state; return stats; }
+    inline bool IsKeyboardIdle() const { return isKeyboardIdle; }
+
+private:
+    PowerManager();
+    void EnterIdle();
+    void Wake();
+    static void OnRowEdge();
+
+private:
+    volatile ePowerState state;
+    volatile bool isKeyboardIdle;
+    volatile bool isMeasuringWake;
+    volatile uint64_t wakeTime;
+    uint64_t lastActivityTime;
+    int keyboardTaskId;
+    int ledTaskId;
+    PowerStats stats;
+};
+
+#endif // POWER_MANAGER_H
@@ -0,0 +1,50 @@
+#include "profiler.h"
+
+#ifdef MACROPAD_PROFILING
+
+Profiler::Profiler() {
+    for (int i = 0; i < PROFILER_NUM_STAGES; i++)
+        Reset(i);
+}
+
+void Profiler::Record(int stage, uint32_t us) {
+    Stage& s = stages[stage];
+    s.Count++;
+    s.TotalUs += us;
+    if (us < s.MinUs)
+        s.MinUs = us;
+    if (us > s.MaxUs)
+        s.MaxUs = us;
+
+    // Bucket = number of significant bits, clamped to the last bucket
+    int bucket = (us == 0) ? 0 : 32 - __builtin_clz(us);
+    if (bucket >= PROFILER_NUM_BUCKETS)
+        bucket = PROFILER_NUM_BUCKETS - 1;
+    if (s.Histogram[bucket] != 0xFFFF)
+        s.Histogram[bucket]++;
+}
+
+void Profiler::GetStage(int stage, ProfileStage& out) const {
+    const Stage& s = stages[stage];
+    out.Stage = stage;
+    out.NumStages = PROFILER_NUM_STAGES;
+    out.Reserved = 0;
+    out.Count = s.Count;
+    out.MinUs = (s.Count > 0) ? s.MinUs : 0;
+    out.MaxUs = s.MaxUs;
+    out.MeanUs = (s.Count > 0) ? (uint32_t)(s.TotalUs / s.Count) : 0;
+    for (int i = 0; i < PROFILER_NUM_BUCKETS; i++)
+        out.Histogram[i] = s.Histogram[i];
+}
+
+void Profiler::Reset(int stage) {
+    Stage& s = stages[stage];
+    s.Count = 0;
+    s.MinUs = UINT32_MAX;
+    s.MaxUs = 0;
+    s.TotalUs = 0;
+    for (auto& h : s.Histogram)
+        h = 0;
+}
+
+#endif // MACROPAD_PROFILING
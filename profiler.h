@@ -0,0 +1,47 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "pico/stdlib.h"
+#include "message_payloads.h"
+
+// Min / max / mean and a log2 histogram per profiler stage.
+// Only built with MACROPAD_PROFILING, otherwise PROFILE_RECORD
+// compiles to nothing.
+#ifdef MACROPAD_PROFILING
+
+#define PROFILE_RECORD(stage, us) Profiler::Instance().Record((stage), (us))
+
+class Profiler {
+private:
+    struct Stage {
+        uint32_t Count;
+        uint32_t MinUs;
+        uint32_t MaxUs;
+        uint64_t TotalUs;
+        uint16_t Histogram[PROFILER_NUM_BUCKETS];
+    };
+
+public:
+    static Profiler& Instance() {
+        static Profiler instance;
+        return instance;
+    }
+
+    void Record(int stage, uint32_t us);
+    void GetStage(int stage, ProfileStage& out) const;
+    void Reset(int stage);
+
+private:
+    Profiler();
+
+private:
+    Stage stages[PROFILER_NUM_STAGES];
+};
+
+#else
+
+#define PROFILE_RECORD(stage, us) ((void)0)
+
+#endif // MACROPAD_PROFILING
+
+#endif // PROFILER_H
@@ -0,0 +1,141 @@
+#include "scheduler.h"
+#include "profiler.h"
+
+Scheduler::Scheduler() {
+    numTasks = 0;
+    idleCallback = nullptr;
+}
+
+int Scheduler::AddPeriodicTask(TaskCallback callback, uint32_t periodUs, eTaskPriority priority) {
+    return AddTask(callback, periodUs, priority, false);
+}
+
+int Scheduler::AddEventTask(TaskCallback callback, eTaskPriority priority) {
+    return AddTask(callback, 0, priority, true);
+}
+
+int Scheduler::AddTask(TaskCallback callback, uint32_t periodUs, eTaskPriority priority, bool isEvent) {
+    if (numTasks >= MAX_SCHEDULER_TASKS)
+        return -1;
+
+    int taskId = numTasks++;
+    Task& task = tasks[taskId];
+    task.Callback = callback;
+    task.NextRelease = time_us_64();
+    task.IsSignaled = false;
+    task.IsEnabled = true;
+    task.Stats = {};
+    task.Stats.PeriodUs = periodUs;
+    task.Stats.Priority = priority;
+    task.Stats.IsEvent = isEvent;
+
+    // Insert after the tasks of the same or higher priority
+    int pos = taskId;
+    while (pos > 0 && tasks[runOrder[pos - 1]].Stats.Priority > priority) {
+        runOrder[pos] = runOrder[pos - 1];
+        pos--;
+    }
+    runOrder[pos] = taskId;
+
+    return taskId;
+}
+
+bool Scheduler::IsReady(Task& task, uint64_t now) {
+    if (!task.IsEnabled)
+        return false;
+
+    if (task.IsSignaled) {
+        // Cleared before running so a signal raised meanwhile is kept
+        task.IsSignaled = false;
+        task.NextRelease = now;
+        return true;
+    }
+
+    return !task.Stats.IsEvent && now >= task.NextRelease;
+}
+
+bool Scheduler::IsAnySignaled() const {
+    for (int i = 0; i < numTasks; i++) {
+        if (tasks[i].IsEnabled && tasks[i].IsSignaled)
+            return true;
+    }
+    return false;
+}
+
+uint64_t Scheduler::GetNextRelease() const {
+    uint64_t nextRelease = UINT64_MAX;
+    for (int i = 0; i < numTasks; i++) {
+        const Task& task = tasks[i];
+        if (task.IsEnabled && !task.Stats.IsEvent && task.Stats.PeriodUs > 0 &&
+                task.NextRelease < nextRelease)
+            nextRelease = task.NextRelease;
+    }
+    return nextRelease;
+}
+
+void Scheduler::RunTask(int taskId, uint64_t now) {
+    Task& task = tasks[taskId];
+    TaskStats& taskStats = task.Stats;
+    uint64_t release = task.NextRelease;
+
+    task.Callback();
+
+    uint64_t end = time_us_64();
+    uint32_t runTime = (uint32_t)(end - now);
+    taskStats.RunCount++;
+    taskStats.LastRunUs = runTime;
+    taskStats.TotalRunUs += runTime;
+    if (runTime > taskStats.MaxRunUs)
+        taskStats.MaxRunUs = runTime;
+    PROFILE_RECORD(PROFILER_STAGE_TASK_RUN + taskId, runTime);
+
+    if (taskStats.IsEvent || taskStats.PeriodUs == 0)
+        return;
+
+    uint32_t lateness = (uint32_t)(now - release);
+    if (lateness > taskStats.MaxLatenessUs)
+        taskStats.MaxLatenessUs = lateness;
+    PROFILE_RECORD(PROFILER_STAGE_TASK_LATENESS + taskId, lateness);
+    if (end > release + taskStats.PeriodUs)
+        taskStats.DeadlineMisses++;
+
+    // Keep the rate, but do not run a burst to catch up on missed periods
+    task.NextRelease = release + taskStats.PeriodUs;
+    if (task.NextRelease <= end)
+        task.NextRelease = end + taskStats.PeriodUs;
+}
+
+void Scheduler::RunPass() {
+    for (int i = 0; i < numTasks; i++) {
+        int taskId = runOrder[i];
+        uint64_t now = time_us_64();
+        if (IsReady(tasks[taskId], now))
+            RunTask(taskId, now);
+    }
+}
+
+void Scheduler::Run() {
+#ifdef MACROPAD_PROFILING
+    uint64_t lastPassStart = time_us_64();
+#endif
+    while (true) {
+#ifdef MACROPAD_PROFILING
+        uint64_t passStart = time_us_64();
+        PROFILE_RECORD(PROFILER_STAGE_LOOP_PERIOD, (uint32_t)(passStart - lastPassStart));
+        lastPassStart = passStart;
+#endif
+        RunPass();
+        if (idleCallback != nullptr && !IsAnySignaled())
+            idleCallback(GetNextRelease());
+    }
+}
+
+void Scheduler::GetStats(SchedulerStats& stats) const {
+    stats.NumTasks = numTasks;
+    for (auto& b : stats.Reserved)
+        b = 0;
+    for (int i = 0; i < numTasks; i++)
+        stats.Tasks[i] = tasks[i].Stats;
+    for (int i = numTasks; i < MAX_SCHEDULER_TASKS; i++)
+        stats.Tasks[i] = {};
+}
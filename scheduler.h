@@ -0,0 +1,69 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "pico/stdlib.h"
+#include "message_payloads.h"
+
+typedef void (*TaskCallback)();
+// Called when a pass found nothing signaled, with the time (time_us_64)
+// the next periodic task is released. Tasks polled on every pass are
+// driven by interrupts and are not taken into account.
+typedef void (*IdleCallback)(uint64_t nextReleaseUs);
+
+// Cooperative scheduler. Every pass runs the ready tasks once, in
+// priority order (tasks of equal priority in the order they were added).
+// A task is ready when its period elapsed, when it was signaled, or
+// always for tasks with a 0 period.
+class Scheduler {
+private:
+    struct Task {
+        TaskCallback Callback;
+        uint64_t NextRelease;
+        volatile bool IsSignaled;
+        volatile bool IsEnabled;
+        TaskStats Stats;
+    };
+
+public:
+    static Scheduler& Instance() {
+        static Scheduler instance;
+        return instance;
+    }
+
+    // Return the task id or -1 if there is no room left
+    int AddPeriodicTask(TaskCallback callback, uint32_t periodUs, eTaskPriority priority);
+    int AddEventTask(TaskCallback callback, eTaskPriority priority);
+    // Marks an event task ready, or releases a periodic task right away.
+    // Safe to call from interrupts.
+    inline void Signal(int taskId) { tasks[taskId].IsSignaled = true; }
+    // Takes effect from the next release, may be called by the task itself
+    inline void SetPeriod(int taskId, uint32_t periodUs) { tasks[taskId].Stats.PeriodUs = periodUs; }
+    // Moves the next release of a periodic task, not safe from interrupts
+    inline void SetNextRelease(int taskId, uint64_t releaseUs) { tasks[taskId].NextRelease = releaseUs; }
+    // Disabled tasks are skipped, safe to call from interrupts
+    inline void SetEnabled(int taskId, bool isEnabled) { tasks[taskId].IsEnabled = isEnabled; }
+    inline void SetIdleCallback(IdleCallback callback) { idleCallback = callback; }
+
+    void RunPass();
+    void Run();
+
+    // Fills a copy, the answer is sent later while the counters move on
+    void GetStats(SchedulerStats& stats) const;
+
+private:
+    Scheduler();
+    int AddTask(TaskCallback callback, uint32_t periodUs, eTaskPriority priority, bool isEvent);
+    bool IsReady(Task& task, uint64_t now);
+    bool IsAnySignaled() const;
+    uint64_t GetNextRelease() const;
+    void RunTask(int taskId, uint64_t now);
+
+private:
+    Task tasks[MAX_SCHEDULER_TASKS];
+    // Task indexes sorted by priority
+    uint8_t runOrder[MAX_SCHEDULER_TASKS];
+    int numTasks;
+    IdleCallback idleCallback;
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,26 @@
+#include "cdc_transport.h"
+#include "cdc_utils.h"
+
+bool CdcTransport::IsConnected() {
+    return tud_cdc_n_connected(CDC_MESSAGES_ITF);
+}
+
+uint32_t CdcTransport::Available() {
+    return tud_cdc_n_available(CDC_MESSAGES_ITF);
+}
+
+uint32_t CdcTransport::Read(void* data, uint32_t length) {
+    return tud_cdc_n_read(CDC_MESSAGES_ITF, data, length);
+}
+
+uint32_t CdcTransport::WriteAvailable() {
+    return tud_cdc_n_write_available(CDC_MESSAGES_ITF);
+}
+
+uint32_t CdcTransport::Write(const void* data, uint32_t length) {
+    return tud_cdc_n_write(CDC_MESSAGES_ITF, data, length);
+}
+
+void CdcTransport::Flush() {
+    tud_cdc_n_write_flush(CDC_MESSAGES_ITF);
+}
@@ -0,0 +1,25 @@
+#ifndef CDC_TRANSPORT_H
+#define CDC_TRANSPORT_H
+
+#include "message_transport.h"
+
+// Messages over the CDC interface, a thin wrapper of the TinyUSB FIFOs
+class CdcTransport : public MessageTransport {
+public:
+    static CdcTransport& Instance() {
+        static CdcTransport instance;
+        return instance;
+    }
+
+    bool IsConnected() override;
+    uint32_t Available() override;
+    uint32_t Read(void* data, uint32_t length) override;
+    uint32_t WriteAvailable() override;
+    uint32_t Write(const void* data, uint32_t length) override;
+    void Flush() override;
+
+private:
+    CdcTransport() {}
+};
+
+#endif // CDC_TRANSPORT_H
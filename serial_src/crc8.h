@@ -0,0 +1,30 @@
+#ifndef CRC8_H
+#define CRC8_H
+
+#include <stdint.h>
+
+// CRC-8 (polynomial 0x07, init 0x00), table driven.
+// The table is generated at compile time and lives in flash.
+struct Crc8Table {
+    uint8_t Values[256];
+
+    constexpr Crc8Table() : Values() {
+        for (int i = 0; i < 256; i++) {
+            uint8_t crc = (uint8_t)i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+            Values[i] = crc;
+        }
+    }
+};
+
+static constexpr Crc8Table CRC8_TABLE;
+
+static inline uint8_t Crc8(const uint8_t* data, uint32_t length) {
+    uint8_t crc = 0;
+    for (uint32_t i = 0; i < length; i++)
+        crc = CRC8_TABLE.Values[crc ^ data[i]];
+    return crc;
+}
+
+#endif // CRC8_H
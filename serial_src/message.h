@@ -1,11 +1,30 @@
 #ifndef MESSAGE_H
 #define MESSAGE_H
 
+#include <stddef.h>
+
 const int MAX_DATA_LENGTH = 256;
 const unsigned char MESSAGE_START_MARK = 1;
 
+// Large frames are never buffered whole, the dispatcher hands
+// their payload to a stream sink in LARGE_FRAME_CHUNK_LENGTH chunks
+const int MAX_LARGE_DATA_LENGTH = 0xFFFF; // Header.Len is 16 bits
+const int LARGE_FRAME_CHUNK_LENGTH = MAX_DATA_LENGTH;
+
+// Raw HID transport: every 64 byte report carries a count byte and up to
+// 63 bytes of the same frame stream as the CDC interface
+const int RAW_HID_REPORT_LENGTH = 64;
+const int RAW_HID_PAYLOAD_LENGTH = RAW_HID_REPORT_LENGTH - 1;
+
+// Answer status shared by every message, message specific
+// statuses (e.g. eProgrammingStatus) stay below this value
+const unsigned char MESSAGE_STATUS_INVALID_LENGTH = 0x80;
+const unsigned char MESSAGE_STATUS_INVALID_VALUE = 0x81;
+const unsigned char MESSAGE_STATUS_NOT_SUPPORTED = 0x82;   // Compiled out of this firmware
+
 enum MessageTypes {
     MESSAGE_TYPE_ANSWER = 0x41,
+    MESSAGE_TYPE_LARGE_REQUEST = 0x4C,
     MESSAGE_TYPE_REQUEST = 0x52
 };
 
@@ -17,6 +36,25 @@ enum MessageIds {
     MESSAGE_ID_PROGRAMMING_KEY_INFO,
     MESSAGE_ID_PROGRAMMING_KEY_PACKET,
     MESSAGE_ID_PROGRAMMING_END,
+    MESSAGE_ID_PROGRAMMING_WINDOW_START,
+    MESSAGE_ID_PROGRAMMING_WINDOW_PACKET,
+    MESSAGE_ID_PROGRAMMING_KEY_SECTOR,
+    MESSAGE_ID_GET_SEND_QUEUE_STATS,
+    MESSAGE_ID_GET_SETTINGS,
+    MESSAGE_ID_SET_SETTINGS,
+    MESSAGE_ID_GET_CONFIG_SNAPSHOT,
+    MESSAGE_ID_RESTORE_CONFIG_SNAPSHOT,
+    MESSAGE_ID_GET_SCHEDULER_STATS,
+    MESSAGE_ID_GET_POWER_STATS,
+    MESSAGE_ID_GET_SCAN_RATE_STATS,
+    MESSAGE_ID_GET_PROFILE_STAGE,
+    MESSAGE_ID_GET_KEYMAP_LAYER,
+    MESSAGE_ID_SET_KEYMAP_LAYER,
+    MESSAGE_ID_GET_COMBOS,
+    MESSAGE_ID_SET_COMBOS,
+    MESSAGE_ID_GET_ENCODERS,
+    MESSAGE_ID_SET_ENCODERS,
+    MESSAGE_ID_GET_USAGE_STATS,
     MESSAGE_ID_TOTAL
 };
 
@@ -48,9 +86,22 @@ struct MessageHeader {
 
 };
 
-struct Message {
+// The header is sent as is on the wire, host and device must agree on it
+static_assert(sizeof(MessageHeader) == 8, "MessageHeader must be 8 bytes");
+static_assert(offsetof(MessageHeader, Mark) == 0, "MessageHeader layout changed");
+static_assert(offsetof(MessageHeader, Type) == 1, "MessageHeader layout changed");
+static_assert(offsetof(MessageHeader, Seq) == 2, "MessageHeader layout changed");
+static_assert(offsetof(MessageHeader, Len) == 4, "MessageHeader layout changed");
+static_assert(offsetof(MessageHeader, Id) == 6, "MessageHeader layout changed");
+static_assert(offsetof(MessageHeader, Status) == 7, "MessageHeader layout changed");
+
+// Word aligned so Data (right after the 8 byte header) can be
+// viewed as a payload struct without unaligned accesses
+struct alignas(4) Message {
     MessageHeader Header;
     unsigned char Data[MAX_DATA_LENGTH];
 };
 
+static_assert(offsetof(Message, Data) == sizeof(MessageHeader), "Message layout changed");
+
 #endif // MESSAGE_H
@@ -0,0 +1,128 @@
+#ifndef MESSAGE_CODEC_H
+#define MESSAGE_CODEC_H
+
+// Typed access to message payloads.
+// Shared by the firmware and the host tools, keep it free of SDK includes.
+
+#include <stdint.h>
+#include <type_traits>
+#include "message.h"
+#include "message_payloads.h"
+
+// Variable length payload (e.g. flash pages of a key macro)
+struct ByteSpan {
+    const uint8_t* Data;
+    uint16_t Length;
+};
+
+// Request and answer payload of every message id.
+// Messages without traits can not be used with the typed API.
+template <MessageIds Id> struct MessageTraits;
+
+#define MESSAGE_TRAITS(id, request, response) \
+    template <> struct MessageTraits<id> { \
+        typedef request Request; \
+        typedef response Response; \
+    }
+
+MESSAGE_TRAITS(MESSAGE_ID_SET_BLINK_ON_TIME, SettingValueRequest, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_SET_BLINK_OFF_TIME, SettingValueRequest, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_GET_FLASH_PAGE, FlashPageRequest, FlashPage);
+MESSAGE_TRAITS(MESSAGE_ID_PROGRAMMING_START, EmptyPayload, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_PROGRAMMING_KEY_INFO, ProgrammingKeyInfo, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_PROGRAMMING_KEY_PACKET, ByteSpan, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_PROGRAMMING_END, EmptyPayload, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_PROGRAMMING_WINDOW_START, ProgrammingWindowInfo, ProgrammingWindowInfo);
+MESSAGE_TRAITS(MESSAGE_ID_PROGRAMMING_WINDOW_PACKET, ByteSpan, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_PROGRAMMING_KEY_SECTOR, ByteSpan, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_GET_SEND_QUEUE_STATS, EmptyPayload, SendQueueStats);
+MESSAGE_TRAITS(MESSAGE_ID_GET_SETTINGS, SettingsMaskRequest, SettingsBatch);
+MESSAGE_TRAITS(MESSAGE_ID_SET_SETTINGS, SettingsBatch, SettingsBatch);
+MESSAGE_TRAITS(MESSAGE_ID_GET_CONFIG_SNAPSHOT, EmptyPayload, ByteSpan);
+MESSAGE_TRAITS(MESSAGE_ID_RESTORE_CONFIG_SNAPSHOT, ByteSpan, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_GET_SCHEDULER_STATS, EmptyPayload, SchedulerStats);
+MESSAGE_TRAITS(MESSAGE_ID_GET_POWER_STATS, EmptyPayload, PowerStats);
+MESSAGE_TRAITS(MESSAGE_ID_GET_SCAN_RATE_STATS, EmptyPayload, ScanRateStats);
+MESSAGE_TRAITS(MESSAGE_ID_GET_PROFILE_STAGE, ProfileRequest, ProfileStage);
+MESSAGE_TRAITS(MESSAGE_ID_GET_KEYMAP_LAYER, KeymapLayerRequest, KeymapLayer);
+MESSAGE_TRAITS(MESSAGE_ID_SET_KEYMAP_LAYER, KeymapLayer, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_GET_COMBOS, EmptyPayload, ComboTable);
+MESSAGE_TRAITS(MESSAGE_ID_SET_COMBOS, ComboTable, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_GET_ENCODERS, EmptyPayload, EncoderMap);
+MESSAGE_TRAITS(MESSAGE_ID_SET_ENCODERS, EncoderMap, EmptyPayload);
+MESSAGE_TRAITS(MESSAGE_ID_GET_USAGE_STATS, UsageRequest, UsageReport);
+
+// Number of payload bytes a type occupies on the wire
+template <typename T>
+struct PayloadLength {
+    static const uint16_t Value = sizeof(T);
+};
+
+template <>
+struct PayloadLength<EmptyPayload> {
+    static const uint16_t Value = 0;
+};
+
+// Variable length, the sender sets Header.Len
+template <>
+struct PayloadLength<ByteSpan> {
+    static const uint16_t Value = 0;
+};
+
+// Zero copy, bounds checked view of a fixed size payload.
+// IsValid() is false if Header.Len is shorter than the payload.
+template <typename T>
+class PayloadView {
+public:
+    static_assert(std::is_trivially_copyable<T>::value, "Payloads must be plain structs");
+    static_assert(alignof(T) <= alignof(Message), "Payload would be read unaligned");
+
+    explicit PayloadView(const Message& msg) :
+        payload((msg.Header.Len >= sizeof(T)) ? reinterpret_cast<const T*>(msg.Data) : nullptr)
+    {}
+
+    inline bool IsValid() const { return payload != nullptr; }
+    inline const T& Get() const { return *payload; }
+
+private:
+    const T* payload;
+};
+
+template <>
+class PayloadView<EmptyPayload> {
+public:
+    explicit PayloadView(const Message& msg) { (void)msg; }
+
+    inline bool IsValid() const { return true; }
+    inline const EmptyPayload& Get() const { return payload; }
+
+private:
+    EmptyPayload payload;
+};
+
+template <>
+class PayloadView<ByteSpan> {
+public:
+    explicit PayloadView(const Message& msg) {
+        span.Data = msg.Data;
+        span.Length = (msg.Header.Len <= MAX_DATA_LENGTH) ? msg.Header.Len : 0;
+    }
+
+    inline bool IsValid() const { return true; }
+    inline const ByteSpan& Get() const { return span; }
+
+private:
+    ByteSpan span;
+};
+
+// Header of the answer to a typed message, Len matches the response type
+template <MessageIds Id>
+inline MessageHeader MakeAnswerHeader(uint16_t seq, uint8_t status = 0) {
+    MessageHeader header(Id);
+    header.Seq = seq;
+    header.Len = PayloadLength<typename MessageTraits<Id>::Response>::Value;
+    header.Status = status;
+    return header;
+}
+
+#endif // MESSAGE_CODEC_H
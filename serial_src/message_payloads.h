@@ -0,0 +1,447 @@
+#ifndef MESSAGE_PAYLOADS_H
+#define MESSAGE_PAYLOADS_H
+
+// Payloads carried by the messages in message.h.
+// Shared by the firmware and the host tools, keep it free of SDK includes.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compile time checks of the wire layout, every payload is checked
+// on both sides so the firmware and the host tools cannot drift apart
+#define PAYLOAD_SIZE(type, size) \
+    static_assert(sizeof(type) == (size), #type " size changed")
+#define PAYLOAD_FIELD(type, field, offset) \
+    static_assert(offsetof(type, field) == (offset), #type "::" #field " moved")
+
+enum eProgrammingStatus {
+    PROG_STATUS_OK = 0,
+    PROG_STATUS_INVALID_KEY_COLUMN = 0x1,
+    PROG_STATUS_INVALID_KEY_ROW = 0x2,
+    PROG_STATUS_INVALID_MACRO_LENGTH = 0x4,
+    PROG_STATUS_INVALID_PACKET_SEQ = 0x8,
+    PROG_STATUS_PACKET_OVERFLOW = 0x10,
+    PROG_STATUS_INVALID_CRC = 0x20,
+    PROG_STATUS_PACKET_GAP = 0x40,
+    // Not flags, and below the shared MESSAGE_STATUS_* values
+    PROG_STATUS_WINDOW_INACTIVE = 0x41,
+    PROG_STATUS_NO_KEY = 0x42          // No key info was accepted to program into
+};
+
+// Messages without a payload
+struct EmptyPayload {
+};
+
+struct SettingValueRequest {
+    uint32_t Value;
+};
+PAYLOAD_SIZE(SettingValueRequest, 4);
+
+struct ProgrammingKeyInfo {
+    uint16_t KeyColumn;
+    uint16_t KeyRow;
+    uint16_t KeyCode;
+    uint16_t MacroLength;
+};
+PAYLOAD_SIZE(ProgrammingKeyInfo, 8);
+PAYLOAD_FIELD(ProgrammingKeyInfo, KeyColumn, 0);
+PAYLOAD_FIELD(ProgrammingKeyInfo, KeyRow, 2);
+PAYLOAD_FIELD(ProgrammingKeyInfo, KeyCode, 4);
+PAYLOAD_FIELD(ProgrammingKeyInfo, MacroLength, 6);
+
+// Request of a window, and its answer with the granted window size
+struct ProgrammingWindowInfo {
+    uint16_t WindowSize;
+    uint16_t NumPackets;
+};
+PAYLOAD_SIZE(ProgrammingWindowInfo, 4);
+PAYLOAD_FIELD(ProgrammingWindowInfo, WindowSize, 0);
+PAYLOAD_FIELD(ProgrammingWindowInfo, NumPackets, 2);
+
+struct MacroKey {
+    uint16_t Code;
+    uint8_t IsModifier;
+    uint8_t IsPressed;
+    uint32_t DelayMs;
+};
+PAYLOAD_SIZE(MacroKey, 8);
+PAYLOAD_FIELD(MacroKey, Code, 0);
+PAYLOAD_FIELD(MacroKey, IsModifier, 2);
+PAYLOAD_FIELD(MacroKey, IsPressed, 3);
+PAYLOAD_FIELD(MacroKey, DelayMs, 4);
+
+struct FlashPageRequest {
+    uint32_t SectorNum;
+    uint32_t PageNum;
+};
+PAYLOAD_SIZE(FlashPageRequest, 8);
+PAYLOAD_FIELD(FlashPageRequest, SectorNum, 0);
+PAYLOAD_FIELD(FlashPageRequest, PageNum, 4);
+
+struct FlashPage {
+    uint8_t Data[256];
+};
+PAYLOAD_SIZE(FlashPage, 256);
+
+// Any subset of SettingsIds, Values is indexed by the settings id
+// and only the entries whose bit is set in IdMask are meaningful
+const int MAX_BATCH_SETTINGS = 32;
+
+struct SettingsMaskRequest {
+    uint32_t IdMask;
+};
+PAYLOAD_SIZE(SettingsMaskRequest, 4);
+
+struct SettingsBatch {
+    uint32_t IdMask;
+    uint32_t Values[MAX_BATCH_SETTINGS];
+};
+PAYLOAD_SIZE(SettingsBatch, 132);
+PAYLOAD_FIELD(SettingsBatch, IdMask, 0);
+PAYLOAD_FIELD(SettingsBatch, Values, 4);
+
+// Full configuration blob (settings + keymap).
+// The header fills the first CONFIG_SNAPSHOT_HEADER_LENGTH bytes, then the
+// macro of every key with MacroLength > 0 follows in key index order,
+// each one starting on a CONFIG_SNAPSHOT_PAGE_LENGTH boundary.
+const uint32_t CONFIG_SNAPSHOT_MAGIC = 0x5343504D; // "MPCS"
+const uint16_t CONFIG_SNAPSHOT_VERSION = 2;
+const uint32_t CONFIG_SNAPSHOT_PAGE_LENGTH = 256;
+const uint32_t CONFIG_SNAPSHOT_HEADER_LENGTH = CONFIG_SNAPSHOT_PAGE_LENGTH;
+const int MAX_SNAPSHOT_SETTINGS = 28;
+const int MAX_SNAPSHOT_KEYS = 16;
+
+enum eConfigSnapshotStatus {
+    SNAPSHOT_STATUS_OK = 0,
+    SNAPSHOT_STATUS_INVALID_MAGIC = 0x1,
+    SNAPSHOT_STATUS_INVALID_VERSION = 0x2,
+    SNAPSHOT_STATUS_INVALID_LAYOUT = 0x4,
+    SNAPSHOT_STATUS_PROGRAMMING_FAILED = 0x8,
+    SNAPSHOT_STATUS_INVALID_SETTING = 0x10
+};
+
+struct SnapshotKey {
+    uint16_t KeyCode;
+    uint16_t MacroLength;
+    uint16_t IsProgrammed;
+    uint16_t Reserved;
+};
+PAYLOAD_SIZE(SnapshotKey, 8);
+
+struct ConfigSnapshotHeader {
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t NumSettings;
+    uint16_t NumKeys;
+    uint16_t Reserved;
+    uint32_t Settings[MAX_SNAPSHOT_SETTINGS];
+    SnapshotKey Keys[MAX_SNAPSHOT_KEYS];
+};
+PAYLOAD_SIZE(ConfigSnapshotHeader, 252);
+PAYLOAD_FIELD(ConfigSnapshotHeader, Version, 4);
+PAYLOAD_FIELD(ConfigSnapshotHeader, NumSettings, 6);
+PAYLOAD_FIELD(ConfigSnapshotHeader, NumKeys, 8);
+PAYLOAD_FIELD(ConfigSnapshotHeader, Settings, 12);
+PAYLOAD_FIELD(ConfigSnapshotHeader, Keys, 124);
+
+// Version 1 had room for 16 settings only, its keys start earlier
+const uint16_t CONFIG_SNAPSHOT_VERSION_V1 = 1;
+const int MAX_SNAPSHOT_SETTINGS_V1 = 16;
+const uint32_t CONFIG_SNAPSHOT_KEYS_OFFSET_V1 = 76;
+static_assert(sizeof(ConfigSnapshotHeader) <= CONFIG_SNAPSHOT_HEADER_LENGTH, 
+        "Snapshot header must fit its page");
+
+enum eSendPriority {
+    SEND_PRIORITY_CONTROL = 0,  // Acks and short answers, always go first
+    SEND_PRIORITY_BULK,         // Flash pages and other large answers
+    SEND_PRIORITY_TOTAL
+};
+
+struct SendQueueStats {
+    uint16_t Depth[SEND_PRIORITY_TOTAL];
+    uint16_t MaxDepth[SEND_PRIORITY_TOTAL];
+    uint32_t Sent;
+    uint32_t Dropped;
+};
+PAYLOAD_SIZE(SendQueueStats, 16);
+PAYLOAD_FIELD(SendQueueStats, Depth, 0);
+PAYLOAD_FIELD(SendQueueStats, MaxDepth, 4);
+PAYLOAD_FIELD(SendQueueStats, Sent, 8);
+PAYLOAD_FIELD(SendQueueStats, Dropped, 12);
+
+enum eTaskPriority {
+    TASK_PRIORITY_HIGH = 0,     // USB servicing and key scanning
+    TASK_PRIORITY_NORMAL,
+    TASK_PRIORITY_LOW,          // LED and other cosmetic tasks
+    TASK_PRIORITY_TOTAL
+};
+
+const int MAX_SCHEDULER_TASKS = 7;
+
+// Per task counters of the firmware scheduler, times in usec.
+// A periodic task misses its deadline if it has not finished
+// by the end of the period it was released in.
+struct TaskStats {
+    uint32_t PeriodUs;          // 0 for tasks polled on every pass
+    uint8_t Priority;
+    uint8_t IsEvent;
+    uint16_t Reserved;
+    uint32_t RunCount;
+    uint32_t DeadlineMisses;
+    uint32_t LastRunUs;
+    uint32_t MaxRunUs;
+    uint32_t TotalRunUs;        // Wraps
+    uint32_t MaxLatenessUs;     // Release to start
+};
+PAYLOAD_SIZE(TaskStats, 32);
+PAYLOAD_FIELD(TaskStats, RunCount, 8);
+PAYLOAD_FIELD(TaskStats, MaxLatenessUs, 28);
+
+struct SchedulerStats {
+    uint8_t NumTasks;
+    uint8_t Reserved[3];
+    TaskStats Tasks[MAX_SCHEDULER_TASKS];
+};
+PAYLOAD_SIZE(SchedulerStats, 228);
+PAYLOAD_FIELD(SchedulerStats, Tasks, 4);
+
+enum ePowerState {
+    POWER_STATE_ACTIVE = 0,
+    POWER_STATE_IDLE,           // No key held, scanning stopped until a row edge
+    POWER_STATE_SUSPENDED       // USB suspended by the host
+};
+
+// Wake latency is from the row edge interrupt to the first HID report
+struct PowerStats {
+    uint8_t State;
+    uint8_t IsRemoteWakeupEnabled;
+    uint16_t Reserved;
+    uint32_t IdleEntries;
+    uint32_t Suspends;
+    uint32_t Wakeups;
+    uint32_t LastWakeLatencyUs;
+    uint32_t MaxWakeLatencyUs;
+};
+PAYLOAD_SIZE(PowerStats, 24);
+PAYLOAD_FIELD(PowerStats, IdleEntries, 4);
+PAYLOAD_FIELD(PowerStats, MaxWakeLatencyUs, 20);
+
+// Scan rate tiers, tier 0 is the ceiling rate, the last one the floor
+const int MAX_SCAN_TIERS = 4;
+
+struct ScanRateStats {
+    uint8_t NumTiers;
+    uint8_t CurrentTier;
+    uint16_t Reserved;
+    uint32_t PeriodUs[MAX_SCAN_TIERS];
+    uint32_t Scans[MAX_SCAN_TIERS];
+    uint32_t TimeMs[MAX_SCAN_TIERS];
+};
+PAYLOAD_SIZE(ScanRateStats, 52);
+PAYLOAD_FIELD(ScanRateStats, PeriodUs, 4);
+PAYLOAD_FIELD(ScanRateStats, TimeMs, 36);
+
+// Profiler stages: the scheduler pass period, then the run time and the
+// lateness (release to start) of every scheduler task, by task id, then
+// the time keyboard reports wait in the endpoint until the host polls
+const int PROFILER_STAGE_LOOP_PERIOD = 0;
+const int PROFILER_STAGE_TASK_RUN = 1;
+const int PROFILER_STAGE_TASK_LATENESS = PROFILER_STAGE_TASK_RUN + MAX_SCHEDULER_TASKS;
+const int PROFILER_STAGE_REPORT_WAIT = PROFILER_STAGE_TASK_LATENESS + MAX_SCHEDULER_TASKS;
+const int PROFILER_NUM_STAGES = PROFILER_STAGE_REPORT_WAIT + 1;
+// Bucket 0 counts samples below 1 us, bucket i samples in [2^(i-1), 2^i) us,
+// the last bucket everything above
+const int PROFILER_NUM_BUCKETS = 16;
+
+struct ProfileRequest {
+    uint8_t Stage;
+    uint8_t IsReset;            // Clears the stage after reading it
+    uint16_t Reserved;
+};
+PAYLOAD_SIZE(ProfileRequest, 4);
+
+struct ProfileStage {
+    uint8_t Stage;
+    uint8_t NumStages;
+    uint16_t Reserved;
+    uint32_t Count;
+    uint32_t MinUs;
+    uint32_t MaxUs;
+    uint32_t MeanUs;
+    uint16_t Histogram[PROFILER_NUM_BUCKETS];    // Saturates at 0xFFFF
+};
+PAYLOAD_SIZE(ProfileStage, 52);
+PAYLOAD_FIELD(ProfileStage, Count, 4);
+PAYLOAD_FIELD(ProfileStage, Histogram, 20);
+
+// Keymap layers. Layer 0 is the base layer made of the programmed keys,
+// every other layer holds one action per key index.
+const int MAX_LAYERS = 16;
+const int MAX_LAYER_KEYS = MAX_SNAPSHOT_KEYS;
+
+// Key actions: kind in bits 15..12, layer in bits 11..8, HID code in bits 7..0.
+// A plain keycode is a KEY_ACTION_KEY action, so keys programmed with a
+// bare KeyCode keep their meaning. Erased flash reads as transparent.
+enum eKeyActionKind {
+    KEY_ACTION_KEY = 0x0,
+    KEY_ACTION_MODIFIER = 0x1,          // Code is a KEY_MOD_* bit
+    KEY_ACTION_LAYER_MOMENTARY = 0x2,   // Layer is on while the key is held
+    KEY_ACTION_LAYER_TOGGLE = 0x3,
+    KEY_ACTION_LAYER_DEFAULT = 0x4,     // Layer becomes the bottom of the stack
+    KEY_ACTION_MOD_TAP = 0x5,           // Code on tap, modifier bit <layer> (0 LCTRL .. 7 RMETA) on hold
+    KEY_ACTION_LAYER_TAP = 0x6,         // Code on tap, momentary layer on hold
+    KEY_ACTION_MACRO = 0x7,             // Plays the macro programmed on key index <code>
+    KEY_ACTION_LEADER = 0x8,            // Starts a leader sequence
+    KEY_ACTION_CONSUMER = 0x9,          // Consumer control usage in bits 11..0
+    KEY_ACTION_RECORD = 0xA,            // Records a macro to key index <code>, again to stop
+    KEY_ACTION_MOUSE = 0xB,             // Mouse key <code>, see eMouseCode
+    KEY_ACTION_TRANSPARENT = 0xF        // Falls through to the next active layer
+};
+
+// Codes of KEY_ACTION_MOUSE
+enum eMouseCode {
+    MOUSE_CODE_UP = 0x00,
+    MOUSE_CODE_DOWN = 0x01,
+    MOUSE_CODE_LEFT = 0x02,
+    MOUSE_CODE_RIGHT = 0x03,
+    MOUSE_CODE_WHEEL_UP = 0x04,
+    MOUSE_CODE_WHEEL_DOWN = 0x05,
+    MOUSE_CODE_WHEEL_LEFT = 0x06,
+    MOUSE_CODE_WHEEL_RIGHT = 0x07,
+    MOUSE_CODE_BUTTON_1 = 0x10          // Buttons 1 to 5: left, right, middle, back, forward
+};
+
+const uint16_t KEY_ACTION_NONE = 0x0000;
+const uint16_t KEY_ACTION_TRANSPARENT_ALL = 0xFFFF;
+
+inline constexpr uint16_t MakeKeyAction(eKeyActionKind kind, uint8_t layer, uint8_t code) {
+    return (uint16_t)((kind << 12) | ((layer & 0x0F) << 8) | code);
+}
+inline constexpr uint16_t MakeConsumerAction(uint16_t usage) {
+    return (uint16_t)((KEY_ACTION_CONSUMER << 12) | (usage & 0x0FFF));
+}
+inline constexpr eKeyActionKind GetKeyActionKind(uint16_t action) {
+    return (eKeyActionKind)(action >> 12);
+}
+inline constexpr uint8_t GetKeyActionLayer(uint16_t action) { return (action >> 8) & 0x0F; }
+inline constexpr uint8_t GetKeyActionCode(uint16_t action) { return action & 0xFF; }
+inline constexpr uint16_t GetKeyActionUsage(uint16_t action) { return action & 0x0FFF; }
+
+struct KeymapLayerRequest {
+    uint8_t Layer;
+    uint8_t Reserved[3];
+};
+PAYLOAD_SIZE(KeymapLayerRequest, 4);
+
+struct KeymapLayer {
+    uint8_t Layer;
+    uint8_t NumKeys;
+    uint16_t ActiveMask;        // Layers currently on, ignored on writes
+    uint16_t Actions[MAX_LAYER_KEYS];
+};
+PAYLOAD_SIZE(KeymapLayer, 36);
+PAYLOAD_FIELD(KeymapLayer, ActiveMask, 2);
+PAYLOAD_FIELD(KeymapLayer, Actions, 4);
+
+// Combos: pressing every key of KeyMask (bit per key index) within the
+// combo window sends Action instead of the keys
+const int MAX_COMBOS = 32;
+
+struct Combo {
+    uint16_t KeyMask;
+    uint16_t Action;
+};
+PAYLOAD_SIZE(Combo, 4);
+
+struct ComboTable {
+    uint8_t NumCombos;
+    uint8_t Reserved[3];
+    Combo Combos[MAX_COMBOS];
+};
+PAYLOAD_SIZE(ComboTable, 132);
+PAYLOAD_FIELD(ComboTable, Combos, 4);
+
+// Leader sequences are programmed as the key at row LEADER_TRIE_KEY_ROW,
+// column 0. Its macro is a LeaderTrieHeader, the trie nodes, then the
+// macros the nodes play, all in MacroKey sized records.
+const uint16_t LEADER_TRIE_KEY_ROW = 0xFFFF;
+const uint32_t LEADER_TRIE_MAGIC = 0x5244414C; // "LADR"
+
+struct LeaderTrieHeader {
+    uint32_t Magic;
+    uint16_t NumNodes;
+    uint16_t Reserved;
+};
+PAYLOAD_SIZE(LeaderTrieHeader, 8);
+
+// Node 0 is the root. The children of a node follow each other from
+// FirstChild in key index order, one per bit of ChildMask, so the child
+// for a key is FirstChild + the number of lower ChildMask bits set.
+// A node with a macro (MacroStart in records from the header) ends a sequence.
+struct LeaderNode {
+    uint16_t ChildMask;
+    uint16_t FirstChild;
+    uint16_t MacroStart;
+    uint16_t MacroLength;
+};
+PAYLOAD_SIZE(LeaderNode, 8);
+PAYLOAD_FIELD(LeaderNode, FirstChild, 2);
+PAYLOAD_FIELD(LeaderNode, MacroStart, 4);
+PAYLOAD_FIELD(LeaderNode, MacroLength, 6);
+static_assert(sizeof(LeaderNode) == sizeof(MacroKey) && sizeof(LeaderTrieHeader) == sizeof(MacroKey),
+        "Leader records must be MacroKey sized");
+
+// Action of each encoder for a detent clockwise and counter clockwise.
+// Detents faster than one per 100 ms are repeated, up to MaxAcceleration
+// times (1 turns acceleration off).
+const int MAX_ENCODERS = 4;
+
+struct EncoderActions {
+    uint16_t Clockwise;
+    uint16_t CounterClockwise;
+};
+PAYLOAD_SIZE(EncoderActions, 4);
+
+struct EncoderMap {
+    uint8_t NumEncoders;
+    uint8_t MaxAcceleration;
+    uint8_t Reserved[2];
+    EncoderActions Encoders[MAX_ENCODERS];
+};
+PAYLOAD_SIZE(EncoderMap, 20);
+PAYLOAD_FIELD(EncoderMap, MaxAcceleration, 1);
+PAYLOAD_FIELD(EncoderMap, Encoders, 4);
+
+// Key and macro usage, kept in RAM and saved to a flash log on idle.
+// HourPresses is only filled in builds with MACROPAD_USAGE_HISTOGRAM.
+const int USAGE_HOURS = 24;
+const uint16_t USAGE_MINUTE_UNKNOWN = 0xFFFF;
+
+struct UsageRequest {
+    uint8_t IsReset;            // Clears every counter after reading them
+    uint8_t Reserved;
+    uint16_t MinuteOfDay;       // Host clock for the hour buckets, or USAGE_MINUTE_UNKNOWN
+};
+PAYLOAD_SIZE(UsageRequest, 4);
+
+struct UsageCounters {
+    uint32_t KeyPresses[MAX_LAYER_KEYS];
+    uint32_t MacroPlays[MAX_LAYER_KEYS];    // Macro programmed on each key index
+    uint32_t LeaderPlays;
+    uint32_t Saves;                         // Records written to the flash log
+    uint32_t HourPresses[USAGE_HOURS];      // Hour of day once the host sent its clock
+};
+PAYLOAD_SIZE(UsageCounters, 232);
+
+struct UsageReport {
+    uint8_t NumKeys;
+    uint8_t CurrentHour;
+    uint8_t IsHistogramEnabled;
+    uint8_t Reserved;
+    uint32_t UnsavedPresses;
+    UsageCounters Counters;
+};
+PAYLOAD_SIZE(UsageReport, 240);
+PAYLOAD_FIELD(UsageReport, Counters, 8);
+
+#endif // MESSAGE_PAYLOADS_H
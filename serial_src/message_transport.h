@@ -0,0 +1,25 @@
+#ifndef MESSAGE_TRANSPORT_H
+#define MESSAGE_TRANSPORT_H
+
+// Free of SDK includes so fakes can be built on the host
+
+#include <stdint.h>
+
+// Byte stream the dispatcher reads frames from and writes answers to.
+// Writes are buffered until Flush(), reads and writes never block.
+class MessageTransport {
+public:
+    virtual ~MessageTransport() {}
+
+    virtual bool IsConnected() = 0;
+    // Received bytes not read yet
+    virtual uint32_t Available() = 0;
+    virtual uint32_t Read(void* data, uint32_t length) = 0;
+
+    // Room left in the send buffer
+    virtual uint32_t WriteAvailable() = 0;
+    virtual uint32_t Write(const void* data, uint32_t length) = 0;
+    virtual void Flush() = 0;
+};
+
+#endif // MESSAGE_TRANSPORT_H
@@ -0,0 +1,108 @@
+#include "raw_hid_transport.h"
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "usb_descriptors.h"
+
+uint32_t RawHidTransport::ByteFifo::Push(const uint8_t* bytes, uint32_t length) {
+    if (length > Room())
+        length = Room();
+    for (uint32_t i = 0; i < length; i++)
+        data[(head + count + i) % FIFO_LENGTH] = bytes[i];
+    count += length;
+    return length;
+}
+
+uint32_t RawHidTransport::ByteFifo::Pop(uint8_t* bytes, uint32_t length) {
+    if (length > count)
+        length = count;
+    for (uint32_t i = 0; i < length; i++)
+        bytes[i] = data[(head + i) % FIFO_LENGTH];
+    head = (head + length) % FIFO_LENGTH;
+    count -= length;
+    return length;
+}
+
+RawHidTransport::RawHidTransport() {
+    receiveCallback = nullptr;
+    droppedReports = 0;
+    lastProgressTime = 0;
+    isStalled = false;
+    numStalls = 0;
+}
+
+void RawHidTransport::SetReceiveCallback(RawHidReceiveCallback callback) {
+    receiveCallback = callback;
+}
+
+void RawHidTransport::OnReport(const uint8_t* report, uint16_t length) {
+    if (length < 1 || report[0] > RAW_HID_PAYLOAD_LENGTH || report[0] > length - 1)
+        return;
+
+    // A partly stored report would splice two frames, drop all of it
+    uint32_t count = report[0];
+    if (count > rxFifo.Room()) {
+        droppedReports++;
+        return;
+    }
+
+    // The host is reading again
+    if (isStalled) {
+        isStalled = false;
+        lastProgressTime = time_us_64();
+    }
+
+    rxFifo.Push(report + 1, count);
+    if (receiveCallback != nullptr)
+        receiveCallback();
+}
+
+void RawHidTransport::OnReportComplete() {
+    isStalled = false;
+    lastProgressTime = time_us_64();
+    SendReport();
+}
+
+bool RawHidTransport::IsConnected() {
+    if (!tud_mounted())
+        return false;
+
+    // Nobody polls the IN endpoint, the send queue must not wait on it
+    if (!isStalled && txFifo.count > 0 && time_us_64() - lastProgressTime > STALL_TIMEOUT_US) {
+        isStalled = true;
+        numStalls++;
+        txFifo.Clear();
+    }
+    return !isStalled;
+}
+
+uint32_t RawHidTransport::Available() {
+    return rxFifo.count;
+}
+
+uint32_t RawHidTransport::Read(void* data, uint32_t length) {
+    return rxFifo.Pop((uint8_t*)data, length);
+}
+
+uint32_t RawHidTransport::WriteAvailable() {
+    return txFifo.Room();
+}
+
+uint32_t RawHidTransport::Write(const void* data, uint32_t length) {
+    if (txFifo.count == 0)
+        lastProgressTime = time_us_64();
+    return txFifo.Push((const uint8_t*)data, length);
+}
+
+void RawHidTransport::Flush() {
+    SendReport();
+}
+
+void RawHidTransport::SendReport() {
+    if (txFifo.count == 0 || !tud_hid_n_ready(HID_INSTANCE_RAW))
+        return;
+
+    // Reports always have the full length, the count byte tells what is used
+    uint8_t report[RAW_HID_REPORT_LENGTH] = {};
+    report[0] = (uint8_t)txFifo.Pop(report + 1, RAW_HID_PAYLOAD_LENGTH);
+    tud_hid_n_report(HID_INSTANCE_RAW, 0, report, sizeof(report));
+}
@@ -0,0 +1,77 @@
+#ifndef RAW_HID_TRANSPORT_H
+#define RAW_HID_TRANSPORT_H
+
+#include <stdint.h>
+#include "message.h"
+#include "message_transport.h"
+
+// Called from tud_task when a report was received
+typedef void (*RawHidReceiveCallback)();
+
+// Messages over the vendor defined HID interface. The frame stream is cut
+// into 64 byte reports, a count byte then up to 63 bytes of the stream.
+// HID needs no driver on the host and has no tty line discipline, and an
+// interrupt endpoint is polled every millisecond. The OUT endpoint has no
+// flow control, reports that do not fit the receive FIFO are dropped and
+// the dispatcher resyncs on the next start mark. The device stays mounted
+// when the hidraw client goes away, so IN reports that make no progress
+// for STALL_TIMEOUT_US mark the transport disconnected and its pending
+// bytes are dropped, until the host sends a report again.
+class RawHidTransport : public MessageTransport {
+public:
+    static const uint32_t FIFO_LENGTH = 2048;
+    static const uint32_t STALL_TIMEOUT_US = 500000;
+
+public:
+    static RawHidTransport& Instance() {
+        static RawHidTransport instance;
+        return instance;
+    }
+
+    void SetReceiveCallback(RawHidReceiveCallback callback);
+    // An OUT report, from tud_hid_set_report_cb
+    void OnReport(const uint8_t* report, uint16_t length);
+    // The last IN report went out, from tud_hid_report_complete_cb
+    void OnReportComplete();
+
+    bool IsConnected() override;
+    uint32_t Available() override;
+    uint32_t Read(void* data, uint32_t length) override;
+    uint32_t WriteAvailable() override;
+    uint32_t Write(const void* data, uint32_t length) override;
+    // Sends a report if the endpoint is free, the rest follows on completion
+    void Flush() override;
+
+    inline uint32_t GetDroppedReports() const { return droppedReports; }
+    inline uint32_t GetNumStalls() const { return numStalls; }
+
+private:
+    struct ByteFifo {
+        uint8_t data[FIFO_LENGTH];
+        uint32_t head;
+        uint32_t count;
+
+        ByteFifo() : head(0), count(0) {}
+
+        inline uint32_t Room() const { return FIFO_LENGTH - count; }
+        inline void Clear() { head = 0; count = 0; }
+        uint32_t Push(const uint8_t* bytes, uint32_t length);
+        uint32_t Pop(uint8_t* bytes, uint32_t length);
+    };
+
+    RawHidTransport();
+
+    void SendReport();
+
+private:
+    RawHidReceiveCallback receiveCallback;
+    ByteFifo rxFifo;
+    ByteFifo txFifo;
+    uint32_t droppedReports;
+    // Last report completion, or the write that found nothing pending
+    uint64_t lastProgressTime;
+    bool isStalled;
+    uint32_t numStalls;
+};
+
+#endif // RAW_HID_TRANSPORT_H
@@ -1,61 +1,420 @@
 #include "serial_dispatcher.h"
-#include "cdc_utils.h"
 #include "message.h"
 
+SerialDispatcher::SerialDispatcher() {
+    for (int i = 0; i < MAX_TRANSPORTS; i++)
+        transports[i] = nullptr;
+    numTransports = 0;
+    receiveTransport = nullptr;
+    answerTransport = nullptr;
+
+    for (int i = 0; i < MESSAGE_ID_TOTAL; i++)
+        streamSinks[i] = nullptr;
+
+    receiveState = RECEIVE_STATE_HEADER;
+    bytesReceived = 0;
+    bytesRemaining = 0;
+    streamOffset = 0;
+    lastReceiveTime = 0;
+
+    for (int i = 0; i < SEND_PRIORITY_TOTAL; i++) {
+        sendQueueStats.Depth[i] = 0;
+        sendQueueStats.MaxDepth[i] = 0;
+    }
+    sendQueueStats.Sent = 0;
+    sendQueueStats.Dropped = 0;
+    inFlightPriority = -1;
+    inFlightBytesSent = 0;
+}
+
 void SerialDispatcher::Initialize() {
 
 }
 
+void SerialDispatcher::AddTransport(MessageTransport* transport) {
+    if (numTransports >= MAX_TRANSPORTS)
+        return;
+
+    transports[numTransports++] = transport;
+    if (answerTransport == nullptr)
+        answerTransport = transport;
+}
+
+bool SerialDispatcher::IsDataAvailable() {
+    if (receiveTransport != nullptr)
+        return receiveTransport->Available() > 0;
+    for (int i = 0; i < numTransports; i++) {
+        if (transports[i]->Available() > 0)
+            return true;
+    }
+    return false;
+}
+
+MessageTransport* SerialDispatcher::SelectReceiveTransport() {
+    // Stay on the transport of a frame started, msg holds its bytes
+    if (receiveTransport != nullptr)
+        return receiveTransport;
+
+    for (int i = 0; i < numTransports; i++) {
+        if (transports[i]->Available() > 0) {
+            receiveTransport = transports[i];
+            break;
+        }
+    }
+    return receiveTransport;
+}
+
 void SerialDispatcher::RegisterForMessage(MessageIds id, MessageCallback callback) {
     if (id >= MESSAGE_ID_TOTAL)
         return;
-    
+
     int& numRegistered = idsCallbacks[id].numRegistered;
     if (numRegistered < MAX_CALLBACKS_PER_ID)
         idsCallbacks[id].callbacks[numRegistered++] = callback;
 }
 
-bool SerialDispatcher::ListenForMessage() {
-    if (tud_cdc_available()) {
-        // read datas
-        uint32_t count = tud_cdc_read((char*)&msg, sizeof(msg));
+void SerialDispatcher::RegisterStreamSink(MessageIds id, StreamSinkCallback sink) {
+    if (id >= MESSAGE_ID_TOTAL)
+        return;
 
-        if (count < sizeof(MessageHeader))
-            return false;
-        if (count < sizeof(MessageHeader) + msg.Header.Len)
-            return false;
-        
-        // Call all of the relevant callbacks
-        if (msg.Header.Id >= MESSAGE_ID_TOTAL)
-            return false;
+    streamSinks[id] = sink;
+}
+
+void SerialDispatcher::CheckReceiveTimeout(uint64_t now) {
+    bool isInFrame = (receiveState != RECEIVE_STATE_HEADER || bytesReceived > 0);
+    if (isInFrame && now - lastReceiveTime >= RECEIVE_TIMEOUT_US)
+        AbortFrame();
+}
+
+void SerialDispatcher::AbortFrame() {
+    // The sink learns its frame is lost and answers it
+    if (receiveState == RECEIVE_STATE_STREAM)
+        streamSinks[streamHeader.Id](streamHeader, streamOffset, nullptr, 0, true);
+
+    receiveState = RECEIVE_STATE_HEADER;
+    bytesReceived = 0;
+    bytesRemaining = 0;
+    receiveTransport = nullptr;
+}
 
-        idsCallbacks[msg.Header.Id].ExecuteCallbacks(msg);  
-        return true;
+bool SerialDispatcher::ListenForMessage(uint64_t now) {
+    CheckReceiveTimeout(now);
+
+    MessageTransport* transport = SelectReceiveTransport();
+    while (transport != nullptr && transport->Available()) {
+        receiveTransport = transport;
+        lastReceiveTime = now;
+        switch (receiveState) {
+        case RECEIVE_STATE_HEADER: {
+            unsigned char* header = (unsigned char*)&msg.Header;
+            bytesReceived += transport->Read(header + bytesReceived,
+                    sizeof(MessageHeader) - bytesReceived);
+
+            // Resync on the start mark if we got out of frame
+            while (bytesReceived > 0 && header[0] != MESSAGE_START_MARK) {
+                for (uint32_t i = 1; i < bytesReceived; i++)
+                    header[i - 1] = header[i];
+                bytesReceived--;
+            }
+
+            if (bytesReceived < sizeof(MessageHeader))
+                break;
+
+            // Answers go back the way the request came
+            bytesReceived = 0;
+            answerTransport = transport;
+            OnHeaderReceived();
+
+            // Header only message
+            if (receiveState == RECEIVE_STATE_PAYLOAD && msg.Header.Len == 0) {
+                receiveState = RECEIVE_STATE_HEADER;
+                receiveTransport = nullptr;
+                idsCallbacks[msg.Header.Id].ExecuteCallbacks(msg);
+                return true;
+            }
+            break;
+        }
+        case RECEIVE_STATE_PAYLOAD:
+            if (ReceivePayload())
+                return true;
+            break;
+        case RECEIVE_STATE_STREAM:
+            if (ReceiveStreamChunk())
+                return true;
+            break;
+        case RECEIVE_STATE_DISCARD:
+            ReceiveDiscard();
+            break;
+        }
     }
 
+    // Between frames, let the other transports in
+    if (receiveState == RECEIVE_STATE_HEADER && bytesReceived == 0)
+        receiveTransport = nullptr;
     return false;
 }
 
-void SerialDispatcher::SendMessage(const MessageHeader& header, unsigned char* data) {
-    msg.Header = header;
+void SerialDispatcher::OnHeaderReceived() {
+    bytesRemaining = msg.Header.Len;
+
+    if (msg.Header.Id >= MESSAGE_ID_TOTAL) {
+        receiveState = RECEIVE_STATE_DISCARD;
+    }
+    else if (msg.Header.Type == MESSAGE_TYPE_LARGE_REQUEST) {
+        if (streamSinks[msg.Header.Id] == nullptr || msg.Header.Len == 0 ||
+                msg.Header.Len > MAX_LARGE_DATA_LENGTH) {
+            receiveState = RECEIVE_STATE_DISCARD;
+            return;
+        }
+
+        streamHeader = msg.Header;
+        streamOffset = 0;
+        receiveState = RECEIVE_STATE_STREAM;
+    }
+    else if (msg.Header.Len > MAX_DATA_LENGTH) {
+        receiveState = RECEIVE_STATE_DISCARD;
+    }
+    else {
+        receiveState = RECEIVE_STATE_PAYLOAD;
+    }
+
+    if (receiveState == RECEIVE_STATE_DISCARD && bytesRemaining == 0)
+        receiveState = RECEIVE_STATE_HEADER;
+}
+
+bool SerialDispatcher::ReceivePayload() {
+    uint32_t count = receiveTransport->Read(msg.Data + bytesReceived, bytesRemaining);
+    bytesReceived += count;
+    bytesRemaining -= count;
+    if (bytesRemaining > 0)
+        return false;
+
+    bytesReceived = 0;
+    receiveState = RECEIVE_STATE_HEADER;
+    receiveTransport = nullptr;
+
+    // Call all of the relevant callbacks
+    idsCallbacks[msg.Header.Id].ExecuteCallbacks(msg);
+    return true;
+}
+
+bool SerialDispatcher::ReceiveStreamChunk() {
+    // msg.Data is reused as the chunk buffer, so a large frame
+    // never needs more than one page of RAM
+    uint32_t chunkLength = LARGE_FRAME_CHUNK_LENGTH;
+    if (chunkLength > bytesRemaining + bytesReceived)
+        chunkLength = bytesRemaining + bytesReceived;
+
+    uint32_t count = receiveTransport->Read(msg.Data + bytesReceived, chunkLength - bytesReceived);
+    bytesReceived += count;
+    bytesRemaining -= count;
+    if (bytesReceived < chunkLength)
+        return false;
+
+    bool isLast = (bytesRemaining == 0);
+    uint32_t offset = streamOffset;
+    streamOffset += chunkLength;
+    bytesReceived = 0;
+    if (isLast) {
+        receiveState = RECEIVE_STATE_HEADER;
+        receiveTransport = nullptr;
+    }
+
+    streamSinks[streamHeader.Id](streamHeader, offset, msg.Data, chunkLength, isLast);
+    return true;
+}
+
+void SerialDispatcher::ReceiveDiscard() {
+    uint32_t count = bytesRemaining;
+    if (count > MAX_DATA_LENGTH)
+        count = MAX_DATA_LENGTH;
+
+    bytesRemaining -= receiveTransport->Read(msg.Data, count);
+    if (bytesRemaining == 0)
+        receiveState = RECEIVE_STATE_HEADER;
+}
+
+bool SerialDispatcher::SendMessage(const MessageHeader& header, const unsigned char* data) {
+    SendSegment payload = { data, (data == nullptr) ? 0u : header.Len };
+    return SendGather(header, &payload, 1);
+}
+
+bool SerialDispatcher::SendMessage(const Message& msgToSend) {
+    return SendMessage(msgToSend.Header, msgToSend.Data);
+}
+
+bool SerialDispatcher::SendGather(const MessageHeader& header, const SendSegment* segments, int numSegments) {
+    MessageTransport* transport = answerTransport;
+    if (transport == nullptr || !transport->IsConnected())
+        return false;
+    // Do not cut into a queued message that is half way on the wire
+    if (inFlightBytesSent > 0)
+        return false;
+
+    MessageHeader wireHeader = header;
+    uint32_t payloadLength = 0;
+    for (int i = 0; i < numSegments; i++)
+        payloadLength += segments[i].Length;
+    wireHeader.Len = payloadLength;
+
+    // Backpressure, never write a partial message
+    if (transport->WriteAvailable() < sizeof(MessageHeader) + payloadLength) {
+        transport->Flush();
+        return false;
+    }
+
+    transport->Write(&wireHeader, sizeof(MessageHeader));
+    for (int i = 0; i < numSegments; i++) {
+        if (segments[i].Length > 0)
+            transport->Write(segments[i].Data, segments[i].Length);
+    }
+    transport->Flush();
+
+    return true;
+}
+
+bool SerialDispatcher::QueueMessage(const MessageHeader& header, const unsigned char* data,
+        eSendPriority priority) {
+    QueuedMessage* queued = AllocateQueued(priority);
+    if (queued == nullptr)
+        return false;
+
+    queued->Header = header;
+    queued->Data = data;
+    queued->Source = nullptr;
     if (data == nullptr)
-        msg.Header.Len = 0;
+        queued->Header.Len = 0;
+
+    return true;
+}
 
-    for (int i = 0; i < header.Len; i++) {
-        msg.Data[i] = data[i];
+bool SerialDispatcher::QueueMessageCopy(const MessageHeader& header, const unsigned char* data,
+        eSendPriority priority) {
+    if (data != nullptr && header.Len > SEND_INLINE_DATA_LENGTH)
+        return false;
+
+    QueuedMessage* queued = AllocateQueued(priority);
+    if (queued == nullptr)
+        return false;
+
+    queued->Header = header;
+    queued->Data = queued->InlineData;
+    queued->Source = nullptr;
+    if (data == nullptr)
+        queued->Header.Len = 0;
+    for (int i = 0; i < queued->Header.Len; i++)
+        queued->InlineData[i] = data[i];
+
+    return true;
+}
+
+bool SerialDispatcher::QueueStream(const MessageHeader& header, PayloadSourceCallback source,
+        eSendPriority priority) {
+    QueuedMessage* queued = AllocateQueued(priority);
+    if (queued == nullptr)
+        return false;
+
+    queued->Header = header;
+    queued->Data = nullptr;
+    queued->Source = source;
+
+    return true;
+}
+
+SerialDispatcher::QueuedMessage* SerialDispatcher::AllocateQueued(eSendPriority priority) {
+    SendQueue& queue = sendQueues[priority];
+    if (queue.count >= SEND_QUEUE_LENGTH) {
+        sendQueueStats.Dropped++;
+        return nullptr;
     }
 
-    SendBuffer((unsigned char*)&msg, sizeof(MessageHeader) + msg.Header.Len);
+    QueuedMessage* queued = &queue.messages[(queue.head + queue.count) % SEND_QUEUE_LENGTH];
+    queued->Transport = answerTransport;
+    queue.count++;
+
+    sendQueueStats.Depth[priority] = queue.count;
+    if (queue.count > sendQueueStats.MaxDepth[priority])
+        sendQueueStats.MaxDepth[priority] = queue.count;
+
+    return queued;
 }
 
-void SerialDispatcher::SendMessage(const Message& msgToSend) {
-    msg.Header = msgToSend.Header;
+void SerialDispatcher::ProcessSendQueue() {
+    MessageTransport* transport = nullptr;
+    while (true) {
+        // Finish the message on the wire before picking the next one
+        int priority = inFlightPriority;
+        for (int i = 0; priority < 0 && i < SEND_PRIORITY_TOTAL; i++) {
+            if (sendQueues[i].count > 0)
+                priority = i;
+        }
+        if (priority < 0)
+            break;
+
+        SendQueue& queue = sendQueues[priority];
+        QueuedMessage& queued = queue.messages[queue.head];
+        // Nobody reads that transport anymore, do not hold back the others
+        if (queued.Transport == nullptr || !queued.Transport->IsConnected()) {
+            PopQueued(priority);
+            sendQueueStats.Dropped++;
+            continue;
+        }
+        // Messages on different transports are flushed one after the other
+        if (transport != nullptr && transport != queued.Transport)
+            transport->Flush();
+        transport = queued.Transport;
+
+        inFlightPriority = priority;
+        if (!SendQueuedMessage(queued))
+            break;
+
+        PopQueued(priority);
+        sendQueueStats.Sent++;
+    }
+
+    if (transport != nullptr)
+        transport->Flush();
+}
+
+void SerialDispatcher::PopQueued(int priority) {
+    SendQueue& queue = sendQueues[priority];
+    queue.head = (queue.head + 1) % SEND_QUEUE_LENGTH;
+    queue.count--;
+    sendQueueStats.Depth[priority] = queue.count;
+    inFlightPriority = -1;
+    inFlightBytesSent = 0;
+}
+
+bool SerialDispatcher::SendQueuedMessage(QueuedMessage& queued) {
+    // Write as much as the FIFO takes, the rest goes out on the next pass
+    uint32_t total = sizeof(MessageHeader) + queued.Header.Len;
+    while (inFlightBytesSent < total) {
+        uint32_t room = queued.Transport->WriteAvailable();
+        if (room == 0)
+            return false;
+
+        const unsigned char* src;
+        uint32_t length;
+        if (inFlightBytesSent < sizeof(MessageHeader)) {
+            src = (const unsigned char*)&queued.Header + inFlightBytesSent;
+            length = sizeof(MessageHeader) - inFlightBytesSent;
+        }
+        else if (queued.Source != nullptr) {
+            src = queued.Source(inFlightBytesSent - sizeof(MessageHeader), length);
+            if (length > total - inFlightBytesSent)
+                length = total - inFlightBytesSent;
+        }
+        else {
+            src = queued.Data + (inFlightBytesSent - sizeof(MessageHeader));
+            length = total - inFlightBytesSent;
+        }
+        if (length > room)
+            length = room;
 
-    for (int i = 0; i < msgToSend.Header.Len; i++) {
-        msg.Data[i] = msgToSend.Data[i];
+        inFlightBytesSent += queued.Transport->Write(src, length);
     }
 
-    SendBuffer((unsigned char*)&msg, sizeof(MessageHeader) + msg.Header.Len);
+    return true;
 }
 
 Message& SerialDispatcher::GetMessage() {
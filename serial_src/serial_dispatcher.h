@@ -1,14 +1,70 @@
 #ifndef SERIAL_DISPATCHER_H
 #define SERIAL_DISPATCHER_H
 
+#include <stdint.h>
 #include "message.h"
+#include "message_payloads.h"
+#include "message_codec.h"
+#include "message_transport.h"
 
 typedef void (*MessageCallback)(const Message&);
 
+// Handler of a typed message, the request is a view into the received message
+template <MessageIds Id>
+using TypedMessageCallback = void (*)(const MessageHeader&, const typename MessageTraits<Id>::Request&);
+
+// Invoked for every chunk of a large frame, offset is relative to the payload start.
+// A frame cut short ends with a call of a null chunk, the sink answers it as failed.
+typedef void (*StreamSinkCallback)(const MessageHeader& header, uint32_t offset, 
+        const unsigned char* chunk, uint32_t length, bool isLast);
+
+// Provides the payload of a queued stream from offset on.
+// Returns the address of the next contiguous bytes and their count in length.
+typedef const unsigned char* (*PayloadSourceCallback)(uint32_t offset, uint32_t& length);
+
 const int MAX_CALLBACKS_PER_ID = 3;
 
+// One piece of a gathered message payload
+struct SendSegment {
+    const unsigned char* Data;
+    uint32_t Length;
+};
+
+const int MAX_TRANSPORTS = 2;
+
+// A frame that stops for this long is dropped, its next bytes are searched for a header
+const uint32_t RECEIVE_TIMEOUT_US = 200000;
+
+const int SEND_QUEUE_LENGTH = 8;
+// Every queued message owns this much payload storage, enough for the
+// largest copied answer, so a handler never hands out a buffer it reuses
+const int SEND_INLINE_DATA_LENGTH = 256;
+
 class SerialDispatcher {
 private:
+    struct QueuedMessage {
+        MessageTransport* Transport;
+        MessageHeader Header;
+        const unsigned char* Data;
+        PayloadSourceCallback Source;
+        unsigned char InlineData[SEND_INLINE_DATA_LENGTH];
+    };
+
+    struct SendQueue {
+        QueuedMessage messages[SEND_QUEUE_LENGTH];
+        int head;
+        int count;
+
+        SendQueue() : head(0), count(0) {}
+    };
+
+    enum ReceiveStates {
+        RECEIVE_STATE_HEADER,
+        RECEIVE_STATE_PAYLOAD,
+        RECEIVE_STATE_STREAM,
+        RECEIVE_STATE_DISCARD
+    };
+
     struct MessageIdCallbacks {
         MessageCallback callbacks[MAX_CALLBACKS_PER_ID];
         int numRegistered;
@@ -31,13 +87,86 @@ public:
     }
 
     void Initialize();
+    // Frames are read from every transport, one frame at a time. Answers
+    // and queued messages go to the transport of the last received frame.
+    void AddTransport(MessageTransport* transport);
+    bool IsDataAvailable();
     void RegisterForMessage(MessageIds id, MessageCallback callback);
-    bool ListenForMessage();
-    void SendMessage(const MessageHeader& header, unsigned char* data);
-    void SendMessage(const Message& msg);
+    // Typed handlers are only called when Header.Len holds a whole request,
+    // shorter messages are answered with MESSAGE_STATUS_INVALID_LENGTH
+    template <MessageIds Id, TypedMessageCallback<Id> Handler>
+    void RegisterForMessage() {
+        RegisterForMessage(Id, &SerialDispatcher::TypedCallback<Id, Handler>);
+    }
+    void RegisterStreamSink(MessageIds id, StreamSinkCallback sink);
+    bool ListenForMessage(uint64_t now);
+    // Drops a frame whose bytes stopped coming, so the next one is not taken as its payload
+    void CheckReceiveTimeout(uint64_t now);
+    // Messages are written straight into the transport TX FIFO without copying.
+    // Returns false (and nothing is written) if the FIFO has no room for
+    // the whole message, the caller may retry after tud_task().
+    bool SendMessage(const MessageHeader& header, const unsigned char* data);
+    bool SendMessage(const Message& msg);
+    bool SendGather(const MessageHeader& header, const SendSegment* segments, int numSegments);
+
+    // Queued messages are sent from ProcessSendQueue(), so handlers never block.
+    // data is not copied and must stay valid until the message is sent.
+    // Returns false if the queue is full (the message is dropped).
+    bool QueueMessage(const MessageHeader& header, const unsigned char* data,
+            eSendPriority priority = SEND_PRIORITY_CONTROL);
+    // Copies a payload (up to SEND_INLINE_DATA_LENGTH) into the queue slot,
+    // for answers built on the stack or snapshots of live state
+    bool QueueMessageCopy(const MessageHeader& header, const unsigned char* data,
+            eSendPriority priority = SEND_PRIORITY_CONTROL);
+    // Queues a message whose payload is not contiguous (e.g. RAM and flash parts)
+    bool QueueStream(const MessageHeader& header, PayloadSourceCallback source,
+            eSendPriority priority = SEND_PRIORITY_BULK);
+    void ProcessSendQueue();
+
+    template <MessageIds Id>
+    bool QueueAnswerCopy(uint16_t seq, const typename MessageTraits<Id>::Response& response,
+            uint8_t status = 0, eSendPriority priority = SEND_PRIORITY_CONTROL) {
+        static_assert(PayloadLength<typename MessageTraits<Id>::Response>::Value <= SEND_INLINE_DATA_LENGTH,
+                "Answer is too long to be copied into the send queue");
+        return QueueMessageCopy(MakeAnswerHeader<Id>(seq, status), 
+                (const unsigned char*)&response, priority);
+    }
+
+    template <MessageIds Id>
+    bool QueueAnswer(uint16_t seq, const typename MessageTraits<Id>::Response* response,
+            uint8_t status = 0, eSendPriority priority = SEND_PRIORITY_CONTROL) {
+        return QueueMessage(MakeAnswerHeader<Id>(seq, status), 
+                (const unsigned char*)response, priority);
+    }
+
+    inline const SendQueueStats& GetSendQueueStats() const { return sendQueueStats; }
+
     Message& GetMessage();
 
 private:
+    SerialDispatcher();
+
+    void OnHeaderReceived();
+    bool ReceivePayload();
+    bool ReceiveStreamChunk();
+    void ReceiveDiscard();
+    void AbortFrame();
+    MessageTransport* SelectReceiveTransport();
+    QueuedMessage* AllocateQueued(eSendPriority priority);
+    void PopQueued(int priority);
+    bool SendQueuedMessage(QueuedMessage& queued);
+
+    template <MessageIds Id, TypedMessageCallback<Id> Handler>
+    static void TypedCallback(const Message& msg) {
+        PayloadView<typename MessageTraits<Id>::Request> request(msg);
+        if (!request.IsValid()) {
+            Instance().QueueAnswer<Id>(msg.Header.Seq, nullptr, MESSAGE_STATUS_INVALID_LENGTH);
+            return;
+        }
+
+        Handler(msg.Header, request.Get());
+    }
+
     static void CallbackDummy(const Message& msg) {
         (void)msg;
     }
@@ -45,6 +174,25 @@ private:
 private:
     Message msg;
     MessageIdCallbacks idsCallbacks[MESSAGE_ID_TOTAL];
+    StreamSinkCallback streamSinks[MESSAGE_ID_TOTAL];
+
+    MessageTransport* transports[MAX_TRANSPORTS];
+    int numTransports;
+    // The transport of the frame being received, and of the last frame
+    MessageTransport* receiveTransport;
+    MessageTransport* answerTransport;
+
+    ReceiveStates receiveState;
+    uint32_t bytesReceived;
+    uint32_t bytesRemaining;
+    MessageHeader streamHeader;
+    uint32_t streamOffset;
+    uint64_t lastReceiveTime;
+
+    SendQueue sendQueues[SEND_PRIORITY_TOTAL];
+    SendQueueStats sendQueueStats;
+    int inFlightPriority;
+    uint32_t inFlightBytesSent;
 };
 
 #endif // SERIAL_DISPATCHER_H
@@ -1,48 +1,218 @@
 #include "settings.h"
 #include "flash_service.h"
 
-const uint32_t Settings::defaults[(uint32_t)SettingsIds::SETTINGS_TOTAL] = {
-    500,        // Blink On Time
-    500,        // Blink Off Time
-    10,         // Debounce Max
-    500000,     // Auto repeat first delay in usec
-    10,         // Auto repeat speed - presses per second
-    166667,     // Auto repeat delay in usec
+static_assert((int)SETTINGS_TOTAL <= 32, "PresentMask holds one bit per setting");
+
+const Settings::SettingSchema Settings::schema[(uint32_t)SettingsIds::SETTINGS_TOTAL] = {
+    // Type              Default   Min     Max       Writable
+    { SETTING_TYPE_U32,  500,      10,     10000,    true },    // Blink On Time
+    { SETTING_TYPE_U32,  500,      10,     10000,    true },    // Blink Off Time
+    { SETTING_TYPE_U32,  10,       0,      1000,     false },   // Debounce in scans at the ceiling rate, follows the time
+    { SETTING_TYPE_U32,  500000,   50000,  5000000,  true },    // Auto repeat first delay in usec
+    { SETTING_TYPE_U32,  10,       1,      100,      true },    // Auto repeat speed - presses per second
+    { SETTING_TYPE_U32,  100000,   10000,  1000000,  false },   // Auto repeat delay in usec, follows the speed
+    { SETTING_TYPE_U32,  100,      10,     60000,    true },    // Idle timeout in msec
+    { SETTING_TYPE_U32,  1000,     100,    2000,     true },    // Scan rate ceiling in Hz
+    { SETTING_TYPE_U32,  125,      10,     2000,     true },    // Scan rate floor in Hz
+    { SETTING_TYPE_U32,  5,        1,      10,       true },    // HID polling interval in msec
+    { SETTING_TYPE_BOOL, 0,        0,      1,        true },    // Final scan synced to the USB SOF
+    { SETTING_TYPE_U32,  200,      10,     2000,     true },    // Tap-hold tapping term in msec
+    { SETTING_TYPE_BOOL, 0,        0,      1,        true },    // Hold when another key is tapped
+    { SETTING_TYPE_BOOL, 0,        0,      1,        true },    // Hold when another key is pressed
+    { SETTING_TYPE_U32,  50,       5,      500,      true },    // Combo window in msec
+    { SETTING_TYPE_U32,  1000,     100,    5000,     true },    // Leader sequence timeout in msec
+    { SETTING_TYPE_U32,  10,       1,      1000,     true },    // Recorded delays are multiples of it, msec
+    { SETTING_TYPE_U32,  500,      10,     60000,    true },    // Longest recorded delay in msec
+    { SETTING_TYPE_U32,  2,        0,      2,        true },    // Mouse keys acceleration curve
+    { SETTING_TYPE_U32,  8,        1,      50,       true },    // Mouse keys tick in msec
+    { SETTING_TYPE_U32,  1000,     0,      5000,     true },    // Mouse keys time to top speed in msec
+    { SETTING_TYPE_U32,  100,      1,      5000,     true },    // Mouse keys start speed in pixels/sec
+    { SETTING_TYPE_U32,  1200,     1,      10000,    true },    // Mouse keys top speed in pixels/sec
+    { SETTING_TYPE_U32,  4,        1,      100,      true },    // Wheel start speed in detents/sec
+    { SETTING_TYPE_U32,  20,       1,      100,      true },    // Wheel top speed in detents/sec
+    { SETTING_TYPE_U32,  10000,    0,      100000,   true },    // Debounce time in usec
+};
+
+// migrations[i] upgrades from version SCHEMA_VERSION_RAW + i
+const Settings::SettingsMigration Settings::migrations[SCHEMA_VERSION - SCHEMA_VERSION_RAW] = {
+    MigrateV1,
+    MigrateV2,
 };
 
 Settings::Settings() {
+    numSubscribers = 0;
     LoadDefaults();
 }
 
-uint32_t Settings::operator() (SettingsIds id) {
-    return settings[(uint32_t)id];
+bool Settings::operator() (SettingsIds id, uint32_t val) {
+    if (!CanSet(id, val))
+        return false;
+
+    if (settings[(uint32_t)id] != val) {
+        settings[(uint32_t)id] = val;
+        UpdateDerived();
+        Notify();
+    }
+    return true;
 }
 
-void Settings::operator() (SettingsIds id, uint32_t val) {
-    settings[(uint32_t)id] = val;
+bool Settings::Subscribe(SettingsChangedCallback callback) {
+    if (numSubscribers >= MAX_SUBSCRIBERS)
+        return false;
+
+    subscribers[numSubscribers++] = callback;
+    callback(cache);
+    return true;
 }
 
 void Settings::Load() {
-    uint32_t* addr = (uint32_t*)FlashService::Instance().GetPageAddress(flashSectorNum, flashMagicNumPageNum);
-    if (magicNumber != addr[0]) {
-        Save();
-    }
-    else {
-        addr = (uint32_t*)FlashService::Instance().GetPageAddress(flashSectorNum, flashSettingsPageNum);
-        for (int i = 0; i < (int)SETTINGS_TOTAL; i++)
-            settings[i] = addr[i];
+    // Flash is only rewritten by Save, a firmware upgrade never
+    // triggers a write at boot
+    StoredSettings stored;
+    uint16_t version;
+    if (!ReadStored(stored, version)) {
+        LoadDefaults();
+        Notify();
+        return;
     }
+
+    for (uint16_t v = version; v < SCHEMA_VERSION; v++)
+        migrations[v - SCHEMA_VERSION_RAW](stored);
+
+    Apply(stored);
+    UpdateDerived();
+    Notify();
 }
 
 void Settings::Save() {
+    // The header goes last, a save cut short reads back as blank flash
     EraseSettingsSector();
-    SaveMagicNumber();
     SaveSettings();
+    SaveHeader();
 }
 
 void Settings::LoadDefaults() {
     for (int i = 0; i < (int)SETTINGS_TOTAL; i++)
-        settings[i] = defaults[i];
+        settings[i] = schema[i].Default;
+    UpdateDerived();
+}
+
+bool Settings::ReadStored(StoredSettings& stored, uint16_t& version) {
+    const FlashHeader* header = (const FlashHeader*)FlashService::Instance().
+        GetPageAddress(flashSectorNum, flashMagicNumPageNum);
+    if (header->MagicNumber != magicNumber)
+        return false;
+
+    // Newer firmware may have written a version we do not know
+    version = (header->Version == 0) ? SCHEMA_VERSION_RAW : header->Version;
+    if (version > SCHEMA_VERSION)
+        return false;
+
+    stored.PresentMask = 0;
+    const uint8_t* page = FlashService::Instance().GetPageAddress(flashSectorNum, flashSettingsPageNum);
+    if (version == SCHEMA_VERSION_RAW) {
+        const uint32_t* values = (const uint32_t*)page;
+        for (int i = 0; i < SCHEMA_V1_TOTAL && i < (int)SETTINGS_TOTAL; i++) {
+            stored.Values[i] = values[i];
+            stored.Types[i] = SETTING_TYPE_U32;
+            stored.PresentMask |= (1u << i);
+        }
+        return true;
+    }
+
+    const FlashEntry* entries = (const FlashEntry*)page;
+    for (int i = 0; i < header->NumEntries && i < maxFlashEntries; i++) {
+        // Entries of settings this firmware does not know are skipped
+        if (entries[i].Id >= (uint16_t)SETTINGS_TOTAL)
+            continue;
+        stored.Values[entries[i].Id] = entries[i].Value;
+        stored.Types[entries[i].Id] = entries[i].Type;
+        stored.PresentMask |= (1u << entries[i].Id);
+    }
+    return true;
+}
+
+void Settings::Apply(const StoredSettings& stored) {
+    // Missing, retyped or out of range entries take their default
+    for (int i = 0; i < (int)SETTINGS_TOTAL; i++) {
+        bool isPresent = (stored.PresentMask & (1u << i)) && stored.Types[i] == schema[i].Type;
+        settings[i] = (isPresent && IsValid((SettingsIds)i, stored.Values[i])) ?
+            stored.Values[i] : schema[i].Default;
+    }
+}
+
+bool Settings::CanSet(SettingsIds id, uint32_t val) const {
+    return IsWritable(id) && IsValid(id, val);
+}
+
+bool Settings::IsValid(SettingsIds id, uint32_t val) const {
+    const SettingSchema& entry = schema[(uint32_t)id];
+    if (entry.Type == SETTING_TYPE_BOOL)
+        return val <= 1;
+    return val >= entry.Min && val <= entry.Max;
+}
+
+void Settings::MigrateV1(StoredSettings& stored) {
+    // Version 1 stored the repeat delay independently of the speed
+    // (default 166667 for 10/s), it is derived now
+    stored.PresentMask &= ~(1u << AUTO_REPEAT_DELAY);
+}
+
+void Settings::MigrateV2(StoredSettings& stored) {
+    // Version 2 debounced for a number of scans, taken at the 1 kHz
+    // ceiling it was tuned for. The count is derived now.
+    if (stored.PresentMask & (1u << DEBOUNCE_MAX)) {
+        uint32_t debounceUs = stored.Values[DEBOUNCE_MAX] * 1000;
+        stored.Values[DEBOUNCE_TIME] = (debounceUs > schema[DEBOUNCE_TIME].Max) ?
+            schema[DEBOUNCE_TIME].Max : debounceUs;
+        stored.Types[DEBOUNCE_TIME] = SETTING_TYPE_U32;
+        stored.PresentMask |= (1u << DEBOUNCE_TIME);
+    }
+    stored.PresentMask &= ~(1u << DEBOUNCE_MAX);
+}
+
+void Settings::UpdateDerived() {
+    // The repeat period is never stored independently of the speed
+    settings[AUTO_REPEAT_DELAY] = 1000000 / settings[AUTO_REPEAT_SPEED];
+
+    cache.BlinkOnTimeUs = settings[BLINK_ON_TIME] * 1000;
+    cache.BlinkOffTimeUs = settings[BLINK_OFF_TIME] * 1000;
+    cache.DebounceUs = settings[DEBOUNCE_TIME];
+    cache.RepeatFirstDelayUs = settings[AUTO_REPEAT_FIRST_DELAY];
+    cache.RepeatPeriodUs = settings[AUTO_REPEAT_DELAY];
+    cache.IdleTimeoutUs = (uint64_t)settings[IDLE_TIMEOUT] * 1000;
+    cache.ScanPeriodMinUs = 1000000 / settings[SCAN_RATE_MAX];
+    cache.ScanPeriodMaxUs = 1000000 / settings[SCAN_RATE_MIN];
+    if (cache.ScanPeriodMaxUs < cache.ScanPeriodMinUs)
+        cache.ScanPeriodMaxUs = cache.ScanPeriodMinUs;
+    // Only reported, the scan loop debounces by time whatever its rate
+    settings[DEBOUNCE_MAX] = settings[DEBOUNCE_TIME] / cache.ScanPeriodMinUs;
+    cache.HidPollIntervalMs = settings[HID_POLL_INTERVAL];
+    cache.IsSofSyncEnabled = settings[SCAN_SOF_SYNC] != 0;
+    cache.TappingTermUs = settings[TAPPING_TERM] * 1000;
+    cache.IsPermissiveHold = settings[TAP_HOLD_PERMISSIVE] != 0;
+    cache.IsHoldOnOtherKeyPress = settings[TAP_HOLD_ON_OTHER_KEY] != 0;
+    cache.ComboWindowUs = settings[COMBO_WINDOW] * 1000;
+    cache.LeaderTimeoutUs = settings[LEADER_TIMEOUT] * 1000;
+    cache.RecordQuantumMs = settings[RECORD_QUANTUM];
+    cache.RecordIdleTrimMs = settings[RECORD_IDLE_TRIM];
+    cache.MouseCurve = (uint8_t)settings[MOUSE_CURVE];
+    // One mouse report per polling interval at most, so a keyboard
+    // report never waits more than one interval behind them
+    uint32_t mouseTickMs = settings[MOUSE_TICK];
+    if (mouseTickMs < cache.HidPollIntervalMs)
+        mouseTickMs = cache.HidPollIntervalMs;
+    cache.MouseTickUs = mouseTickMs * 1000;
+    cache.MouseAccelTimeUs = settings[MOUSE_ACCEL_TIME] * 1000;
+    cache.MouseSpeedMin = settings[MOUSE_SPEED_MIN];
+    cache.MouseSpeedMax = settings[MOUSE_SPEED_MAX];
+    cache.WheelSpeedMin = settings[WHEEL_SPEED_MIN];
+    cache.WheelSpeedMax = settings[WHEEL_SPEED_MAX];
+}
+
+void Settings::Notify() {
+    for (int i = 0; i < numSubscribers; i++)
+        subscribers[i](cache);
 }
 
 void Settings::EraseSettingsSector() {
@@ -50,15 +220,24 @@ void Settings::EraseSettingsSector() {
     FlashService::Instance().EraseSector(flashSectorNum);
 }
 
-void Settings::SaveMagicNumber() {
-    // Write Magic number as this is the first save to flash
-    FlashService::Instance().WriteToSector(flashSectorNum, 
-            flashMagicNumPageNum, (uint8_t*)&magicNumber, sizeof(magicNumber));
+void Settings::SaveHeader() {
+    FlashHeader header;
+    header.MagicNumber = magicNumber;
+    header.Version = SCHEMA_VERSION;
+    header.NumEntries = SETTINGS_TOTAL;
+    FlashService::Instance().WriteToSector(flashSectorNum,
+            flashMagicNumPageNum, (const uint8_t*)&header, sizeof(header));
 }
 
 void Settings::SaveSettings() {
-    // Write settings to flash
-    FlashService::Instance().WriteToSector(flashSectorNum, flashSettingsPageNum, 
-            (uint8_t*)settings, (int)SETTINGS_TOTAL * sizeof(int));
+    // Write settings to flash, tagged with their id and type
+    FlashEntry entries[SETTINGS_TOTAL];
+    for (int i = 0; i < (int)SETTINGS_TOTAL; i++) {
+        entries[i].Id = i;
+        entries[i].Type = schema[i].Type;
+        entries[i].Reserved = 0;
+        entries[i].Value = settings[i];
+    }
+    FlashService::Instance().WriteToSector(flashSectorNum, flashSettingsPageNum,
+            (const uint8_t*)entries, sizeof(entries));
 }
-
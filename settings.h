@@ -2,24 +2,124 @@
 #define SETTINGS_H
 
 #include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "flash_layout.h"
 
+// Ids are stored in flash next to each value, only ever append
 enum SettingsIds {
     BLINK_ON_TIME = 0,
     BLINK_OFF_TIME,
-    DEBOUNCE_MAX,
+    DEBOUNCE_MAX,       // Derived from DEBOUNCE_TIME, read only
     AUTO_REPEAT_FIRST_DELAY,
     AUTO_REPEAT_SPEED,
-    AUTO_REPEAT_DELAY,
+    AUTO_REPEAT_DELAY,  // Derived from AUTO_REPEAT_SPEED, read only
+    IDLE_TIMEOUT,
+    SCAN_RATE_MAX,
+    SCAN_RATE_MIN,
+    HID_POLL_INTERVAL,  // Applied after a reboot
+    SCAN_SOF_SYNC,
+    TAPPING_TERM,
+    TAP_HOLD_PERMISSIVE,
+    TAP_HOLD_ON_OTHER_KEY,
+    COMBO_WINDOW,
+    LEADER_TIMEOUT,
+    RECORD_QUANTUM,
+    RECORD_IDLE_TRIM,
+    MOUSE_CURVE,        // 0 constant, 1 linear, 2 exponential
+    MOUSE_TICK,         // Never below the HID polling interval
+    MOUSE_ACCEL_TIME,
+    MOUSE_SPEED_MIN,
+    MOUSE_SPEED_MAX,
+    WHEEL_SPEED_MIN,
+    WHEEL_SPEED_MAX,
+    DEBOUNCE_TIME,
     SETTINGS_TOTAL
 };
 
+// Settings converted to the units their consumers use.
+// Recomputed on every accepted write so hot paths only read fields.
+struct SettingsCache {
+    uint32_t BlinkOnTimeUs;
+    uint32_t BlinkOffTimeUs;
+    uint32_t DebounceUs;
+    uint64_t RepeatFirstDelayUs;
+    uint64_t RepeatPeriodUs;
+    uint64_t IdleTimeoutUs;
+    uint32_t ScanPeriodMinUs;   // From the ceiling rate
+    uint32_t ScanPeriodMaxUs;   // From the floor rate, never below ScanPeriodMinUs
+    uint8_t HidPollIntervalMs;
+    bool IsSofSyncEnabled;
+    uint32_t TappingTermUs;
+    bool IsPermissiveHold;
+    bool IsHoldOnOtherKeyPress;
+    uint32_t ComboWindowUs;
+    uint32_t LeaderTimeoutUs;
+    uint32_t RecordQuantumMs;
+    uint32_t RecordIdleTrimMs;
+    uint8_t MouseCurve;
+    uint32_t MouseTickUs;
+    uint32_t MouseAccelTimeUs;
+    uint32_t MouseSpeedMin;     // Pixels per second
+    uint32_t MouseSpeedMax;
+    uint32_t WheelSpeedMin;     // Detents per second
+    uint32_t WheelSpeedMax;
+};
+
+enum eSettingType {
+    SETTING_TYPE_U32 = 0,
+    SETTING_TYPE_BOOL,
+};
+
+// Called with the new cache after a setting changed
+typedef void (*SettingsChangedCallback)(const SettingsCache& cache);
+
 class Settings {
 private:
-    static const uint32_t defaults[(uint32_t)SettingsIds::SETTINGS_TOTAL];
-    const uint32_t flashSectorNum = 0;
+    struct SettingSchema {
+        eSettingType Type;
+        uint32_t Default;
+        uint32_t Min;
+        uint32_t Max;
+        bool IsWritable;
+    };
+
+    // Version 1 is the original layout: SETTINGS_TOTAL raw words and no
+    // version word (reads 0). Version 2 stores tagged entries. Version 3
+    // debounces by time instead of by scan count.
+    static const uint16_t SCHEMA_VERSION = 3;
+    static const uint16_t SCHEMA_VERSION_RAW = 1;
+    static const int SCHEMA_V1_TOTAL = 6;
+
+    struct FlashHeader {
+        uint32_t MagicNumber;
+        uint16_t Version;
+        uint16_t NumEntries;
+    };
+
+    struct FlashEntry {
+        uint16_t Id;
+        uint8_t Type;
+        uint8_t Reserved;
+        uint32_t Value;
+    };
+
+    // Values read from flash before they are checked against the schema
+    struct StoredSettings {
+        uint32_t Values[SETTINGS_TOTAL];
+        uint8_t Types[SETTINGS_TOTAL];
+        uint32_t PresentMask;
+    };
+    // Upgrades StoredSettings by one schema version
+    typedef void (*SettingsMigration)(StoredSettings& stored);
+
+    static const SettingSchema schema[(uint32_t)SettingsIds::SETTINGS_TOTAL];
+    static const SettingsMigration migrations[SCHEMA_VERSION - SCHEMA_VERSION_RAW];
+    static const int MAX_SUBSCRIBERS = 4;
+    const uint32_t flashSectorNum = FLASH_SETTINGS_SECTOR;
     const uint8_t flashMagicNumPageNum = 0;
     const uint32_t magicNumber = 0xABCD1234;
     const uint8_t flashSettingsPageNum = 1;
+    const int maxFlashEntries = FLASH_PAGE_SIZE / sizeof(FlashEntry);
 
 public:
     static Settings& Instance() {
@@ -27,21 +127,41 @@ public:
         return instance;
     }
 
-    uint32_t operator() (SettingsIds id);
-    void operator() (SettingsIds id, uint32_t val);
+    inline uint32_t operator() (SettingsIds id) const {
+        return settings[(uint32_t)id];
+    }
+    // Returns false if the value is out of range or the setting is read only
+    bool operator() (SettingsIds id, uint32_t val);
+    // Whether operator() would take the value, nothing changes
+    bool CanSet(SettingsIds id, uint32_t val) const;
+    inline bool IsWritable(SettingsIds id) const { return schema[(uint32_t)id].IsWritable; }
+    inline const SettingsCache& GetCache() const { return cache; }
+
+    // The callback is also invoked once right away with the current cache
+    bool Subscribe(SettingsChangedCallback callback);
+
     void Load();
     void Save();
 
 private:
     Settings();
     void LoadDefaults();
+    bool ReadStored(StoredSettings& stored, uint16_t& version);
+    void Apply(const StoredSettings& stored);
+    bool IsValid(SettingsIds id, uint32_t val) const;
+    static void MigrateV1(StoredSettings& stored);
+    static void MigrateV2(StoredSettings& stored);
+    void UpdateDerived();
+    void Notify();
     void EraseSettingsSector();
-    void SaveMagicNumber();
+    void SaveHeader();
     void SaveSettings();
 
 private:
     uint32_t settings[(uint32_t)SettingsIds::SETTINGS_TOTAL];
-    bool isFirstSave;
+    SettingsCache cache;
+    SettingsChangedCallback subscribers[MAX_SUBSCRIBERS];
+    int numSubscribers;
 };
 
 #endif // SETTINGS_H
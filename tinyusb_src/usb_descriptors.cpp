@@ -1,5 +1,6 @@
 #include "tusb.h"
 #include "usb_descriptors.h"
+#include "message.h"
 
 /* A combination of interfaces must have a unique product id, since PC will save device driver after the first plug.
  * Same VID/PID with different interface e.g MSC (first), then CDC (later) will possibly cause system error on PC.
@@ -59,10 +60,92 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
+// Resolution Multiplier usage of the Generic Desktop page
+#define HID_USAGE_DESKTOP_RES_MULTIPLIER  0x48
+
+// Mouse of 5 buttons with 16 bit wheel and pan, laid out as MouseMotion.
+// Each wheel has a resolution multiplier in the feature report: once the
+// host writes 1 a detent counts 120, for smooth high resolution scrolling.
+#define TUD_HID_REPORT_DESC_MOUSE_HIGH_RES(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP      )                   ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_MOUSE     )                   ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION  )                   ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    HID_USAGE      ( HID_USAGE_DESKTOP_POINTER )                   ,\
+    HID_COLLECTION ( HID_COLLECTION_PHYSICAL   )                   ,\
+      HID_USAGE_PAGE  ( HID_USAGE_PAGE_BUTTON  )                   ,\
+        HID_USAGE_MIN   ( 1                                      ) ,\
+        HID_USAGE_MAX   ( 5                                      ) ,\
+        HID_LOGICAL_MIN ( 0                                      ) ,\
+        HID_LOGICAL_MAX ( 1                                      ) ,\
+        HID_REPORT_COUNT( 5                                      ) ,\
+        HID_REPORT_SIZE ( 1                                      ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+        HID_REPORT_COUNT( 1                                      ) ,\
+        HID_REPORT_SIZE ( 3                                      ) ,\
+        HID_INPUT       ( HID_CONSTANT                           ) ,\
+      HID_USAGE_PAGE  ( HID_USAGE_PAGE_DESKTOP )                   ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_X                    ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_Y                    ) ,\
+        HID_LOGICAL_MIN ( 0x81                                   ) ,\
+        HID_LOGICAL_MAX ( 0x7f                                   ) ,\
+        HID_REPORT_COUNT( 2                                      ) ,\
+        HID_REPORT_SIZE ( 8                                      ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+        /* Reserved byte, keeps the wheels 16 bit aligned */\
+        HID_REPORT_COUNT( 1                                      ) ,\
+        HID_INPUT       ( HID_CONSTANT                           ) ,\
+      HID_COLLECTION ( HID_COLLECTION_LOGICAL  )                   ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_RES_MULTIPLIER       ) ,\
+        HID_LOGICAL_MIN ( 0                                      ) ,\
+        HID_LOGICAL_MAX ( 1                                      ) ,\
+        HID_PHYSICAL_MIN( 1                                      ) ,\
+        HID_PHYSICAL_MAX( 120                                    ) ,\
+        HID_REPORT_SIZE ( 2                                      ) ,\
+        HID_FEATURE     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+        HID_PHYSICAL_MIN( 0                                      ) ,\
+        HID_PHYSICAL_MAX( 0                                      ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_WHEEL                ) ,\
+        HID_LOGICAL_MIN_N( 0x8001, 2                             ) ,\
+        HID_LOGICAL_MAX_N( 0x7fff, 2                             ) ,\
+        HID_REPORT_SIZE ( 16                                     ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+      HID_COLLECTION_END                                           ,\
+      HID_COLLECTION ( HID_COLLECTION_LOGICAL  )                   ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_RES_MULTIPLIER       ) ,\
+        HID_LOGICAL_MIN ( 0                                      ) ,\
+        HID_LOGICAL_MAX ( 1                                      ) ,\
+        HID_PHYSICAL_MIN( 1                                      ) ,\
+        HID_PHYSICAL_MAX( 120                                    ) ,\
+        HID_REPORT_SIZE ( 2                                      ) ,\
+        HID_FEATURE     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+        HID_PHYSICAL_MIN( 0                                      ) ,\
+        HID_PHYSICAL_MAX( 0                                      ) ,\
+        HID_USAGE_PAGE  ( HID_USAGE_PAGE_CONSUMER                ) ,\
+        HID_USAGE_N     ( HID_USAGE_CONSUMER_AC_PAN, 2           ) ,\
+        HID_LOGICAL_MIN_N( 0x8001, 2                             ) ,\
+        HID_LOGICAL_MAX_N( 0x7fff, 2                             ) ,\
+        HID_REPORT_SIZE ( 16                                     ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+      HID_COLLECTION_END                                           ,\
+      /* Feature report padding to a byte */\
+      HID_REPORT_SIZE ( 4                                        ) ,\
+      HID_FEATURE     ( HID_CONSTANT                             ) ,\
+    HID_COLLECTION_END                                             ,\
+  HID_COLLECTION_END \
+
 uint8_t const desc_hid_report[] =
 {
   TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD         )),
   TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )),
+  TUD_HID_REPORT_DESC_MOUSE_HIGH_RES( HID_REPORT_ID(REPORT_ID_MOUSE      )),
+};
+
+// Vendor defined usage page, no report id: the messages transport
+uint8_t const desc_raw_hid_report[] =
+{
+  TUD_HID_REPORT_DESC_GENERIC_INOUT(RAW_HID_REPORT_LENGTH)
 };
 
 // Invoked when received GET HID REPORT DESCRIPTOR
@@ -70,8 +153,7 @@ uint8_t const desc_hid_report[] =
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 {
-  (void) instance;
-  return desc_hid_report;
+  return (instance == HID_INSTANCE_RAW) ? desc_raw_hid_report : desc_hid_report;
 }
 
 //--------------------------------------------------------------------+
@@ -83,10 +165,12 @@ enum
   ITF_NUM_HID = 0,
   ITF_NUM_CDC,
   ITF_NUM_CDC_DATA,
+  ITF_NUM_RAW_HID,
   ITF_NUM_TOTAL
 };
 
-#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + CFG_TUD_CDC * TUD_CDC_DESC_LEN)
+#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + CFG_TUD_CDC * TUD_CDC_DESC_LEN + \
+                            TUD_HID_INOUT_DESC_LEN)
 
 #define EPNUM_CDC_NOTIF   0x81
 #define EPNUM_CDC_OUT     0x02
@@ -94,16 +178,30 @@ enum
 
 #define EPNUM_HID   0x83
 
-uint8_t const desc_fs_configuration[] =
+#define EPNUM_RAW_HID_OUT   0x04
+#define EPNUM_RAW_HID_IN    0x84
+
+// The keyboard reports are short, only the raw HID endpoints need 64 bytes
+#define HID_EP_SIZE         16
+
+// bInterval is the last byte of the HID endpoint descriptor
+#define HID_EP_INTERVAL_OFFSET  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN - 1)
+
+// Not const, the HID polling interval comes from the settings
+uint8_t desc_fs_configuration[] =
 {
   // Config number, interface count, string index, total length, attribute, power in mA
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
   // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5),
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, HID_EP_SIZE, 5),
  
   // Interface number, string index, EP notification address and size, EP data address (out, in) and size.
   TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
+
+  // Interface number, string index, protocol, report descriptor len, EP Out & In address, size & polling interval
+  TUD_HID_INOUT_DESCRIPTOR(ITF_NUM_RAW_HID, 5, HID_ITF_PROTOCOL_NONE, sizeof(desc_raw_hid_report),
+      EPNUM_RAW_HID_OUT, EPNUM_RAW_HID_IN, RAW_HID_REPORT_LENGTH, 1),
 };
 
 #if TUD_OPT_HIGH_SPEED
@@ -115,10 +213,14 @@ uint8_t const desc_fs_configuration[] =
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
 
   // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5),
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, HID_EP_SIZE, 5),
  
   // Interface number, string index, EP notification address and size, EP data address (out, in) and size.
   TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 512),
+
+  // Interface number, string index, protocol, report descriptor len, EP Out & In address, size & polling interval
+  TUD_HID_INOUT_DESCRIPTOR(ITF_NUM_RAW_HID, 5, HID_ITF_PROTOCOL_NONE, sizeof(desc_raw_hid_report),
+      EPNUM_RAW_HID_OUT, EPNUM_RAW_HID_IN, RAW_HID_REPORT_LENGTH, 1),
 };
 
 // device qualifier is mostly similar to device descriptor since we don't change configuration based on speed
@@ -166,6 +268,11 @@ uint8_t const* tud_descriptor_other_speed_configuration_cb(uint8_t index)
 
 #endif // highspeed
 
+void SetHidPollInterval(uint8_t intervalMs)
+{
+  desc_fs_configuration[HID_EP_INTERVAL_OFFSET] = intervalMs;
+}
+
 // Invoked when received GET CONFIGURATION DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
@@ -193,6 +300,7 @@ char const* string_desc_arr [] =
   "TinyUSB Device",              // 2: Product
   "123456",                      // 3: Serials, should use chip ID
   "TinyUSB CDC",                 // 4: CDC Interface
+  "MacroPad Raw HID",            // 5: Raw HID Interface
 };
 
 static uint16_t _desc_str[32];
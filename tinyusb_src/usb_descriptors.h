@@ -29,7 +29,19 @@ enum
 {
   REPORT_ID_KEYBOARD = 1,
   REPORT_ID_CONSUMER_CONTROL,
+  REPORT_ID_MOUSE,
   REPORT_ID_COUNT
 };
 
+// HID instances, in the order of their interfaces
+enum
+{
+  HID_INSTANCE_KEYBOARD = 0,
+  HID_INSTANCE_RAW,
+  HID_INSTANCE_COUNT
+};
+
+// Patches bInterval of the HID endpoint, call before tusb_init()
+void SetHidPollInterval(uint8_t intervalMs);
+
 #endif /* USB_DESCRIPTORS_H_ */
@@ -0,0 +1,127 @@
+#include "usage_analytics.h"
+#include "flash_service.h"
+#include "message.h"
+#include "crc8.h"
+
+static_assert(sizeof(UsageReport) <= MAX_DATA_LENGTH, "Usage report must fit one message");
+
+UsageAnalytics::UsageAnalytics() {
+    counters = {};
+    unsavedPresses = 0;
+    currentHour = 0;
+    nextHourTime = HOUR_US;
+    isSaveRequested = false;
+    isResetPending = false;
+    lastSaveTime = 0;
+    sequence = 0;
+    nextSlot = 0;
+    pagesPerSector = FlashService::Instance().GetNumPagesPerSector();
+}
+
+const UsageAnalytics::UsageRecord* UsageAnalytics::GetRecord(uint32_t slot) const {
+    return (const UsageRecord*)FlashService::Instance().GetPageAddress(
+            flashFirstSectorNum + slot / pagesPerSector, slot % pagesPerSector);
+}
+
+void UsageAnalytics::Load(uint64_t now) {
+    static_assert(sizeof(UsageRecord) <= FLASH_PAGE_SIZE, "Usage record must fit a flash page");
+
+    int newest = -1;
+    for (uint32_t slot = 0; slot < flashNumSectors * pagesPerSector; slot++) {
+        const UsageRecord* record = GetRecord(slot);
+        if (record->Magic != flashMagicNumber ||
+                record->Crc != Crc8((const uint8_t*)&record->Counters, sizeof(UsageCounters)))
+            continue;
+        if (newest < 0 || record->Sequence > sequence) {
+            newest = (int)slot;
+            sequence = record->Sequence;
+        }
+    }
+
+    if (newest >= 0) {
+        counters = GetRecord(newest)->Counters;
+        nextSlot = (newest + 1) % (flashNumSectors * pagesPerSector);
+    }
+    currentHour = 0;
+    nextHourTime = now + HOUR_US;
+    lastSaveTime = now;
+}
+
+void UsageAnalytics::OnIdle(bool isSuspended, uint64_t now) {
+    if (unsavedPresses == 0 && !isResetPending)
+        return;
+
+    // Batch saves on idle, the host may cut power while suspended
+    if (isSuspended || isResetPending || unsavedPresses >= MIN_UNSAVED_PRESSES ||
+            now - lastSaveTime >= MIN_SAVE_INTERVAL_US)
+        isSaveRequested = true;
+}
+
+void UsageAnalytics::Update(uint64_t now, bool isKeyboardIdle) {
+    while (now >= nextHourTime) {
+        currentHour = (currentHour + 1) % USAGE_HOURS;
+        nextHourTime += HOUR_US;
+    }
+
+    if (!isSaveRequested || !isKeyboardIdle)
+        return;
+
+    isSaveRequested = false;
+    lastSaveTime = now;
+    Save();
+}
+
+void UsageAnalytics::Save() {
+    // Records are written in order, an erased sector is only ever entered
+    // at its first page. A used page means a torn log, start the next sector.
+    uint32_t slot = nextSlot;
+    if (slot % pagesPerSector != 0 && GetRecord(slot)->Magic != 0xFFFFFFFF)
+        slot = ((slot / pagesPerSector + 1) % flashNumSectors) * pagesPerSector;
+
+    uint32_t sectorNum = flashFirstSectorNum + slot / pagesPerSector;
+    if (slot % pagesPerSector == 0)
+        FlashService::Instance().EraseSector(sectorNum);
+
+    counters.Saves++;
+    UsageRecord record = {};
+    record.Magic = flashMagicNumber;
+    record.Sequence = ++sequence;
+    record.Counters = counters;
+    record.Crc = Crc8((const uint8_t*)&record.Counters, sizeof(UsageCounters));
+    FlashService::Instance().WriteToSector(sectorNum, slot % pagesPerSector,
+            (const uint8_t*)&record, sizeof(UsageRecord));
+
+    nextSlot = (slot + 1) % (flashNumSectors * pagesPerSector);
+    unsavedPresses = 0;
+    isResetPending = false;
+}
+
+void UsageAnalytics::GetReport(int numKeys, UsageReport& report) const {
+    report.NumKeys = (uint8_t)numKeys;
+    report.CurrentHour = currentHour;
+#ifdef MACROPAD_USAGE_HISTOGRAM
+    report.IsHistogramEnabled = 1;
+#else
+    report.IsHistogramEnabled = 0;
+#endif
+    report.Reserved = 0;
+    report.UnsavedPresses = unsavedPresses;
+    report.Counters = counters;
+}
+
+void UsageAnalytics::SetClock(uint16_t minuteOfDay, uint64_t now) {
+    if (minuteOfDay >= USAGE_HOURS * 60)
+        return;
+
+    currentHour = (uint8_t)(minuteOfDay / 60);
+    nextHourTime = now + (uint64_t)(60 - minuteOfDay % 60) * 60 * 1000000;
+}
+
+void UsageAnalytics::Reset() {
+    // The number of saves tracks flash wear, it survives a reset
+    uint32_t saves = counters.Saves;
+    counters = {};
+    counters.Saves = saves;
+    unsavedPresses = 0;
+    isResetPending = true;
+}
@@ -0,0 +1,81 @@
+#ifndef USAGE_ANALYTICS_H
+#define USAGE_ANALYTICS_H
+
+#include "pico/stdlib.h"
+#include "message_payloads.h"
+#include "flash_layout.h"
+
+// Counts key presses and macro plays in RAM, the press path only bumps a
+// counter or two. The counters are saved to a log of page sized records
+// over two flash sectors, and only while the keyboard is idle or
+// suspended: on idle once enough presses piled up or after a while, on
+// suspend whenever something changed. Records are appended, so a sector
+// is erased once every PAGES_PER_SECTOR saves, and the other sector
+// always holds the previous records.
+class UsageAnalytics {
+public:
+    static const uint32_t MIN_UNSAVED_PRESSES = 64;
+    static const uint64_t MIN_SAVE_INTERVAL_US = 15ull * 60 * 1000000;
+    static const uint64_t HOUR_US = 60ull * 60 * 1000000;
+
+public:
+    static UsageAnalytics& Instance() {
+        static UsageAnalytics instance;
+        return instance;
+    }
+
+    // Restores the counters from the newest valid record
+    void Load(uint64_t now);
+
+    inline void OnKeyPress(int keyIndex) {
+        counters.KeyPresses[keyIndex]++;
+#ifdef MACROPAD_USAGE_HISTOGRAM
+        counters.HourPresses[currentHour]++;
+#endif
+        unsavedPresses++;
+    }
+    inline void OnMacroPlay(int keyIndex) { counters.MacroPlays[keyIndex]++; unsavedPresses++; }
+    inline void OnLeaderPlay() { counters.LeaderPlays++; unsavedPresses++; }
+
+    // Called on idle and suspend, the save itself is done by Update
+    void OnIdle(bool isSuspended, uint64_t now);
+    // Periodic task: moves the hour bucket, and writes a requested save
+    // if the keyboard is still idle
+    void Update(uint64_t now, bool isKeyboardIdle);
+
+    void GetReport(int numKeys, UsageReport& report) const;
+    void SetClock(uint16_t minuteOfDay, uint64_t now);
+    void Reset();
+
+private:
+    struct UsageRecord {
+        uint32_t Magic;
+        uint32_t Sequence;
+        uint8_t Crc;            // Of Counters, a torn write does not load
+        uint8_t Reserved[3];
+        UsageCounters Counters;
+    };
+
+    UsageAnalytics();
+    const UsageRecord* GetRecord(uint32_t slot) const;
+    void Save();
+
+private:
+    const uint32_t flashFirstSectorNum = FLASH_FIRST_USAGE_SECTOR;
+    const uint32_t flashNumSectors = FLASH_NUM_USAGE_SECTORS;
+    const uint32_t flashMagicNumber = 0x55534147; // "USAG"
+
+    UsageCounters counters;
+    uint32_t unsavedPresses;
+    uint8_t currentHour;
+    uint64_t nextHourTime;
+
+    bool isSaveRequested;
+    bool isResetPending;        // Saved on the next idle even with no press
+    uint64_t lastSaveTime;
+    uint32_t sequence;
+    uint32_t nextSlot;
+    uint32_t pagesPerSector;
+};
+
+#endif // USAGE_ANALYTICS_H